@@ -17,140 +17,297 @@ limitations under the License.
 
 #include <EEPROM.h>
 
-const int kFan0PwmPin = 3;
-const int kFan1PwmPin = 9;
-const int kFan2PwmPin = 10;
-const int kFan3PwmPin = 11;
+#include "fan_protocol.h"
+#include "tachometer.h"
 
-const int kFan0RpmPin = 4;
-const int kFan1RpmPin = 6;
-const int kFan2RpmPin = 7;
-const int kFan3RpmPin = 8;
+const int kNumFans = 4;
+
+// Reported in fan_protocol::kIdentifyReply
+const uint16_t kFirmwareVersion = 2;
+const unsigned long kBaudRate = 19200;
+
+const int kPwmPins[kNumFans] = {3, 9, 10, 11};
+const int kRpmPins[kNumFans] = {4, 6, 7, 8};
+
+// RPM telemetry is sent at this rate regardless of how fast the fans spin.
+// The host can change it with fan_protocol::kSetTelemetryPeriod.
+const unsigned long kDefaultTelemetryPeriodMs = 100;
+
+// The persistent duty cycles stored in EEPROM take over if no duty cycle
+// command arrives for this long
+const unsigned long kCommandTimeoutMs = 3000;
+
+// The default duty cycles are stored at the start of the EEPROM, the UUID of
+// the board after them
+const int kUuidAddress = 16;
+
+Tachometer<kNumFans> tachometer;
+
+volatile uint8_t* tach_input_registers[kNumFans];
+uint8_t tach_bit_masks[kNumFans];
+
+// Bit i of the result is the level of the tach pin of fan i
+uint8_t ReadTachLevels() {
+  uint8_t levels = 0;
+  for (uint8_t i = 0; i < kNumFans; ++i) {
+    if (*tach_input_registers[i] & tach_bit_masks[i]) {
+      levels |= 1 << i;
+    }
+  }
+  return levels;
+}
+
+// The tach pins are spread over ports B and D. Both pin change interrupts
+// report all four levels and the tachometer figures out which pins changed.
+ISR(PCINT0_vect) { tachometer.OnPinChange(ReadTachLevels(), micros()); }
+ISR(PCINT2_vect) { tachometer.OnPinChange(ReadTachLevels(), micros()); }
+
+uint8_t uuid[fan_protocol::kUuidLength];
+
+// The lowest bit of a floating analog input is noise. A6 isn't connected on
+// the board.
+uint8_t ReadRandomByte() {
+  uint8_t value = 0;
+  for (uint8_t bit = 0; bit < 8; ++bit) {
+    value = (value << 1) | ((analogRead(A6) ^ micros()) & 1);
+  }
+  return value;
+}
+
+// A new chip reads 0xff everywhere, so the first boot generates a random
+// (version 4) UUID
+void LoadUuid() {
+  bool is_blank = true;
+  for (uint8_t i = 0; i < fan_protocol::kUuidLength; ++i) {
+    uuid[i] = EEPROM.read(kUuidAddress + i);
+    is_blank = is_blank && uuid[i] == 0xff;
+  }
+  if (!is_blank) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < fan_protocol::kUuidLength; ++i) {
+    uuid[i] = ReadRandomByte();
+  }
+  uuid[6] = (uuid[6] & 0x0f) | 0x40;
+  uuid[8] = (uuid[8] & 0x3f) | 0x80;
+  for (uint8_t i = 0; i < fan_protocol::kUuidLength; ++i) {
+    EEPROM.write(kUuidAddress + i, uuid[i]);
+  }
+}
 
 void setup() {
-  Serial.begin(19200);
+  Serial.begin(kBaudRate);
+  LoadUuid();
 
-  pinMode(kFan0RpmPin, INPUT_PULLUP); 
-  pinMode(kFan1RpmPin, INPUT_PULLUP);
-  pinMode(kFan2RpmPin, INPUT_PULLUP); 
-  pinMode(kFan3RpmPin, INPUT_PULLUP);
+  for (uint8_t i = 0; i < kNumFans; ++i) {
+    const int pin = kRpmPins[i];
+    pinMode(pin, INPUT_PULLUP);
+    tach_input_registers[i] = portInputRegister(digitalPinToPort(pin));
+    tach_bit_masks[i] = digitalPinToBitMask(pin);
+  }
+
+  noInterrupts();
+  for (uint8_t i = 0; i < kNumFans; ++i) {
+    const int pin = kRpmPins[i];
+    *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+    PCIFR |= _BV(digitalPinToPCICRbit(pin));
+    *digitalPinToPCICR(pin) |= _BV(digitalPinToPCICRbit(pin));
+  }
+  interrupts();
 }
 
-void emptySerialBuffer() {
-  while (Serial.available() > 0) {
-    Serial.read();
+// Telemetry is sent as frames after the host said hello. Until then, and
+// whenever a text command arrives, the legacy text lines are sent.
+bool binary_protocol = false;
+fan_protocol::FrameDecoder frame_decoder;
+
+unsigned long telemetry_period_ms = kDefaultTelemetryPeriodMs;
+
+void SendFrame(uint8_t type, const uint8_t* payload, uint8_t length) {
+  uint8_t frame[fan_protocol::kMaxFrameLength];
+  const size_t frame_length =
+      fan_protocol::EncodeFrame(type, payload, length, frame, sizeof(frame));
+  Serial.write(frame, frame_length);
+}
+
+// Returns 1 if a duty cycle command was received and written to buffer.
+// Anything else received is handled right here.
+int ProcessFrame(int* buffer, const unsigned int length) {
+  const uint8_t* payload = frame_decoder.GetPayload();
+  const uint8_t payload_length = frame_decoder.GetLength();
+
+  switch (frame_decoder.GetType()) {
+    case fan_protocol::kHello: {
+      const uint8_t version = fan_protocol::kVersion;
+      SendFrame(fan_protocol::kHelloReply, &version, 1);
+      binary_protocol = true;
+      return 0;
+    }
+
+    case fan_protocol::kIdentify: {
+      fan_protocol::Identity identity;
+      identity.firmware_version = kFirmwareVersion;
+      for (uint8_t i = 0; i < fan_protocol::kUuidLength; ++i) {
+        identity.uuid[i] = uuid[i];
+      }
+      identity.num_fans = kNumFans;
+      identity.protocols =
+          fan_protocol::kProtocolText | fan_protocol::kProtocolFrames;
+      identity.max_baud_rate = kBaudRate;
+
+      uint8_t frame[fan_protocol::kMaxFrameLength];
+      const size_t frame_length =
+          fan_protocol::EncodeIdentity(identity, frame, sizeof(frame));
+      Serial.write(frame, frame_length);
+      return 0;
+    }
+
+    case fan_protocol::kSetTelemetryPeriod:
+      if (payload_length == 2) {
+        const unsigned long period_ms = payload[0] | (payload[1] << 8);
+        if (period_ms > 0) {
+          telemetry_period_ms = period_ms;
+        }
+      }
+      return 0;
+
+    case fan_protocol::kSetDutyCycles:
+    case fan_protocol::kSetDefaultDutyCycles: {
+      if (payload_length != length - 1) {
+        return 0;
+      }
+      const bool is_default =
+          frame_decoder.GetType() == fan_protocol::kSetDefaultDutyCycles;
+      buffer[0] = is_default ? 2 : 1;
+      for (unsigned int i = 1; i < length; ++i) {
+        buffer[i] = payload[i - 1];
+      }
+      return 1;
+    }
   }
+
+  return 0;
 }
 
-// Returns 1 if command is intercepted
-//         0 otherwise
+// Returns 1 if a duty cycle command was received and written to buffer. It
+// returns right away, so each command is applied in turn, and the bytes after
+// it are read on the next loop. Bytes that neither start a frame nor a text
+// command are skipped.
 int ReadSerial(int* buffer, const unsigned int length) {
   while (Serial.available() > 0) {
-    if (Serial.read() == 'c') {
+    const int c = Serial.read();
+
+    if (frame_decoder.InFrame() || c == fan_protocol::kSync) {
+      if (frame_decoder.Push(c) && ProcessFrame(buffer, length)) {
+        return 1;
+      }
+    } else if (c == 'c') {
       Serial.setTimeout(100);
-      int i;
-      for (i = 0; i < length; ++i) {
+      for (unsigned int i = 0; i < length; ++i) {
         buffer[i] = Serial.parseInt();
       }
 
-      // We want to respond quickly to duty cycle commands
-      // So if there is a long queue of such commands, we 
-      // discard the old ones
-      emptySerialBuffer();
+      // A host sending text commands expects text telemetry
+      binary_protocol = false;
       return 1;
     }
   }
-  
+
   return 0;
 }
 
-// This affects the minimum measurable RPM
-// Non-rotating fans will cause twice this much delay per reading
-const unsigned long kPwmReadTimeout = 300000;
+void SendTelemetry(const uint16_t* rpms, const int* duty_cycles) {
+  if (binary_protocol) {
+    uint8_t duty_cycle_values[kNumFans];
+    for (uint8_t i = 0; i < kNumFans; ++i) {
+      duty_cycle_values[i] = duty_cycles[i];
+    }
+    uint8_t frame[fan_protocol::kMaxFrameLength];
+    const size_t frame_length = fan_protocol::EncodeTelemetry(
+        rpms, duty_cycle_values, kNumFans, frame, sizeof(frame));
+    Serial.write(frame, frame_length);
+    return;
+  }
 
-unsigned long ReadRpm(const int pin) {
-  digitalWrite(pin, HIGH);
-  delay(5);
-  
-  // Intel compliant PWM fans generate 2 pulses per cycle
-  const unsigned long period_width = 60000000/2;
-  unsigned long cycle_width = pulseIn(pin, LOW, kPwmReadTimeout) + pulseIn(pin, HIGH, kPwmReadTimeout);
-  
-  if (cycle_width == 0) {
-    return 0;
+  for (uint8_t i = 0; i < kNumFans; ++i) {
+    Serial.print(rpms[i]);
+    Serial.print(" ");
   }
-  
-  return period_width / cycle_width;
+  for (uint8_t i = 0; i < kNumFans - 1; ++i) {
+    Serial.print(duty_cycles[i]);
+    Serial.print(" ");
+  }
+  Serial.println(duty_cycles[kNumFans - 1]);
 }
 
-int dutycycle_command_age = 0;
-int fan_0_dutycycle;
-int fan_1_dutycycle;
-int fan_2_dutycycle;
-int fan_3_dutycycle;
+int duty_cycles[kNumFans];
+bool using_default_duty_cycles = false;
+unsigned long last_command_ms = 0;
+unsigned long last_telemetry_ms = 0;
+
+void ApplyDutyCycles() {
+  for (uint8_t i = 0; i < kNumFans; ++i) {
+    analogWrite(kPwmPins[i], duty_cycles[i]);
+  }
+}
 
 void loop() {
-  dutycycle_command_age += 1;
-  
-  const int kCommandLength = 5;
+  const int kCommandLength = kNumFans + 1;
   int command[kCommandLength];
   
   const int kCommandSetDutycycle = 1;
   const int kCommandSetDefaultDutycycle = 2;
-  
-  unsigned int rpm0, rpm1, rpm2, rpm3;
-
-  rpm0 = ReadRpm(kFan0RpmPin);
-  rpm1 = ReadRpm(kFan1RpmPin);
-  rpm2 = ReadRpm(kFan2RpmPin);
-  rpm3 = ReadRpm(kFan3RpmPin);
-      
-  Serial.print(rpm0);
-  Serial.print(" ");
-  Serial.print(rpm1);
-  Serial.print(" ");
-  Serial.print(rpm2);
-  Serial.print(" ");
-  Serial.print(rpm3);
-  Serial.print(" ");
-  Serial.print(fan_0_dutycycle);
-  Serial.print(" ");
-  Serial.print(fan_1_dutycycle);
-  Serial.print(" ");
-  Serial.print(fan_2_dutycycle);
-  Serial.print(" ");
-  Serial.println(fan_3_dutycycle);
 
   if (ReadSerial(command, kCommandLength)) {
     switch (command[0]) {
       case kCommandSetDutycycle:
-        dutycycle_command_age = 0;
-        fan_0_dutycycle = command[1];
-        fan_1_dutycycle = command[2];
-        fan_2_dutycycle = command[3];
-        fan_3_dutycycle = command[4];
+        last_command_ms = millis();
+        using_default_duty_cycles = false;
+        for (uint8_t i = 0; i < kNumFans; ++i) {
+          duty_cycles[i] = command[i + 1];
+        }
+        ApplyDutyCycles();
         break;
         
       case kCommandSetDefaultDutycycle:
-        EEPROM.write(0, command[1]);
-        EEPROM.write(1, command[2]);
-        EEPROM.write(2, command[3]);
-        EEPROM.write(3, command[4]);
+        for (uint8_t i = 0; i < kNumFans; ++i) {
+          EEPROM.write(i, command[i + 1]);
+        }
+        // Picked up on the next loop
+        using_default_duty_cycles = false;
         break;
     }
   }
-  
-  if (dutycycle_command_age > 10) {
-    fan_0_dutycycle = EEPROM.read(0);
-    fan_1_dutycycle = EEPROM.read(1);
-    fan_2_dutycycle = EEPROM.read(2);
-    fan_3_dutycycle = EEPROM.read(3);
+
+  const unsigned long now_ms = millis();
+
+  if (now_ms - last_command_ms > kCommandTimeoutMs &&
+      !using_default_duty_cycles) {
+    for (uint8_t i = 0; i < kNumFans; ++i) {
+      duty_cycles[i] = EEPROM.read(i);
+    }
+    using_default_duty_cycles = true;
+    ApplyDutyCycles();
   }
-  
-  analogWrite(kFan0PwmPin, fan_0_dutycycle);
-  analogWrite(kFan1PwmPin, fan_1_dutycycle);
-  analogWrite(kFan2PwmPin, fan_2_dutycycle);
-  analogWrite(kFan3PwmPin, fan_3_dutycycle);
 
-  delay(200);
+  if (now_ms - last_telemetry_ms >= telemetry_period_ms) {
+    last_telemetry_ms += telemetry_period_ms;
+    // Don't try to catch up with a backlog of periods, e.g. after the period
+    // was shortened
+    if (now_ms - last_telemetry_ms >= telemetry_period_ms) {
+      last_telemetry_ms = now_ms;
+    }
+
+    uint16_t rpms[kNumFans];
+    noInterrupts();
+    // Read inside the critical section, so no edge can be newer than now_us
+    const uint32_t now_us = micros();
+    for (uint8_t i = 0; i < kNumFans; ++i) {
+      rpms[i] = tachometer.TakeRpm(i, now_us);
+    }
+    interrupts();
+
+    SendTelemetry(rpms, duty_cycles);
+  }
 }
@@ -0,0 +1,290 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * Binary framing shared by the fan controller firmware and the PC software.
+ *
+ * This header is included by both fan_controller.ino and the host library, so
+ * it sticks to what avr-gcc offers: C++11, fixed width integers, no standard
+ * library containers and no dynamic allocation.
+ *
+ * Frame layout:
+ *
+ *   | sync | version | type | length | payload[length] | crc |
+ *
+ * The crc is CRC-8/SMBUS (polynomial 0x07, init 0) over version, type, length
+ * and payload. Multi-byte payload fields are little endian.
+ *
+ * Boards start up speaking the legacy text protocol. A host that supports
+ * frames sends kHello first. Firmware that knows the protocol answers with
+ * kHelloReply and switches its telemetry to frames. Legacy firmware only
+ * reacts to 'c', which is why no byte of the hello frame may be 'c'. It then
+ * keeps sending text lines, and the host stays on the text protocol.
+ *
+ * Right after the hello the host sends kIdentify. Firmware that knows it
+ * answers at once with kIdentifyReply, which tells the board's UUID and
+ * capabilities, so the host needn't wait for telemetry to learn the number of
+ * fans. The UUID is generated on first boot and kept in EEPROM, so a board is
+ * recognized whichever port it shows up on. Older firmware ignores the frame.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fan_protocol {
+// Not a printable character, so the text protocol never produces it
+const uint8_t kSync = 0xA5;
+const uint8_t kVersion = 1;
+const uint8_t kMaxPayloadLength = 32;
+const uint8_t kHeaderLength = 4;
+const uint8_t kMaxFrameLength = kHeaderLength + kMaxPayloadLength + 1;
+
+enum MessageType : uint8_t {
+  // Host to device. Payload: the highest protocol version the host speaks.
+  kHello = 0x01,
+  // Device to host. Payload: the protocol version the device will use.
+  kHelloReply = 0x02,
+  // Host to device. No payload.
+  kIdentify = 0x03,
+  // Device to host. Payload: see EncodeIdentity.
+  kIdentifyReply = 0x04,
+  // Host to device. Payload: one uint8 duty cycle (0-255) per fan.
+  kSetDutyCycles = 0x10,
+  // Host to device. Same payload as kSetDutyCycles, stored in EEPROM and
+  // used whenever the host goes silent.
+  kSetDefaultDutyCycles = 0x11,
+  // Host to device. Payload: uint16 telemetry period in milliseconds.
+  kSetTelemetryPeriod = 0x12,
+  // Device to host. Payload: uint16 RPM and uint8 duty cycle per fan.
+  kTelemetry = 0x20
+};
+
+const uint8_t kTelemetryBytesPerFan = 3;
+
+// Bits of Identity::protocols
+const uint8_t kProtocolText = 0x01;
+const uint8_t kProtocolFrames = 0x02;
+
+const uint8_t kUuidLength = 16;
+
+// Starts the kIdentifyReply payload, so a reply can't be mistaken for one
+// from some other device that happens to use the same framing
+const uint8_t kIdentifyMagic[4] = {'F', 'A', 'N', 'C'};
+const uint8_t kIdentifyReplyLength = 4 + 2 + kUuidLength + 1 + 1 + 4;
+
+struct Identity {
+  uint16_t firmware_version;
+  uint8_t uuid[kUuidLength];
+  uint8_t num_fans;
+  // kProtocolText | kProtocolFrames
+  uint8_t protocols;
+  uint32_t max_baud_rate;
+};
+
+inline uint8_t Crc8(const uint8_t* data, size_t length, uint8_t crc = 0) {
+  for (size_t i = 0; i < length; ++i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07)
+                         : static_cast<uint8_t>(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Writes a complete frame into out. Returns the number of bytes written, or 0
+// if the payload is too long or out is too small.
+inline size_t EncodeFrame(uint8_t type, const uint8_t* payload,
+                          uint8_t length, uint8_t* out, size_t out_size) {
+  if (length > kMaxPayloadLength ||
+      out_size < static_cast<size_t>(kHeaderLength + length + 1)) {
+    return 0;
+  }
+
+  out[0] = kSync;
+  out[1] = kVersion;
+  out[2] = type;
+  out[3] = length;
+  for (uint8_t i = 0; i < length; ++i) {
+    out[kHeaderLength + i] = payload[i];
+  }
+  out[kHeaderLength + length] = Crc8(out + 1, kHeaderLength - 1 + length);
+  return kHeaderLength + length + 1;
+}
+
+inline size_t EncodeTelemetry(const uint16_t* rpms, const uint8_t* duty_cycles,
+                              uint8_t num_fans, uint8_t* out,
+                              size_t out_size) {
+  if (num_fans > kMaxPayloadLength / kTelemetryBytesPerFan) {
+    return 0;
+  }
+
+  uint8_t payload[kMaxPayloadLength];
+  for (uint8_t i = 0; i < num_fans; ++i) {
+    payload[i * kTelemetryBytesPerFan] = rpms[i] & 0xff;
+    payload[i * kTelemetryBytesPerFan + 1] = rpms[i] >> 8;
+    payload[i * kTelemetryBytesPerFan + 2] = duty_cycles[i];
+  }
+  return EncodeFrame(kTelemetry, payload, num_fans * kTelemetryBytesPerFan,
+                     out, out_size);
+}
+
+// Returns the number of fans decoded
+inline uint8_t DecodeTelemetry(const uint8_t* payload, uint8_t length,
+                               uint16_t* rpms, uint8_t* duty_cycles,
+                               uint8_t max_num_fans) {
+  uint8_t num_fans = length / kTelemetryBytesPerFan;
+  if (num_fans > max_num_fans) {
+    num_fans = max_num_fans;
+  }
+  for (uint8_t i = 0; i < num_fans; ++i) {
+    rpms[i] = static_cast<uint16_t>(
+        payload[i * kTelemetryBytesPerFan] |
+        (payload[i * kTelemetryBytesPerFan + 1] << 8));
+    duty_cycles[i] = payload[i * kTelemetryBytesPerFan + 2];
+  }
+  return num_fans;
+}
+
+// Payload layout: | magic[4] | firmware_version | uuid[16] | num_fans |
+// protocols | max_baud_rate |
+inline size_t EncodeIdentity(const Identity& identity, uint8_t* out,
+                             size_t out_size) {
+  uint8_t payload[kIdentifyReplyLength];
+  uint8_t* p = payload;
+  for (uint8_t i = 0; i < sizeof(kIdentifyMagic); ++i) {
+    *p++ = kIdentifyMagic[i];
+  }
+  *p++ = identity.firmware_version & 0xff;
+  *p++ = identity.firmware_version >> 8;
+  for (uint8_t i = 0; i < kUuidLength; ++i) {
+    *p++ = identity.uuid[i];
+  }
+  *p++ = identity.num_fans;
+  *p++ = identity.protocols;
+  for (uint8_t i = 0; i < 4; ++i) {
+    *p++ = (identity.max_baud_rate >> (8 * i)) & 0xff;
+  }
+  return EncodeFrame(kIdentifyReply, payload, sizeof(payload), out, out_size);
+}
+
+// Returns false if the payload is not a valid identity
+inline bool DecodeIdentity(const uint8_t* payload, uint8_t length,
+                           Identity& identity) {
+  if (length < kIdentifyReplyLength) {
+    return false;
+  }
+  for (uint8_t i = 0; i < sizeof(kIdentifyMagic); ++i) {
+    if (payload[i] != kIdentifyMagic[i]) {
+      return false;
+    }
+  }
+  const uint8_t* p = payload + sizeof(kIdentifyMagic);
+  identity.firmware_version = static_cast<uint16_t>(p[0] | (p[1] << 8));
+  p += 2;
+  for (uint8_t i = 0; i < kUuidLength; ++i) {
+    identity.uuid[i] = *p++;
+  }
+  identity.num_fans = *p++;
+  identity.protocols = *p++;
+  identity.max_baud_rate = 0;
+  for (uint8_t i = 0; i < 4; ++i) {
+    identity.max_baud_rate |= static_cast<uint32_t>(p[i]) << (8 * i);
+  }
+  return true;
+}
+
+// Incremental frame parser. Bytes can be fed one at a time as they arrive;
+// anything that is not part of a valid frame is skipped.
+class FrameDecoder {
+ public:
+  FrameDecoder() : state_(kWaitSync), length_(0), received_(0) {}
+
+  // Returns true when byte completed a frame with a valid checksum. The frame
+  // can be accessed until the next call.
+  bool Push(uint8_t byte) {
+    switch (state_) {
+      case kWaitSync:
+        if (byte == kSync) {
+          state_ = kVersionByte;
+        }
+        return false;
+
+      case kVersionByte:
+        if (byte != kVersion) {
+          // A newer major version we can't parse, or just noise
+          state_ = byte == kSync ? kVersionByte : kWaitSync;
+          return false;
+        }
+        header_[0] = byte;
+        state_ = kTypeByte;
+        return false;
+
+      case kTypeByte:
+        header_[1] = byte;
+        state_ = kLengthByte;
+        return false;
+
+      case kLengthByte:
+        if (byte > kMaxPayloadLength) {
+          state_ = kWaitSync;
+          return false;
+        }
+        header_[2] = byte;
+        length_ = byte;
+        received_ = 0;
+        state_ = length_ > 0 ? kPayload : kCrc;
+        return false;
+
+      case kPayload:
+        payload_[received_++] = byte;
+        if (received_ == length_) {
+          state_ = kCrc;
+        }
+        return false;
+
+      case kCrc: {
+        state_ = kWaitSync;
+        const uint8_t crc = Crc8(payload_, length_, Crc8(header_, 3));
+        if (crc != byte) {
+          ++num_crc_errors_;
+          return false;
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // True while the bytes of a frame are being received
+  bool InFrame() const { return state_ != kWaitSync; }
+
+  uint8_t GetType() const { return header_[1]; }
+  const uint8_t* GetPayload() const { return payload_; }
+  uint8_t GetLength() const { return length_; }
+  uint16_t GetNumCrcErrors() const { return num_crc_errors_; }
+
+ private:
+  enum State : uint8_t {
+    kWaitSync,
+    kVersionByte,
+    kTypeByte,
+    kLengthByte,
+    kPayload,
+    kCrc
+  };
+
+  State state_;
+  uint8_t header_[3];
+  uint8_t payload_[kMaxPayloadLength];
+  uint8_t length_;
+  uint8_t received_;
+  uint16_t num_crc_errors_ = 0;
+};
+}  // namespace fan_protocol
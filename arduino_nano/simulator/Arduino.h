@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * Just enough of the Arduino core for an ATmega328P (Nano) to compile and run
+ * fan_controller.ino on the host. The simulator namespace at the bottom is how
+ * the simulator drives it.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define _BV(bit) (1 << (bit))
+
+// Analog only inputs of the Nano
+#define A6 20
+#define A7 21
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+// Returns noise, as from an unconnected pin
+int analogRead(uint8_t pin);
+
+void noInterrupts();
+void interrupts();
+
+// Pin change interrupt registers and the pin mapping macros of the real core.
+// Digital pins 0-7 are on port D, 8-13 on port B.
+volatile uint8_t* portInputRegister(uint8_t port);
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+volatile uint8_t* digitalPinToPCICR(uint8_t pin);
+uint8_t digitalPinToPCICRbit(uint8_t pin);
+volatile uint8_t* digitalPinToPCMSK(uint8_t pin);
+uint8_t digitalPinToPCMSKbit(uint8_t pin);
+
+extern volatile uint8_t PCIFR;
+
+// Interrupt handlers become plain functions that the simulator calls. The ones
+// the sketch doesn't define resolve to null.
+#define ISR(vector) void vector()
+#define PCINT0_vect SimulatorPcint0Vector
+#define PCINT1_vect SimulatorPcint1Vector
+#define PCINT2_vect SimulatorPcint2Vector
+
+__attribute__((weak)) void SimulatorPcint0Vector();
+__attribute__((weak)) void SimulatorPcint1Vector();
+__attribute__((weak)) void SimulatorPcint2Vector();
+
+class HardwareSerial {
+ public:
+  void begin(unsigned long baud);
+  int available();
+  int read();
+  void setTimeout(unsigned long timeout_ms);
+
+  // Skips anything that is not a digit or a minus sign, like the real one.
+  // Returns 0 on timeout.
+  long parseInt();
+
+  size_t write(uint8_t value);
+  size_t write(const uint8_t* data, size_t length);
+
+  size_t print(const char* value);
+  size_t print(int value);
+  size_t print(unsigned int value);
+  size_t print(long value);
+  size_t print(unsigned long value);
+
+  template <typename T>
+  size_t println(T value) {
+    const auto length = print(value);
+    return length + print("\r\n");
+  }
+
+ private:
+  int Peek(unsigned long timeout_ms);
+
+  unsigned long timeout_ms_ = 1000;
+};
+
+extern HardwareSerial Serial;
+
+namespace simulator {
+// The serial port of the board is this file descriptor
+void AttachSerial(int fd);
+
+// Value of the last analogWrite on pin
+int GetPwm(uint8_t pin);
+
+// Sets the input level of pin as if it changed at time_us, and runs the pin
+// change interrupt handler if the pin is enabled for it. micros() returns
+// time_us inside the handler.
+void SetInputLevel(uint8_t pin, uint8_t level, unsigned long time_us);
+
+// Blocks until the serial port has input or timeout_ms elapses
+void WaitForSerialInput(int timeout_ms);
+}  // namespace simulator
@@ -0,0 +1,31 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// In-memory EEPROM of the ATmega328P. A new chip reads 0xff everywhere.
+class EEPROMClass {
+ public:
+  static const int kSize = 1024;
+
+  EEPROMClass() {
+    for (int i = 0; i < kSize; ++i) {
+      data_[i] = 0xff;
+    }
+  }
+
+  uint8_t read(int address) const { return data_[address % kSize]; }
+
+  void write(int address, uint8_t value) { data_[address % kSize] = value; }
+
+ private:
+  uint8_t data_[kSize];
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,256 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "Arduino.h"
+#include "EEPROM.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <thread>
+
+EEPROMClass EEPROM;
+HardwareSerial Serial;
+volatile uint8_t PCIFR = 0;
+
+namespace {
+const uint8_t kPortB = 2;
+const uint8_t kPortD = 4;
+
+const auto kStartTime = std::chrono::steady_clock::now();
+
+bool in_interrupt_handler = false;
+unsigned long interrupt_time_us = 0;
+
+volatile uint8_t pin_b = 0;
+volatile uint8_t pin_d = 0;
+volatile uint8_t pcicr = 0;
+volatile uint8_t pcmsk0 = 0;
+volatile uint8_t pcmsk2 = 0;
+
+int pwm_values[20] = {};
+
+int serial_fd = -1;
+std::deque<uint8_t> serial_rx;
+
+bool IsOnPortD(uint8_t pin) { return pin < 8; }
+
+uint8_t PinBit(uint8_t pin) { return IsOnPortD(pin) ? pin : pin - 8; }
+
+void FillSerialRx() {
+  uint8_t buffer[256];
+  ssize_t length;
+  while ((length = ::read(serial_fd, buffer, sizeof(buffer))) > 0) {
+    serial_rx.insert(serial_rx.end(), buffer, buffer + length);
+  }
+}
+}  // namespace
+
+unsigned long millis() { return micros() / 1000; }
+
+unsigned long micros() {
+  if (in_interrupt_handler) {
+    return interrupt_time_us;
+  }
+  return static_cast<unsigned long>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - kStartTime)
+          .count());
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (mode == INPUT_PULLUP) {
+    digitalWrite(pin, HIGH);
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  auto& port = IsOnPortD(pin) ? pin_d : pin_b;
+  if (value) {
+    port |= _BV(PinBit(pin));
+  } else {
+    port &= ~_BV(PinBit(pin));
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return ((IsOnPortD(pin) ? pin_d : pin_b) & _BV(PinBit(pin))) ? HIGH : LOW;
+}
+
+void analogWrite(uint8_t pin, int value) { pwm_values[pin] = value; }
+
+int analogRead(uint8_t) {
+  static std::random_device noise;
+  return static_cast<int>(noise() & 0x3ff);
+}
+
+// Simulated pin changes are only delivered in between two calls of loop(), so
+// there is nothing to mask
+void noInterrupts() {}
+void interrupts() {}
+
+volatile uint8_t* portInputRegister(uint8_t port) {
+  return port == kPortD ? &pin_d : &pin_b;
+}
+
+uint8_t digitalPinToPort(uint8_t pin) {
+  return IsOnPortD(pin) ? kPortD : kPortB;
+}
+
+uint8_t digitalPinToBitMask(uint8_t pin) { return _BV(PinBit(pin)); }
+
+volatile uint8_t* digitalPinToPCICR(uint8_t) { return &pcicr; }
+
+uint8_t digitalPinToPCICRbit(uint8_t pin) { return IsOnPortD(pin) ? 2 : 0; }
+
+volatile uint8_t* digitalPinToPCMSK(uint8_t pin) {
+  return IsOnPortD(pin) ? &pcmsk2 : &pcmsk0;
+}
+
+uint8_t digitalPinToPCMSKbit(uint8_t pin) { return PinBit(pin); }
+
+// >>> HardwareSerial member definitions ======================================
+void HardwareSerial::begin(unsigned long) {}
+
+int HardwareSerial::available() {
+  FillSerialRx();
+  return static_cast<int>(serial_rx.size());
+}
+
+int HardwareSerial::read() {
+  FillSerialRx();
+  if (serial_rx.empty()) {
+    return -1;
+  }
+  const int value = serial_rx.front();
+  serial_rx.pop_front();
+  return value;
+}
+
+void HardwareSerial::setTimeout(unsigned long timeout_ms) {
+  timeout_ms_ = timeout_ms;
+}
+
+int HardwareSerial::Peek(unsigned long timeout_ms) {
+  const auto deadline = millis() + timeout_ms;
+  while (available() == 0) {
+    const auto now = millis();
+    if (now >= deadline) {
+      return -1;
+    }
+    simulator::WaitForSerialInput(static_cast<int>(deadline - now));
+  }
+  return serial_rx.front();
+}
+
+long HardwareSerial::parseInt() {
+  int c;
+  while ((c = Peek(timeout_ms_)) != -1 && c != '-' && (c < '0' || c > '9')) {
+    read();
+  }
+  if (c == -1) {
+    return 0;
+  }
+
+  bool negative = false;
+  long value = 0;
+  while ((c = Peek(timeout_ms_)) != -1) {
+    if (c == '-') {
+      negative = true;
+    } else if (c >= '0' && c <= '9') {
+      value = value * 10 + c - '0';
+    } else {
+      break;
+    }
+    read();
+  }
+  return negative ? -value : value;
+}
+
+size_t HardwareSerial::write(uint8_t value) { return write(&value, 1); }
+
+// The UART of the real board keeps sending whether or not anyone listens, so
+// whatever the pty can't take is dropped
+size_t HardwareSerial::write(const uint8_t* data, size_t length) {
+  size_t written = 0;
+  while (written < length) {
+    const auto result = ::write(serial_fd, data + written, length - written);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    written += static_cast<size_t>(result);
+  }
+  return length;
+}
+
+size_t HardwareSerial::print(const char* value) {
+  return write(reinterpret_cast<const uint8_t*>(value), strlen(value));
+}
+
+size_t HardwareSerial::print(int value) { return print(static_cast<long>(value)); }
+
+size_t HardwareSerial::print(unsigned int value) {
+  return print(static_cast<unsigned long>(value));
+}
+
+size_t HardwareSerial::print(long value) {
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), "%ld", value);
+  return print(buffer);
+}
+
+size_t HardwareSerial::print(unsigned long value) {
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), "%lu", value);
+  return print(buffer);
+}
+// <<< HardwareSerial member definitions --------------------------------------
+
+namespace simulator {
+void AttachSerial(int fd) { serial_fd = fd; }
+
+int GetPwm(uint8_t pin) { return pwm_values[pin]; }
+
+void SetInputLevel(uint8_t pin, uint8_t level, unsigned long time_us) {
+  if (digitalRead(pin) == level) {
+    return;
+  }
+  digitalWrite(pin, level);
+
+  const bool enabled = (pcicr & _BV(digitalPinToPCICRbit(pin))) &&
+                       (*digitalPinToPCMSK(pin) & _BV(PinBit(pin)));
+  const auto handler =
+      IsOnPortD(pin) ? &SimulatorPcint2Vector : &SimulatorPcint0Vector;
+  if (enabled && handler != nullptr) {
+    in_interrupt_handler = true;
+    interrupt_time_us = time_us;
+    handler();
+    in_interrupt_handler = false;
+  }
+}
+
+void WaitForSerialInput(int timeout_ms) {
+  if (!serial_rx.empty()) {
+    return;
+  }
+  pollfd fd{serial_fd, POLLIN, 0};
+  poll(&fd, 1, timeout_ms);
+}
+}  // namespace simulator
@@ -0,0 +1,263 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * A virtual fan controller. The unmodified firmware runs against the mock
+ * Arduino core, its serial port is the master side of a pseudo-terminal, and
+ * a simple model of four PWM fans drives the tach pins.
+ *
+ * The path of the slave side is printed on the first line of stdout, and it
+ * can be opened like any other serial port.
+ *
+ * The EEPROM, and with it the UUID of the board, only survives a restart if
+ * it's kept in a file with --eeprom.
+ */
+
+#include "Arduino.h"
+
+#include "fan_controller.ino"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+volatile sig_atomic_t should_exit = 0;
+
+// Turns the duty cycle of the PWM pin into RPM with a first order lag, and
+// toggles the tach pin twice per pulse accordingly
+class FanModel {
+ public:
+  static constexpr unsigned long kStopped =
+      std::numeric_limits<unsigned long>::max();
+
+  FanModel(uint8_t pwm_pin, uint8_t tach_pin, float max_rpm,
+           float time_constant_s)
+      : pwm_pin_(pwm_pin),
+        tach_pin_(tach_pin),
+        max_rpm_(max_rpm),
+        time_constant_s_(time_constant_s) {}
+
+  void AdvanceTo(unsigned long now_us) {
+    while (next_edge_us_ <= now_us) {
+      UpdateRpm(next_edge_us_);
+      level_ = level_ == HIGH ? LOW : HIGH;
+      simulator::SetInputLevel(tach_pin_, level_, next_edge_us_);
+      ScheduleNextEdge(next_edge_us_);
+    }
+
+    UpdateRpm(now_us);
+    if (next_edge_us_ == kStopped) {
+      ScheduleNextEdge(now_us);
+    }
+  }
+
+ private:
+  // Below this the fan is considered to be standing still
+  static constexpr float kMinRpm = 60.0f;
+
+  uint8_t pwm_pin_;
+  uint8_t tach_pin_;
+  float max_rpm_;
+  float time_constant_s_;
+  float rpm_ = 0.0f;
+  uint8_t level_ = HIGH;
+  unsigned long last_update_us_ = 0;
+  unsigned long next_edge_us_ = kStopped;
+
+  float GetTargetRpm() const {
+    // Most PWM fans don't go below roughly a fifth of their top speed, but
+    // are allowed to stop at 0 % duty cycle
+    const int duty_cycle = simulator::GetPwm(pwm_pin_);
+    if (duty_cycle <= 0) {
+      return 0.0f;
+    }
+    return max_rpm_ * (0.2f + 0.8f * std::min(duty_cycle, 255) / 255.0f);
+  }
+
+  void UpdateRpm(unsigned long now_us) {
+    const float dt_s = (now_us - last_update_us_) / 1e6f;
+    last_update_us_ = now_us;
+    rpm_ += (GetTargetRpm() - rpm_) * (1.0f - std::exp(-dt_s / time_constant_s_));
+  }
+
+  void ScheduleNextEdge(unsigned long from_us) {
+    if (rpm_ < kMinRpm) {
+      next_edge_us_ = kStopped;
+      return;
+    }
+    const float pulses_per_s = rpm_ / 60.0f * 2.0f;
+    next_edge_us_ = from_us + static_cast<unsigned long>(0.5e6f / pulses_per_s);
+  }
+};
+
+int OpenPseudoTerminal(std::string& slave_path, int& slave_fd) {
+  const int master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (master_fd == -1 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0) {
+    throw std::runtime_error(std::string("posix_openpt failed. Reason: ") +
+                             strerror(errno));
+  }
+  slave_path = ptsname(master_fd);
+
+  // Keeping the slave open means the master never sees a hangup while the
+  // host software reconnects. Making it raw now avoids the line discipline
+  // echoing our telemetry back before the host configures the port.
+  slave_fd = open(slave_path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+  termios tty;
+  if (slave_fd == -1 || tcgetattr(slave_fd, &tty) != 0) {
+    throw std::runtime_error("Failed to open " + slave_path);
+  }
+  cfmakeraw(&tty);
+  tcsetattr(slave_fd, TCSANOW, &tty);
+
+  fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+  return master_fd;
+}
+
+// A missing file leaves the EEPROM blank, like on a new chip
+void LoadEeprom(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return;
+  }
+  for (int i = 0; i < EEPROMClass::kSize; ++i) {
+    const int value = fgetc(file);
+    if (value == EOF) {
+      break;
+    }
+    EEPROM.write(i, static_cast<uint8_t>(value));
+  }
+  fclose(file);
+}
+
+void SaveEeprom(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "Failed to write %s\n", path.c_str());
+    return;
+  }
+  for (int i = 0; i < EEPROMClass::kSize; ++i) {
+    fputc(EEPROM.read(i), file);
+  }
+  fclose(file);
+}
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--link PATH] [--eeprom PATH] [--max-rpm RPM]\n"
+          "          [--time-constant SECONDS]\n"
+          "\n"
+          "  --link PATH              Also make the port available at PATH\n"
+          "  --eeprom PATH            Keep the EEPROM in PATH across runs\n"
+          "  --max-rpm RPM            Speed of the fans at 100 %% duty cycle "
+          "(1800)\n"
+          "  --time-constant SECONDS  How fast the fans follow the duty cycle "
+          "(1.5)\n",
+          program);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string link_path;
+  std::string eeprom_path;
+  float max_rpm = 1800.0f;
+  float time_constant_s = 1.5f;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 < argc && arg == "--link") {
+      link_path = argv[++i];
+    } else if (i + 1 < argc && arg == "--eeprom") {
+      eeprom_path = argv[++i];
+    } else if (i + 1 < argc && arg == "--max-rpm") {
+      max_rpm = std::stof(argv[++i]);
+    } else if (i + 1 < argc && arg == "--time-constant") {
+      time_constant_s = std::stof(argv[++i]);
+    } else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  std::string slave_path;
+  int slave_fd;
+  int master_fd;
+  try {
+    master_fd = OpenPseudoTerminal(slave_path, slave_fd);
+  } catch (std::runtime_error& error) {
+    fprintf(stderr, "%s\n", error.what());
+    return 1;
+  }
+
+  if (!link_path.empty()) {
+    unlink(link_path.c_str());
+    if (symlink(slave_path.c_str(), link_path.c_str()) != 0) {
+      fprintf(stderr, "Failed to create %s\n", link_path.c_str());
+      return 1;
+    }
+  }
+
+  // Before the port is announced, so a SIGTERM right after still removes the
+  // link
+  signal(SIGINT, [](int) { should_exit = 1; });
+  signal(SIGTERM, [](int) { should_exit = 1; });
+
+  printf("%s\n", slave_path.c_str());
+  fflush(stdout);
+
+  simulator::AttachSerial(master_fd);
+
+  std::vector<FanModel> fans;
+  for (int i = 0; i < kNumFans; ++i) {
+    fans.emplace_back(kPwmPins[i], kRpmPins[i], max_rpm, time_constant_s);
+  }
+
+  if (!eeprom_path.empty()) {
+    LoadEeprom(eeprom_path);
+  }
+
+  setup();
+
+  // The first boot writes the UUID
+  if (!eeprom_path.empty()) {
+    SaveEeprom(eeprom_path);
+  }
+
+  while (!should_exit) {
+    const auto now_us = micros();
+    for (auto& fan : fans) {
+      fan.AdvanceTo(now_us);
+    }
+
+    loop();
+
+    // Edges are delivered with their exact timestamps, so a coarse wait
+    // doesn't distort the measured RPM. Commands wake us up right away.
+    simulator::WaitForSerialInput(1);
+  }
+
+  if (!eeprom_path.empty()) {
+    SaveEeprom(eeprom_path);
+  }
+  if (!link_path.empty()) {
+    unlink(link_path.c_str());
+  }
+  close(slave_fd);
+  close(master_fd);
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * Interrupt driven RPM measurement for several fans at once.
+ *
+ * The pin change interrupt handlers pass the current level of every tach pin
+ * to OnPinChange. The falling edges are counted, and the time of the first and
+ * last edge of each measurement window is kept. TakeRpm then turns that into
+ * an average period, so every fan is measured all the time and reading the
+ * RPMs never blocks.
+ *
+ * Nothing in here depends on the Arduino core, so the same code can be driven
+ * by synthetic pulse trains on the host.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+template <uint8_t kNumFans>
+class Tachometer {
+ public:
+  // Intel compliant PWM fans generate 2 pulses per revolution
+  static const uint8_t kPulsesPerRevolution = 2;
+
+  // This affects the minimum measurable RPM. A fan that produced no edge for
+  // this long is reported as stopped.
+  static const uint32_t kStallTimeoutUs = 300000;
+
+  // Edges closer to each other than this are ringing on the tach line, not
+  // pulses. It corresponds to 30000 RPM.
+  static const uint32_t kMinPeriodUs = 1000;
+
+  // No member is volatile. On the AVR, cli and sei are compiler memory
+  // barriers, which is all the interrupts-disabled section around TakeRpm
+  // needs.
+  Tachometer() : last_levels_(0xff) {
+    for (uint8_t i = 0; i < kNumFans; ++i) {
+      num_edges_[i] = 0;
+      first_edge_us_[i] = 0;
+      last_edge_us_[i] = 0;
+      period_us_[i] = 0;
+    }
+  }
+
+  // Bit i of levels is the current level of the tach pin of fan i. Meant to be
+  // called from the pin change interrupt handlers.
+  void OnPinChange(uint8_t levels, uint32_t now_us) {
+    const uint8_t falling = last_levels_ & ~levels;
+    last_levels_ = levels;
+
+    for (uint8_t i = 0; i < kNumFans; ++i) {
+      if (!(falling & (1 << i))) {
+        continue;
+      }
+
+      if (num_edges_[i] > 0) {
+        const uint32_t since_last_edge = now_us - last_edge_us_[i];
+        if (since_last_edge < kMinPeriodUs) {
+          continue;
+        }
+        if (since_last_edge < kStallTimeoutUs) {
+          period_us_[i] = since_last_edge;
+        } else {
+          // The fan was stalled, start measuring from scratch
+          num_edges_[i] = 0;
+        }
+      }
+
+      if (num_edges_[i] == 0) {
+        first_edge_us_[i] = now_us;
+      }
+      last_edge_us_[i] = now_us;
+      if (num_edges_[i] < 0xffff) {
+        ++num_edges_[i];
+      }
+    }
+  }
+
+  // Returns the average RPM since the previous call for the same fan. The
+  // caller has to make sure that OnPinChange doesn't run concurrently, i.e.
+  // disable interrupts around the call on the microcontroller.
+  uint16_t TakeRpm(uint8_t i_fan, uint32_t now_us) {
+    if (num_edges_[i_fan] == 0 ||
+        now_us - last_edge_us_[i_fan] >= kStallTimeoutUs) {
+      num_edges_[i_fan] = 0;
+      period_us_[i_fan] = 0;
+      return 0;
+    }
+
+    uint32_t period_us;
+    if (num_edges_[i_fan] >= 2) {
+      period_us = (last_edge_us_[i_fan] - first_edge_us_[i_fan]) /
+                  (num_edges_[i_fan] - 1);
+    } else {
+      // Slow fans may have fewer than two edges per measurement window. The
+      // last full period is still a good estimate then.
+      period_us = period_us_[i_fan];
+    }
+
+    // Continue the next window from the last edge, so no period is lost
+    // between windows
+    num_edges_[i_fan] = 1;
+    first_edge_us_[i_fan] = last_edge_us_[i_fan];
+
+    if (period_us == 0) {
+      return 0;
+    }
+
+    const uint32_t rpm = 60000000UL / (period_us * kPulsesPerRevolution);
+    return rpm > 0xffff ? 0xffff : static_cast<uint16_t>(rpm);
+  }
+
+ private:
+  uint8_t last_levels_;
+  uint16_t num_edges_[kNumFans];
+  uint32_t first_edge_us_[kNumFans];
+  uint32_t last_edge_us_[kNumFans];
+  uint32_t period_us_[kNumFans];
+};
@@ -0,0 +1,71 @@
+#include "alertable_wait.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace bbmp {
+AlertableWait& AlertableWait::ForThisThread() {
+  thread_local AlertableWait instance;
+  return instance;
+}
+
+AlertableWait::AlertableWait() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+  if (epoll_fd_ == -1) {
+    throw std::runtime_error(std::string("epoll_create1 failed. Reason: ") +
+                             strerror(errno));
+  }
+}
+
+AlertableWait::~AlertableWait() { close(epoll_fd_); }
+
+void AlertableWait::Arm(int fd, uint32_t events, Handler* handler) {
+  epoll_event event{};
+  event.events = events;
+  event.data.fd = fd;
+
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) == -1) {
+    if (errno != ENOENT || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event)) {
+      throw std::runtime_error(std::string("epoll_ctl failed. Reason: ") +
+                               strerror(errno));
+    }
+  }
+
+  handlers_[fd] = handler;
+}
+
+void AlertableWait::Disarm(int fd) noexcept {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  handlers_.erase(fd);
+}
+
+bool AlertableWait::Wait(uint32_t timeout_milliseconds) {
+  std::array<epoll_event, 16> events;
+  int num_events;
+  do {
+    num_events = epoll_wait(epoll_fd_, events.data(), events.size(),
+                            static_cast<int>(timeout_milliseconds));
+  } while (num_events == -1 && errno == EINTR);
+
+  if (num_events == -1) {
+    throw std::runtime_error(std::string("epoll_wait failed. Reason: ") +
+                             strerror(errno));
+  }
+
+  bool handler_invoked = false;
+  for (int i = 0; i < num_events; ++i) {
+    auto it = handlers_.find(events[i].data.fd);
+    if (it != handlers_.end()) {
+      it->second->OnReady(events[i].events);
+      handler_invoked = true;
+    }
+  }
+
+  return handler_invoked;
+}
+}  // namespace bbmp
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+namespace bbmp {
+/*
+ * POSIX stand-in for the Win32 alertable wait.
+ *
+ * On Windows the completion routines of ReadFileEx/WriteFileEx are queued to
+ * the thread that issued the operation, and they run when that thread enters
+ * an alertable SleepEx. Here every thread gets its own epoll instance instead.
+ * File descriptors are armed from the thread that issues the operation, and
+ * their handlers run inside Wait() on that same thread. Wait() returns as soon
+ * as at least one handler has run, just like SleepEx returns
+ * WAIT_IO_COMPLETION.
+ */
+class AlertableWait {
+ public:
+  struct Handler {
+    virtual ~Handler() = default;
+
+    // Called from Wait() with the epoll event mask that became ready
+    virtual void OnReady(uint32_t events) = 0;
+  };
+
+  static AlertableWait& ForThisThread();
+
+  AlertableWait(const AlertableWait&) = delete;
+  AlertableWait& operator=(const AlertableWait&) = delete;
+  ~AlertableWait();
+
+  // Registers or re-arms fd. Pass EPOLLONESHOT in events to get the one
+  // completion per issued operation behaviour of overlapped IO.
+  void Arm(int fd, uint32_t events, Handler* handler);
+
+  // Safe to call with an fd that was never armed
+  void Disarm(int fd) noexcept;
+
+  // Returns true if at least one handler was invoked
+  bool Wait(uint32_t timeout_milliseconds);
+
+ private:
+  AlertableWait();
+
+  int epoll_fd_;
+
+  // Looked up on dispatch, so a handler disarmed by another handler during the
+  // same Wait() call is never invoked
+  std::unordered_map<int, Handler*> handlers_;
+};
+}  // namespace bbmp
@@ -0,0 +1,67 @@
+#include "atomic_file.h"
+
+#include "windows_handles.h"
+
+#include <stdexcept>
+
+namespace bbmp {
+namespace {
+[[noreturn]] void ThrowLastError(const std::string& what) {
+  throw std::runtime_error(what + " failed. Reason: " + GetLastErrorAsString());
+}
+
+void WriteAndFlush(const std::string& path, const std::string& data) {
+  WindowsHandle<-1> file;
+  try {
+    file = WindowsHandle<-1>(CreateFileA(path.c_str(), GENERIC_WRITE, 0,
+                                         nullptr, CREATE_ALWAYS,
+                                         FILE_ATTRIBUTE_NORMAL, nullptr));
+  } catch (std::runtime_error&) {
+    ThrowLastError("Opening " + path);
+  }
+
+  size_t written = 0;
+  while (written < data.size()) {
+    DWORD num_bytes_written;
+    if (!WriteFile(file.Get(), data.data() + written,
+                   static_cast<DWORD>(data.size() - written),
+                   &num_bytes_written, nullptr)) {
+      ThrowLastError("Writing " + path);
+    }
+    written += num_bytes_written;
+  }
+
+  if (!FlushFileBuffers(file.Get())) {
+    ThrowLastError("Flushing " + path);
+  }
+}
+}  // namespace
+
+void ReplaceFileContents(const std::string& path, const std::string& data,
+                         const std::string& backup_path) {
+  const auto temp_path = path + ".tmp";
+  try {
+    WriteAndFlush(temp_path, data);
+  } catch (...) {
+    DeleteFileA(temp_path.c_str());
+    throw;
+  }
+
+  // ReplaceFile keeps the backup in the same step, but only works if there is
+  // something to replace
+  if (GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES &&
+      ReplaceFileA(path.c_str(), temp_path.c_str(),
+                   backup_path.empty() ? nullptr : backup_path.c_str(),
+                   REPLACEFILE_IGNORE_MERGE_ERRORS, nullptr, nullptr)) {
+    return;
+  }
+
+  if (!MoveFileExA(temp_path.c_str(), path.c_str(),
+                   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    const auto error = GetLastErrorAsString();
+    DeleteFileA(temp_path.c_str());
+    throw std::runtime_error("Renaming " + temp_path +
+                             " failed. Reason: " + error);
+  }
+}
+}  // namespace bbmp
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+namespace bbmp {
+/*
+ * Replaces the contents of path so that after a crash or power loss the file
+ * holds either the old or the new contents, never a mix or nothing.
+ *
+ * The data goes to path + ".tmp" first, which is flushed to the disk and then
+ * renamed over path. If backup_path isn't empty, the previous version of the
+ * file is kept there.
+ *
+ * Throws std::runtime_error on failure, in which case path is left untouched.
+ */
+void ReplaceFileContents(const std::string& path, const std::string& data,
+                         const std::string& backup_path = {});
+}  // namespace bbmp
@@ -0,0 +1,90 @@
+#include "atomic_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace bbmp {
+namespace {
+[[noreturn]] void ThrowErrno(const std::string& what) {
+  throw std::runtime_error(what + " failed. Reason: " + strerror(errno));
+}
+
+std::string GetDirectory(const std::string& path) {
+  const auto i_slash = path.find_last_of('/');
+  if (i_slash == std::string::npos) {
+    return ".";
+  }
+  return i_slash == 0 ? "/" : path.substr(0, i_slash);
+}
+
+void WriteAndSync(const std::string& path, const std::string& data) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644);
+  if (fd == -1) {
+    ThrowErrno("Opening " + path);
+  }
+
+  size_t written = 0;
+  while (written < data.size()) {
+    const auto result = write(fd, data.data() + written, data.size() - written);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      const int write_errno = errno;
+      close(fd);
+      errno = write_errno;
+      ThrowErrno("Writing " + path);
+    }
+    written += static_cast<size_t>(result);
+  }
+
+  if (fsync(fd) == -1) {
+    const int fsync_errno = errno;
+    close(fd);
+    errno = fsync_errno;
+    ThrowErrno("fsync of " + path);
+  }
+  close(fd);
+}
+}  // namespace
+
+void ReplaceFileContents(const std::string& path, const std::string& data,
+                         const std::string& backup_path) {
+  const auto temp_path = path + ".tmp";
+  try {
+    WriteAndSync(temp_path, data);
+  } catch (...) {
+    unlink(temp_path.c_str());
+    throw;
+  }
+
+  // A hard link keeps the old version around without a moment where path
+  // doesn't exist. Not every file system supports them, and a missing backup
+  // is no reason to fail the save.
+  if (!backup_path.empty()) {
+    unlink(backup_path.c_str());
+    link(path.c_str(), backup_path.c_str());
+  }
+
+  if (rename(temp_path.c_str(), path.c_str()) == -1) {
+    const int rename_errno = errno;
+    unlink(temp_path.c_str());
+    errno = rename_errno;
+    ThrowErrno("Renaming " + temp_path);
+  }
+
+  // The rename itself is only durable once the directory is synced
+  const auto directory = GetDirectory(path);
+  const int directory_fd =
+      open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directory_fd != -1) {
+    fsync(directory_fd);
+    close(directory_fd);
+  }
+}
+}  // namespace bbmp
@@ -0,0 +1,72 @@
+#include "device_watcher.h"
+
+#include "windows_handles.h"
+
+#include <cfgmgr32.h>
+#include <initguid.h>
+#include <ntddser.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+namespace bbmp {
+// The notification callback runs on a thread pool thread. It queues an APC to
+// the thread that created the watcher, which wakes that thread from its
+// alertable SleepEx like an IO completion would.
+class DeviceWatcher::Impl {
+ public:
+  Impl() {
+    HANDLE thread;
+    if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+                         GetCurrentProcess(), &thread, THREAD_SET_CONTEXT,
+                         FALSE, 0)) {
+      throw std::runtime_error("DuplicateHandle failed. Reason: " +
+                               GetLastErrorAsString());
+    }
+    thread_handle_ = WindowsHandle<0>(thread);
+
+    CM_NOTIFY_FILTER filter{};
+    filter.cbSize = sizeof(filter);
+    filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+    filter.u.DeviceInterface.ClassGuid = GUID_DEVINTERFACE_COMPORT;
+    const auto result =
+        CM_Register_Notification(&filter, this, OnNotification, &notification_);
+    if (result != CR_SUCCESS) {
+      throw std::runtime_error(
+          "CM_Register_Notification failed. Reason: error code " +
+          std::to_string(result));
+    }
+  }
+
+  // Waits for running callbacks. An APC that is already queued does nothing.
+  ~Impl() { CM_Unregister_Notification(notification_); }
+
+  bool TakeChange() { return changed_.exchange(false); }
+
+ private:
+  static DWORD CALLBACK OnNotification(HCMNOTIFICATION, PVOID context,
+                                       CM_NOTIFY_ACTION action,
+                                       PCM_NOTIFY_EVENT_DATA, DWORD) {
+    if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL ||
+        action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL) {
+      auto* impl = static_cast<Impl*>(context);
+      impl->changed_ = true;
+      QueueUserAPC(WakeUp, impl->thread_handle_.Get(), 0);
+    }
+    return ERROR_SUCCESS;
+  }
+
+  static VOID CALLBACK WakeUp(ULONG_PTR) {}
+
+  std::atomic<bool> changed_{false};
+  WindowsHandle<0> thread_handle_;
+  HCMNOTIFICATION notification_ = nullptr;
+};
+
+DeviceWatcher::DeviceWatcher() : impl_(std::make_unique<Impl>()) {}
+
+DeviceWatcher::~DeviceWatcher() = default;
+
+bool DeviceWatcher::TakeChange() { return impl_->TakeChange(); }
+}  // namespace bbmp
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+
+namespace bbmp {
+/*
+ * Tells when serial ports may have appeared or disappeared, without polling.
+ *
+ * Like the completions of Serial, notifications wake up the thread that
+ * created the watcher from Serial::WindowsSleepEx, so a loop can sleep until
+ * serial IO or a device change, whichever comes first. Which port changed
+ * isn't reported, GetComPorts tells that.
+ *
+ * On Windows this is a CM_Register_Notification for COM port interfaces. On
+ * Linux it's the kernel's tty uevents, together with inotify on /dev and on
+ * the directories of BBMP_EXTRA_SERIAL_PORTS. uevents arrive before udev
+ * creates the device node and sets its permissions, so inotify is what tells
+ * when the port can be opened, and it's all there is inside containers.
+ */
+class DeviceWatcher {
+ public:
+  // Throws if no notification mechanism is available
+  DeviceWatcher();
+  ~DeviceWatcher();
+
+  DeviceWatcher(const DeviceWatcher&) = delete;
+  DeviceWatcher& operator=(const DeviceWatcher&) = delete;
+
+  // Returns true once after one or more changes
+  bool TakeChange();
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+}  // namespace bbmp
@@ -0,0 +1,180 @@
+#include "device_watcher.h"
+
+#include "alertable_wait.h"
+
+#include <linux/netlink.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace bbmp {
+namespace {
+// The group the kernel broadcasts its uevents to, before udev processes them
+constexpr uint32_t kKernelUeventGroup = 1;
+
+constexpr uint32_t kInotifyMask =
+    IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM;
+
+// A uevent is "ACTION@DEVPATH" followed by KEY=VALUE strings, all terminated
+// by a null character
+bool IsTtyUevent(const char* data, size_t size) {
+  for (size_t begin = 0; begin < size;) {
+    const auto length = strnlen(data + begin, size - begin);
+    if (std::string_view(data + begin, length) == "SUBSYSTEM=tty") {
+      return true;
+    }
+    begin += length + 1;
+  }
+  return false;
+}
+
+// Where /dev doesn't cover them
+std::set<std::string> GetExtraPortDirectories() {
+  std::set<std::string> directories;
+  if (const char* extra_ports = std::getenv("BBMP_EXTRA_SERIAL_PORTS")) {
+    std::stringstream ss(extra_ports);
+    std::string port_name;
+    while (std::getline(ss, port_name, ':')) {
+      const auto directory =
+          std::filesystem::path(port_name).parent_path().string();
+      if (!directory.empty() && directory != "/dev") {
+        directories.insert(directory);
+      }
+    }
+  }
+  return directories;
+}
+}  // namespace
+
+class DeviceWatcher::Impl {
+ public:
+  Impl()
+      : uevent_handler_(*this, &Impl::DrainUevents),
+        inotify_handler_(*this, &Impl::DrainInotify) {
+    std::string reasons;
+    uevent_handler_.fd = OpenUeventSocket(reasons);
+    inotify_handler_.fd = OpenInotify(reasons);
+    if (uevent_handler_.fd == -1 && inotify_handler_.fd == -1) {
+      throw std::runtime_error("DeviceWatcher failed. Reason: " + reasons);
+    }
+
+    try {
+      for (auto* handler : {&uevent_handler_, &inotify_handler_}) {
+        if (handler->fd != -1) {
+          AlertableWait::ForThisThread().Arm(handler->fd, EPOLLIN, handler);
+        }
+      }
+    } catch (...) {
+      Close();
+      throw;
+    }
+  }
+
+  ~Impl() { Close(); }
+
+  bool TakeChange() { return std::exchange(changed_, false); }
+
+ private:
+  // One per file descriptor, as handlers aren't told which one became ready
+  struct Handler : AlertableWait::Handler {
+    using Drain = bool (Impl::*)(int fd);
+
+    Handler(Impl& owner, Drain drain) : owner(owner), drain(drain) {}
+
+    void OnReady(uint32_t) override {
+      if ((owner.*drain)(fd)) {
+        owner.changed_ = true;
+      }
+    }
+
+    Impl& owner;
+    Drain drain;
+    int fd = -1;
+  };
+
+  static int OpenUeventSocket(std::string& reasons) {
+    const int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                          NETLINK_KOBJECT_UEVENT);
+    sockaddr_nl address{};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = kKernelUeventGroup;
+    if (fd == -1 || bind(fd, reinterpret_cast<sockaddr*>(&address),
+                         sizeof(address)) == -1) {
+      reasons += std::string("uevent socket: ") + strerror(errno) + ". ";
+      if (fd != -1) {
+        close(fd);
+      }
+      return -1;
+    }
+    return fd;
+  }
+
+  static int OpenInotify(std::string& reasons) {
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1 || inotify_add_watch(fd, "/dev", kInotifyMask) == -1) {
+      reasons += std::string("inotify on /dev: ") + strerror(errno) + ". ";
+      if (fd != -1) {
+        close(fd);
+      }
+      return -1;
+    }
+    // Directories that don't exist yet are simply not watched
+    for (const auto& directory : GetExtraPortDirectories()) {
+      inotify_add_watch(fd, directory.c_str(), kInotifyMask);
+    }
+    return fd;
+  }
+
+  // Only tty events count, the socket gets those of every subsystem
+  bool DrainUevents(int fd) {
+    bool changed = false;
+    char buffer[4096];
+    ssize_t size;
+    while ((size = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+      changed = changed || IsTtyUevent(buffer, static_cast<size_t>(size));
+    }
+    return changed;
+  }
+
+  bool DrainInotify(int fd) {
+    bool changed = false;
+    alignas(inotify_event) char buffer[4096];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+      changed = true;
+    }
+    return changed;
+  }
+
+  void Close() noexcept {
+    for (auto* handler : {&uevent_handler_, &inotify_handler_}) {
+      if (handler->fd != -1) {
+        AlertableWait::ForThisThread().Disarm(handler->fd);
+        close(handler->fd);
+        handler->fd = -1;
+      }
+    }
+  }
+
+  bool changed_ = false;
+  Handler uevent_handler_;
+  Handler inotify_handler_;
+};
+
+DeviceWatcher::DeviceWatcher() : impl_(std::make_unique<Impl>()) {}
+
+DeviceWatcher::~DeviceWatcher() = default;
+
+bool DeviceWatcher::TakeChange() { return impl_->TakeChange(); }
+}  // namespace bbmp
@@ -0,0 +1,207 @@
+#include "fan_controller.h"
+
+#include "logging.h"
+#include "stringstream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+namespace bbmp {
+namespace {
+// Generous, firmware answers within a few milliseconds
+constexpr std::chrono::milliseconds kIdentifyTimeout{250};
+
+// Firmware that doesn't answer the identify request drives four fans
+constexpr size_t kLegacyNumFans = 4;
+
+// 8-4-4-4-12 hex digits
+std::string FormatUuid(const uint8_t* uuid) {
+  std::string result;
+  char digits[3];
+  for (uint8_t i = 0; i < fan_protocol::kUuidLength; ++i) {
+    if (i == 4 || i == 6 || i == 8 || i == 10) {
+      result.push_back('-');
+    }
+    std::snprintf(digits, sizeof(digits), "%02x", uuid[i]);
+    result.append(digits);
+  }
+  return result;
+}
+}  // namespace
+
+FanController::FanController(std::string port_name)
+    : port_name_(std::move(port_name)),
+      identify_deadline_(std::chrono::steady_clock::now() + kIdentifyTimeout),
+      line_reader_(256, [this](const char* data, size_t length) {
+        OnTextLine(data, length);
+      }) {
+  serial_ = std::make_unique<Serial>(
+      port_name_.c_str(),
+      [this](const char* data, size_t size) { OnSerialData(data, size); });
+  SendHello();
+}
+
+bool FanController::IsIdentified() const {
+  return num_fans_ > 0 &&
+         (!uuid_.empty() ||
+          std::chrono::steady_clock::now() >= identify_deadline_);
+}
+
+void FanController::IssueRead() { serial_->IssueRead(); }
+
+bool FanController::TrySendDutyCycles(const float* duty_cycles) {
+  std::array<uint8_t, kMaxFans> values;
+  for (size_t i = 0; i < num_fans_; ++i) {
+    values[i] = static_cast<uint8_t>(std::round(
+        std::clamp(duty_cycles[i], 0.0f, 100.0f) / 100.0f * 255.0f));
+  }
+
+  if (binary_protocol_) {
+    uint8_t frame[fan_protocol::kMaxFrameLength];
+    const auto length = fan_protocol::EncodeFrame(
+        fan_protocol::kSetDutyCycles, values.data(),
+        static_cast<uint8_t>(num_fans_), frame, sizeof(frame));
+    return serial_->TryIssueWrite(reinterpret_cast<const char*>(frame),
+                                  length);
+  }
+
+  // "c 1" followed by a value for every fan
+  char msg[8 + 4 * kMaxFans];
+  int length = std::snprintf(msg, sizeof(msg), "c 1");
+  for (size_t i = 0; i < num_fans_; ++i) {
+    length += std::snprintf(msg + length, sizeof(msg) - length, " %d",
+                            static_cast<int>(values[i]));
+  }
+  length += std::snprintf(msg + length, sizeof(msg) - length, "\n");
+  return serial_->TryIssueWrite(msg, static_cast<size_t>(length));
+}
+
+bool FanController::SetTelemetryPeriod(uint16_t period_ms) {
+  if (!binary_protocol_) {
+    return false;
+  }
+  const uint8_t payload[] = {static_cast<uint8_t>(period_ms & 0xff),
+                             static_cast<uint8_t>(period_ms >> 8)};
+  uint8_t frame[fan_protocol::kMaxFrameLength];
+  const auto length =
+      fan_protocol::EncodeFrame(fan_protocol::kSetTelemetryPeriod, payload,
+                                sizeof(payload), frame, sizeof(frame));
+  return serial_->TryIssueWrite(reinterpret_cast<const char*>(frame), length);
+}
+
+// The identify request goes out in the same write as the hello
+void FanController::SendHello() {
+  const uint8_t version = fan_protocol::kVersion;
+  uint8_t frames[2 * fan_protocol::kMaxFrameLength];
+  auto length = fan_protocol::EncodeFrame(fan_protocol::kHello, &version, 1,
+                                          frames, sizeof(frames));
+  length += fan_protocol::EncodeFrame(fan_protocol::kIdentify, nullptr, 0,
+                                      frames + length, sizeof(frames) - length);
+  if (!serial_->TryIssueWrite(reinterpret_cast<const char*>(frames),
+                              length)) {
+    throw std::runtime_error("FanController failed. Reason: couldn't send "
+                             "the hello on " +
+                             port_name_);
+  }
+}
+
+// Until the board answers the hello, everything received is also treated as
+// text. Old firmware never answers, so those boards stay on text lines.
+void FanController::OnSerialData(const char* data, size_t size) {
+  const bool was_binary = binary_protocol_;
+  size_t text_length = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (frame_decoder_.Push(static_cast<uint8_t>(data[i]))) {
+      ProcessFrame();
+    }
+    if (!binary_protocol_) {
+      text_length = i + 1;
+    }
+  }
+  if (!was_binary && text_length > 0) {
+    line_reader_.Read(data, text_length);
+  }
+}
+
+// A line of text telemetry is the RPM of every fan followed by their duty
+// cycles. Lines with any other number of values are noise, e.g. a line cut in
+// half by a reset, and are dropped.
+void FanController::OnTextLine(const char* data, size_t length) {
+  const auto num_fans = uuid_.empty() ? kLegacyNumFans : num_fans_;
+  std::array<int, 2 * kMaxFans + 1> values;
+  size_t num_values = 0;
+  StringStream stream(data, length);
+  while (num_values <= 2 * num_fans) {
+    const auto value = stream.GetInt();
+    if (!value) {
+      break;
+    }
+    values[num_values++] = *value;
+  }
+  if (num_values == 2 * num_fans) {
+    SetRpms(values.data(), num_fans);
+  }
+}
+
+void FanController::ProcessFrame() {
+  switch (frame_decoder_.GetType()) {
+    case fan_protocol::kHelloReply:
+      if (!binary_protocol_) {
+        Log("Fan controller on {} switched to the binary protocol",
+            port_name_);
+      }
+      binary_protocol_ = true;
+      break;
+
+    case fan_protocol::kIdentifyReply: {
+      fan_protocol::Identity identity;
+      if (fan_protocol::DecodeIdentity(frame_decoder_.GetPayload(),
+                                       frame_decoder_.GetLength(), identity)) {
+        OnIdentity(identity);
+      }
+      break;
+    }
+
+    case fan_protocol::kTelemetry: {
+      std::array<uint16_t, kMaxFans> rpms{};
+      std::array<uint8_t, kMaxFans> duty_cycles{};
+      const auto num_fans = fan_protocol::DecodeTelemetry(
+          frame_decoder_.GetPayload(), frame_decoder_.GetLength(),
+          rpms.data(), duty_cycles.data(), kMaxFans);
+      std::array<int, kMaxFans> rpms_int;
+      std::copy(rpms.begin(), rpms.begin() + num_fans, rpms_int.begin());
+      SetRpms(rpms_int.data(), num_fans);
+      break;
+    }
+  }
+}
+
+void FanController::OnIdentity(const fan_protocol::Identity& identity) {
+  if (!uuid_.empty() || identity.num_fans == 0 ||
+      identity.num_fans > kMaxFans) {
+    return;
+  }
+  uuid_ = FormatUuid(identity.uuid);
+  firmware_version_ = identity.firmware_version;
+  Log("Fan controller {} with {} fans and firmware version {} found on {}",
+      uuid_, identity.num_fans, firmware_version_, port_name_);
+  if (num_fans_ == 0) {
+    num_fans_ = identity.num_fans;
+  }
+}
+
+// The first complete message decides the number of fans. Later messages
+// describing a different number are ignored.
+void FanController::SetRpms(const int* rpms, size_t num_fans) {
+  if (num_fans == 0 || (num_fans_ != 0 && num_fans != num_fans_)) {
+    return;
+  }
+  if (num_fans_ == 0) {
+    num_fans_ = num_fans;
+    Log("Fan controller with {} fans found on {}", num_fans, port_name_);
+  }
+  std::copy(rpms, rpms + num_fans, rpms_.begin());
+}
+}  // namespace bbmp
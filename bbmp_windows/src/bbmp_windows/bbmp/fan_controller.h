@@ -0,0 +1,95 @@
+#pragma once
+
+#include "fan_protocol.h"
+#include "line_reader.h"
+#include "serial.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace bbmp {
+/*
+ * One fan controller board on a serial port.
+ *
+ * The number of fans isn't known up front. Current firmware tells it in its
+ * answer to the identify request, along with the UUID of the board, within a
+ * round trip. Older firmware is identified by its first telemetry instead,
+ * once it had the chance to answer, and must send the text telemetry of four
+ * fans. Until then the board is not identified.
+ *
+ * Reads and writes are asynchronous. Their completions run inside
+ * Serial::WindowsSleepEx on the thread that issued them, so a FanController is
+ * only to be used from a single thread.
+ */
+class FanController {
+ public:
+  // The most fans a telemetry frame can describe
+  static constexpr size_t kMaxFans =
+      fan_protocol::kMaxPayloadLength / fan_protocol::kTelemetryBytesPerFan;
+
+  // Opens the port and sends the hello. Throws if the port can't be opened or
+  // the hello can't be written.
+  explicit FanController(std::string port_name);
+
+  FanController(const FanController&) = delete;
+  FanController& operator=(const FanController&) = delete;
+
+  const std::string& GetPortName() const { return port_name_; }
+
+  bool IsIdentified() const;
+
+  // The UUID of the board if it answered the identify request, the port name
+  // otherwise. Stable across reboots and port changes for current firmware.
+  const std::string& GetBoardId() const {
+    return uuid_.empty() ? port_name_ : uuid_;
+  }
+
+  // 0 if the board didn't answer the identify request
+  uint16_t GetFirmwareVersion() const { return firmware_version_; }
+
+  // 0 until the board is identified
+  size_t GetNumFans() const { return num_fans_; }
+
+  bool IsBinaryProtocol() const { return binary_protocol_; }
+
+  // GetNumFans() values from the most recent telemetry
+  const int* GetRpms() const { return rpms_.data(); }
+
+  // Throws if the device failed or was disconnected
+  void IssueRead();
+
+  // duty_cycles has GetNumFans() values in percent. Returns false if the
+  // previous command is still being written.
+  bool TrySendDutyCycles(const float* duty_cycles);
+
+  // Asks the board to send telemetry every period_ms instead of its default
+  // 100 ms. Only boards on the binary protocol support this. Returns false if
+  // the command couldn't be issued.
+  bool SetTelemetryPeriod(uint16_t period_ms);
+
+ private:
+  void SendHello();
+  void OnSerialData(const char* data, size_t size);
+  void OnTextLine(const char* data, size_t length);
+  void ProcessFrame();
+  void OnIdentity(const fan_protocol::Identity& identity);
+  void SetRpms(const int* rpms, size_t num_fans);
+
+  std::string port_name_;
+  // Until then the board may still answer the identify request
+  std::chrono::steady_clock::time_point identify_deadline_;
+  std::string uuid_;
+  uint16_t firmware_version_ = 0;
+  bool binary_protocol_ = false;
+  size_t num_fans_ = 0;
+  std::array<int, kMaxFans> rpms_{};
+  fan_protocol::FrameDecoder frame_decoder_;
+  LineReader line_reader_;
+  // Last, so no callback can reach a half destroyed controller
+  std::unique_ptr<Serial> serial_;
+};
+}  // namespace bbmp
@@ -0,0 +1,305 @@
+#include "fan_controller_registry.h"
+
+#include "logging.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace bbmp {
+namespace {
+constexpr std::chrono::milliseconds kProbeTimeout{4000};
+constexpr uint32_t kProbeSliceMs = 50;
+constexpr uint32_t kIdleWaitMs = 1000;
+constexpr int kRetryMs = 2000;
+
+// USB to serial converters of Arduino Nanos and their clones. A product ID of
+// 0 matches every product of the vendor.
+struct UsbId {
+  uint16_t vendor_id;
+  uint16_t product_id;
+};
+
+constexpr UsbId kFanControllerUsbIds[] = {
+    {0x2341, 0},       // Arduino
+    {0x2a03, 0},       // Arduino.org
+    {0x0403, 0x6001},  // FTDI FT232R
+    {0x1a86, 0x7523},  // WCH CH340
+    {0x10c4, 0xea60},  // Silicon Labs CP210x
+};
+}  // namespace
+
+FanControllerRegistry::FanControllerRegistry(
+    std::vector<Slot> saved_slots, const std::function<bool()>& should_exit,
+    const std::function<void(int)>& wait_ms) {
+  for (auto& slot : saved_slots) {
+    const auto is_duplicate =
+        std::any_of(slots_.begin(), slots_.end(), [&slot](const auto& other) {
+          return other.board_id == slot.board_id;
+        });
+    if (!slot.board_id.empty() && !is_duplicate) {
+      slots_.push_back(
+          {std::move(slot.board_id), slot.num_fans, 0, nullptr, false});
+    }
+  }
+  num_saved_slots_ = slots_.size();
+  UpdateLayout();
+
+  try {
+    device_watcher_ = std::make_unique<DeviceWatcher>();
+  } catch (std::runtime_error& error) {
+    Log(LogLevel::kWarning, "{}. Rescanning ports every 2 seconds instead.",
+        error.what());
+  }
+
+  ProbeNewPorts();
+  bool is_idle = false;
+  while (!should_exit() &&
+         (GetNumControllers() == 0 ||
+          (!candidates_.empty() && IsMissingSavedBoards()))) {
+    if (candidates_.empty() != is_idle) {
+      is_idle = candidates_.empty();
+      if (is_idle) {
+        Log(LogLevel::kWarning,
+            "Fan controller not found. Waiting for a serial port to appear...");
+      }
+    }
+
+    if (device_watcher_ != nullptr) {
+      // Returns as soon as a completion or a device change arrives. While idle
+      // the timeout is only there to check should_exit.
+      Serial::WindowsSleepEx(is_idle ? kIdleWaitMs : kProbeSliceMs, true);
+      if (device_watcher_->TakeChange()) {
+        ProbeNewPorts();
+      }
+    } else if (is_idle) {
+      wait_ms(kRetryMs);
+      ignored_ports_.clear();
+      ProbeNewPorts();
+    } else {
+      Serial::WindowsSleepEx(kProbeSliceMs, true);
+    }
+    UpdateCandidates();
+  }
+}
+
+bool FanControllerRegistry::IsCandidate(const ComPort& port) {
+  if (port.usb_vendor_id == 0) {
+    return true;
+  }
+  for (const auto& id : kFanControllerUsbIds) {
+    if (port.usb_vendor_id == id.vendor_id &&
+        (id.product_id == 0 || port.usb_product_id == id.product_id)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t FanControllerRegistry::GetNumControllers() const {
+  return static_cast<size_t>(
+      std::count_if(slots_.begin(), slots_.end(), [](const SlotState& slot) {
+        return slot.controller != nullptr;
+      }));
+}
+
+std::vector<FanControllerRegistry::Slot> FanControllerRegistry::GetSlots()
+    const {
+  std::vector<Slot> slots;
+  for (const auto& slot : slots_) {
+    slots.push_back({slot.board_id, slot.num_fans});
+  }
+  return slots;
+}
+
+void FanControllerRegistry::IssueReads() {
+  ForEachController([this](size_t i) { slots_[i].controller->IssueRead(); });
+  if (device_watcher_ != nullptr && device_watcher_->TakeChange()) {
+    ProbeNewPorts();
+  }
+  UpdateCandidates();
+  if (GetNumControllers() == 0) {
+    throw std::runtime_error("All fan controllers were lost");
+  }
+}
+
+void FanControllerRegistry::GetRpms(int* rpms) const {
+  for (const auto& slot : slots_) {
+    if (slot.controller != nullptr) {
+      std::copy(slot.controller->GetRpms(),
+                slot.controller->GetRpms() + slot.num_fans,
+                rpms + slot.first_fan);
+    } else {
+      std::fill(rpms + slot.first_fan, rpms + slot.first_fan + slot.num_fans,
+                0);
+    }
+  }
+}
+
+void FanControllerRegistry::SetDutyCycles(const float* duty_cycles) {
+  std::copy(duty_cycles, duty_cycles + num_fans_, duty_cycles_.begin());
+  for (auto& slot : slots_) {
+    slot.is_pending = slot.controller != nullptr;
+  }
+  FlushDutyCycles();
+}
+
+void FanControllerRegistry::FlushDutyCycles() {
+  ForEachController([this](size_t i) {
+    auto& slot = slots_[i];
+    if (slot.is_pending && slot.controller->TrySendDutyCycles(
+                               duty_cycles_.data() + slot.first_fan)) {
+      slot.is_pending = false;
+    }
+  });
+}
+
+void FanControllerRegistry::SetTelemetryPeriod(uint16_t period_ms) {
+  ForEachController([this, period_ms](size_t i) {
+    slots_[i].controller->SetTelemetryPeriod(period_ms);
+  });
+}
+
+void FanControllerRegistry::ProbeNewPorts() {
+  const auto ports = GetComPorts();
+  for (auto it = ignored_ports_.begin(); it != ignored_ports_.end();) {
+    const auto is_present =
+        std::any_of(ports.begin(), ports.end(),
+                    [&it](const ComPort& port) { return port.name == *it; });
+    it = is_present ? std::next(it) : ignored_ports_.erase(it);
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + kProbeTimeout;
+  for (const auto& port : ports) {
+    if (IsKnownPort(port.name)) {
+      continue;
+    }
+    if (!IsCandidate(port)) {
+      Log(LogLevel::kDebug, "Skipping port {} with USB ID {}:{}", port.name,
+          port.usb_vendor_id, port.usb_product_id);
+      ignored_ports_.insert(port.name);
+      continue;
+    }
+    // A port that can't be opened yet, e.g. before udev set its permissions,
+    // is tried again on the next device change
+    Log("Connecting to port {}...", port.name);
+    try {
+      candidates_.push_back(
+          {std::make_unique<FanController>(port.name), deadline});
+    } catch (std::runtime_error& error) {
+      Log(LogLevel::kError, "{}", error.what());
+    }
+  }
+}
+
+bool FanControllerRegistry::IsKnownPort(const std::string& port_name) const {
+  return ignored_ports_.count(port_name) > 0 ||
+         std::any_of(slots_.begin(), slots_.end(),
+                     [&port_name](const SlotState& slot) {
+                       return slot.controller != nullptr &&
+                              slot.controller->GetPortName() == port_name;
+                     }) ||
+         std::any_of(candidates_.begin(), candidates_.end(),
+                     [&port_name](const Candidate& candidate) {
+                       return candidate.controller->GetPortName() == port_name;
+                     });
+}
+
+void FanControllerRegistry::UpdateCandidates() {
+  if (candidates_.empty()) {
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  bool added = false;
+  for (auto it = candidates_.begin(); it != candidates_.end();) {
+    auto& controller = it->controller;
+    try {
+      if (!controller->IsIdentified()) {
+        if (now >= it->deadline) {
+          Log(LogLevel::kWarning, "No valid message was received on {}",
+              controller->GetPortName());
+          ignored_ports_.insert(controller->GetPortName());
+          it = candidates_.erase(it);
+          continue;
+        }
+        controller->IssueRead();
+      }
+    } catch (std::runtime_error& error) {
+      Log(LogLevel::kError, "{}", error.what());
+      it = candidates_.erase(it);
+      continue;
+    }
+
+    if (!controller->IsIdentified()) {
+      ++it;
+      continue;
+    }
+
+    // Into the slot of the board if it has one, the same board on two ports
+    // at once gets a slot for each
+    const auto& board_id = controller->GetBoardId();
+    auto slot = std::find_if(slots_.begin(), slots_.end(),
+                             [&board_id](const SlotState& other) {
+                               return other.controller == nullptr &&
+                                      other.board_id == board_id;
+                             });
+    if (slot == slots_.end()) {
+      slots_.push_back({board_id, 0, 0, nullptr, false});
+      slot = std::prev(slots_.end());
+    }
+    slot->num_fans = controller->GetNumFans();
+    slot->controller = std::move(controller);
+    it = candidates_.erase(it);
+    added = true;
+  }
+
+  if (added) {
+    UpdateLayout();
+  }
+}
+
+bool FanControllerRegistry::IsMissingSavedBoards() const {
+  return std::any_of(slots_.begin(), slots_.begin() + num_saved_slots_,
+                     [](const SlotState& slot) {
+                       return slot.controller == nullptr;
+                     });
+}
+
+template <typename Function>
+void FanControllerRegistry::ForEachController(Function&& function) {
+  bool removed = false;
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    auto& slot = slots_[i];
+    if (slot.controller == nullptr) {
+      continue;
+    }
+    try {
+      function(i);
+    } catch (std::runtime_error& error) {
+      Log(LogLevel::kError, "Fan controller on {} lost: {}",
+          slot.controller->GetPortName(), error.what());
+      slot.controller.reset();
+      slot.is_pending = false;
+      removed = true;
+    }
+  }
+  if (removed) {
+    UpdateLayout();
+  }
+}
+
+void FanControllerRegistry::UpdateLayout() {
+  num_fans_ = 0;
+  is_fan_connected_.clear();
+  for (auto& slot : slots_) {
+    slot.first_fan = num_fans_;
+    num_fans_ += slot.num_fans;
+    is_fan_connected_.resize(num_fans_, slot.controller != nullptr);
+  }
+  duty_cycles_.assign(num_fans_, 0.0f);
+  for (auto& slot : slots_) {
+    slot.is_pending = false;
+  }
+  ++layout_version_;
+}
+}  // namespace bbmp
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "device_watcher.h"
+#include "fan_controller.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace bbmp {
+/*
+ * Every fan controller board attached to the machine, driven from the thread
+ * that owns the registry.
+ *
+ * Each board has its own serial port, but the completions of all of them are
+ * handled by the same Serial::WindowsSleepEx call. One thread serves any
+ * number of boards, without locks and without a thread per port. Probing
+ * works the same way: every candidate port is opened at once, and a port that
+ * doesn't answer only delays itself.
+ *
+ * Every board has a slot, which reserves a range of fan numbers for it. Slots
+ * are created in the order the boards are found, after those of the boards
+ * the registry was created with. A board that is lost keeps its slot, so the
+ * fans of the other boards keep their numbers, and it takes the slot back
+ * when it's found again. The duty cycles of all fans are set in one call,
+ * which issues the commands of every connected board back to back.
+ *
+ * Ports are probed when they appear, as reported by a DeviceWatcher. Without
+ * a board or a device change there is no periodic work, apart from checking
+ * should_exit. Ports that didn't answer, or whose USB IDs rule them out, are
+ * only probed again after they were gone.
+ */
+class FanControllerRegistry {
+ public:
+  struct Slot {
+    // FanController::GetBoardId
+    std::string board_id;
+    size_t num_fans;
+  };
+
+  // Starts probing every candidate serial port, and returns once a board was
+  // found and every board of saved_slots is either found or has no port left
+  // that could be it. The ports still being probed are probed further by
+  // IssueReads, and their boards are added as they answer.
+  //
+  // saved_slots are as returned by GetSlots, usually by an earlier registry.
+  // Their boards keep their fan numbers, whether they are found or not. A
+  // board found with more or fewer fans than its slot has resizes it.
+  //
+  // Waits for ports to appear until a board is found or should_exit returns
+  // true. Rescans every 2 seconds where device changes can't be watched.
+  FanControllerRegistry(std::vector<Slot> saved_slots,
+                        const std::function<bool()>& should_exit,
+                        const std::function<void(int)>& wait_ms);
+
+  // The connected boards
+  size_t GetNumControllers() const;
+
+  // Every slot, connected or not, in the order the fans are numbered
+  std::vector<Slot> GetSlots() const;
+
+  // Total over all slots, including the fans of boards that aren't connected
+  size_t GetNumFans() const { return num_fans_; }
+
+  // False for the fans of a slot whose board isn't connected
+  bool IsFanConnected(size_t i_fan) const { return is_fan_connected_[i_fan]; }
+
+  // Incremented whenever a board is added, lost or found again, or a slot
+  // changes its size
+  uint64_t GetLayoutVersion() const { return layout_version_; }
+
+  // Issues a read on every board, and every port still being probed, and
+  // starts probing the ports that appeared. Boards that answered are added,
+  // the ones that failed are removed. Throws if no board is left.
+  void IssueReads();
+
+  // Ports from which boards can be expected. USB devices are only probed if
+  // their IDs are those of a converter found on Arduino Nanos and their
+  // clones, other ports are always probed.
+  static bool IsCandidate(const ComPort& port);
+
+  // Writes GetNumFans() values, 0 for the fans that aren't connected
+  void GetRpms(int* rpms) const;
+
+  // duty_cycles has GetNumFans() values in percent, the ones of the fans that
+  // aren't connected are ignored. The command of a board whose previous write
+  // is still in progress is issued by the next FlushDutyCycles.
+  void SetDutyCycles(const float* duty_cycles);
+
+  // Issues the commands SetDutyCycles couldn't. Call after every wakeup.
+  void FlushDutyCycles();
+
+  void SetTelemetryPeriod(uint16_t period_ms);
+
+ private:
+  struct SlotState {
+    std::string board_id;
+    size_t num_fans;
+    size_t first_fan = 0;
+    // Null while the board isn't connected
+    std::unique_ptr<FanController> controller;
+    // True if the board's command is yet to be issued
+    bool is_pending = false;
+  };
+
+  // A port that was sent the hello, and hasn't answered yet
+  struct Candidate {
+    std::unique_ptr<FanController> controller;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  // Opens every candidate port that isn't probed, taken or ignored yet
+  void ProbeNewPorts();
+
+  bool IsKnownPort(const std::string& port_name) const;
+
+  // Issues reads on the candidates, drops the ones that failed or timed out,
+  // and puts the boards of the ones that answered into their slots
+  void UpdateCandidates();
+
+  bool IsMissingSavedBoards() const;
+
+  // Calls function with the index of the slot of every connected board, and
+  // disconnects the boards for which it throws
+  template <typename Function>
+  void ForEachController(Function&& function);
+
+  void UpdateLayout();
+
+  std::vector<SlotState> slots_;
+  // The first ones of slots_, that the registry was created with
+  size_t num_saved_slots_ = 0;
+  std::vector<Candidate> candidates_;
+  // Null if device changes can't be watched
+  std::unique_ptr<DeviceWatcher> device_watcher_;
+  // Not probed again until they disappear
+  std::set<std::string> ignored_ports_;
+  size_t num_fans_ = 0;
+  // [i_fan]
+  std::vector<bool> is_fan_connected_;
+  uint64_t layout_version_ = 0;
+
+  // [i_fan], the most recent duty cycles
+  std::vector<float> duty_cycles_;
+};
+}  // namespace bbmp
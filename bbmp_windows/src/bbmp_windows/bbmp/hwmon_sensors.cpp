@@ -0,0 +1,145 @@
+#include "hwmon_sensors.h"
+
+#include "stringstream.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+std::string ReadFirstLine(const std::filesystem::path& path) {
+  std::ifstream is(path);
+  std::string line;
+  std::getline(is, line);
+  return line;
+}
+
+// Directory entries come in no particular order. Sorting them with the
+// numbers compared as numbers gives temp2 < temp10 and stable sensor indices.
+bool NaturalLess(const std::string& a, const std::string& b) {
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size()) {
+    if (isdigit(a[i]) && isdigit(b[j])) {
+      size_t i_end = i, j_end = j;
+      while (i_end < a.size() && isdigit(a[i_end])) ++i_end;
+      while (j_end < b.size() && isdigit(b[j_end])) ++j_end;
+      const auto a_number = std::stoull(a.substr(i, i_end - i));
+      const auto b_number = std::stoull(b.substr(j, j_end - j));
+      if (a_number != b_number) {
+        return a_number < b_number;
+      }
+      i = i_end;
+      j = j_end;
+    } else {
+      if (a[i] != b[j]) {
+        return a[i] < b[j];
+      }
+      ++i;
+      ++j;
+    }
+  }
+  return a.size() - i < b.size() - j;
+}
+
+std::vector<std::filesystem::path> SortedEntries(
+    const std::filesystem::path& directory, const std::string& prefix) {
+  std::vector<std::filesystem::path> entries;
+  std::error_code error;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(directory, error)) {
+    if (entry.path().filename().string().rfind(prefix, 0) == 0) {
+      entries.push_back(entry.path());
+    }
+  }
+  std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+    return NaturalLess(a.filename().string(), b.filename().string());
+  });
+  return entries;
+}
+}  // namespace
+
+namespace bbmp {
+HwmonSensors::HwmonSensors(const std::string& sysfs_class_root) {
+  const std::filesystem::path root(sysfs_class_root);
+
+  const auto add_sensor = [this](const std::filesystem::path& path,
+                                 std::string chip, std::string label) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+      sensors_.push_back({std::move(chip), std::move(label), fd});
+    }
+  };
+
+  for (const auto& hwmon : SortedEntries(root / "hwmon", "hwmon")) {
+    const auto chip = ReadFirstLine(hwmon / "name");
+    for (const auto& input : SortedEntries(hwmon, "temp")) {
+      const auto file_name = input.filename().string();
+      const std::string suffix = "_input";
+      if (file_name.size() <= suffix.size() ||
+          file_name.compare(file_name.size() - suffix.size(), suffix.size(),
+                            suffix) != 0) {
+        continue;
+      }
+      const auto sensor_name =
+          file_name.substr(0, file_name.size() - suffix.size());
+      auto label = ReadFirstLine(hwmon / (sensor_name + "_label"));
+      add_sensor(input, chip, label.empty() ? sensor_name : std::move(label));
+    }
+  }
+
+  for (const auto& zone : SortedEntries(root / "thermal", "thermal_zone")) {
+    add_sensor(zone / "temp", ReadFirstLine(zone / "type"),
+               zone.filename().string());
+  }
+}
+
+HwmonSensors::~HwmonSensors() {
+  for (const auto& sensor : sensors_) {
+    close(sensor.fd);
+  }
+}
+
+std::optional<float> HwmonSensors::Read(size_t i_sensor) const {
+  // Millidegrees Celsius as a decimal number and a newline
+  char buffer[24];
+  const auto length =
+      pread(sensors_[i_sensor].fd, buffer, sizeof(buffer), 0);
+  if (length <= 0) {
+    return {};
+  }
+
+  StringStream stream(buffer, static_cast<size_t>(length));
+  if (auto millidegrees = stream.GetInt()) {
+    return static_cast<float>(*millidegrees) / 1000.0f;
+  }
+  return {};
+}
+
+std::optional<size_t> HwmonSensors::Find(
+    const std::vector<std::string>& chips,
+    const std::vector<std::string>& preferred_labels) const {
+  std::optional<size_t> found;
+  for (const auto& chip : chips) {
+    for (size_t i = 0; i < sensors_.size(); ++i) {
+      if (sensors_[i].chip != chip) {
+        continue;
+      }
+      if (std::find(preferred_labels.begin(), preferred_labels.end(),
+                    sensors_[i].label) != preferred_labels.end()) {
+        return i;
+      }
+      if (!found) {
+        found = i;
+      }
+    }
+    if (found) {
+      return found;
+    }
+  }
+  return found;
+}
+}  // namespace bbmp
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace bbmp {
+/*
+ * In-process temperature source for Linux.
+ *
+ * The temp<N>_input files of every <root>/hwmon/hwmon<N> device and the temp
+ * file of every <root>/thermal/thermal_zone<N> are discovered once in the
+ * constructor and kept open. Reading a sample is then a single pread at
+ * offset 0 per sensor, which is how sysfs attributes are meant to be re-read.
+ *
+ * The root is a parameter so that the class can be pointed at a fake sysfs
+ * tree.
+ */
+class HwmonSensors {
+ public:
+  struct Sensor {
+    // Contents of hwmon*/name, or thermal_zone*/type for thermal zones
+    std::string chip;
+    // Contents of temp*_label if present, otherwise the file name
+    std::string label;
+    int fd;
+  };
+
+  explicit HwmonSensors(const std::string& sysfs_class_root = "/sys/class");
+  ~HwmonSensors();
+
+  HwmonSensors(const HwmonSensors&) = delete;
+  HwmonSensors& operator=(const HwmonSensors&) = delete;
+
+  const std::vector<Sensor>& GetSensors() const { return sensors_; }
+
+  // Returns the temperature in degrees Celsius, or nothing if the sensor could
+  // not be read, which some drivers do while the device is powered down
+  std::optional<float> Read(size_t i_sensor) const;
+
+  // Returns the index of the first sensor whose chip is in chips. Among the
+  // sensors of a chip, the ones with a label in preferred_labels come first.
+  std::optional<size_t> Find(
+      const std::vector<std::string>& chips,
+      const std::vector<std::string>& preferred_labels = {}) const;
+
+ private:
+  std::vector<Sensor> sensors_;
+};
+}  // namespace bbmp
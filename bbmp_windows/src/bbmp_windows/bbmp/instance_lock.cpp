@@ -0,0 +1,33 @@
+#include "instance_lock.h"
+
+#include "windows_handles.h"
+
+#include <stdexcept>
+
+namespace bbmp {
+class InstanceLock::Impl {
+ public:
+  explicit Impl(const std::string& path) {
+    // No sharing, so the next process opening the file fails
+    const auto handle =
+        CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                    OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error(
+          "Locking " + path + " failed. Reason: " +
+          (GetLastError() == ERROR_SHARING_VIOLATION
+               ? std::string("another process is using the same files")
+               : GetLastErrorAsString()));
+    }
+    file_handle_ = WindowsHandle<-1>(handle);
+  }
+
+ private:
+  WindowsHandle<-1> file_handle_;
+};
+
+InstanceLock::InstanceLock(const std::string& path)
+    : impl_(std::make_unique<Impl>(path)) {}
+
+InstanceLock::~InstanceLock() = default;
+}  // namespace bbmp
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace bbmp {
+/*
+ * Exclusive ownership of a lock file for as long as the object lives, so that
+ * processes sharing files can make sure only one of them runs. The lock is
+ * released by the operating system when the process dies, so a crash doesn't
+ * leave it behind. The file itself is created if it doesn't exist, and is left
+ * in place.
+ *
+ * On Linux this is flock, on Windows the file is opened without sharing.
+ */
+class InstanceLock {
+ public:
+  // Throws std::runtime_error if another process holds the lock, or the file
+  // can't be opened
+  explicit InstanceLock(const std::string& path);
+  ~InstanceLock();
+
+  InstanceLock(const InstanceLock&) = delete;
+  InstanceLock& operator=(const InstanceLock&) = delete;
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+}  // namespace bbmp
@@ -0,0 +1,40 @@
+#include "instance_lock.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace bbmp {
+class InstanceLock::Impl {
+ public:
+  explicit Impl(const std::string& path) {
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+      throw std::runtime_error("Opening " + path +
+                               " failed. Reason: " + strerror(errno));
+    }
+    if (flock(fd_, LOCK_EX | LOCK_NB) == -1) {
+      const int error = errno;
+      close(fd_);
+      throw std::runtime_error(
+          "Locking " + path + " failed. Reason: " +
+          (error == EWOULDBLOCK ? "another process is using the same files"
+                                : strerror(error)));
+    }
+  }
+
+  ~Impl() { close(fd_); }
+
+ private:
+  int fd_;
+};
+
+InstanceLock::InstanceLock(const std::string& path)
+    : impl_(std::make_unique<Impl>(path)) {}
+
+InstanceLock::~InstanceLock() = default;
+}  // namespace bbmp
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace bbmp {
+/*
+ * HDR-style histogram of durations in nanoseconds. Every power of two is split
+ * into kSubBuckets linear buckets, so a recorded value is off by at most
+ * 1 / kSubBuckets of itself, over the whole range of uint64_t.
+ *
+ * Record is only to be called from one thread. Any thread may call Load
+ * meanwhile, it sees every bucket either before or after an update.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBucketBits = 3;
+  static constexpr uint64_t kSubBuckets = uint64_t{1} << kSubBucketBits;
+  static constexpr size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  // A copy that can be merged with others and queried
+  struct Counts {
+    std::array<uint64_t, kNumBuckets> buckets{};
+    uint64_t count = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+
+    void Merge(const Counts& other) {
+      for (size_t i = 0; i < kNumBuckets; ++i) {
+        buckets[i] += other.buckets[i];
+      }
+      count += other.count;
+      sum_ns += other.sum_ns;
+      max_ns = max_ns > other.max_ns ? max_ns : other.max_ns;
+    }
+
+    // The upper end of the bucket holding the given fraction of the values,
+    // e.g. 0.99 for p99. 0 if nothing was recorded.
+    uint64_t GetPercentile(double fraction) const {
+      const auto rank = static_cast<uint64_t>(fraction * count);
+      uint64_t seen = 0;
+      for (size_t i = 0; i < kNumBuckets; ++i) {
+        seen += buckets[i];
+        if (seen > rank) {
+          const auto upper = GetBucketEnd(i) - 1;
+          return upper < max_ns ? upper : max_ns;
+        }
+      }
+      return max_ns;
+    }
+  };
+
+  static size_t GetBucket(uint64_t ns) {
+    if (ns < kSubBuckets) {
+      return static_cast<size_t>(ns);
+    }
+    const int magnitude = 63 - CountLeadingZeros(ns);
+    const int shift = magnitude - kSubBucketBits;
+    const auto sub_bucket = (ns >> shift) & (kSubBuckets - 1);
+    return static_cast<size_t>((shift + 1) * kSubBuckets + sub_bucket);
+  }
+
+  // The first value that doesn't fall into the bucket
+  static uint64_t GetBucketEnd(size_t i) {
+    if (i < kSubBuckets) {
+      return i + 1;
+    }
+    const auto shift = static_cast<int>(i / kSubBuckets) - 1;
+    const auto sub_bucket = i % kSubBuckets;
+    return (kSubBuckets + sub_bucket + 1) << shift;
+  }
+
+  void Record(uint64_t ns) {
+    Increment(buckets_[GetBucket(ns)], 1);
+    Increment(count_, 1);
+    Increment(sum_ns_, ns);
+    if (ns > max_ns_.load(std::memory_order_relaxed)) {
+      max_ns_.store(ns, std::memory_order_relaxed);
+    }
+  }
+
+  void Load(Counts& counts) const {
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+      counts.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+    counts.count = count_.load(std::memory_order_relaxed);
+    counts.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+    counts.max_ns = max_ns_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static int CountLeadingZeros(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - static_cast<int>(index);
+#else
+    return __builtin_clzll(value);
+#endif
+  }
+
+  // Only the recording thread writes, so there is no need for a locked
+  // read-modify-write
+  static void Increment(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<uint64_t>, kNumBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_ns_{0};
+  std::atomic<uint64_t> max_ns_{0};
+};
+}  // namespace bbmp
@@ -1,5 +1,7 @@
 #include "line_reader.h"
 
+#include <stdexcept>
+
 void LineReader::ProcessLine(const char* data, size_t length) {
   line_processor_(data, length);
 }
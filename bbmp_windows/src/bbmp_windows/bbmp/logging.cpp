@@ -1,52 +1,328 @@
 #include "logging.h"
-#include <moodycamel/concurrentqueue.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+#include <vector>
 
 namespace bbmp {
 
-struct NonBlockingLogger::Impl {
-  Impl();
-  ~Impl();
+// >>> LogRecord member definitions ===========================================
+std::string LogRecord::Format() const {
+  std::string result;
+  size_t i_argument = 0;
+  char buffer[64];
+
+  for (const char* c = format; *c != '\0'; ++c) {
+    if (*c != '{' || i_argument == num_arguments) {
+      result.push_back(*c);
+      continue;
+    }
+
+    const char* end = std::strchr(c, '}');
+    if (end == nullptr) {
+      result.append(c);
+      break;
+    }
+    // Whatever follows the colon, e.g. ".1f" in {:.1f}
+    std::string_view spec(c + 1, static_cast<size_t>(end - c - 1));
+    if (!spec.empty() && spec[0] == ':') {
+      spec.remove_prefix(1);
+    }
+    c = end;
+
+    const auto& value = values[i_argument];
+    switch (types[i_argument++]) {
+      case Type::kInt:
+        std::snprintf(buffer, sizeof(buffer), "%" PRId64, value.i);
+        result.append(buffer);
+        break;
+      case Type::kUInt:
+        std::snprintf(buffer, sizeof(buffer), "%" PRIu64, value.u);
+        result.append(buffer);
+        break;
+      case Type::kDouble: {
+        char double_format[16] = "%g";
+        if (!spec.empty() && spec.size() < sizeof(double_format) - 1) {
+          double_format[0] = '%';
+          std::memcpy(double_format + 1, spec.data(), spec.size());
+          double_format[spec.size() + 1] = '\0';
+        }
+        std::snprintf(buffer, sizeof(buffer), double_format, value.d);
+        result.append(buffer);
+        break;
+      }
+      case Type::kBool:
+        result.append(value.u != 0 ? "true" : "false");
+        break;
+      case Type::kChar:
+        result.push_back(static_cast<char>(value.u));
+        break;
+      case Type::kText:
+        result.append(text + value.text.offset, value.text.size);
+        break;
+    }
+  }
+  return result;
+}
+// <<< LogRecord member definitions -------------------------------------------
+
+namespace {
+class LogRing {
+ public:
+  explicit LogRing(uint32_t thread_id) : thread_id_(thread_id) {}
+
+  uint32_t GetThreadId() const { return thread_id_; }
+
+  const char* GetThreadName() const {
+    return thread_name_.load(std::memory_order_relaxed);
+  }
+
+  void SetThreadName(const char* name) {
+    thread_name_.store(name, std::memory_order_relaxed);
+  }
+
+  // >>> Producer side ========================================================
+  LogRecord* Begin() {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == records_.size()) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &records_[tail % records_.size()];
+  }
+
+  void Commit() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
 
-  bool TryLog(LogMessage&& msg) noexcept;
+  void Abandon() { abandoned_.store(true, std::memory_order_release); }
+  // <<< ----------------------------------------------------------------------
+
+  // >>> Consumer side ========================================================
+  const LogRecord* Front() const {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &records_[head % records_.size()];
+  }
+
+  void PopFront() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  // True if the thread is gone and everything it logged was consumed
+  bool IsFinished() const {
+    return abandoned_.load(std::memory_order_acquire) && Front() == nullptr;
+  }
+  // <<< ----------------------------------------------------------------------
+
+  uint64_t GetNumDropped() const {
+    return num_dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::array<LogRecord, NonBlockingLogger::kRingCapacity> records_;
+  // Kept on separate cache lines, as they are written by different threads
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  std::atomic<uint64_t> num_dropped_{0};
+  std::atomic<bool> abandoned_{false};
+  std::atomic<const char*> thread_name_{nullptr};
+  const uint32_t thread_id_;
+};
+
+// Both trivially destructible, so they can be read from the destructors of
+// thread_local objects destroyed after ThreadExit
+thread_local LogRing* thread_ring = nullptr;
+thread_local bool thread_exited = false;
+
+// Tells the consumer when the thread exits, so its ring can be freed once it's
+// drained. The thread can't use the ring after that.
+struct ThreadExit {
+  // Set when the ring is created, which registers the destructor
+  bool has_ring = false;
+
+  ~ThreadExit() {
+    if (thread_ring != nullptr) {
+      thread_ring->Abandon();
+      thread_ring = nullptr;
+    }
+    thread_exited = true;
+  }
+};
+
+thread_local ThreadExit thread_exit;
+}  // namespace
+
+struct NonBlockingLogger::Impl {
+  LogRing* GetThreadRing() noexcept;
 
   bool TryDequeue(LogMessage& message) noexcept;
 
+  uint64_t GetNumDropped() const noexcept;
+
+  void CountDroppedAfterExit() noexcept {
+    num_dropped_after_exit_.fetch_add(1, std::memory_order_relaxed);
+  }
+
  private:
-  moodycamel::ConcurrentQueue<LogMessage> msg_queue_;
+  uint64_t CountDropped() const noexcept;
+
+  std::atomic<uint32_t> next_thread_id_{1};
+  std::atomic<uint64_t> num_dropped_after_exit_{0};
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<LogRing>> rings_;
+  // Drops of rings already freed
+  uint64_t num_dropped_by_finished_rings_ = 0;
+  uint64_t num_dropped_reported_ = 0;
 };
 
 // >>> NonBlockingLogger::Impl member definitions =============================
-NonBlockingLogger::Impl::Impl() : msg_queue_(500) {}
+// nullptr once the thread is exiting, its ring may already be freed
+LogRing* NonBlockingLogger::Impl::GetThreadRing() noexcept {
+  if (thread_exited) {
+    return nullptr;
+  }
+  if (thread_ring == nullptr) {
+    try {
+      auto ring = std::make_unique<LogRing>(next_thread_id_++);
+      auto* ring_pointer = ring.get();
+      auto lock = std::lock_guard(mutex_);
+      rings_.push_back(std::move(ring));
+      thread_ring = ring_pointer;
+      thread_exit.has_ring = true;
+    } catch (...) {
+      return nullptr;
+    }
+  }
+  return thread_ring;
+}
+
+bool NonBlockingLogger::Impl::TryDequeue(LogMessage& message) noexcept {
+  try {
+    auto lock = std::lock_guard(mutex_);
 
-NonBlockingLogger::Impl::~Impl() = default;
+    const auto num_dropped = CountDropped();
+    if (num_dropped != num_dropped_reported_) {
+      message = LogMessage(std::to_string(num_dropped - num_dropped_reported_) +
+                           " log messages were dropped");
+      message.level = LogLevel::kWarning;
+      message.timestamp_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now().time_since_epoch())
+              .count();
+      num_dropped_reported_ = num_dropped;
+      return true;
+    }
 
-bool NonBlockingLogger::Impl::TryLog(LogMessage&& msg) noexcept {
-  return msg_queue_.try_enqueue(std::move(msg));
+    // Merges the rings in timestamp order
+    LogRing* oldest = nullptr;
+    for (auto it = rings_.begin(); it != rings_.end();) {
+      auto& ring = *it;
+      if (ring->IsFinished()) {
+        num_dropped_by_finished_rings_ += ring->GetNumDropped();
+        it = rings_.erase(it);
+        continue;
+      }
+      const auto* front = ring->Front();
+      if (front != nullptr &&
+          (oldest == nullptr ||
+           front->timestamp_ns < oldest->Front()->timestamp_ns)) {
+        oldest = ring.get();
+      }
+      ++it;
+    }
+
+    if (oldest == nullptr) {
+      return false;
+    }
+    const auto& record = *oldest->Front();
+    message = LogMessage(record.Format());
+    message.level = record.level;
+    message.thread_id = record.thread_id;
+    message.thread_name = oldest->GetThreadName();
+    message.timestamp_ns = record.timestamp_ns;
+    oldest->PopFront();
+    return true;
+  } catch (...) {
+    return false;
+  }
 }
 
-bool NonBlockingLogger::Impl::TryDequeue(LogMessage& message) noexcept {
-  return msg_queue_.try_dequeue(message);
+uint64_t NonBlockingLogger::Impl::GetNumDropped() const noexcept {
+  auto lock = std::lock_guard(mutex_);
+  return CountDropped();
 }
 
-NonBlockingLogger& NonBlockingLogger::GetInstance() noexcept {
-  static NonBlockingLogger instance;
-  return instance;
+// Must be called with mutex_ held
+uint64_t NonBlockingLogger::Impl::CountDropped() const noexcept {
+  auto num_dropped = num_dropped_by_finished_rings_ +
+                     num_dropped_after_exit_.load(std::memory_order_relaxed);
+  for (const auto& ring : rings_) {
+    num_dropped += ring->GetNumDropped();
+  }
+  return num_dropped;
 }
 // <<< NonBlockingLogger::Impl member definitions -----------------------------
 
 // >>> NonBlockingLogger member definitions ===================================
 NonBlockingLogger::NonBlockingLogger() : impl_(std::make_unique<Impl>()) {}
 
-bool NonBlockingLogger::TryLog(LogMessage&& msg) noexcept {
-  return impl_->TryLog(std::move(msg));
+NonBlockingLogger::~NonBlockingLogger() = default;
+
+// Never destroyed. Threads may log, and their thread_local ThreadExit abandon
+// the rings the logger owns, while or after static objects are destroyed.
+NonBlockingLogger& NonBlockingLogger::GetInstance() noexcept {
+  static auto* instance = new NonBlockingLogger();
+  return *instance;
+}
+
+LogRecord* NonBlockingLogger::BeginRecord(LogLevel level,
+                                          const char* format) noexcept {
+  auto* ring = impl_->GetThreadRing();
+  if (ring == nullptr) {
+    if (thread_exited) {
+      impl_->CountDroppedAfterExit();
+    }
+    return nullptr;
+  }
+
+  auto* record = ring->Begin();
+  if (record != nullptr) {
+    record->timestamp_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    record->format = format;
+    record->level = level;
+    record->thread_id = ring->GetThreadId();
+    record->num_arguments = 0;
+    record->text_size = 0;
+  }
+  return record;
+}
+
+void NonBlockingLogger::CommitRecord() noexcept { thread_ring->Commit(); }
+
+void NonBlockingLogger::SetThreadName(const char* name) noexcept {
+  if (auto* ring = impl_->GetThreadRing()) {
+    ring->SetThreadName(name);
+  }
 }
 
 bool NonBlockingLogger::TryDequeue(LogMessage& message) noexcept {
   return impl_->TryDequeue(message);
 }
-// <<< NonBlockingLogger member definitions -----------------------------------
 
-void Log(LogMessage&& message) {
-  NonBlockingLogger::GetInstance().TryLog(std::move(message));
+uint64_t NonBlockingLogger::GetNumDropped() const noexcept {
+  return impl_->GetNumDropped();
 }
+// <<< NonBlockingLogger member definitions -----------------------------------
 }  // namespace bbmp
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 
 namespace bbmp {
+enum class LogLevel : uint8_t { kDebug, kInfo, kWarning, kError };
+
 struct LogMessage {
   LogMessage() : message(nullptr) {}
 
@@ -17,24 +25,157 @@ struct LogMessage {
 
   std::string const* message;
   std::unique_ptr<std::string> heap_message;
+  LogLevel level = LogLevel::kInfo;
+  // Threads are numbered from 1 in the order they first log
+  uint32_t thread_id = 0;
+  // Set with NonBlockingLogger::SetThreadName, or nullptr
+  const char* thread_name = nullptr;
+  int64_t timestamp_ns = 0;
 };
 
-// All public functions are thread safe, non blocking, non allocating
+// A log call as it is stored by the producer. Formatting is left to the
+// consumer, the producer only copies the arguments.
+struct LogRecord {
+  static constexpr size_t kMaxArguments = 8;
+  static constexpr size_t kTextSize = 160;
+
+  enum class Type : uint8_t { kInt, kUInt, kDouble, kBool, kChar, kText };
+
+  struct Text {
+    uint16_t offset;
+    uint16_t size;
+  };
+
+  union Value {
+    int64_t i;
+    uint64_t u;
+    double d;
+    Text text;
+  };
+
+  int64_t timestamp_ns;
+  // Points to a string literal, so it stays valid until the consumer gets to
+  // the record
+  const char* format;
+  uint32_t thread_id;
+  uint8_t num_arguments;
+  LogLevel level;
+  uint16_t text_size;
+  Type types[kMaxArguments];
+  Value values[kMaxArguments];
+  // Contents of the string arguments, truncated if they don't fit
+  char text[kTextSize];
+
+  void AddArgument(int64_t value) { Add(Type::kInt).i = value; }
+  void AddArgument(uint64_t value) { Add(Type::kUInt).u = value; }
+  void AddArgument(double value) { Add(Type::kDouble).d = value; }
+  void AddArgument(bool value) { Add(Type::kBool).u = value; }
+  void AddArgument(char value) { Add(Type::kChar).u = value; }
+  void AddArgument(std::string_view value) {
+    const auto size = std::min(value.size(), kTextSize - text_size);
+    std::memcpy(text + text_size, value.data(), size);
+    Add(Type::kText).text = {text_size, static_cast<uint16_t>(size)};
+    text_size += static_cast<uint16_t>(size);
+  }
+
+  // Replaces every {} in format with the next argument. A format
+  // specification for doubles is passed on to snprintf, e.g. {:.1f}.
+  std::string Format() const;
+
+ private:
+  Value& Add(Type type) {
+    types[num_arguments] = type;
+    return values[num_arguments++];
+  }
+};
+
+// Four records per kilobyte
+static_assert(sizeof(LogRecord) == 256);
+
+/*
+ * Every thread that logs gets its own single producer single consumer ring of
+ * LogRecords, allocated the first time it logs. After that logging neither
+ * allocates nor blocks: a record is filled in place and published with a
+ * single store. When a ring is full the record is dropped and counted.
+ *
+ * The consumer merges the rings in timestamp order and formats the records.
+ *
+ * The instance lives until the process ends, so logging is safe from the
+ * destructors of static and thread_local objects. Records a thread logs after
+ * its ring was abandoned on exit are dropped and counted.
+ */
 struct NonBlockingLogger {
  private:
   NonBlockingLogger();
 
  public:
+  static constexpr size_t kRingCapacity = 256;
+
   static NonBlockingLogger& GetInstance() noexcept;
 
-  bool TryLog(LogMessage&& message) noexcept;
+  ~NonBlockingLogger();
+
+  // Thread safe, non blocking, non allocating except for the first call on a
+  // thread. Returns a record to fill, or nullptr if the ring of this thread is
+  // full or the thread is exiting.
+  LogRecord* BeginRecord(LogLevel level, const char* format) noexcept;
+
+  void CommitRecord() noexcept;
 
+  // Names the calling thread in the messages it logs. name has to be a string
+  // literal.
+  void SetThreadName(const char* name) noexcept;
+
+  // Formats the oldest record, or reports dropped records. Can be called from
+  // any thread, calls are serialized.
   bool TryDequeue(LogMessage& message) noexcept;
 
+  // Number of records dropped because of full rings or exiting threads since
+  // the start
+  uint64_t GetNumDropped() const noexcept;
+
  private:
   struct Impl;
   std::unique_ptr<Impl> impl_;
 };
 
-void Log(LogMessage&& message);
+namespace logging_detail {
+template <typename T>
+void AddArgument(LogRecord& record, const T& value) {
+  if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, char>) {
+    record.AddArgument(value);
+  } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+    if constexpr (std::is_signed_v<T>) {
+      record.AddArgument(static_cast<int64_t>(value));
+    } else {
+      record.AddArgument(static_cast<uint64_t>(value));
+    }
+  } else if constexpr (std::is_floating_point_v<T>) {
+    record.AddArgument(static_cast<double>(value));
+  } else {
+    static_assert(std::is_convertible_v<const T&, std::string_view>,
+                  "Unsupported log argument type");
+    record.AddArgument(std::string_view(value));
+  }
+}
+}  // namespace logging_detail
+
+// format has to be a string literal with a {} for each argument. Arguments
+// can be numbers, bools, chars and strings, strings are copied.
+template <size_t N, typename... Args>
+void Log(LogLevel level, const char (&format)[N],
+         const Args&... args) noexcept {
+  static_assert(sizeof...(Args) <= LogRecord::kMaxArguments,
+                "Too many log arguments");
+  auto& logger = NonBlockingLogger::GetInstance();
+  if (auto* record = logger.BeginRecord(level, format)) {
+    (logging_detail::AddArgument(*record, args), ...);
+    logger.CommitRecord();
+  }
+}
+
+template <size_t N, typename... Args>
+void Log(const char (&format)[N], const Args&... args) noexcept {
+  Log(LogLevel::kInfo, format, args...);
+}
 }  // namespace bbmp
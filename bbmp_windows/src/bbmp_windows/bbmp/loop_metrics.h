@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+
+namespace bbmp {
+/*
+ * Counts how often an event loop wakes up and how late its periodic ticks run
+ * compared to their deadlines. Only to be used from the loop's own thread.
+ */
+class LoopMetrics {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit LoopMetrics(Clock::duration report_interval)
+      : report_interval_(report_interval), interval_start_(Clock::now()) {}
+
+  void OnWakeup() { ++num_wakeups_; }
+
+  void OnTick(Clock::time_point deadline) {
+    const auto lateness = std::max(Clock::now() - deadline, Clock::duration{});
+    ++num_ticks_;
+    sum_lateness_ += lateness;
+    max_lateness_ = std::max(max_lateness_, lateness);
+  }
+
+  // Once every report interval returns a summary of the interval, e.g.
+  // "1.00 wakeups/s, 1.00 ticks/s, tick jitter: mean 0.06 ms, max 0.21 ms"
+  std::optional<std::string> TakeReport() {
+    const auto now = Clock::now();
+    const auto elapsed = now - interval_start_;
+    if (elapsed < report_interval_) {
+      return std::nullopt;
+    }
+
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    const auto seconds = std::chrono::duration<double>(elapsed).count();
+    const auto mean_lateness_ms =
+        num_ticks_ > 0 ? Milliseconds(sum_lateness_).count() / num_ticks_ : 0.0;
+
+    char report[128];
+    snprintf(report, sizeof(report),
+             "%.2f wakeups/s, %.2f ticks/s, tick jitter: mean %.2f ms, max "
+             "%.2f ms",
+             num_wakeups_ / seconds, num_ticks_ / seconds, mean_lateness_ms,
+             Milliseconds(max_lateness_).count());
+
+    interval_start_ = now;
+    num_wakeups_ = 0;
+    num_ticks_ = 0;
+    sum_lateness_ = {};
+    max_lateness_ = {};
+    return std::string(report);
+  }
+
+ private:
+  Clock::duration report_interval_;
+  Clock::time_point interval_start_;
+  uint64_t num_wakeups_ = 0;
+  uint64_t num_ticks_ = 0;
+  Clock::duration sum_lateness_{};
+  Clock::duration max_lateness_{};
+};
+}  // namespace bbmp
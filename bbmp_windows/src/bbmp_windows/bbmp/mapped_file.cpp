@@ -0,0 +1,79 @@
+#include "mapped_file.h"
+
+#include "windows_handles.h"
+
+#include <stdexcept>
+
+namespace bbmp {
+class MappedFile::Impl {
+ public:
+  Impl(const std::string& path, size_t size) : size_(size) {
+    try {
+      file_handle_ = WindowsHandle<-1>(
+          CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                      FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                      FILE_ATTRIBUTE_NORMAL, nullptr));
+    } catch (std::runtime_error&) {
+      Throw("Opening " + path);
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle_.Get(), &file_size)) {
+      Throw("GetFileSizeEx of " + path);
+    }
+    if (static_cast<size_t>(file_size.QuadPart) != size) {
+      LARGE_INTEGER new_size;
+      new_size.QuadPart = static_cast<LONGLONG>(size);
+      if (!SetFilePointerEx(file_handle_.Get(), new_size, nullptr,
+                            FILE_BEGIN) ||
+          !SetEndOfFile(file_handle_.Get())) {
+        Throw("Resizing " + path);
+      }
+    }
+
+    try {
+      mapping_handle_ = WindowsHandle<0>(CreateFileMappingA(
+          file_handle_.Get(), nullptr, PAGE_READWRITE, 0, 0, nullptr));
+    } catch (std::runtime_error&) {
+      Throw("CreateFileMapping of " + path);
+    }
+
+    data_ = static_cast<uint8_t*>(
+        MapViewOfFile(mapping_handle_.Get(), FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (data_ == nullptr) {
+      Throw("MapViewOfFile of " + path);
+    }
+  }
+
+  ~Impl() { UnmapViewOfFile(data_); }
+
+  uint8_t* GetData() const { return data_; }
+  size_t GetSize() const { return size_; }
+
+  void Flush() { FlushViewOfFile(data_, size_); }
+
+ private:
+  [[noreturn]] static void Throw(const std::string& what) {
+    throw std::runtime_error(what + " failed. Reason: " +
+                             GetLastErrorAsString());
+  }
+
+  WindowsHandle<-1> file_handle_;
+  WindowsHandle<0> mapping_handle_;
+  uint8_t* data_;
+  size_t size_;
+};
+
+MappedFile::MappedFile(const std::string& path, size_t size)
+    : impl_(std::make_unique<Impl>(path, size)) {}
+
+MappedFile::~MappedFile() = default;
+
+uint8_t* MappedFile::GetData() { return impl_->GetData(); }
+
+const uint8_t* MappedFile::GetData() const { return impl_->GetData(); }
+
+size_t MappedFile::GetSize() const { return impl_->GetSize(); }
+
+void MappedFile::Flush() { impl_->Flush(); }
+}  // namespace bbmp
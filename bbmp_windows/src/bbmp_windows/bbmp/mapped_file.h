@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace bbmp {
+/*
+ * A file mapped into memory for reading and writing. Changes go to the file
+ * through the page cache, so they survive the process crashing. The file is
+ * created if it doesn't exist, and resized to size if it's smaller or larger.
+ */
+class MappedFile {
+ public:
+  MappedFile(const std::string& path, size_t size);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  uint8_t* GetData();
+  const uint8_t* GetData() const;
+  size_t GetSize() const;
+
+  // Schedules writing the dirty pages to the disk without waiting for it
+  void Flush();
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+}  // namespace bbmp
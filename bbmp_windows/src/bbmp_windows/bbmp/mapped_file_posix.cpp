@@ -0,0 +1,74 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace bbmp {
+class MappedFile::Impl {
+ public:
+  Impl(const std::string& path, size_t size) : size_(size) {
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+      Throw("Opening " + path);
+    }
+
+    struct stat file_stat;
+    if (fstat(fd_, &file_stat) == -1 ||
+        (static_cast<size_t>(file_stat.st_size) != size &&
+         ftruncate(fd_, static_cast<off_t>(size)) == -1)) {
+      const int error = errno;
+      close(fd_);
+      errno = error;
+      Throw("Resizing " + path);
+    }
+
+    void* data =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) {
+      const int error = errno;
+      close(fd_);
+      errno = error;
+      Throw("Mapping " + path);
+    }
+    data_ = static_cast<uint8_t*>(data);
+  }
+
+  ~Impl() {
+    munmap(data_, size_);
+    close(fd_);
+  }
+
+  uint8_t* GetData() const { return data_; }
+  size_t GetSize() const { return size_; }
+
+  void Flush() { msync(data_, size_, MS_ASYNC); }
+
+ private:
+  [[noreturn]] static void Throw(const std::string& what) {
+    throw std::runtime_error(what + " failed. Reason: " + strerror(errno));
+  }
+
+  int fd_;
+  uint8_t* data_;
+  size_t size_;
+};
+
+MappedFile::MappedFile(const std::string& path, size_t size)
+    : impl_(std::make_unique<Impl>(path, size)) {}
+
+MappedFile::~MappedFile() = default;
+
+uint8_t* MappedFile::GetData() { return impl_->GetData(); }
+
+const uint8_t* MappedFile::GetData() const { return impl_->GetData(); }
+
+size_t MappedFile::GetSize() const { return impl_->GetSize(); }
+
+void MappedFile::Flush() { impl_->Flush(); }
+}  // namespace bbmp
@@ -0,0 +1,66 @@
+#include "periodic_timer.h"
+
+#include "windows_handles.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace bbmp {
+// The completion routine of a waitable timer is queued as an APC to the thread
+// that set the timer, and runs when that thread enters an alertable SleepEx.
+class PeriodicTimer::Impl {
+ public:
+  explicit Impl(PeriodicTimer& owner) : owner_(owner) {
+    try {
+      timer_handle_ =
+          WindowsHandle<0>(CreateWaitableTimer(nullptr, FALSE, nullptr));
+    } catch (std::runtime_error&) {
+      throw std::runtime_error("CreateWaitableTimer failed. Reason: " +
+                               GetLastErrorAsString());
+    }
+  }
+
+  // Also removes an APC that is already queued
+  ~Impl() { CancelWaitableTimer(timer_handle_.Get()); }
+
+  void Start(Clock::time_point first_deadline, std::chrono::milliseconds period) {
+    // Negative due times are relative, in 100 ns units
+    const auto due_in = std::chrono::duration_cast<std::chrono::microseconds>(
+        first_deadline - Clock::now());
+    LARGE_INTEGER due_time;
+    due_time.QuadPart = -10 * std::max<long long>(due_in.count(), 1);
+    if (!SetWaitableTimer(timer_handle_.Get(), &due_time,
+                          static_cast<LONG>(period.count()), TimerCallback,
+                          this, FALSE)) {
+      throw std::runtime_error("SetWaitableTimer failed. Reason: " +
+                               GetLastErrorAsString());
+    }
+  }
+
+ private:
+  static VOID CALLBACK TimerCallback(LPVOID arg, DWORD, DWORD) {
+    static_cast<Impl*>(arg)->owner_.OnExpired();
+  }
+
+  PeriodicTimer& owner_;
+  WindowsHandle<0> timer_handle_;
+};
+
+PeriodicTimer::PeriodicTimer(
+    std::chrono::milliseconds period,
+    std::function<void(Clock::time_point deadline)> on_tick)
+    : period_(period),
+      on_tick_(std::move(on_tick)),
+      impl_(std::make_unique<Impl>(*this)) {
+  Restart();
+}
+
+PeriodicTimer::~PeriodicTimer() = default;
+
+void PeriodicTimer::Restart() {
+  start_ = Clock::now();
+  last_index_ = 0;
+  impl_->Start(start_ + period_, period_);
+}
+}  // namespace bbmp
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace bbmp {
+/*
+ * Calls on_tick at the absolute deadlines start + n * period. The callback runs
+ * inside Serial::WindowsSleepEx on the thread that created the timer, just like
+ * the completion routines of Serial, so a loop can sleep until whichever comes
+ * first: serial IO or the next tick.
+ *
+ * Deadlines don't drift with the time spent in the loop. If the thread wasn't
+ * waiting when one or more deadlines passed, only the last of them is
+ * delivered.
+ */
+class PeriodicTimer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // on_tick receives the deadline it was scheduled for
+  PeriodicTimer(std::chrono::milliseconds period,
+                std::function<void(Clock::time_point deadline)> on_tick);
+  ~PeriodicTimer();
+
+  PeriodicTimer(const PeriodicTimer&) = delete;
+  PeriodicTimer& operator=(const PeriodicTimer&) = delete;
+
+  // The next deadline will be one period from now
+  void Restart();
+
+  std::chrono::milliseconds GetPeriod() const { return period_; }
+
+ private:
+  class Impl;
+
+  void OnExpired() {
+    const auto now = Clock::now();
+    // Coarse OS timers may fire a hair before the deadline
+    auto index = static_cast<int64_t>((now - start_) / period_);
+    if (index <= last_index_) {
+      index = last_index_ + 1;
+    }
+    last_index_ = index;
+    on_tick_(start_ + index * period_);
+  }
+
+  std::chrono::milliseconds period_;
+  std::function<void(Clock::time_point)> on_tick_;
+  Clock::time_point start_;
+  int64_t last_index_ = 0;
+  std::unique_ptr<Impl> impl_;
+};
+}  // namespace bbmp
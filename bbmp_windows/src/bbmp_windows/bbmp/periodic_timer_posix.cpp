@@ -0,0 +1,87 @@
+#include "periodic_timer.h"
+
+#include "alertable_wait.h"
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace bbmp {
+namespace {
+timespec ToTimespec(std::chrono::nanoseconds duration) {
+  timespec result;
+  result.tv_sec = static_cast<time_t>(duration.count() / 1000000000);
+  result.tv_nsec = static_cast<long>(duration.count() % 1000000000);
+  return result;
+}
+}  // namespace
+
+// steady_clock is CLOCK_MONOTONIC, so its time points can be handed to the
+// timerfd as absolute deadlines
+class PeriodicTimer::Impl : public AlertableWait::Handler {
+ public:
+  explicit Impl(PeriodicTimer& owner)
+      : owner_(owner),
+        timer_fd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) {
+    if (timer_fd_ == -1) {
+      throw std::runtime_error(std::string("timerfd_create failed. Reason: ") +
+                               strerror(errno));
+    }
+    try {
+      AlertableWait::ForThisThread().Arm(timer_fd_, EPOLLIN, this);
+    } catch (...) {
+      close(timer_fd_);
+      throw;
+    }
+  }
+
+  ~Impl() {
+    AlertableWait::ForThisThread().Disarm(timer_fd_);
+    close(timer_fd_);
+  }
+
+  void Start(Clock::time_point first_deadline, std::chrono::milliseconds period) {
+    itimerspec spec{};
+    spec.it_value = ToTimespec(first_deadline.time_since_epoch());
+    spec.it_interval = ToTimespec(period);
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+      throw std::runtime_error(std::string("timerfd_settime failed. Reason: ") +
+                               strerror(errno));
+    }
+  }
+
+  void OnReady(uint32_t) override {
+    uint64_t num_expirations;
+    if (read(timer_fd_, &num_expirations, sizeof(num_expirations)) ==
+        sizeof(num_expirations)) {
+      owner_.OnExpired();
+    }
+  }
+
+ private:
+  PeriodicTimer& owner_;
+  int timer_fd_;
+};
+
+PeriodicTimer::PeriodicTimer(
+    std::chrono::milliseconds period,
+    std::function<void(Clock::time_point deadline)> on_tick)
+    : period_(period),
+      on_tick_(std::move(on_tick)),
+      impl_(std::make_unique<Impl>(*this)) {
+  Restart();
+}
+
+PeriodicTimer::~PeriodicTimer() = default;
+
+void PeriodicTimer::Restart() {
+  start_ = Clock::now();
+  last_index_ = 0;
+  impl_->Start(start_ + period_, period_);
+}
+}  // namespace bbmp
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace bbmp {
+/*
+ * Holds an immutable, versioned value that is replaced as a whole.
+ *
+ * Readers get a Snapshot without locking or allocating. A snapshot keeps
+ * pointing to the same value for as long as it's alive, however many times the
+ * value is replaced in the meantime.
+ *
+ * Writers copy the current value, modify the copy and swap it in with a single
+ * atomic exchange. Writers are serialized with a mutex, and they are the ones
+ * freeing the replaced values. A value is freed once no hazard slot points to
+ * it, i.e. no snapshot of it is alive anymore.
+ *
+ * There are kNumHazardSlots slots, which limits the number of snapshots alive
+ * at the same time. Read() spins while all of them are taken, and throws if
+ * the calling thread holds all of them itself, since none would ever be freed.
+ */
+template <typename T>
+class RcuCell {
+ public:
+  static constexpr size_t kNumHazardSlots = 16;
+
+ private:
+  struct Node {
+    template <typename... Args>
+    Node(uint64_t v, Args&&... args)
+        : value(std::forward<Args>(args)...), version(v) {}
+
+    const T value;
+    const uint64_t version;
+  };
+
+  struct alignas(64) HazardSlot {
+    std::atomic<bool> in_use{false};
+    std::atomic<const Node*> node{nullptr};
+    // The thread that claimed the slot. Only compared with the calling
+    // thread's own ID, so relaxed is enough.
+    std::atomic<std::thread::id> owner{};
+  };
+
+ public:
+  class Snapshot {
+   public:
+    Snapshot(Snapshot&& other) noexcept
+        : slot_(std::exchange(other.slot_, nullptr)), node_(other.node_) {}
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    Snapshot& operator=(Snapshot&&) = delete;
+
+    ~Snapshot() {
+      if (slot_ != nullptr) {
+        slot_->node.store(nullptr, std::memory_order_release);
+        slot_->owner.store(std::thread::id(), std::memory_order_relaxed);
+        slot_->in_use.store(false, std::memory_order_release);
+      }
+    }
+
+    const T& operator*() const { return node_->value; }
+    const T* operator->() const { return &node_->value; }
+
+    // Starts at 1 and is incremented by every Publish and Update
+    uint64_t GetVersion() const { return node_->version; }
+
+   private:
+    friend class RcuCell;
+
+    Snapshot(HazardSlot* slot, const Node* node) : slot_(slot), node_(node) {}
+
+    HazardSlot* slot_;
+    const Node* node_;
+  };
+
+  template <typename... Args>
+  explicit RcuCell(Args&&... args)
+      : current_(new Node(1, std::forward<Args>(args)...)) {}
+
+  RcuCell(const RcuCell&) = delete;
+  RcuCell& operator=(const RcuCell&) = delete;
+
+  // There must be no snapshots left at this point
+  ~RcuCell() {
+    delete current_.load(std::memory_order_relaxed);
+    for (auto* node : retired_) {
+      delete node;
+    }
+  }
+
+  Snapshot Read() const {
+    HazardSlot* slot = ClaimSlot();
+
+    // Announce the node we are about to use, then make sure it's still the
+    // current one. If it is, no writer can free it from now on.
+    const Node* node = current_.load(std::memory_order_acquire);
+    for (;;) {
+      slot->node.store(node, std::memory_order_seq_cst);
+      const Node* now_current = current_.load(std::memory_order_seq_cst);
+      if (now_current == node) {
+        break;
+      }
+      node = now_current;
+    }
+
+    return Snapshot(slot, node);
+  }
+
+  uint64_t GetVersion() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  void Publish(T value) {
+    auto lock = std::lock_guard(writer_mutex_);
+    Swap(new Node(version_.load(std::memory_order_relaxed) + 1,
+                  std::move(value)));
+  }
+
+  // Applies modifier to a copy of the current value and publishes the result
+  template <typename Modifier>
+  void Update(Modifier&& modifier) {
+    auto lock = std::lock_guard(writer_mutex_);
+    // Only writers retire nodes, so the current one can't go away while we
+    // hold the lock
+    T value = current_.load(std::memory_order_acquire)->value;
+    modifier(value);
+    Swap(new Node(version_.load(std::memory_order_relaxed) + 1,
+                  std::move(value)));
+  }
+
+ private:
+  HazardSlot* ClaimSlot() const {
+    const auto this_thread = std::this_thread::get_id();
+    for (;;) {
+      size_t num_own = 0;
+      for (auto& slot : hazard_slots_) {
+        if (!slot.in_use.load(std::memory_order_relaxed) &&
+            !slot.in_use.exchange(true, std::memory_order_acquire)) {
+          slot.owner.store(this_thread, std::memory_order_relaxed);
+          return &slot;
+        }
+        if (slot.owner.load(std::memory_order_relaxed) == this_thread) {
+          ++num_own;
+        }
+      }
+
+      if (num_own == kNumHazardSlots) {
+        throw std::runtime_error(
+            "RcuCell::Read failed. Reason: the calling thread holds all "
+            "snapshots");
+      }
+    }
+  }
+
+  // Must be called with writer_mutex_ held
+  void Swap(Node* node) {
+    retired_.push_back(current_.exchange(node, std::memory_order_seq_cst));
+    version_.store(node->version, std::memory_order_release);
+
+    std::array<const Node*, kNumHazardSlots> hazards;
+    for (size_t i = 0; i < kNumHazardSlots; ++i) {
+      hazards[i] = hazard_slots_[i].node.load(std::memory_order_seq_cst);
+    }
+
+    auto is_hazard = [&hazards](const Node* node) {
+      for (auto* hazard : hazards) {
+        if (hazard == node) {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    size_t num_kept = 0;
+    for (auto* retired : retired_) {
+      if (is_hazard(retired)) {
+        retired_[num_kept++] = retired;
+      } else {
+        delete retired;
+      }
+    }
+    retired_.resize(num_kept);
+  }
+
+  std::atomic<Node*> current_;
+  std::atomic<uint64_t> version_{1};
+  mutable std::array<HazardSlot, kNumHazardSlots> hazard_slots_;
+
+  std::mutex writer_mutex_;
+  std::vector<Node*> retired_;
+};
+}  // namespace bbmp
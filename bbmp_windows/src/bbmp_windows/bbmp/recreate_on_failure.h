@@ -19,8 +19,7 @@ class RecreateOnFailure {
     try {
       action(*instance_);
     } catch (std::runtime_error& error) {
-      bbmp::NonBlockingLogger::GetInstance().TryLog(
-          {nullptr, std::make_unique<std::string>(error.what())});
+      bbmp::Log(bbmp::LogLevel::kError, "{}", error.what());
       recreate = true;
     }
 
@@ -32,8 +31,7 @@ class RecreateOnFailure {
           instance_ = instantiate_();
           create_success = true;
         } catch (std::runtime_error& error) {
-          bbmp::NonBlockingLogger::GetInstance().TryLog(
-              {nullptr, std::make_unique<std::string>(error.what())});
+          bbmp::Log(bbmp::LogLevel::kError, "{}", error.what());
           std::this_thread::sleep_for(std::chrono::milliseconds(50));
         }
       }
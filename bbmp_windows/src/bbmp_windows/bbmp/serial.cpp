@@ -221,6 +221,15 @@ std::vector<std::string> GetComPortNames() {
   return port_names;
 }
 
+// The USB IDs would need SetupAPI, so none are reported here
+std::vector<ComPort> GetComPorts() {
+  std::vector<ComPort> ports;
+  for (auto& port_name : GetComPortNames()) {
+    ports.push_back({std::move(port_name)});
+  }
+  return ports;
+}
+
 void Serial::WindowsSleepEx(uint32_t timeout_milliseconds, bool alertable) {
   SleepEx(timeout_milliseconds, alertable);
 }
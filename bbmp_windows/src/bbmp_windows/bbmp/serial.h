@@ -11,8 +11,14 @@ class Serial {
  public:
   static void WindowsSleepEx(uint32_t timeout_milliseconds, bool alertable);
 
+  // read_callback runs inside WindowsSleepEx on the thread that issued the
+  // read
   Serial(const char* port_name,
          std::function<void(const char*, size_t)> read_callback);
+
+  // Must run on the thread that issued operations, if any were issued. Their
+  // completions are queued to that thread, on Windows as APCs and on POSIX in
+  // its AlertableWait, which isn't synchronized.
   ~Serial();
 
   void IssueRead();
@@ -28,4 +34,15 @@ class Serial {
 };
 
 std::vector<std::string> GetComPortNames();
+
+struct ComPort {
+  std::string name;
+  // Both 0 if the port is not a USB device, or its IDs are unknown
+  uint16_t usb_vendor_id = 0;
+  uint16_t usb_product_id = 0;
+};
+
+// The ports of GetComPortNames, with the IDs of the USB devices behind them
+// where they are available
+std::vector<ComPort> GetComPorts();
 }  // namespace bbmp
@@ -0,0 +1,317 @@
+#include "serial.h"
+
+#include "alertable_wait.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+void ThrowOnFailure(bool success, const char* error_msg) {
+  if (!success) {
+    throw std::runtime_error(error_msg + std::string(" Reason: ") +
+                             strerror(errno));
+  }
+}
+}  // namespace
+
+namespace bbmp {
+class Serial::Impl : private AlertableWait::Handler {
+ public:
+  Impl(const char* port_name,
+       std::function<void(const char*, size_t)> read_callback)
+      : read_callback_(std::move(read_callback)),
+        read_buffer_(1024),
+        read_issued_(false),
+        write_buffer_(1024),
+        write_offset_(0),
+        write_length_(0),
+        write_issued_(false) {
+    port_fd_ = open(port_name, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (port_fd_ == -1) {
+      throw std::runtime_error("Failed opening port " + std::string(port_name) +
+                               ". Reason: " + strerror(errno));
+    }
+
+    try {
+      // Equivalent of the zero share mode passed to CreateFile
+      ThrowOnFailure(ioctl(port_fd_, TIOCEXCL) == 0, "TIOCEXCL failed");
+
+      termios tty;
+      ThrowOnFailure(tcgetattr(port_fd_, &tty) == 0, "tcgetattr failed");
+      cfmakeraw(&tty);
+      cfsetispeed(&tty, B19200);
+      cfsetospeed(&tty, B19200);
+      tty.c_cflag &= ~(PARENB | CSTOPB | CSIZE);
+      tty.c_cflag |= CS8 | CLOCAL | CREAD;
+      // Reads never block, readiness is signalled through epoll
+      tty.c_cc[VMIN] = 0;
+      tty.c_cc[VTIME] = 0;
+      ThrowOnFailure(tcsetattr(port_fd_, TCSANOW, &tty) == 0,
+                     "tcsetattr failed");
+    } catch (...) {
+      close(port_fd_);
+      throw;
+    }
+  }
+
+  // The wait and its handlers belong to the thread that issued the first
+  // operation, see Serial::~Serial
+  ~Impl() {
+    if (alertable_wait_ != nullptr) {
+      assert(owner_ == std::this_thread::get_id());
+      alertable_wait_->Disarm(port_fd_);
+    }
+    close(port_fd_);
+  }
+
+  void IssueRead() {
+    auto lock = std::lock_guard(read_mutex_);
+    ThrowIfFailed();
+    if (read_issued_) {
+      return;
+    }
+    read_issued_ = true;
+    UpdateInterest();
+  }
+
+  bool TryIssueWrite(const char* data, size_t length) {
+    if (length > write_buffer_.size()) {
+      throw std::runtime_error("IssueWrite: data larger than buffer");
+    }
+    auto lock = std::lock_guard(write_mutex_);
+    ThrowIfFailed();
+    if (write_issued_) {
+      return false;
+    }
+
+    std::copy(data, data + length, write_buffer_.data());
+    write_offset_ = 0;
+    write_length_ = length;
+    write_issued_ = true;
+
+    // Most writes fit into the kernel buffer right away, in which case no
+    // completion needs to be waited for
+    ContinueWrite();
+    if (write_issued_) {
+      UpdateInterest();
+    }
+    return true;
+  }
+
+ private:
+  std::function<void(const char*, size_t)> read_callback_;
+  int port_fd_;
+  AlertableWait* alertable_wait_ = nullptr;
+  std::thread::id owner_;
+  std::vector<char> read_buffer_;
+  bool read_issued_;
+  std::recursive_mutex read_mutex_;
+  std::vector<char> write_buffer_;
+  size_t write_offset_;
+  size_t write_length_;
+  bool write_issued_;
+  std::recursive_mutex write_mutex_;
+  bool failed_ = false;
+  std::string failure_reason_;
+
+  void ThrowIfFailed() {
+    if (failed_) {
+      throw std::runtime_error("Serial port failed. Reason: " +
+                               failure_reason_);
+    }
+  }
+
+  void Fail(const char* reason) {
+    failed_ = true;
+    failure_reason_ = reason;
+    read_issued_ = false;
+    write_issued_ = false;
+  }
+
+  // Like the completion routines on Windows, the handler runs on the thread
+  // that issued the first operation. Each issued operation is delivered once,
+  // hence EPOLLONESHOT, and re-armed here if anything is still outstanding.
+  void UpdateInterest() {
+    if (alertable_wait_ == nullptr) {
+      alertable_wait_ = &AlertableWait::ForThisThread();
+      owner_ = std::this_thread::get_id();
+    }
+
+    uint32_t events = 0;
+    if (read_issued_) {
+      events |= EPOLLIN;
+    }
+    if (write_issued_) {
+      events |= EPOLLOUT;
+    }
+
+    if (events != 0 && !failed_) {
+      alertable_wait_->Arm(port_fd_, events | EPOLLONESHOT, this);
+    }
+  }
+
+  void ContinueWrite() {
+    while (write_offset_ < write_length_) {
+      const auto written =
+          write(port_fd_, write_buffer_.data() + write_offset_,
+                write_length_ - write_offset_);
+      if (written == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno != EAGAIN) {
+          Fail(strerror(errno));
+        }
+        return;
+      }
+      write_offset_ += static_cast<size_t>(written);
+    }
+    write_issued_ = false;
+  }
+
+  // The read callback comes last, after the fd is re-armed for whatever is
+  // still outstanding, and without the locks. Nothing of this is touched once
+  // it returns, so the callback may issue the next read or destroy the Serial.
+  void OnReady(uint32_t events) override {
+    auto read_lock = std::unique_lock(read_mutex_);
+    auto write_lock = std::unique_lock(write_mutex_);
+    if (events & EPOLLOUT) {
+      ContinueWrite();
+    }
+
+    ssize_t num_read = 0;
+    if (events & EPOLLIN) {
+      do {
+        num_read = read(port_fd_, read_buffer_.data(), read_buffer_.size());
+      } while (num_read == -1 && errno == EINTR);
+
+      if (num_read > 0) {
+        read_issued_ = false;
+      } else if (num_read == -1 && errno != EAGAIN) {
+        Fail(strerror(errno));
+      } else if (events & (EPOLLERR | EPOLLHUP)) {
+        Fail("The device was disconnected");
+      }
+    } else if (events & (EPOLLERR | EPOLLHUP)) {
+      // A vanished device is reported to the caller of the next IssueRead or
+      // TryIssueWrite, the same way a failing ReadFileEx would be
+      Fail("The device was disconnected");
+    }
+    UpdateInterest();
+    write_lock.unlock();
+    read_lock.unlock();
+
+    // Only the owning thread reads into the buffer, and it's busy here
+    if (num_read > 0) {
+      read_callback_(read_buffer_.data(), static_cast<size_t>(num_read));
+    }
+  }
+};
+
+Serial::Serial(const char* port_name,
+               std::function<void(const char*, size_t)> read_callback)
+    : impl_(std::make_unique<Impl>(port_name, std::move(read_callback))) {}
+
+Serial::~Serial() = default;
+
+void Serial::IssueRead() { impl_->IssueRead(); }
+
+bool Serial::TryIssueWrite(const char* data, size_t length) {
+  return impl_->TryIssueWrite(data, length);
+}
+
+namespace {
+// Reads a hexadecimal ID like the ones in idVendor and idProduct
+uint16_t ReadUsbId(const std::filesystem::path& path) {
+  std::ifstream file(path);
+  unsigned int id = 0;
+  file >> std::hex >> id;
+  return static_cast<uint16_t>(id);
+}
+
+// The tty's device is a USB interface, or for usb-serial drivers a port below
+// the interface. The IDs are in the USB device a couple of levels up.
+void ReadUsbIds(std::filesystem::path device, ComPort& port) {
+  for (int i = 0; i < 4 && device.has_relative_path(); ++i) {
+    std::error_code error;
+    if (std::filesystem::exists(device / "idVendor", error)) {
+      port.usb_vendor_id = ReadUsbId(device / "idVendor");
+      port.usb_product_id = ReadUsbId(device / "idProduct");
+      return;
+    }
+    device = device.parent_path();
+  }
+}
+}  // namespace
+
+std::vector<std::string> GetComPortNames() {
+  std::vector<std::string> port_names;
+  for (auto& port : GetComPorts()) {
+    port_names.push_back(std::move(port.name));
+  }
+  return port_names;
+}
+
+// Only ttys backed by an actual device are listed. This leaves out the
+// virtual consoles, and the placeholder ttyS* ports the 8250 driver registers
+// whether or not there is hardware behind them.
+//
+// Pseudo-terminals, like the one of the fan controller simulator, have no
+// device and can be added in BBMP_EXTRA_SERIAL_PORTS as a colon separated list.
+// Those that don't exist are left out, so they can come and go like devices.
+std::vector<ComPort> GetComPorts() {
+  std::vector<ComPort> ports;
+
+  if (const char* extra_ports = std::getenv("BBMP_EXTRA_SERIAL_PORTS")) {
+    std::stringstream ss(extra_ports);
+    std::string port_name;
+    while (std::getline(ss, port_name, ':')) {
+      if (!port_name.empty() && std::filesystem::exists(port_name)) {
+        ports.push_back({port_name});
+      }
+    }
+  }
+
+  std::error_code error;
+  for (const auto& entry :
+       std::filesystem::directory_iterator("/sys/class/tty", error)) {
+    const auto device =
+        std::filesystem::canonical(entry.path() / "device", error);
+    if (error || device.filename() == "serial8250") {
+      error.clear();
+      continue;
+    }
+    ports.push_back({"/dev/" + entry.path().filename().string()});
+    ReadUsbIds(device, ports.back());
+  }
+
+  std::sort(ports.begin(), ports.end(),
+            [](const ComPort& a, const ComPort& b) { return a.name < b.name; });
+  return ports;
+}
+
+void Serial::WindowsSleepEx(uint32_t timeout_milliseconds, bool alertable) {
+  if (alertable) {
+    AlertableWait::ForThisThread().Wait(timeout_milliseconds);
+  } else {
+    usleep(timeout_milliseconds * 1000);
+  }
+}
+}  // namespace bbmp
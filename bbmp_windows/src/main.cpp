@@ -1,10 +1,11 @@
 #include "bbmp/serial.h"
 
+#include <cstring>
 #include <iostream>
 
-int main() {
+int main(int argc, char* argv[]) {
   try {
-    bbmp::Serial serial("COM3", [](const char* data, size_t length) {
+    bbmp::Serial serial(argc > 1 ? argv[1] : "COM3", [](const char* data, size_t length) {
       std::cout << std::string(data, length);
     });
     for (int i = 0; i < 5000 / 100; ++i) {
@@ -0,0 +1,56 @@
+"""
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+"""
+
+# Compares two result files of coolth_bench --json, e.g. of two commits:
+#
+#   python compare_bench.py before.json after.json [--threshold 10]
+#
+# Prints the change of the median of every benchmark found in both files, and
+# exits with 1 if any got slower by more than the threshold percent.
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        results = json.load(f)
+    return results, {b["name"]: b for b in results["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("candidate")
+    parser.add_argument("--threshold", type=float, default=10.0, help="percent")
+    args = parser.parse_args()
+
+    baseline, baseline_benchmarks = load(args.baseline)
+    candidate, candidate_benchmarks = load(args.candidate)
+    print(f"{baseline.get('label', args.baseline)} -> {candidate.get('label', args.candidate)}")
+
+    num_regressions = 0
+    for name, after in candidate_benchmarks.items():
+        before = baseline_benchmarks.get(name)
+        if before is None:
+            print(f"{name:48} {after['median_ns']:12.1f} ns  new")
+            continue
+        change = (after["median_ns"] / before["median_ns"] - 1.0) * 100.0
+        mark = ""
+        if change > args.threshold:
+            mark = "  SLOWER"
+            num_regressions += 1
+        elif change < -args.threshold:
+            mark = "  faster"
+        print(f"{name:48} {before['median_ns']:12.1f} -> {after['median_ns']:12.1f} ns {change:+7.1f}%{mark}")
+
+    return 1 if num_regressions > 0 else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,250 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// Compares the control modes on a simulated CPU and its fans. The load steps
+// from idle to full and back, and every mode runs the same curves:
+//
+// - curves: the curves at the current temperature
+// - smoothed: the same with the default filter of "Average temps"
+// - predictive: PredictiveController
+//
+// The plant is a heat capacity that the fans cool through a conductance
+// growing with their airflow, which lags behind the duty cycle. The sensor
+// reads whole degrees, like the temperature reader on Windows. Before the
+// step a pre-roll with a varying load lets the thermal models identify it.
+//
+//   coolth_control_sim [--csv FILE]
+
+#include "control_engine.h"
+#include "fan_curve_table.h"
+#include "predictive_controller.h"
+#include "sensor_filter.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr size_t kNumFans = 4;
+constexpr double kControlPeriod =
+    ControlEngine::kControlPeriod.count() / 1000.0;
+// Integration steps per control period
+constexpr int kSubsteps = 10;
+
+constexpr double kHeatCapacity = 60.0;  // J/K
+constexpr double kAmbientTemp = 30.0;
+constexpr double kFanLag = 4.0;  // s
+
+constexpr int kPreRollSteps = 900;
+constexpr int kNumSteps = 400;
+constexpr int kStepUp = 60;
+constexpr int kStepDown = 240;
+constexpr double kIdleLoad = 15.0;  // W
+constexpr double kFullLoad = 95.0;
+// Time above this counts against a mode
+constexpr double kHotTemp = 75.0;
+
+enum class Mode { kCurves, kSmoothed, kPredictive };
+
+const char* GetModeName(Mode mode) {
+  switch (mode) {
+    case Mode::kCurves:
+      return "curves";
+    case Mode::kSmoothed:
+      return "smoothed";
+    case Mode::kPredictive:
+      return "predictive";
+  }
+  return "";
+}
+
+class Plant {
+ public:
+  // airflow is in [0, 1]
+  double GetConductance() const { return 0.5 + 2.0 * airflow_; }
+
+  void Advance(double load, double duty_cycle) {
+    const auto dt = kControlPeriod / kSubsteps;
+    for (int i = 0; i < kSubsteps; ++i) {
+      airflow_ += (duty_cycle / 100.0 - airflow_) * dt / kFanLag;
+      temp_ += (load - GetConductance() * (temp_ - kAmbientTemp)) * dt /
+               kHeatCapacity;
+    }
+  }
+
+  double GetTemp() const { return temp_; }
+  float ReadSensor() const { return static_cast<float>(std::round(temp_)); }
+
+ private:
+  double temp_ = 45.0;
+  double airflow_ = 0.2;
+};
+
+// One curve for the CPU, the GPU has none
+CoolthSettings::TFanCurves MakeCurves() {
+  return {{"cpu",
+           {{40.0f, 20.0f}, {55.0f, 35.0f}, {70.0f, 70.0f}, {80.0f, 100.0f}}}};
+}
+
+struct Trace {
+  std::vector<double> temps;
+  std::vector<double> duty_cycles;
+};
+
+struct Summary {
+  double peak_temp = 0.0;
+  double seconds_hot = 0.0;
+  double mean_duty_cycle = 0.0;
+  // Sum of the changes of the duty cycle, how busy the fans sound
+  double duty_cycle_variation = 0.0;
+  // Until the temperature stays within a degree of where it ends up under
+  // full load
+  double settling_seconds = 0.0;
+};
+
+double GetLoad(int step) {
+  return step >= kStepUp && step < kStepDown ? kFullLoad : kIdleLoad;
+}
+
+Trace Simulate(Mode mode) {
+  const CoolthSettings::State settings;
+  std::vector<CoolthSettings::TFanCurves> curves(kNumFans, MakeCurves());
+  FanCurveTable table(kNumFans, settings.GetNumSensors());
+  table.Compile(curves, [&settings](const std::string& id) {
+    return settings.FindSensor(id);
+  });
+  PredictiveController predictive(settings.GetNumSensors());
+
+  // The same for every mode
+  std::mt19937 rng(1);
+  double pre_roll_load = kIdleLoad;
+  Plant plant;
+  SensorFilterBank filters(settings.GetNumSensors());
+  for (size_t i = 0; i < filters.GetNumChannels(); ++i) {
+    filters.Configure(i, mode == Mode::kSmoothed
+                             ? CoolthSettings::GetDefaultFilter()
+                             : std::vector<FilterStage>{});
+  }
+  SensorFilterBank::Clock::time_point time;
+  std::vector<float> temps(settings.GetNumSensors());
+  std::vector<float> raw_temps(settings.GetNumSensors(), std::nanf(""));
+  std::vector<float> duty_cycles(kNumFans);
+  std::vector<int> i_sensors(kNumFans);
+  std::vector<float> plan_temps(kNumFans);
+
+  Trace trace;
+  for (int step = -kPreRollSteps; step < kNumSteps; ++step) {
+    raw_temps[0] = plant.ReadSensor();
+    time += ControlEngine::kControlPeriod;
+    filters.Process(raw_temps.data(), time, temps.data());
+
+    // Every mode identifies the models, like ControlEngine
+    predictive.Observe(raw_temps.data());
+    if (mode == Mode::kPredictive) {
+      predictive.Plan(table, duty_cycles.data(), i_sensors.data(),
+                      plan_temps.data());
+    } else {
+      table.Evaluate(temps.data(), duty_cycles.data(), i_sensors.data());
+    }
+    predictive.SetInput(duty_cycles.data(), kNumFans);
+
+    double duty_cycle = 0.0;
+    for (auto value : duty_cycles) {
+      duty_cycle += value / kNumFans;
+    }
+    if (step >= 0) {
+      trace.temps.push_back(plant.GetTemp());
+      trace.duty_cycles.push_back(duty_cycle);
+    }
+    if (step < 0 && step % 20 == 0) {
+      pre_roll_load =
+          std::uniform_real_distribution<double>(kIdleLoad, 70.0)(rng);
+    }
+    plant.Advance(step < 0 ? pre_roll_load : GetLoad(step), duty_cycle);
+  }
+  return trace;
+}
+
+Summary Summarize(const Trace& trace) {
+  Summary summary;
+  const auto final_temp = trace.temps[kStepDown - 1];
+  for (size_t i = 0; i < trace.temps.size(); ++i) {
+    summary.peak_temp = std::max(summary.peak_temp, trace.temps[i]);
+    if (trace.temps[i] > kHotTemp) {
+      summary.seconds_hot += kControlPeriod;
+    }
+    summary.mean_duty_cycle += trace.duty_cycles[i] / trace.temps.size();
+    if (i > 0) {
+      summary.duty_cycle_variation +=
+          std::abs(trace.duty_cycles[i] - trace.duty_cycles[i - 1]);
+    }
+  }
+  for (int i = kStepDown - 1; i >= kStepUp; --i) {
+    if (std::abs(trace.temps[i] - final_temp) > 1.0) {
+      summary.settling_seconds = (i + 1 - kStepUp) * kControlPeriod;
+      break;
+    }
+  }
+  return summary;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string csv_file;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+      csv_file = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--csv FILE]\n";
+      return 2;
+    }
+  }
+
+  const Mode modes[] = {Mode::kCurves, Mode::kSmoothed, Mode::kPredictive};
+  std::vector<Trace> traces;
+  std::printf("Load %.0f W -> %.0f W at %d s, back at %d s\n\n", kIdleLoad,
+              kFullLoad, kStepUp, kStepDown);
+  std::printf("%-12s %10s %12s %10s %14s %10s\n", "mode", "peak", "above 75 C",
+              "mean duty", "duty variation", "settling");
+  for (auto mode : modes) {
+    traces.push_back(Simulate(mode));
+    const auto summary = Summarize(traces.back());
+    std::printf("%-12s %8.1f C %10.0f s %8.1f %% %12.1f %% %8.0f s\n",
+                GetModeName(mode), summary.peak_temp, summary.seconds_hot,
+                summary.mean_duty_cycle, summary.duty_cycle_variation,
+                summary.settling_seconds);
+  }
+
+  if (!csv_file.empty()) {
+    std::ofstream os(csv_file);
+    os << "t";
+    for (auto mode : modes) {
+      os << "," << GetModeName(mode) << "_temp," << GetModeName(mode)
+         << "_duty";
+    }
+    os << "\n";
+    for (int step = 0; step < kNumSteps; ++step) {
+      os << step * kControlPeriod;
+      for (const auto& trace : traces) {
+        os << "," << trace.temps[step] << "," << trace.duty_cycles[step];
+      }
+      os << "\n";
+    }
+    if (!os) {
+      std::cerr << "Writing " << csv_file << " failed\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,1051 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// Microbenchmarks of the hot paths of bbmp and of the control loop.
+//
+// Every benchmark is calibrated to run for about kSampleTime, then run
+// kNumSamples times. The table on stdout shows the median and the fastest
+// sample. --json writes the same in a file, see scripts/compare_bench.py for
+// comparing two of them.
+//
+//   coolth_bench [--filter SUBSTRING] [--json FILE] [--label TEXT]
+
+#include "bbmp/fan_controller.h"
+#include "bbmp/latency_histogram.h"
+#include "bbmp/line_reader.h"
+#include "bbmp/logging.h"
+#include "bbmp/stringstream.h"
+#include "control_engine.h"
+#include "fan_curve_table.h"
+#include "fan_protocol.h"
+#include "predictive_controller.h"
+#include "sample_line.h"
+#include "sensor_filter.h"
+#include "settings.h"
+#include "telemetry_store.h"
+#include "thermal_model.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Every allocation of the process, for the benchmarks that promise none
+static std::atomic<uint64_t> g_num_allocations{0};
+
+// All the replaceable forms, so that every new is paired with a delete on the
+// same heap. Over-aligned memory comes from aligned_alloc, which free releases,
+// except on Windows, where _aligned_malloc needs _aligned_free.
+static void* Allocate(size_t size) noexcept {
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size > 0 ? size : 1);
+}
+
+static void* AllocateAligned(size_t size, std::align_val_t alignment) noexcept {
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  const auto align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+  return _aligned_malloc(size > 0 ? size : 1, align);
+#else
+  // The size must be a multiple of the alignment
+  return std::aligned_alloc(align, (size + align - 1) / align * align);
+#endif
+}
+
+static void FreeAligned(void* p) noexcept {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+static void* ThrowIfNull(void* p) {
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new(size_t size) { return ThrowIfNull(Allocate(size)); }
+void* operator new[](size_t size) { return ThrowIfNull(Allocate(size)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size);
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+  return ThrowIfNull(AllocateAligned(size, alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return ThrowIfNull(AllocateAligned(size, alignment));
+}
+void* operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return AllocateAligned(size, alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return AllocateAligned(size, alignment);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  FreeAligned(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  FreeAligned(p);
+}
+void operator delete(void* p, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  FreeAligned(p);
+}
+void operator delete[](void* p, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  FreeAligned(p);
+}
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr std::chrono::milliseconds kSampleTime{50};
+constexpr int kNumSamples = 5;
+
+// What a benchmark gets: it does iterations of its work and says how many
+// items that was, e.g. lines parsed, if not one per iteration
+struct State {
+  uint64_t iterations;
+  uint64_t items = 0;
+  // Extra figures that belong in the results, e.g. dropped log messages
+  std::vector<std::pair<std::string, double>> counters;
+  Clock::time_point start;
+  Clock::duration paused{};
+  Clock::time_point pause_start;
+
+  // Leaves the setup done so far out of the measurement
+  void ResetTimer() {
+    start = Clock::now();
+    paused = {};
+  }
+
+  // Leave the work between them out of the measurement
+  void PauseTimer() { pause_start = Clock::now(); }
+  void ResumeTimer() { paused += Clock::now() - pause_start; }
+};
+
+struct Benchmark {
+  std::string name;
+  // What an item is, for the table and the JSON
+  std::string unit;
+  std::function<void(State&)> run;
+};
+
+struct Result {
+  std::string name;
+  std::string unit;
+  uint64_t iterations;
+  double median_ns;
+  double min_ns;
+  std::vector<std::pair<std::string, double>> counters;
+};
+
+// Keeps the compiler from optimizing away a result
+template <typename T>
+void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "g"(&value) : "memory");
+#else
+  static volatile const void* sink;
+  sink = &value;
+#endif
+}
+
+struct Sample {
+  double elapsed_ns;
+  uint64_t items;
+};
+
+Sample RunSample(const Benchmark& benchmark, State& state) {
+  state.items = 0;
+  state.counters.clear();
+  state.ResetTimer();
+  benchmark.run(state);
+  const auto elapsed = Clock::now() - state.start - state.paused;
+  return {std::chrono::duration<double, std::nano>(elapsed).count(),
+          state.items > 0 ? state.items : state.iterations};
+}
+
+Result Run(const Benchmark& benchmark) {
+  State state{1, 0, {}, {}, {}, {}};
+  const auto sample_ns =
+      std::chrono::duration<double, std::nano>(kSampleTime).count();
+  for (;;) {
+    const auto sample = RunSample(benchmark, state);
+    if (sample.elapsed_ns >= sample_ns / 10 ||
+        state.iterations >= (uint64_t{1} << 40)) {
+      state.iterations = std::max<uint64_t>(
+          1, static_cast<uint64_t>(state.iterations * sample_ns /
+                                   sample.elapsed_ns));
+      break;
+    }
+    state.iterations *= 10;
+  }
+
+  std::vector<double> samples;
+  for (int i = 0; i < kNumSamples; ++i) {
+    const auto sample = RunSample(benchmark, state);
+    samples.push_back(sample.elapsed_ns / static_cast<double>(sample.items));
+  }
+  std::sort(samples.begin(), samples.end());
+  return {benchmark.name,  benchmark.unit,
+          state.iterations, samples[samples.size() / 2],
+          samples.front(),  state.counters};
+}
+
+std::string EscapeJson(const std::string& text) {
+  std::string result;
+  for (const auto c : text) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      result += escaped;
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+// One result per line, so the files diff well
+void WriteJson(std::ostream& os, const std::string& label,
+               const std::vector<Result>& results) {
+  const auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+  os << "{\n";
+  os << "  \"label\": \"" << EscapeJson(label) << "\",\n";
+  os << "  \"timestamp_ms\": " << now_ms << ",\n";
+#if defined(__clang__)
+  os << "  \"compiler\": \"clang " << __clang_version__ << "\",\n";
+#elif defined(__GNUC__)
+  os << "  \"compiler\": \"gcc " << __VERSION__ << "\",\n";
+#elif defined(_MSC_VER)
+  os << "  \"compiler\": \"msvc " << _MSC_VER << "\",\n";
+#endif
+  os << "  \"hardware_threads\": " << std::thread::hardware_concurrency()
+     << ",\n";
+  os << "  \"benchmarks\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    char numbers[160];
+    std::snprintf(numbers, sizeof(numbers),
+                  "\"iterations\": %llu, \"median_ns\": %.3f, "
+                  "\"min_ns\": %.3f",
+                  static_cast<unsigned long long>(result.iterations),
+                  result.median_ns, result.min_ns);
+    os << "    {\"name\": \"" << EscapeJson(result.name) << "\", \"unit\": \""
+       << EscapeJson(result.unit) << "\", " << numbers;
+    for (const auto& [name, value] : result.counters) {
+      os << ", \"" << EscapeJson(name) << "\": " << value;
+    }
+    os << (i + 1 < results.size() ? "},\n" : "}\n");
+  }
+  os << "  ]\n}\n";
+}
+
+// >>> BENCHMARKS =============================================================
+// What the temperature reader writes, one line per sample
+std::string MakeTemperatureLines(size_t num_lines) {
+  std::string text;
+  for (size_t i = 0; i < num_lines; ++i) {
+    text += std::to_string(40 + i % 50) + " " + std::to_string(35 + i % 40) +
+            "\r\n";
+  }
+  return text;
+}
+
+Benchmark LineReaderRead(size_t chunk_size) {
+  return {"line_reader/read/chunk_" + std::to_string(chunk_size), "line",
+          [chunk_size](State& state) {
+            constexpr size_t kNumLines = 1000;
+            static const auto text = MakeTemperatureLines(kNumLines);
+            uint64_t num_lines = 0;
+            LineReader reader(32, [&num_lines](const char*, size_t) {
+              ++num_lines;
+            });
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              for (size_t offset = 0; offset < text.size();
+                   offset += chunk_size) {
+                reader.Read(text.data() + offset,
+                            std::min(chunk_size, text.size() - offset));
+              }
+            }
+            DoNotOptimize(num_lines);
+            state.items = state.iterations * kNumLines;
+          }};
+}
+
+Benchmark StringStreamGetInt() {
+  return {"string_stream/get_int", "int", [](State& state) {
+            const char line[] = "55 48";
+            int sum = 0;
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              StringStream stream(line, sizeof(line) - 1);
+              sum += stream.GetInt().value_or(0);
+              sum += stream.GetInt().value_or(0);
+            }
+            DoNotOptimize(sum);
+            state.items = 2 * state.iterations;
+          }};
+}
+
+Benchmark SampleLineParse(size_t num_sensors) {
+  return {"sample_line/parse/sensors_" + std::to_string(num_sensors), "field",
+          [num_sensors](State& state) {
+            std::string line = "cpu=54 gpu=41.5";
+            for (size_t i = 2; i < num_sensors; ++i) {
+              line += " sensor_" + std::to_string(i) + "=" +
+                      std::to_string(30 + i % 40) + ".25";
+            }
+            float sum = 0.0f;
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              sample_line::Parse(
+                  line.data(), line.size(),
+                  [&sum](std::string_view key, float value, size_t) {
+                    sum += value + static_cast<float>(key.size());
+                  });
+            }
+            DoNotOptimize(sum);
+            state.items = state.iterations * num_sensors;
+          }};
+}
+
+// The messages of a four fan board in the text protocol and in frames, see
+// fan_protocol.h. The bytes counter is the size of one message on the wire,
+// which at 19200 baud is what limits the rate.
+constexpr uint8_t kProtocolNumFans = 4;
+const uint8_t kProtocolDutyCycles[kProtocolNumFans] = {51, 128, 204, 255};
+const uint16_t kProtocolRpms[kProtocolNumFans] = {1180, 1420, 960, 0};
+
+// What the host sends, as in FanController::TrySendDutyCycles
+int FormatTextDutyCycles(char* out, size_t out_size) {
+  int length = std::snprintf(out, out_size, "c 1");
+  for (uint8_t i = 0; i < kProtocolNumFans; ++i) {
+    length += std::snprintf(out + length, out_size - length, " %d",
+                            static_cast<int>(kProtocolDutyCycles[i]));
+  }
+  length += std::snprintf(out + length, out_size - length, "\n");
+  return length;
+}
+
+// What the firmware sends, the RPMs and then the duty cycles
+int FormatTextTelemetry(char* out, size_t out_size) {
+  int length = 0;
+  for (uint8_t i = 0; i < kProtocolNumFans; ++i) {
+    length += std::snprintf(out + length, out_size - length, "%d ",
+                            static_cast<int>(kProtocolRpms[i]));
+  }
+  for (uint8_t i = 0; i < kProtocolNumFans; ++i) {
+    length += std::snprintf(out + length, out_size - length,
+                            i + 1 < kProtocolNumFans ? "%d " : "%d\r\n",
+                            static_cast<int>(kProtocolDutyCycles[i]));
+  }
+  return length;
+}
+
+Benchmark ProtocolEncodeDutyCycles(bool frames) {
+  return {std::string("protocol/duty_cycles/") + (frames ? "frame" : "text") +
+              "/encode",
+          "message", [frames](State& state) {
+            char out[fan_protocol::kMaxFrameLength + 32];
+            size_t length = 0;
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              length =
+                  frames ? fan_protocol::EncodeFrame(
+                               fan_protocol::kSetDutyCycles,
+                               kProtocolDutyCycles, kProtocolNumFans,
+                               reinterpret_cast<uint8_t*>(out), sizeof(out))
+                         : static_cast<size_t>(
+                               FormatTextDutyCycles(out, sizeof(out)));
+              DoNotOptimize(out);
+            }
+            state.counters = {{"bytes", static_cast<double>(length)}};
+          }};
+}
+
+Benchmark ProtocolEncodeTelemetry(bool frames) {
+  return {std::string("protocol/telemetry/") + (frames ? "frame" : "text") +
+              "/encode",
+          "message", [frames](State& state) {
+            char out[fan_protocol::kMaxFrameLength + 64];
+            size_t length = 0;
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              length = frames ? fan_protocol::EncodeTelemetry(
+                                    kProtocolRpms, kProtocolDutyCycles,
+                                    kProtocolNumFans,
+                                    reinterpret_cast<uint8_t*>(out),
+                                    sizeof(out))
+                              : static_cast<size_t>(
+                                    FormatTextTelemetry(out, sizeof(out)));
+              DoNotOptimize(out);
+            }
+            state.counters = {{"bytes", static_cast<double>(length)}};
+          }};
+}
+
+// 100 messages at a time through the host's parsers, as in
+// FanController::OnSerialData
+Benchmark ProtocolDecodeTelemetry(bool frames) {
+  return {std::string("protocol/telemetry/") + (frames ? "frame" : "text") +
+              "/decode",
+          "message", [frames](State& state) {
+            constexpr size_t kNumMessages = 100;
+            std::string stream = frames ? "" : "\n";
+            char message[fan_protocol::kMaxFrameLength + 64];
+            size_t length = 0;
+            for (size_t i = 0; i < kNumMessages; ++i) {
+              length = frames ? fan_protocol::EncodeTelemetry(
+                                    kProtocolRpms, kProtocolDutyCycles,
+                                    kProtocolNumFans,
+                                    reinterpret_cast<uint8_t*>(message),
+                                    sizeof(message))
+                              : static_cast<size_t>(FormatTextTelemetry(
+                                    message, sizeof(message)));
+              stream.append(message, length);
+            }
+
+            int sum = 0;
+            fan_protocol::FrameDecoder decoder;
+            LineReader reader(256, [&sum](const char* data, size_t size) {
+              StringStream values(data, size);
+              while (const auto value = values.GetInt()) {
+                sum += *value;
+              }
+            });
+            uint16_t rpms[bbmp::FanController::kMaxFans];
+            uint8_t duty_cycles[bbmp::FanController::kMaxFans];
+
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              if (frames) {
+                for (const auto c : stream) {
+                  if (decoder.Push(static_cast<uint8_t>(c))) {
+                    sum += fan_protocol::DecodeTelemetry(
+                        decoder.GetPayload(), decoder.GetLength(), rpms,
+                        duty_cycles, bbmp::FanController::kMaxFans);
+                    sum += rpms[0];
+                  }
+                }
+              } else {
+                reader.Read(stream.data(), stream.size());
+              }
+            }
+            DoNotOptimize(sum);
+            state.items = state.iterations * kNumMessages;
+            state.counters = {{"bytes", static_cast<double>(length)}};
+          }};
+}
+
+// The default sensors, then sensor_2, sensor_3... up to num_sensors
+CoolthSettings::TSensors MakeSensors(size_t num_sensors) {
+  auto sensors = CoolthSettings::GetDefaultSensors();
+  for (size_t i = sensors.size(); i < num_sensors; ++i) {
+    const auto id = "sensor_" + std::to_string(i);
+    sensors.push_back({id, id, {}});
+  }
+  return sensors;
+}
+
+int FindSensor(const CoolthSettings::TSensors& sensors, const std::string& id) {
+  for (size_t i = 0; i < sensors.size(); ++i) {
+    if (sensors[i].id == id) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+// Four points per curve, like the defaults. Every fan follows the CPU, and the
+// GPU or, with more sensors, one of the others.
+CoolthSettings::TFanCurves MakeCurves(size_t i_fan, size_t num_sensors = 2) {
+  const auto offset = static_cast<float>(i_fan % 10);
+  const auto i_sensor = num_sensors > 2 ? 2 + i_fan % (num_sensors - 2) : 1;
+  return {{"cpu",
+           {{35.0f + offset, 20.0f},
+            {50.0f, 35.0f},
+            {70.0f, 70.0f},
+            {85.0f - offset, 100.0f}}},
+          {i_sensor == 1 ? "gpu" : "sensor_" + std::to_string(i_sensor),
+           {{40.0f, 25.0f}, {60.0f + offset, 50.0f}, {80.0f, 100.0f}}}};
+}
+
+FanCurveTable MakeTable(size_t num_fans, size_t num_sensors = 2) {
+  std::vector<CoolthSettings::TFanCurves> curves;
+  for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+    curves.push_back(MakeCurves(i_fan, num_sensors));
+  }
+  const auto sensors = MakeSensors(num_sensors);
+  FanCurveTable table(num_fans, num_sensors);
+  table.Compile(curves, [&sensors](const std::string& id) {
+    return FindSensor(sensors, id);
+  });
+  return table;
+}
+
+Benchmark FanCurveTableEvaluate(size_t num_fans) {
+  return {"fan_curve_table/evaluate/fans_" + std::to_string(num_fans), "step",
+          [num_fans](State& state) {
+            const auto table = MakeTable(num_fans);
+            std::vector<float> duty_cycles(num_fans);
+            std::vector<int> i_sensors(num_fans);
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              const float temps[] = {30.0f + static_cast<float>(i % 600) / 10,
+                                     45.0f};
+              table.Evaluate(temps, duty_cycles.data(), i_sensors.data());
+              DoNotOptimize(duty_cycles[0]);
+            }
+          }};
+}
+
+// What the control step did before FanCurveTable, a copy of
+// GraphComponent::GetYForX with a stand-in for juce::Point<float>, which this
+// target doesn't link. The points are sorted by x, as the editor keeps them.
+struct GraphPoint {
+  float x;
+  float y;
+  float getX() const { return x; }
+  float getY() const { return y; }
+};
+
+std::optional<float> GetYForX(std::vector<GraphPoint>& points, const float x) {
+  if (points.size() == 0) {
+    return {};
+  }
+
+  std::optional<GraphPoint> smaller;
+  std::optional<GraphPoint> larger;
+  for (const auto& p : points) {
+    if (p.getX() <= x) {
+      smaller = p;
+    }
+    if (!larger.has_value() && x < p.getX()) {
+      larger = p;
+    }
+    if (smaller.has_value() && larger.has_value()) {
+      break;
+    }
+  }
+
+  if (!smaller.has_value()) {
+    return larger->getY();
+  }
+  if (!larger.has_value()) {
+    return smaller->getY();
+  }
+
+  return {smaller->getY() + (larger->getY() - smaller->getY()) *
+                                (x - smaller->getX()) /
+                                (larger->getX() - smaller->getX())};
+}
+
+// num_points over the range of the editor, rising
+std::vector<GraphPoint> MakeCurvePoints(size_t num_points) {
+  std::vector<GraphPoint> points;
+  const auto range = FanCurveTable::kMaxTemp - FanCurveTable::kMinTemp;
+  for (size_t i = 0; i < num_points; ++i) {
+    const auto t = static_cast<float>(i) / static_cast<float>(num_points - 1);
+    points.push_back({FanCurveTable::kMinTemp + t * range,
+                      20.0f + 80.0f * t * t});
+  }
+  return points;
+}
+
+// A single curve of num_points, looked up at temperatures sweeping the range
+// of the editor
+Benchmark CurveLookup(bool table, size_t num_points) {
+  return {std::string("curve_lookup/") +
+              (table ? "fan_curve_table" : "get_y_for_x") + "/points_" +
+              std::to_string(num_points),
+          "lookup", [table, num_points](State& state) {
+            auto points = MakeCurvePoints(num_points);
+            std::vector<float> xs, ys;
+            for (const auto& p : points) {
+              xs.push_back(p.x);
+              ys.push_back(p.y);
+            }
+            FanCurveTable curve_table(1, 1);
+            curve_table.SetCurve(0, 0, xs.data(), ys.data(), num_points);
+            float duty_cycle = 0.0f;
+            int i_sensor = 0;
+
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              const float temp = 25.0f + static_cast<float>(i % 700) / 10;
+              if (table) {
+                curve_table.Evaluate(&temp, &duty_cycle, &i_sensor);
+              } else {
+                duty_cycle = GetYForX(points, temp).value_or(0.0f);
+              }
+              DoNotOptimize(duty_cycle);
+            }
+          }};
+}
+
+Benchmark FanCurveTableCompile(size_t num_fans) {
+  return {"fan_curve_table/compile/fans_" + std::to_string(num_fans),
+          "compile", [num_fans](State& state) {
+            std::vector<CoolthSettings::TFanCurves> curves;
+            for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+              curves.push_back(MakeCurves(i_fan));
+            }
+            const auto sensors = CoolthSettings::GetDefaultSensors();
+            FanCurveTable table(num_fans, sensors.size());
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              table.Compile(curves, [&sensors](const std::string& id) {
+                return FindSensor(sensors, id);
+              });
+            }
+          }};
+}
+
+// Every producer logs iterations messages while this thread drains them, like
+// the GUI's log panel or the log drain of coolthd. Producers hold back while
+// the rings are full, so the figure is the delivered throughput rather than
+// the cost of dropping.
+Benchmark LoggerThroughput(int num_producers) {
+  return {"logger/producers_" + std::to_string(num_producers), "message",
+          [num_producers](State& state) {
+            // A producer only starts a burst when fewer messages are pending
+            // in all rings together than what leaves room for it in its own
+            static constexpr uint64_t kCapacity =
+                bbmp::NonBlockingLogger::kRingCapacity;
+            static constexpr uint64_t kBurst = kCapacity / 2;
+            auto& logger = bbmp::NonBlockingLogger::GetInstance();
+            const auto dropped_before = logger.GetNumDropped();
+            std::atomic<uint64_t> num_logged{0};
+            std::atomic<uint64_t> num_consumed{0};
+            std::atomic<int> num_running{num_producers};
+            std::vector<std::thread> producers;
+            for (int i = 0; i < num_producers; ++i) {
+              producers.emplace_back([&state, &num_logged, &num_consumed,
+                                      &num_running] {
+                for (uint64_t i = 0; i < state.iterations; i += kBurst) {
+                  while (num_logged - num_consumed > kCapacity - kBurst) {
+                    std::this_thread::yield();
+                  }
+                  const auto burst = std::min(kBurst, state.iterations - i);
+                  for (uint64_t j = 0; j < burst; ++j) {
+                    bbmp::Log(bbmp::LogLevel::kDebug, "Control step {}: {:.1f}",
+                              i + j, 42.5);
+                  }
+                  num_logged += burst;
+                }
+                --num_running;
+              });
+            }
+            bbmp::LogMessage message;
+            for (;;) {
+              const bool done = num_running == 0;
+              while (logger.TryDequeue(message)) {
+                ++num_consumed;
+              }
+              if (done) {
+                break;
+              }
+              std::this_thread::yield();
+            }
+            for (auto& producer : producers) {
+              producer.join();
+            }
+            state.items = num_consumed;
+            state.counters = {
+                {"dropped", static_cast<double>(logger.GetNumDropped() -
+                                                dropped_before)}};
+          }};
+}
+
+// What a Log call costs the producer, with the ring drained outside the
+// measurement before it gets full. Allocations only counts the ones of the
+// Log calls.
+Benchmark LoggerProducerCall() {
+  return {"logger/producer_call", "message", [](State& state) {
+            constexpr uint64_t kBatch =
+                bbmp::NonBlockingLogger::kRingCapacity / 2;
+            auto& logger = bbmp::NonBlockingLogger::GetInstance();
+            bbmp::LogMessage message;
+            const auto drain = [&logger, &message] {
+              while (logger.TryDequeue(message)) {
+              }
+            };
+            // The first call on a thread allocates its ring
+            bbmp::Log(bbmp::LogLevel::kDebug, "Warming up");
+            drain();
+            const auto dropped_before = logger.GetNumDropped();
+            uint64_t num_allocations = 0;
+
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; i += kBatch) {
+              const auto allocations_before =
+                  g_num_allocations.load(std::memory_order_relaxed);
+              const auto batch = std::min(kBatch, state.iterations - i);
+              for (uint64_t j = 0; j < batch; ++j) {
+                bbmp::Log(bbmp::LogLevel::kDebug,
+                          "Fan controller on {} at {} RPM, {:.1f} %",
+                          "/dev/ttyUSB0", i + j, 42.5);
+              }
+              num_allocations +=
+                  g_num_allocations.load(std::memory_order_relaxed) -
+                  allocations_before;
+
+              state.PauseTimer();
+              drain();
+              state.ResumeTimer();
+            }
+            state.counters = {
+                {"allocations", static_cast<double>(num_allocations)},
+                {"dropped", static_cast<double>(logger.GetNumDropped() -
+                                                dropped_before)}};
+          }};
+}
+
+CoolthSettings& GetBenchSettings() {
+  static CoolthSettings settings;
+  static const bool initialized = [] {
+    settings.EnsureNumFans(16);
+    settings.AccessTempCurves([](auto& temp_curves) {
+      for (size_t i_fan = 0; i_fan < temp_curves.size(); ++i_fan) {
+        temp_curves[i_fan] = MakeCurves(i_fan);
+      }
+    });
+    return true;
+  }();
+  DoNotOptimize(initialized);
+  return settings;
+}
+
+Benchmark SettingsSerialize() {
+  return {"settings/serialize/fans_16", "save", [](State& state) {
+            auto& settings = GetBenchSettings();
+            size_t size = 0;
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              size += settings.Serialize().size();
+            }
+            DoNotOptimize(size);
+          }};
+}
+
+Benchmark SettingsDeserialize() {
+  return {"settings/deserialize/fans_16", "load", [](State& state) {
+            const auto data = GetBenchSettings().Serialize();
+            CoolthSettings settings;
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              std::istringstream is(data, std::ios::binary);
+              cereal::BinaryInputArchive archive(is);
+              archive(settings);
+            }
+          }};
+}
+
+Benchmark HistogramRecord() {
+  return {"latency_histogram/record", "record", [](State& state) {
+            auto histogram = std::make_unique<bbmp::LatencyHistogram>();
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              histogram->Record((i * 2654435761u) % 1000000);
+            }
+          }};
+}
+
+// What ControlEngine::Run does in a control step once the temperatures are
+// read: smoothing, the curves, the commands of the boards and the telemetry,
+// without the serial IO and the listeners
+Benchmark ControlStep(size_t num_sensors, size_t num_fans) {
+  const auto name =
+      num_sensors == 2
+          ? "control_step/fans_" + std::to_string(num_fans)
+          : "control_step/sensors_" + std::to_string(num_sensors) + "/fans_" +
+                std::to_string(num_fans);
+  return {name, "step", [num_sensors, num_fans](State& state) {
+            const auto table = MakeTable(num_fans, num_sensors);
+
+            const auto telemetry_file =
+                std::filesystem::temp_directory_path() /
+                ("coolth_bench_" + std::to_string(num_sensors) + "_" +
+                 std::to_string(num_fans) + ".bin");
+            std::filesystem::remove(telemetry_file);
+            TelemetryStore store(telemetry_file.string(),
+                                 ControlEngine::GetTelemetryChannels(
+                                     MakeSensors(num_sensors), num_fans));
+
+            std::vector<float> raw_temps(num_sensors);
+            std::vector<float> temps(num_sensors, 45.0f);
+            std::vector<float> duty_cycles(num_fans);
+            std::vector<int> i_sensors(num_fans);
+            std::vector<int> rpms(num_fans, 1200);
+            std::vector<float> sample(2 * num_sensors + 2 * num_fans);
+            // One command per board of FanController::kMaxFans fans
+            constexpr auto kFansPerBoard = bbmp::FanController::kMaxFans;
+            std::vector<uint8_t> values(num_fans);
+            uint8_t frame[fan_protocol::kMaxFrameLength];
+            size_t num_bytes = 0;
+            static int64_t timestamp_ms = 0;
+
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              for (size_t j = 0; j < num_sensors; ++j) {
+                raw_temps[j] = 40.0f + static_cast<float>((i + j) % 40);
+                temps[j] = 0.1f * raw_temps[j] + 0.9f * temps[j];
+              }
+              table.Evaluate(temps.data(), duty_cycles.data(),
+                             i_sensors.data());
+
+              for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+                values[i_fan] = static_cast<uint8_t>(std::round(
+                    std::clamp(duty_cycles[i_fan], 0.0f, 100.0f) / 100.0f *
+                    255.0f));
+              }
+              for (size_t first = 0; first < num_fans;
+                   first += kFansPerBoard) {
+                num_bytes += fan_protocol::EncodeFrame(
+                    fan_protocol::kSetDutyCycles, values.data() + first,
+                    static_cast<uint8_t>(
+                        std::min(kFansPerBoard, num_fans - first)),
+                    frame, sizeof(frame));
+              }
+
+              std::copy(raw_temps.begin(), raw_temps.end(), sample.begin());
+              std::copy(temps.begin(), temps.end(),
+                        sample.begin() + num_sensors);
+              auto* fans = sample.data() + 2 * num_sensors;
+              for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+                fans[i_fan] = duty_cycles[i_fan];
+                fans[num_fans + i_fan] = static_cast<float>(rpms[i_fan]);
+              }
+              store.Append(timestamp_ms += 1000, sample.data());
+            }
+            DoNotOptimize(num_bytes);
+          }};
+}
+
+// A first order plant a sensor could belong to: 0.95 of the temperature
+// remains per step, and the fans take off up to 1.5 degrees per step
+float PlantStep(float temp, float duty_cycle, float load) {
+  return 0.95f * temp - 0.015f * duty_cycle + load;
+}
+
+Benchmark ThermalModelUpdate() {
+  return {"thermal_model/update", "update", [](State& state) {
+            ThermalModel model;
+            float temp = 50.0f;
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              const auto duty_cycle = static_cast<float>(i * 37 % 100);
+              model.Observe(temp);
+              model.SetInput(duty_cycle);
+              temp = PlantStep(temp, duty_cycle, 3.0f);
+            }
+            DoNotOptimize(model.GetParameters());
+          }};
+}
+
+// A control step in predictive mode: the models see the temperatures, then
+// the duty cycles of all fans are planned
+Benchmark PredictivePlan(size_t num_fans) {
+  return {"predictive/plan/fans_" + std::to_string(num_fans), "step",
+          [num_fans](State& state) {
+            const auto table = MakeTable(num_fans);
+            std::vector<float> duty_cycles(num_fans);
+            std::vector<int> i_sensors(num_fans);
+            std::vector<float> plan_temps(num_fans);
+
+            // Identified, so every fan takes the bisection
+            PredictiveController predictive(table.GetNumSensors());
+            float temps[] = {50.0f, 45.0f};
+            for (int i = 0; i < 200; ++i) {
+              const auto duty_cycle = static_cast<float>(i * 37 % 100);
+              predictive.Observe(temps);
+              duty_cycles.assign(num_fans, duty_cycle);
+              predictive.SetInput(duty_cycles.data(), num_fans);
+              temps[0] = PlantStep(temps[0], duty_cycle, 3.0f);
+              temps[1] = PlantStep(temps[1], duty_cycle, 2.8f);
+            }
+
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              predictive.Observe(temps);
+              predictive.Plan(table, duty_cycles.data(), i_sensors.data(),
+                              plan_temps.data());
+              predictive.SetInput(duty_cycles.data(), num_fans);
+              temps[0] = PlantStep(temps[0], duty_cycles[0], 3.0f);
+              temps[1] = PlantStep(temps[1], duty_cycles[0], 2.8f);
+            }
+            DoNotOptimize(duty_cycles[0]);
+          }};
+}
+
+// One sample for each of 256 sensors per iteration, every sensor with the
+// same stages
+Benchmark SensorFilter(const std::string& name,
+                       const std::vector<FilterStage>& stages) {
+  return {"sensor_filter/channels_256/" + name, "sample",
+          [stages](State& state) {
+            constexpr size_t kNumChannels = 256;
+            SensorFilterBank filters(kNumChannels);
+            for (size_t i_channel = 0; i_channel < kNumChannels; ++i_channel) {
+              filters.Configure(i_channel, stages);
+            }
+            std::vector<float> samples(kNumChannels);
+            std::vector<float> filtered(kNumChannels);
+            auto time = SensorFilterBank::Clock::time_point{};
+
+            const auto allocations_before =
+                g_num_allocations.load(std::memory_order_relaxed);
+            state.ResetTimer();
+            for (uint64_t i = 0; i < state.iterations; ++i) {
+              for (size_t i_channel = 0; i_channel < kNumChannels;
+                   ++i_channel) {
+                samples[i_channel] =
+                    40.0f + static_cast<float>((i + i_channel * 7) % 13);
+              }
+              time += std::chrono::milliseconds(250);
+              filters.Process(samples.data(), time, filtered.data());
+              DoNotOptimize(filtered[0]);
+            }
+            state.items = state.iterations * kNumChannels;
+            state.counters = {
+                {"allocations",
+                 static_cast<double>(
+                     g_num_allocations.load(std::memory_order_relaxed) -
+                     allocations_before)}};
+          }};
+}
+// <<< BENCHMARKS -------------------------------------------------------------
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string filter;
+  std::string json_file;
+  std::string label;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_file = argv[++i];
+    } else if (std::strcmp(argv[i], "--label") == 0 && i + 1 < argc) {
+      label = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--filter SUBSTRING] [--json FILE] [--label TEXT]\n";
+      return 2;
+    }
+  }
+
+  std::vector<Benchmark> benchmarks;
+  for (size_t chunk_size : {1, 8, 64, 512, 4096}) {
+    benchmarks.push_back(LineReaderRead(chunk_size));
+  }
+  benchmarks.push_back(StringStreamGetInt());
+  for (size_t num_sensors : {2, 32}) {
+    benchmarks.push_back(SampleLineParse(num_sensors));
+  }
+  for (bool frames : {false, true}) {
+    benchmarks.push_back(ProtocolEncodeDutyCycles(frames));
+    benchmarks.push_back(ProtocolEncodeTelemetry(frames));
+    benchmarks.push_back(ProtocolDecodeTelemetry(frames));
+  }
+  for (size_t num_fans : {4, 16, 128}) {
+    benchmarks.push_back(FanCurveTableEvaluate(num_fans));
+  }
+  benchmarks.push_back(FanCurveTableCompile(16));
+  for (size_t num_points : {2, 10, 100, 1000}) {
+    benchmarks.push_back(CurveLookup(false, num_points));
+    benchmarks.push_back(CurveLookup(true, num_points));
+  }
+  benchmarks.push_back(LoggerProducerCall());
+  for (int num_producers : {1, 2, 4, 8, 16}) {
+    benchmarks.push_back(LoggerThroughput(num_producers));
+  }
+  benchmarks.push_back(SettingsSerialize());
+  benchmarks.push_back(SettingsDeserialize());
+  benchmarks.push_back(HistogramRecord());
+  for (size_t num_fans : {8, 128}) {
+    benchmarks.push_back(ControlStep(2, num_fans));
+  }
+  benchmarks.push_back(ControlStep(128, 64));
+  benchmarks.push_back(SensorFilter("ema", {{FilterStage::kEma, 9.5f, 0.0f}}));
+  benchmarks.push_back(
+      SensorFilter("median_5", {{FilterStage::kMedian, 5.0f, 0.0f}}));
+  benchmarks.push_back(
+      SensorFilter("slew", {{FilterStage::kSlewLimit, 2.0f, 0.0f}}));
+  benchmarks.push_back(
+      SensorFilter("kalman", {{FilterStage::kKalman, 0.05f, 0.3f}}));
+  benchmarks.push_back(SensorFilter("median_5,ema,slew",
+                                    {{FilterStage::kMedian, 5.0f, 0.0f},
+                                     {FilterStage::kEma, 9.5f, 0.0f},
+                                     {FilterStage::kSlewLimit, 2.0f, 0.0f}}));
+  benchmarks.push_back(ThermalModelUpdate());
+  for (size_t num_fans : {8, 128}) {
+    benchmarks.push_back(PredictivePlan(num_fans));
+  }
+
+  std::vector<Result> results;
+  std::printf("%-48s %12s %12s  %s\n", "benchmark", "median", "min", "per");
+  for (const auto& benchmark : benchmarks) {
+    if (benchmark.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    results.push_back(Run(benchmark));
+    const auto& result = results.back();
+    std::printf("%-48s %9.1f ns %9.1f ns  %s", result.name.c_str(),
+                result.median_ns, result.min_ns, result.unit.c_str());
+    for (const auto& [name, value] : result.counters) {
+      std::printf(", %s %g", name.c_str(), value);
+    }
+    std::printf("\n");
+    std::fflush(stdout);
+  }
+
+  if (!json_file.empty()) {
+    std::ofstream os(json_file);
+    WriteJson(os, label, results);
+    if (!os) {
+      std::cerr << "Writing " << json_file << " failed\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,214 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// Repaints of HistoryComponent without a window: 24 hours of 1 Hz samples of
+// two sensors and four fans, i.e. ten series, zoomed and panned.
+//
+// A paint is what HistoryComponent::paint does with the samples: the sample
+// bounds of every pixel column, the range of every series in the view for
+// growing the y axis, and the range of every column of every series, turned
+// into the coordinates of a vertical line, or a connecting line over a gap.
+// The lines are summed up instead of drawn, so the figures leave out the
+// rasterizer, which only depends on the width. The budget is 2 ms per paint.
+//
+// Appending a sample and the rebuild when half of the history is dropped are
+// measured too.
+//
+//   coolth_history_bench [WIDTH]
+
+#include "min_max_pyramid.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t kSecond = 1000;
+constexpr int64_t kHour = 3600 * kSecond;
+constexpr int64_t kDay = 24 * kHour;
+constexpr size_t kNumSeries = 10;
+// As in history_component.cpp
+constexpr int64_t kMaxGapMs = 5000;
+
+struct Summary {
+  double median;
+  double p99;
+  double max;
+};
+
+Summary Summarize(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const auto percentile = [&values](double p) {
+    return values[static_cast<size_t>(p *
+                                      static_cast<double>(values.size() - 1))];
+  };
+  return {percentile(0.5), percentile(0.99), values.back()};
+}
+
+double ToMicroseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void Print(const std::string& name, const Summary& summary) {
+  std::printf("%-32s median %8.1f us  p99 %8.1f us  max %8.1f us\n",
+              name.c_str(), summary.median, summary.p99, summary.max);
+}
+
+struct History {
+  std::vector<int64_t> timestamps;
+  std::vector<MinMaxPyramid> pyramids{kNumSeries};
+};
+
+// Temperatures, duty cycles and RPMs that wander about, with a few minutes
+// missing every couple of hours, like a sleeping machine
+History MakeHistory() {
+  History history;
+  for (int64_t t = 0; t < kDay; t += kSecond) {
+    if (t % (2 * kHour) < 5 * 60 * kSecond && t > 0) {
+      continue;
+    }
+    history.timestamps.push_back(t);
+    const auto phase = static_cast<float>(t) / 600000.0f;
+    for (size_t i = 0; i < kNumSeries; ++i) {
+      const auto wave = std::sin(phase * (1.0f + 0.1f * i)) +
+                        0.3f * std::sin(phase * 17.0f + i);
+      const float scale = i < 2 ? 15.0f : i < 6 ? 30.0f : 500.0f;
+      const float offset = i < 2 ? 50.0f : i < 6 ? 50.0f : 1200.0f;
+      history.pyramids[i].Append(offset + scale * wave);
+    }
+  }
+  return history;
+}
+
+// Returns a checksum of the lines, so nothing is optimized away
+double Paint(const History& history, int width, int64_t view_start,
+             int64_t view_end, std::vector<size_t>& column_bounds) {
+  const auto& timestamps = history.timestamps;
+  const auto duration = view_end - view_start;
+  column_bounds.resize(static_cast<size_t>(width) + 1);
+  auto it = timestamps.begin();
+  for (int x = 0; x <= width; ++x) {
+    const auto t = view_start + duration * x / width;
+    it = std::lower_bound(it, timestamps.end(), t);
+    column_bounds[x] = static_cast<size_t>(it - timestamps.begin());
+  }
+
+  double checksum = 0.0;
+  for (const auto& pyramid : history.pyramids) {
+    const auto view_range =
+        pyramid.GetRange(column_bounds.front(), column_bounds.back());
+    const auto ymax = view_range.IsEmpty() ? 1.0f : view_range.max;
+    const auto to_y = [ymax](float value) { return 300.0f * value / ymax; };
+
+    int previous_x = -1;
+    MinMaxPyramid::Range previous_range;
+    for (int x = 0; x < width; ++x) {
+      const auto begin = column_bounds[x];
+      const auto end = column_bounds[x + 1];
+      if (begin == end) {
+        continue;
+      }
+      const auto range = pyramid.GetRange(begin, end);
+      if (range.IsEmpty()) {
+        previous_x = -1;
+        continue;
+      }
+
+      auto drawn = range;
+      if (previous_x >= 0 &&
+          timestamps[begin] - timestamps[column_bounds[previous_x + 1] - 1] <=
+              kMaxGapMs) {
+        if (previous_x == x - 1) {
+          drawn.min = std::min(drawn.min, previous_range.max);
+          drawn.max = std::max(drawn.max, previous_range.min);
+        } else {
+          checksum += to_y(0.5f * (range.min + range.max)) - previous_x;
+        }
+      }
+      previous_x = x;
+      previous_range = range;
+      checksum += to_y(drawn.max) - to_y(drawn.min) + x;
+    }
+  }
+  return checksum;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int width = argc > 1 ? std::max(1, std::atoi(argv[1])) : 1920;
+
+  const auto build_start = Clock::now();
+  const auto history = MakeHistory();
+  const auto build_us = ToMicroseconds(Clock::now() - build_start);
+  std::printf("%zu samples of %zu series, %d columns\n",
+              history.timestamps.size(), kNumSeries, width);
+  std::printf("%-32s %8.3f us per sample of all series\n", "append",
+              build_us / static_cast<double>(history.timestamps.size()));
+
+  std::vector<size_t> column_bounds;
+  double checksum = 0.0;
+  const int64_t end = history.timestamps.back() + kSecond;
+
+  struct View {
+    const char* name;
+    int64_t duration;
+  };
+  const View views[] = {{"24 h", kDay},
+                        {"6 h", 6 * kHour},
+                        {"1 h", kHour},
+                        {"5 min", 5 * 60 * kSecond},
+                        {"1 min", 60 * kSecond}};
+
+  // Panning from the start of the history to its end in 200 steps, as when
+  // dragging the view
+  bool over_budget = false;
+  for (const auto& view : views) {
+    std::vector<double> durations;
+    for (int i = 0; i <= 200; ++i) {
+      const auto view_end =
+          view.duration + (end - view.duration) * i / 200;
+      const auto start = Clock::now();
+      checksum += Paint(history, width, view_end - view.duration, view_end,
+                        column_bounds);
+      durations.push_back(ToMicroseconds(Clock::now() - start));
+    }
+    const auto summary = Summarize(durations);
+    over_budget = over_budget || summary.p99 > 2000.0;
+    Print(std::string("paint, panning over ") + view.name, summary);
+  }
+
+  // Zooming in and out around the middle of the day
+  std::vector<double> durations;
+  for (int i = 0; i <= 200; ++i) {
+    const auto duration = static_cast<int64_t>(
+        60.0 * kSecond * std::pow(1440.0, std::abs(i - 100) / 100.0));
+    const auto start = Clock::now();
+    checksum += Paint(history, width, kDay / 2 - duration / 2,
+                      kDay / 2 + duration / 2, column_bounds);
+    durations.push_back(ToMicroseconds(Clock::now() - start));
+  }
+  const auto zoom_summary = Summarize(durations);
+  over_budget = over_budget || zoom_summary.p99 > 2000.0;
+  Print("paint, zooming 1 min to 24 h", zoom_summary);
+
+  // What HistoryComponent::Append pays every capacity / 2 samples
+  auto pyramid = history.pyramids[0];
+  const auto drop_start = Clock::now();
+  pyramid.DropFront(pyramid.GetSize() / 2);
+  std::printf("%-32s %8.1f us per series\n", "drop half",
+              ToMicroseconds(Clock::now() - drop_start));
+
+  std::printf("(checksum %g)\n", checksum);
+  std::printf("%s the 2 ms budget\n", over_budget ? "Over" : "Within");
+  return over_budget ? 1 : 0;
+}
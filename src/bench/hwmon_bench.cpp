@@ -0,0 +1,231 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// Per-sample cost of the temperatures, CPU and GPU:
+//
+// - in-process: two HwmonSensors::Read, a pread each on the open files
+// - child process: the way temperature_reader.exe delivered them. A child
+//   reads the files and writes "<cpu> <gpu>\n" into a pipe, and the control
+//   thread takes it through LineReader and StringStream. The child answers a
+//   request byte, so every sample is one round trip, without the .NET
+//   runtime the reader needed.
+//
+// Runs on a fake sysfs tree in a temporary directory, or on SYSFS_CLASS_ROOT,
+// e.g. /sys/class, which then needs a k10temp or coretemp and an amdgpu or
+// nouveau sensor.
+//
+//   coolth_hwmon_bench [ITERATIONS] [SYSFS_CLASS_ROOT]
+
+#include "bbmp/hwmon_sensors.h"
+#include "bbmp/line_reader.h"
+#include "bbmp/stringstream.h"
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+namespace fs = std::filesystem;
+
+struct Summary {
+  double median;
+  double p99;
+  double max;
+};
+
+Summary Summarize(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const auto percentile = [&values](double p) {
+    return values[static_cast<size_t>(p *
+                                      static_cast<double>(values.size() - 1))];
+  };
+  return {percentile(0.5), percentile(0.99), values.back()};
+}
+
+double ToNanoseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+void Print(const char* name, const Summary& summary) {
+  std::printf("%-16s median %9.1f ns  p99 %9.1f ns  max %10.1f ns\n", name,
+              summary.median, summary.p99, summary.max);
+}
+
+fs::path MakeFakeSysfs() {
+  std::string pattern =
+      (fs::temp_directory_path() / "coolth_sysfs_XXXXXX").string();
+  const fs::path root = mkdtemp(pattern.data());
+
+  fs::create_directories(root / "hwmon/hwmon0");
+  std::ofstream(root / "hwmon/hwmon0/name") << "k10temp\n";
+  std::ofstream(root / "hwmon/hwmon0/temp1_input") << "45250\n";
+  fs::create_directories(root / "hwmon/hwmon1");
+  std::ofstream(root / "hwmon/hwmon1/name") << "amdgpu\n";
+  std::ofstream(root / "hwmon/hwmon1/temp1_input") << "61000\n";
+  return root;
+}
+
+std::string GetPath(int fd) {
+  return fs::read_symlink("/proc/self/fd/" + std::to_string(fd)).string();
+}
+
+int ReadMillidegrees(const std::string& path) {
+  std::ifstream is(path);
+  int millidegrees = 0;
+  is >> millidegrees;
+  return millidegrees;
+}
+
+// Answers every byte on request_fd with a line of whole degrees on reply_fd
+[[noreturn]] void RunReader(int request_fd, int reply_fd,
+                            const std::string& cpu_path,
+                            const std::string& gpu_path) {
+  // The line reader only trusts what follows the first newline
+  (void)write(reply_fd, "\n", 1);
+
+  char request;
+  while (read(request_fd, &request, 1) == 1) {
+    char line[32];
+    const int length =
+        std::snprintf(line, sizeof(line), "%d %d\n",
+                      ReadMillidegrees(cpu_path) / 1000,
+                      ReadMillidegrees(gpu_path) / 1000);
+    (void)write(reply_fd, line, static_cast<size_t>(length));
+  }
+  _exit(0);
+}
+
+std::vector<double> MeasureInProcess(const bbmp::HwmonSensors& sensors,
+                                     size_t i_cpu, size_t i_gpu,
+                                     int iterations) {
+  std::vector<double> durations;
+  durations.reserve(static_cast<size_t>(iterations));
+  float sum = 0.0f;
+  for (int i = 0; i < iterations; ++i) {
+    const auto start = Clock::now();
+    const auto cpu = sensors.Read(i_cpu);
+    const auto gpu = sensors.Read(i_gpu);
+    durations.push_back(ToNanoseconds(Clock::now() - start));
+    sum += cpu.value_or(0.0f) + gpu.value_or(0.0f);
+  }
+  std::printf("(checksum %.0f)\n", static_cast<double>(sum));
+  return durations;
+}
+
+std::vector<double> MeasureChildProcess(const std::string& cpu_path,
+                                        const std::string& gpu_path,
+                                        int iterations) {
+  int request_pipe[2];
+  int reply_pipe[2];
+  if (pipe(request_pipe) != 0 || pipe(reply_pipe) != 0) {
+    std::perror("pipe");
+    std::exit(1);
+  }
+
+  const pid_t child = fork();
+  if (child == 0) {
+    close(request_pipe[1]);
+    close(reply_pipe[0]);
+    RunReader(request_pipe[0], reply_pipe[1], cpu_path, gpu_path);
+  }
+  close(request_pipe[0]);
+  close(reply_pipe[1]);
+
+  std::optional<float> cpu, gpu;
+  bool line_complete = false;
+  LineReader line_reader(32, [&](const char* data, size_t length) {
+    StringStream stream(data, length);
+    const auto AsFloat = [](std::optional<int> value) -> std::optional<float> {
+      return value ? std::make_optional(static_cast<float>(*value))
+                   : std::nullopt;
+    };
+    cpu = AsFloat(stream.GetInt());
+    gpu = AsFloat(stream.GetInt());
+    line_complete = true;
+  });
+
+  // The greeting
+  char buffer[64];
+  if (read(reply_pipe[0], buffer, 1) == 1) {
+    line_reader.Read(buffer, 1);
+  }
+
+  const auto read_reply = [&] {
+    line_complete = false;
+    while (!line_complete) {
+      const auto length = read(reply_pipe[0], buffer, sizeof(buffer));
+      if (length <= 0) {
+        std::fprintf(stderr, "The reader process is gone\n");
+        std::exit(1);
+      }
+      line_reader.Read(buffer, static_cast<size_t>(length));
+    }
+  };
+
+  std::vector<double> durations;
+  durations.reserve(static_cast<size_t>(iterations));
+  float sum = 0.0f;
+  for (int i = 0; i < iterations; ++i) {
+    const auto start = Clock::now();
+    (void)write(request_pipe[1], "r", 1);
+    read_reply();
+    durations.push_back(ToNanoseconds(Clock::now() - start));
+    sum += cpu.value_or(0.0f) + gpu.value_or(0.0f);
+  }
+  std::printf("(checksum %.0f)\n", static_cast<double>(sum));
+
+  close(request_pipe[1]);
+  close(reply_pipe[0]);
+  waitpid(child, nullptr, 0);
+  return durations;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 100000;
+  const bool fake = argc <= 2;
+  const fs::path root = fake ? MakeFakeSysfs() : fs::path(argv[2]);
+
+  int result = 0;
+  {
+    bbmp::HwmonSensors sensors(root.string());
+    const auto i_cpu = sensors.Find({"k10temp", "coretemp"});
+    const auto i_gpu = sensors.Find({"amdgpu", "nouveau"});
+    if (!i_cpu || !i_gpu) {
+      std::fprintf(stderr, "No CPU or GPU sensor under %s\n",
+                   root.string().c_str());
+      result = 1;
+    } else {
+      // The paths the reader process opens on every sample
+      const auto cpu_path = GetPath(sensors.GetSensors()[*i_cpu].fd);
+      const auto gpu_path = GetPath(sensors.GetSensors()[*i_gpu].fd);
+
+      std::printf("%d samples of %s and %s\n", iterations, cpu_path.c_str(),
+                  gpu_path.c_str());
+      Print("in-process", Summarize(MeasureInProcess(sensors, *i_cpu, *i_gpu,
+                                                     iterations)));
+      Print("child process", Summarize(MeasureChildProcess(
+                                 cpu_path, gpu_path, iterations)));
+    }
+  }
+
+  if (fake) {
+    std::error_code error;
+    fs::remove_all(root, error);
+  }
+  return result;
+}
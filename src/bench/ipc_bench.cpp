@@ -0,0 +1,189 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// Runs an IpcServer in-process with many subscribers, publishes telemetry much
+// faster than the control loop would, and measures:
+//
+// - how long Publish takes on the publishing thread, i.e. what the control
+//   step pays for the fan-out
+// - how many telemetry frames reach the subscribers
+// - the round trip time of requests while the fan-out is running, one at a
+//   time and pipelined
+//
+//   coolth_ipc_bench [SUBSCRIBERS] [PUBLISH_HZ] [SECONDS]
+
+#include "coolth_ipc.h"
+#include "ipc_client.h"
+#include "ipc_server.h"
+#include "settings.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// What 2 sensors and 8 fans produce: 2 raw and 2 smoothed temperatures, 8
+// duty cycles and 8 RPMs
+constexpr size_t kNumValues = 4 + 2 * 8;
+constexpr int kNumPipelinedRequests = 10000;
+
+struct Summary {
+  double median;
+  double p99;
+  double max;
+};
+
+Summary Summarize(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const auto percentile = [&values](double p) {
+    return values[static_cast<size_t>(p *
+                                      static_cast<double>(values.size() - 1))];
+  };
+  return {percentile(0.5), percentile(0.99), values.back()};
+}
+
+double ToMicroseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int num_subscribers = argc > 1 ? std::stoi(argv[1]) : 100;
+  const int publish_hz = argc > 2 ? std::stoi(argv[2]) : 1000;
+  const int seconds = argc > 3 ? std::stoi(argv[3]) : 5;
+
+  const auto socket_path =
+      "/tmp/coolth_ipc_bench_" + std::to_string(getpid()) + ".sock";
+  CoolthSettings settings;
+  IpcServer server(settings, socket_path);
+
+  std::vector<std::unique_ptr<IpcClient>> subscribers;
+  std::vector<uint8_t> every_step;
+  coolth_ipc::Writer(every_step).U32(0);
+  for (int i = 0; i < num_subscribers; ++i) {
+    subscribers.push_back(std::make_unique<IpcClient>(socket_path));
+    subscribers.back()->Call(coolth_ipc::kSubscribe, every_step);
+  }
+
+  std::atomic<bool> should_stop{false};
+  std::atomic<bool> should_stop_receiving{false};
+  std::atomic<uint64_t> num_received{0};
+  std::thread receiver([&subscribers, &should_stop_receiving, &num_received] {
+    std::vector<pollfd> fds;
+    for (const auto& subscriber : subscribers) {
+      fds.push_back({subscriber->GetFd(), POLLIN, 0});
+    }
+    coolth_ipc::Frame frame;
+    while (!should_stop_receiving.load()) {
+      if (poll(fds.data(), fds.size(), 100) <= 0) {
+        continue;
+      }
+      for (size_t i = 0; i < fds.size(); ++i) {
+        if (fds[i].revents & POLLIN) {
+          while (subscribers[i]->TryReceive(frame)) {
+            if (frame.type == coolth_ipc::kTelemetry) {
+              num_received.fetch_add(1, std::memory_order_relaxed);
+            }
+          }
+        }
+      }
+    }
+  });
+
+  const auto run_begin = Clock::now();
+  uint64_t num_published = 0;
+  std::vector<double> publish_us;
+  std::thread publisher([&] {
+    const std::vector<float> values(kNumValues, 42.0f);
+    const auto period = std::chrono::nanoseconds(1000000000 / publish_hz);
+    auto next = Clock::now();
+    while (!should_stop.load()) {
+      const auto start = Clock::now();
+      server.Publish(static_cast<int64_t>(num_published), 2, values.data(),
+                     values.size());
+      publish_us.push_back(ToMicroseconds(Clock::now() - start));
+      ++num_published;
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+  });
+
+  // One request at a time while the fan-out is running
+  IpcClient commander(socket_path);
+  std::vector<double> round_trip_us;
+  const auto begin = Clock::now();
+  const auto end = begin + std::chrono::seconds(seconds);
+  while (Clock::now() < end) {
+    const auto start = Clock::now();
+    commander.Call(coolth_ipc::kPing);
+    round_trip_us.push_back(ToMicroseconds(Clock::now() - start));
+  }
+  const auto elapsed_s =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+
+  // Requests sent back to back, then all replies collected
+  const auto pipelined_start = Clock::now();
+  for (int i = 0; i < kNumPipelinedRequests; ++i) {
+    commander.Send(coolth_ipc::kPing);
+  }
+  for (int num_replies = 0; num_replies < kNumPipelinedRequests;) {
+    if (commander.Receive().type == coolth_ipc::kReply) {
+      ++num_replies;
+    }
+  }
+  const auto pipelined_s =
+      std::chrono::duration<double>(Clock::now() - pipelined_start).count();
+
+  should_stop.store(true);
+  publisher.join();
+  const auto run_s =
+      std::chrono::duration<double>(Clock::now() - run_begin).count();
+
+  // Frames still in flight get a second to arrive
+  const auto num_expected = num_published * num_subscribers;
+  const auto drain_deadline = Clock::now() + std::chrono::seconds(1);
+  while (num_received.load() < num_expected && Clock::now() < drain_deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  should_stop_receiving.store(true);
+  receiver.join();
+
+  const auto publish = Summarize(publish_us);
+  const auto round_trip = Summarize(round_trip_us);
+  std::printf("subscribers: %d, published: %llu at %d Hz over %.1f s\n",
+              num_subscribers, static_cast<unsigned long long>(num_published),
+              publish_hz, run_s);
+  std::printf("Publish: median %.2f us, p99 %.2f us, max %.2f us\n",
+              publish.median, publish.p99, publish.max);
+  std::printf("delivered: %llu of %llu frames (%.1f %%), %.0f frames/s, "
+              "dropped by the server: %llu\n",
+              static_cast<unsigned long long>(num_received.load()),
+              static_cast<unsigned long long>(num_expected),
+              100.0 * static_cast<double>(num_received.load()) /
+                  static_cast<double>(std::max<uint64_t>(num_expected, 1)),
+              static_cast<double>(num_received.load()) / run_s,
+              static_cast<unsigned long long>(server.GetNumDroppedFrames()));
+  std::printf("round trip: %zu requests, median %.1f us, p99 %.1f us, max "
+              "%.1f us, %.0f requests/s\n",
+              round_trip_us.size(), round_trip.median, round_trip.p99,
+              round_trip.max,
+              static_cast<double>(round_trip_us.size()) / elapsed_s);
+  std::printf("pipelined: %d requests in %.1f ms, %.0f requests/s\n",
+              kNumPipelinedRequests, 1000.0 * pipelined_s,
+              kNumPipelinedRequests / pipelined_s);
+  return 0;
+}
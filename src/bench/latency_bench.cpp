@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// Measures what timing a stage of the control pipeline costs:
+//
+// - LatencyHistogram::Record on its own
+// - PipelineLatency::Record, which adds finding the histograms of the thread
+// - PipelineLatency::RecordSince, which adds the clock read every stage needs
+//
+// The calls are too short to time one by one, so every figure is the mean of
+// a batch. The percentiles of a known distribution are printed as a check.
+//
+//   coolth_latency_bench [ITERATIONS]
+
+#include "bbmp/latency_histogram.h"
+#include "pipeline_latency.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+template <typename F>
+double MeasureNanoseconds(int iterations, F&& f) {
+  const auto start = Clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f(i);
+  }
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+             .count() /
+         iterations;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int iterations = argc > 1 ? std::stoi(argv[1]) : 10000000;
+  using Stage = PipelineLatency::Stage;
+  auto& latency = PipelineLatency::GetInstance();
+
+  // Values spread over many buckets, like real latencies
+  const auto value = [](int i) {
+    return static_cast<uint64_t>((i * 2654435761u) % 1000000);
+  };
+
+  auto histogram = std::make_unique<bbmp::LatencyHistogram>();
+  std::printf("LatencyHistogram::Record      %6.1f ns\n",
+              MeasureNanoseconds(iterations, [&histogram, &value](int i) {
+                histogram->Record(value(i));
+              }));
+
+  std::printf("PipelineLatency::Record       %6.1f ns\n",
+              MeasureNanoseconds(iterations, [&latency, &value](int i) {
+                latency.Record(Stage::kCurves,
+                               std::chrono::nanoseconds(value(i)));
+              }));
+
+  volatile int64_t sink = 0;
+  std::printf("steady_clock::now             %6.1f ns\n",
+              MeasureNanoseconds(iterations, [&sink](int) {
+                sink = Clock::now().time_since_epoch().count();
+              }));
+
+  auto stage_start = Clock::now();
+  std::printf("PipelineLatency::RecordSince  %6.1f ns\n",
+              MeasureNanoseconds(iterations, [&latency, &stage_start](int) {
+                stage_start = latency.RecordSince(Stage::kCommand, stage_start);
+              }));
+
+  bbmp::LatencyHistogram::Counts counts;
+  histogram->Load(counts);
+  std::printf("Uniform 0-1 ms: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+              counts.GetPercentile(0.5) / 1e3, counts.GetPercentile(0.99) / 1e3,
+              counts.max_ns / 1e3);
+  return 0;
+}
@@ -0,0 +1,182 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// The log view without a window, flooded with 10000 messages per second: the
+// 10 Hz LogComponent::Update appending 1000 messages, each followed by a
+// repaint of the visible rows, for 30 seconds of messages, i.e. three times
+// the capacity of the ring.
+//
+// The text is a std::string formatted like in LogComponent::Update instead of
+// a juce::String, and a paint sums up the lengths of the visible rows instead
+// of drawing them. The figures are grouped by the length of the history, and
+// should be the same in every group.
+//
+// Switching the filters, which rebuilds the rows from the full ring, is
+// measured too.
+//
+//   coolth_log_view_bench [VISIBLE_ROWS]
+
+#include "log_history.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr int kUpdatesPerSecond = 10;
+constexpr int kMessagesPerUpdate = 1000;
+constexpr int kNumUpdates = 30 * kUpdatesPerSecond;
+
+struct Summary {
+  double median;
+  double p99;
+  double max;
+};
+
+Summary Summarize(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const auto percentile = [&values](double p) {
+    return values[static_cast<size_t>(p *
+                                      static_cast<double>(values.size() - 1))];
+  };
+  return {percentile(0.5), percentile(0.99), values.back()};
+}
+
+double ToMicroseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void Print(const std::string& name, const Summary& summary) {
+  std::printf("%-32s median %8.1f us  p99 %8.1f us  max %8.1f us\n",
+              name.c_str(), summary.median, summary.p99, summary.max);
+}
+
+using History = LogHistory<std::string>;
+
+// One in ten messages is a warning, one in a hundred an error, from four
+// threads
+History::Entry MakeEntry(uint64_t i) {
+  const auto level = i % 100 == 0  ? bbmp::LogLevel::kError
+                     : i % 10 == 0 ? bbmp::LogLevel::kWarning
+                                   : bbmp::LogLevel::kInfo;
+  const auto thread_id = static_cast<uint32_t>(i % 4 + 1);
+  char text[96];
+  std::snprintf(text, sizeof(text), "%02d:%02d:%02d [%u] Message number %llu",
+                static_cast<int>(i / 36000000 % 24),
+                static_cast<int>(i / 600000 % 60),
+                static_cast<int>(i / 10000 % 60), thread_id,
+                static_cast<unsigned long long>(i));
+  return {text, level, thread_id};
+}
+
+// What LogComponent::paint reads when following the newest message. Returns a
+// checksum, so nothing is optimized away.
+size_t Paint(const History& history, size_t num_visible_rows) {
+  const auto num_rows = history.GetNumRows();
+  const auto first_row =
+      num_rows > num_visible_rows ? num_rows - num_visible_rows : 0;
+  size_t checksum = 0;
+  for (auto row = first_row; row < num_rows; ++row) {
+    const auto& entry = history.GetRow(row);
+    checksum += entry.text.size() + static_cast<size_t>(entry.level);
+  }
+  return checksum;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const auto num_visible_rows =
+      static_cast<size_t>(argc > 1 ? std::max(1, std::atoi(argv[1])) : 40);
+
+  // The first update that falls into each group
+  struct Group {
+    const char* name;
+    uint64_t first_message;
+    std::vector<double> update_durations;
+    std::vector<double> paint_durations;
+  };
+  Group groups[] = {{"0 - 25k", 0, {}, {}},
+                    {"25k - 50k", 25000, {}, {}},
+                    {"50k - 100k", 50000, {}, {}},
+                    {"full ring, 100k - 300k", History::kCapacity, {}, {}}};
+
+  History history;
+  std::vector<History::Entry> batch;
+  size_t checksum = 0;
+  size_t num_rows_dropped = 0;
+  uint64_t next_message = 0;
+
+  for (int update = 0; update < kNumUpdates; ++update) {
+    auto* group = &groups[0];
+    for (auto& g : groups) {
+      if (history.GetNumMessages() >= g.first_message) {
+        group = &g;
+      }
+    }
+
+    // The messages are made outside of the timed part, as in the component
+    // they come formatted from the logger
+    batch.clear();
+    for (int i = 0; i < kMessagesPerUpdate; ++i) {
+      batch.push_back(MakeEntry(next_message++));
+    }
+
+    const auto update_start = Clock::now();
+    for (auto& entry : batch) {
+      num_rows_dropped += history.Append(std::move(entry));
+    }
+    group->update_durations.push_back(
+        ToMicroseconds(Clock::now() - update_start));
+
+    const auto paint_start = Clock::now();
+    checksum += Paint(history, num_visible_rows);
+    group->paint_durations.push_back(
+        ToMicroseconds(Clock::now() - paint_start));
+  }
+
+  std::printf("%d messages in updates of %d, %zu visible rows\n",
+              kNumUpdates * kMessagesPerUpdate, kMessagesPerUpdate,
+              num_visible_rows);
+  for (const auto& group : groups) {
+    Print(std::string("update, ") + group.name,
+          Summarize(group.update_durations));
+  }
+  for (const auto& group : groups) {
+    Print(std::string("paint, ") + group.name,
+          Summarize(group.paint_durations));
+  }
+
+  // What LogComponent::RebuildFilter pays when a combo box changes
+  struct Filter {
+    const char* name;
+    bbmp::LogLevel min_level;
+    uint32_t source;
+  };
+  const Filter filters[] = {{"warnings", bbmp::LogLevel::kWarning, 0},
+                            {"errors", bbmp::LogLevel::kError, 0},
+                            {"one thread", bbmp::LogLevel::kDebug, 2},
+                            {"all", bbmp::LogLevel::kDebug, 0}};
+  for (const auto& filter : filters) {
+    const auto start = Clock::now();
+    history.SetFilter(filter.min_level, filter.source);
+    const auto rebuild_us = ToMicroseconds(Clock::now() - start);
+    std::printf("%-32s %8.1f us for %zu of %llu rows\n",
+                (std::string("filter, ") + filter.name).c_str(), rebuild_us,
+                history.GetNumRows(),
+                static_cast<unsigned long long>(History::kCapacity));
+    checksum += Paint(history, num_visible_rows);
+  }
+
+  std::printf("(checksum %zu, %zu rows dropped)\n", checksum,
+              num_rows_dropped);
+  return 0;
+}
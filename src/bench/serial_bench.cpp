@@ -0,0 +1,152 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// Measures bbmp::Serial on a pty:
+//
+// - read: from the device writing a byte to the read callback running, with
+//   the control thread blocked in WindowsSleepEx as it is between steps
+// - write: from TryIssueWrite to the byte arriving at the device
+//
+// The device side is a thread on the pty master. Each byte is written after a
+// pause, so every sample includes a wakeup from an idle wait.
+//
+//   coolth_serial_bench [ITERATIONS]
+
+#include "bbmp/serial.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Summary {
+  double median;
+  double p99;
+  double max;
+};
+
+Summary Summarize(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const auto percentile = [&values](double p) {
+    return values[static_cast<size_t>(p *
+                                      static_cast<double>(values.size() - 1))];
+  };
+  return {percentile(0.5), percentile(0.99), values.back()};
+}
+
+double ToMicroseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void Print(const char* name, const Summary& summary) {
+  std::printf("%-8s median %8.1f us  p99 %8.1f us  max %9.1f us\n", name,
+              summary.median, summary.p99, summary.max);
+}
+
+int OpenPtyMaster() {
+  const int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master_fd == -1 || grantpt(master_fd) != 0 ||
+      unlockpt(master_fd) != 0) {
+    throw std::runtime_error(std::string("posix_openpt failed. Reason: ") +
+                             strerror(errno));
+  }
+
+  termios attributes;
+  tcgetattr(master_fd, &attributes);
+  cfmakeraw(&attributes);
+  tcsetattr(master_fd, TCSANOW, &attributes);
+  return master_fd;
+}
+
+std::vector<double> MeasureRead(int master_fd, const char* port_name,
+                                int iterations) {
+  std::vector<double> latencies;
+  latencies.reserve(static_cast<size_t>(iterations));
+
+  std::atomic<Clock::rep> sent_at{0};
+  bool received = false;
+  bbmp::Serial serial(port_name, [&](const char*, size_t) {
+    latencies.push_back(ToMicroseconds(
+        Clock::now() - Clock::time_point(Clock::duration(sent_at.load()))));
+    received = true;
+  });
+
+  for (int i = 0; i < iterations; ++i) {
+    received = false;
+    serial.IssueRead();
+
+    std::thread device([&] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      sent_at = Clock::now().time_since_epoch().count();
+      (void)write(master_fd, "x", 1);
+    });
+
+    while (!received) {
+      bbmp::Serial::WindowsSleepEx(100, true);
+    }
+    device.join();
+  }
+  return latencies;
+}
+
+std::vector<double> MeasureWrite(int master_fd, const char* port_name,
+                                 int iterations) {
+  std::vector<double> latencies;
+  latencies.reserve(static_cast<size_t>(iterations));
+
+  bbmp::Serial serial(port_name, [](const char*, size_t) {});
+  for (int i = 0; i < iterations; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const auto start = Clock::now();
+    while (!serial.TryIssueWrite("x", 1)) {
+      bbmp::Serial::WindowsSleepEx(1, true);
+    }
+
+    pollfd poll_fd{master_fd, POLLIN, 0};
+    poll(&poll_fd, 1, 1000);
+    char byte;
+    (void)read(master_fd, &byte, 1);
+    latencies.push_back(ToMicroseconds(Clock::now() - start));
+
+    // Lets the write complete
+    bbmp::Serial::WindowsSleepEx(0, true);
+  }
+  return latencies;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 1000;
+
+  const int master_fd = OpenPtyMaster();
+  const std::string port_name = ptsname(master_fd);
+
+  std::printf("%d iterations on %s\n", iterations, port_name.c_str());
+  Print("read", Summarize(MeasureRead(master_fd, port_name.c_str(),
+                                      iterations)));
+  Print("write", Summarize(MeasureWrite(master_fd, port_name.c_str(),
+                                        iterations)));
+
+  close(master_fd);
+  return 0;
+}
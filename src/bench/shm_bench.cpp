@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// Runs a TelemetryShmWriter in-process and measures:
+//
+// - how long Publish takes, i.e. what the control step pays for the segment
+// - how long a Reader takes for a snapshot while nothing is published
+// - the same with a thread publishing at PUBLISH_HZ, far more often than the
+//   control loop does, and how often the reader had to retry
+//
+// Every call is timed on its own, so the figures include one steady_clock
+// read, which is printed first.
+//
+//   coolth_shm_bench [ITERATIONS] [PUBLISH_HZ]
+
+#include "control_engine.h"
+#include "settings.h"
+#include "telemetry_shm.h"
+#include "telemetry_shm_writer.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Summary {
+  double median;
+  double p99;
+  double max;
+};
+
+Summary Summarize(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  const auto percentile = [&values](double p) {
+    return values[static_cast<size_t>(p *
+                                      static_cast<double>(values.size() - 1))];
+  };
+  return {percentile(0.5), percentile(0.99), values.back()};
+}
+
+double ToNanoseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+void Print(const char* name, const Summary& summary) {
+  std::printf("%-36s median %7.1f ns  p99 %7.1f ns  max %9.1f ns\n", name,
+              summary.median, summary.p99, summary.max);
+}
+
+// A control step of num_sensors and num_fans with plausible values
+struct FakeStep {
+  FakeStep(size_t num_sensors, size_t num_fans)
+      : raw_temps(num_sensors, 55.0f),
+        temps(num_sensors, 54.5f),
+        duty_cycles(num_fans, 42.0f),
+        rpms(num_fans, 1200),
+        duty_points(num_fans),
+        telemetry(2 * num_sensors + 2 * num_fans, 0.0f) {
+    step.timestamp_ms = 0;
+    step.num_sensors = num_sensors;
+    step.raw_temps = raw_temps.data();
+    step.temps = temps.data();
+    step.smooth_temps = true;
+    step.num_fans = num_fans;
+    step.duty_cycles = duty_cycles.data();
+    step.rpms = rpms.data();
+    step.duty_points = duty_points.data();
+    step.telemetry = telemetry.data();
+    step.num_telemetry_channels = telemetry.size();
+  }
+
+  std::vector<float> raw_temps;
+  std::vector<float> temps;
+  std::vector<float> duty_cycles;
+  std::vector<int> rpms;
+  std::vector<std::optional<CurvePoint>> duty_points;
+  std::vector<float> telemetry;
+  ControlEngine::Step step;
+};
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int iterations = argc > 1 ? std::stoi(argv[1]) : 1000000;
+  const int publish_hz = argc > 2 ? std::stoi(argv[2]) : 10000;
+  const auto name = "/coolth_shm_bench_" + std::to_string(getpid());
+
+  // The names of the sensors are copied once, the first time they appear
+  CoolthSettings settings;
+  CoolthSettings::TSensors sensors;
+  for (size_t i = 2; i < telemetry_shm::kMaxSensors; ++i) {
+    const auto id = "sensor_" + std::to_string(i);
+    sensors.push_back({id, id, {}});
+  }
+  settings.EnsureSensors(sensors);
+
+  TelemetryShmWriter writer(settings, name);
+  telemetry_shm::Reader reader(name.c_str());
+  telemetry_shm::Snapshot snapshot;
+  std::vector<double> durations(iterations);
+
+  for (int i = 0; i < iterations; ++i) {
+    const auto start = Clock::now();
+    durations[i] = ToNanoseconds(Clock::now() - start);
+  }
+  Print("steady_clock", Summarize(durations));
+
+  const std::pair<size_t, size_t> sizes[] = {{2, 8}, {2, 128}, {128, 64}};
+  for (const auto& [num_sensors, num_fans] : sizes) {
+    const auto size = std::to_string(num_sensors) + " sensors, " +
+                      std::to_string(num_fans) + " fans";
+    FakeStep fake(num_sensors, num_fans);
+    for (int i = 0; i < iterations; ++i) {
+      fake.step.timestamp_ms = i;
+      const auto start = Clock::now();
+      writer.Publish(fake.step);
+      durations[i] = ToNanoseconds(Clock::now() - start);
+    }
+    Print(("Publish, " + size).c_str(), Summarize(durations));
+
+    for (int i = 0; i < iterations; ++i) {
+      const auto start = Clock::now();
+      reader.Read(snapshot);
+      durations[i] = ToNanoseconds(Clock::now() - start);
+    }
+    Print(("Read, " + size).c_str(), Summarize(durations));
+  }
+
+  // Contended: the writer publishes 2 sensors and 8 fans at publish_hz
+  std::atomic<bool> stop{false};
+  std::thread publisher([&writer, &stop, publish_hz] {
+    FakeStep fake(2, 8);
+    const auto period = std::chrono::nanoseconds(1000000000 / publish_hz);
+    auto next = Clock::now();
+    for (int64_t i = 0; !stop; ++i) {
+      fake.step.timestamp_ms = i;
+      writer.Publish(fake.step);
+      next += period;
+      std::this_thread::sleep_until(next);
+    }
+  });
+  size_t num_retries = 0;
+  size_t num_failures = 0;
+  for (int i = 0; i < iterations; ++i) {
+    int num_attempts = 0;
+    const auto start = Clock::now();
+    num_failures += !reader.Read(snapshot, 1000, &num_attempts);
+    durations[i] = ToNanoseconds(Clock::now() - start);
+    num_retries += num_attempts - 1;
+  }
+  stop = true;
+  publisher.join();
+  Print(("Read, publishing at " + std::to_string(publish_hz) + " Hz").c_str(),
+        Summarize(durations));
+  std::printf("Retries: %zu in %d reads, %zu failed\n", num_retries,
+              iterations, num_failures);
+  std::printf("Hardware threads: %u\n", std::thread::hardware_concurrency());
+  return 0;
+}
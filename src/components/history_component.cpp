@@ -0,0 +1,348 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "history_component.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+
+namespace {
+constexpr int kLeftMargin = 44;
+constexpr int kRightMargin = 10;
+constexpr int kBottomMargin = 22;
+constexpr int kTitleHeight = 16;
+constexpr int kPlotSpacing = 6;
+
+constexpr int64_t kMinVisibleDurationMs = 60 * 1000;
+// Samples further apart are not connected by a line
+constexpr int64_t kMaxGapMs = 5000;
+
+int64_t GetCurrentTimeMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+}  // namespace
+
+HistoryComponent::HistoryComponent(std::vector<Plot> plots, size_t capacity)
+    : capacity_(std::max(capacity, size_t{2})) {
+  SetPlots(std::move(plots));
+}
+
+void HistoryComponent::SetPlots(std::vector<Plot> plots) {
+  {
+    auto lock = std::lock_guard(mutex_);
+
+    // [i_plot][i_legend] -> index into series_
+    std::vector<std::vector<size_t>> old_series(plots_.size());
+    for (size_t i = 0; i < series_.size(); ++i) {
+      old_series[series_[i].i_plot].push_back(i);
+    }
+
+    std::vector<Series> series;
+    const auto colour = findColour(juce::Slider::thumbColourId);
+    for (size_t i_plot = 0; i_plot < plots.size(); ++i_plot) {
+      const auto& legend = plots[i_plot].legend;
+      for (size_t i = 0; i < legend.size(); ++i) {
+        series.push_back(
+            {i_plot,
+             colour.withRotatedHue(static_cast<float>(i) / legend.size()),
+             {}});
+        if (i_plot < old_series.size() && i < old_series[i_plot].size()) {
+          series.back().pyramid =
+              std::move(series_[old_series[i_plot][i]].pyramid);
+        } else {
+          for (size_t i_sample = 0; i_sample < timestamps_.size();
+               ++i_sample) {
+            series.back().pyramid.Append(std::nanf(""));
+          }
+        }
+      }
+    }
+
+    plots_ = std::move(plots);
+    series_ = std::move(series);
+  }
+  triggerAsyncUpdate();
+}
+
+void HistoryComponent::Append(int64_t timestamp_ms, const float* values) {
+  {
+    auto lock = std::lock_guard(mutex_);
+    if (timestamps_.size() >= capacity_) {
+      // Dropping half at once keeps the cost of rebuilding the pyramids
+      // amortized constant per sample
+      const auto num_dropped = capacity_ / 2;
+      timestamps_.erase(timestamps_.begin(),
+                        timestamps_.begin() + num_dropped);
+      for (auto& series : series_) {
+        series.pyramid.DropFront(num_dropped);
+      }
+    }
+
+    timestamps_.push_back(timestamp_ms);
+    for (size_t i = 0; i < series_.size(); ++i) {
+      series_[i].pyramid.Append(values[i]);
+    }
+  }
+  triggerAsyncUpdate();
+}
+
+void HistoryComponent::paint(juce::Graphics& g) {
+  auto lock = std::lock_guard(mutex_);
+
+  const auto plot_area = GetPlotArea();
+  const auto width = plot_area.getWidth();
+  if (width <= 0 || plots_.empty()) {
+    return;
+  }
+
+  const auto view_end = GetViewEnd();
+  const auto view_start = view_end - visible_duration_ms_;
+
+  // Every series shares the timestamps, so the samples falling into each
+  // column are only searched for once
+  column_bounds_.resize(static_cast<size_t>(width) + 1);
+  auto it = timestamps_.begin();
+  for (int x = 0; x <= width; ++x) {
+    const auto t = view_start + visible_duration_ms_ * x / width;
+    it = std::lower_bound(it, timestamps_.end(), t);
+    column_bounds_[x] = static_cast<size_t>(it - timestamps_.begin());
+  }
+
+  const auto num_plots = static_cast<int>(plots_.size());
+  const auto plot_height =
+      (plot_area.getHeight() - kPlotSpacing * (num_plots - 1)) / num_plots;
+  auto remaining_area = plot_area;
+  const int font_size = g.getCurrentFont().getHeightInPoints();
+
+  for (size_t i_plot = 0; i_plot < plots_.size(); ++i_plot) {
+    const auto& plot = plots_[i_plot];
+    auto area = remaining_area.removeFromTop(plot_height);
+    remaining_area.removeFromTop(kPlotSpacing);
+    auto title_area = area.removeFromTop(kTitleHeight);
+
+    auto ymax = plot.ymax;
+    if (plot.grow_ymax) {
+      for (const auto& series : series_) {
+        if (series.i_plot != i_plot) {
+          continue;
+        }
+        const auto range = series.pyramid.GetRange(column_bounds_.front(),
+                                                   column_bounds_.back());
+        if (!range.IsEmpty() && range.max > ymax) {
+          ymax = std::ceil(range.max / plot.ytick) * plot.ytick;
+        }
+      }
+    }
+
+    g.setColour(findColour(juce::Slider::textBoxOutlineColourId));
+    g.drawRect(area);
+
+    // Leaves at least two lines of text between the grid lines
+    auto ytick = plot.ytick;
+    while ((ymax - plot.ymin) / ytick * 2 * font_size > area.getHeight()) {
+      ytick *= 2;
+    }
+    for (auto v = plot.ymin; v <= ymax; v += ytick) {
+      const auto y = area.getBottom() -
+                     (v - plot.ymin) / (ymax - plot.ymin) * area.getHeight();
+      g.drawHorizontalLine(static_cast<int>(y), area.getX(), area.getRight());
+      g.drawText(juce::String(v, 0, false), 0,
+                 static_cast<int>(y - font_size * 0.5f), kLeftMargin - 6,
+                 font_size, juce::Justification::centredRight);
+    }
+
+    g.setColour(findColour(juce::Label::textColourId));
+    g.drawText(plot.label, title_area.removeFromLeft(120),
+               juce::Justification::left);
+    size_t i_legend = 0;
+    for (const auto& series : series_) {
+      if (series.i_plot == i_plot) {
+        g.setColour(series.colour);
+        g.drawText(plot.legend[i_legend++], title_area.removeFromLeft(48),
+                   juce::Justification::left);
+      }
+    }
+
+    juce::Graphics::ScopedSaveState state(g);
+    g.reduceClipRegion(area);
+    for (const auto& series : series_) {
+      if (series.i_plot == i_plot) {
+        PaintSeries(g, series, area, plot.ymin, ymax);
+      }
+    }
+  }
+
+  const auto time_axis_area = getLocalBounds()
+                                  .removeFromBottom(kBottomMargin)
+                                  .withX(plot_area.getX())
+                                  .withWidth(width);
+  PaintTimeAxis(g, time_axis_area, view_start, view_end);
+}
+
+void HistoryComponent::PaintSeries(juce::Graphics& g, const Series& series,
+                                   juce::Rectangle<int> area, float ymin,
+                                   float ymax) {
+  const auto to_y = [&area, ymin, ymax](float value) {
+    return area.getBottom() - (value - ymin) / (ymax - ymin) * area.getHeight();
+  };
+
+  g.setColour(series.colour);
+  int previous_x = -1;
+  MinMaxPyramid::Range previous_range;
+  const auto width = static_cast<int>(column_bounds_.size()) - 1;
+
+  for (int x = 0; x < width; ++x) {
+    const auto begin = column_bounds_[x];
+    const auto end = column_bounds_[x + 1];
+    if (begin == end) {
+      continue;
+    }
+
+    const auto range = series.pyramid.GetRange(begin, end);
+    if (range.IsEmpty()) {
+      previous_x = -1;
+      continue;
+    }
+
+    auto drawn = range;
+    if (previous_x >= 0 &&
+        timestamps_[begin] - timestamps_[column_bounds_[previous_x + 1] - 1] <=
+            kMaxGapMs) {
+      if (previous_x == x - 1) {
+        // Stretches the column to meet the previous one
+        drawn.min = std::min(drawn.min, previous_range.max);
+        drawn.max = std::max(drawn.max, previous_range.min);
+      } else {
+        g.drawLine(static_cast<float>(area.getX() + previous_x),
+                   to_y(0.5f * (previous_range.min + previous_range.max)),
+                   static_cast<float>(area.getX() + x),
+                   to_y(0.5f * (range.min + range.max)));
+      }
+    }
+    previous_x = x;
+    previous_range = range;
+
+    const auto top = to_y(drawn.max);
+    const auto bottom = std::max(to_y(drawn.min), top + 1.0f);
+    g.drawVerticalLine(area.getX() + x, top, bottom);
+  }
+}
+
+void HistoryComponent::PaintTimeAxis(juce::Graphics& g,
+                                     juce::Rectangle<int> area,
+                                     int64_t view_start, int64_t view_end) {
+  constexpr int64_t kSecond = 1000;
+  constexpr int64_t kMinute = 60 * kSecond;
+  constexpr int64_t kHour = 60 * kMinute;
+  constexpr int64_t kSteps[] = {
+      kSecond,     5 * kSecond, 15 * kSecond, 30 * kSecond, kMinute,
+      5 * kMinute, 15 * kMinute, 30 * kMinute, kHour,       3 * kHour,
+      6 * kHour,   12 * kHour,   24 * kHour};
+  constexpr int kMinTickSpacing = 70;
+
+  const auto duration = view_end - view_start;
+  auto step = kSteps[std::size(kSteps) - 1];
+  for (const auto s : kSteps) {
+    if (s * area.getWidth() >= kMinTickSpacing * duration) {
+      step = s;
+      break;
+    }
+  }
+
+  // Ticks are placed at round local times
+  const int64_t utc_offset =
+      juce::Time(view_start).getUTCOffsetSeconds() * int64_t{1000};
+  const auto first_tick =
+      ((view_start + utc_offset + step - 1) / step) * step - utc_offset;
+  const auto* format =
+      step < kMinute ? "%H:%M:%S" : (step < 24 * kHour ? "%H:%M" : "%d %b");
+
+  g.setColour(findColour(juce::Label::textColourId));
+  const int label_width = kMinTickSpacing;
+  for (auto t = first_tick; t <= view_end; t += step) {
+    const auto x =
+        area.getX() + static_cast<int>((t - view_start) * area.getWidth() /
+                                       duration);
+    g.drawText(juce::Time(t).formatted(format), x - label_width / 2,
+               area.getY(), label_width, area.getHeight(),
+               juce::Justification::centred);
+  }
+}
+
+juce::Rectangle<int> HistoryComponent::GetPlotArea() const {
+  auto area = getLocalBounds();
+  area.removeFromLeft(kLeftMargin);
+  area.removeFromRight(kRightMargin);
+  area.removeFromTop(4);
+  area.removeFromBottom(kBottomMargin);
+  return area;
+}
+
+// Must be called with mutex_ held
+int64_t HistoryComponent::GetViewEnd() const {
+  if (view_end_ms_) {
+    return *view_end_ms_;
+  }
+  return timestamps_.empty() ? GetCurrentTimeMs() : timestamps_.back();
+}
+
+void HistoryComponent::mouseDown(const juce::MouseEvent&) {
+  auto lock = std::lock_guard(mutex_);
+  drag_start_view_end_ms_ = GetViewEnd();
+}
+
+void HistoryComponent::mouseDrag(const juce::MouseEvent& e) {
+  const auto width = std::max(GetPlotArea().getWidth(), 1);
+  const auto view_end = drag_start_view_end_ms_ -
+                        e.getDistanceFromDragStartX() * visible_duration_ms_ /
+                            width;
+  {
+    auto lock = std::lock_guard(mutex_);
+    if (!timestamps_.empty() && view_end >= timestamps_.back()) {
+      view_end_ms_.reset();
+    } else {
+      view_end_ms_ = view_end;
+    }
+  }
+  repaint();
+}
+
+void HistoryComponent::mouseDoubleClick(const juce::MouseEvent&) {
+  view_end_ms_.reset();
+  repaint();
+}
+
+void HistoryComponent::mouseWheelMove(const juce::MouseEvent& e,
+                                      const juce::MouseWheelDetails& wheel) {
+  const auto plot_area = GetPlotArea();
+  const auto width = std::max(plot_area.getWidth(), 1);
+  const auto new_duration = std::clamp(
+      static_cast<int64_t>(visible_duration_ms_ *
+                           std::exp2(-2.0f * wheel.deltaY)),
+      kMinVisibleDurationMs, static_cast<int64_t>(capacity_) * 1000);
+
+  {
+    auto lock = std::lock_guard(mutex_);
+    const auto view_end = GetViewEnd();
+    const auto x = std::clamp(e.x - plot_area.getX(), 0, width);
+
+    // Keeps the time under the cursor in place, unless following the newest
+    // sample
+    if (view_end_ms_) {
+      const auto cursor_time =
+          view_end - visible_duration_ms_ + visible_duration_ms_ * x / width;
+      view_end_ms_ = cursor_time + (view_end - cursor_time) * new_duration /
+                                       visible_duration_ms_;
+    }
+  }
+  visible_duration_ms_ = new_duration;
+  repaint();
+}
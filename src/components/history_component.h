@@ -0,0 +1,102 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "min_max_pyramid.h"
+
+#include <juce_gui_basics/juce_gui_basics.h>
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/*
+ * Plots the recent history of the control loop, one plot per quantity stacked
+ * vertically, with a shared time axis.
+ *
+ * Every series keeps a MinMaxPyramid, so a column of pixels covering any
+ * number of samples is drawn as a single vertical line from the minimum to the
+ * maximum of its samples. The cost of a repaint only depends on the width.
+ *
+ * Mouse wheel zooms around the cursor, dragging pans, a double click returns
+ * to following the newest samples.
+ */
+class HistoryComponent : public juce::Component, public juce::AsyncUpdater {
+ public:
+  struct Plot {
+    juce::String label;
+    float ymin;
+    float ymax;
+    float ytick;
+    // Raises ymax in steps of ytick to fit the visible samples
+    bool grow_ymax;
+    std::vector<juce::String> legend;
+  };
+
+  // capacity is the number of samples kept
+  explicit HistoryComponent(std::vector<Plot> plots,
+                            size_t capacity = 7 * 24 * 3600);
+
+  size_t GetNumSeries() const {
+    auto lock = std::lock_guard(mutex_);
+    return series_.size();
+  }
+
+  // Series at the same place in the old and the new plots keep their samples,
+  // the others start out with every sample missing. Can be called from any
+  // thread.
+  void SetPlots(std::vector<Plot> plots);
+
+  // values has one entry for each series, in the order of the plots' legends.
+  // NaN marks a missing value. Can be called from any thread.
+  void Append(int64_t timestamp_ms, const float* values);
+
+  void paint(juce::Graphics& g) override;
+
+  void mouseDown(const juce::MouseEvent& e) override;
+  void mouseDrag(const juce::MouseEvent& e) override;
+  void mouseDoubleClick(const juce::MouseEvent& e) override;
+  void mouseWheelMove(const juce::MouseEvent& e,
+                      const juce::MouseWheelDetails& wheel) override;
+
+  void handleAsyncUpdate() override { repaint(); }
+
+ private:
+  struct Series {
+    size_t i_plot;
+    juce::Colour colour;
+    MinMaxPyramid pyramid;
+  };
+
+  juce::Rectangle<int> GetPlotArea() const;
+  int64_t GetViewEnd() const;
+  void PaintTimeAxis(juce::Graphics& g, juce::Rectangle<int> area,
+                     int64_t view_start, int64_t view_end);
+  void PaintSeries(juce::Graphics& g, const Series& series,
+                   juce::Rectangle<int> area, float ymin, float ymax);
+
+  std::vector<Plot> plots_;
+  size_t capacity_;
+
+  // Guards plots_, timestamps_ and the series
+  mutable std::mutex mutex_;
+  std::vector<int64_t> timestamps_;
+  std::vector<Series> series_;
+
+  // >>> View, only touched on the message thread =============================
+  int64_t visible_duration_ms_ = 3600 * 1000;
+  // Follows the newest sample when empty
+  std::optional<int64_t> view_end_ms_;
+  int64_t drag_start_view_end_ms_ = 0;
+  // Sample index bounds of every pixel column, reused across repaints
+  std::vector<size_t> column_bounds_;
+  // <<< ----------------------------------------------------------------------
+
+  JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(HistoryComponent)
+};
@@ -7,25 +7,80 @@ License that can be found in the LICENSE file.
 
 #include "log_component.h"
 
+#include <algorithm>
+#include <chrono>
+
+namespace {
+constexpr int kRowHeight = 15;
+constexpr int kFilterHeight = 26;
+
+const char* GetLevelName(bbmp::LogLevel level) {
+  switch (level) {
+    case bbmp::LogLevel::kDebug:
+      return "Debug";
+    case bbmp::LogLevel::kInfo:
+      return "Info";
+    case bbmp::LogLevel::kWarning:
+      return "Warning";
+    case bbmp::LogLevel::kError:
+      return "Error";
+  }
+  return "";
+}
+
+int64_t GetWallClockOffsetMs() {
+  using namespace std::chrono;
+  return duration_cast<milliseconds>(
+             system_clock::now().time_since_epoch() -
+             duration_cast<system_clock::duration>(
+                 steady_clock::now().time_since_epoch()))
+      .count();
+}
+}  // namespace
+
 LogComponent::LogComponent(
     std::function<std::optional<bbmp::LogMessage>()> log_message_getter,
     bool has_hide_button)
-    : log_message_getter_(std::move(log_message_getter)), message_counter_(0) {
-  editor_.setColour(
-      juce::TextEditor::backgroundColourId,
-      editor_.findColour(juce::TextEditor::backgroundColourId).withAlpha(0.7f));
-  editor_.setMultiLine(true, true);
-  editor_.setReadOnly(true);
-  addAndMakeVisible(editor_);
+    : log_message_getter_(std::move(log_message_getter)),
+      wall_clock_offset_ms_(GetWallClockOffsetMs()) {
+  setOpaque(false);
+
+  for (auto level = static_cast<int>(bbmp::LogLevel::kDebug);
+       level <= static_cast<int>(bbmp::LogLevel::kError); ++level) {
+    level_filter_.addItem(
+        juce::String(GetLevelName(static_cast<bbmp::LogLevel>(level))) + "+",
+        level + 1);
+  }
+  level_filter_.setSelectedId(static_cast<int>(min_level_) + 1,
+                              juce::dontSendNotification);
+  level_filter_.onChange = [this]() {
+    min_level_ = static_cast<bbmp::LogLevel>(level_filter_.getSelectedId() - 1);
+    RebuildFilter();
+  };
+  addAndMakeVisible(level_filter_);
+
+  source_filter_.addItem("All sources", 1);
+  source_filter_.setSelectedId(1, juce::dontSendNotification);
+  source_filter_.onChange = [this]() {
+    source_ = static_cast<uint32_t>(source_filter_.getSelectedId() - 1);
+    RebuildFilter();
+  };
+  addAndMakeVisible(source_filter_);
+
+  scroll_bar_.setAutoHide(false);
+  scroll_bar_.addListener(this);
+  addAndMakeVisible(scroll_bar_);
 
   if (has_hide_button) {
     button_show_hide_ = std::make_unique<juce::TextButton>("Log");
     button_show_hide_->setTooltip("Show/hide log");
     button_show_hide_->onClick = [this]() {
-      const auto isVisible = editor_.isVisible();
-      editor_.setVisible(!isVisible);
-      setInterceptsMouseClicks(!isVisible, true);
-      editor_.setInterceptsMouseClicks(!isVisible, !isVisible);
+      show_messages_ = !show_messages_;
+      level_filter_.setVisible(show_messages_);
+      source_filter_.setVisible(show_messages_);
+      scroll_bar_.setVisible(show_messages_);
+      setInterceptsMouseClicks(show_messages_, true);
+      repaint();
     };
     addAndMakeVisible(*button_show_hide_);
   }
@@ -34,42 +89,166 @@ LogComponent::LogComponent(
 }
 
 void LogComponent::Update() {
-  bool new_message_arrived = false;
-  while (auto messageOpt = log_message_getter_()) {
-    bbmp::LogMessage message{std::move(*messageOpt)};
-    if (message.message != nullptr) {
-      log_messages_.add(juce::String(message_counter_++) + ">" +
-                        *message.message);
+  const auto num_messages_before = history_.GetNumMessages();
+  size_t num_rows_dropped = 0;
+
+  while (auto message = log_message_getter_()) {
+    juce::String text =
+        juce::Time(message->timestamp_ns / 1000000 + wall_clock_offset_ms_)
+            .formatted("%H:%M:%S ");
+    if (message->thread_name != nullptr) {
+      text << "[" << message->thread_name << "] ";
+    } else if (message->thread_id != 0) {
+      text << "[" << static_cast<int>(message->thread_id) << "] ";
     }
-    if (message.heap_message != nullptr) {
-      log_messages_.add(juce::String(message_counter_++) + ">" +
-                        *message.heap_message);
+    if (message->message != nullptr) {
+      text << juce::String(*message->message);
     }
-    new_message_arrived = true;
+    if (message->heap_message != nullptr) {
+      text << juce::String(*message->heap_message);
+    }
+
+    if (message->thread_id != 0 &&
+        std::find(known_sources_.begin(), known_sources_.end(),
+                  message->thread_id) == known_sources_.end()) {
+      known_sources_.push_back(message->thread_id);
+      source_filter_.addItem(message->thread_name != nullptr
+                                 ? juce::String(message->thread_name)
+                                 : "Thread " + juce::String(static_cast<int>(
+                                                   message->thread_id)),
+                             static_cast<int>(message->thread_id) + 1);
+    }
+
+    num_rows_dropped += history_.Append(
+        {std::move(text), message->level, message->thread_id});
+  }
+
+  if (history_.GetNumMessages() == num_messages_before) {
+    return;
+  }
+
+  first_row_ -= std::min(first_row_, num_rows_dropped);
+  UpdateScrollBar();
+  repaint();
+}
+
+void LogComponent::RebuildFilter() {
+  history_.SetFilter(min_level_, source_);
+  follow_ = true;
+  UpdateScrollBar();
+  repaint();
+}
+
+void LogComponent::UpdateScrollBar() {
+  const auto num_rows = static_cast<size_t>(GetNumVisibleRows());
+  const auto num_filtered = history_.GetNumRows();
+  const auto max_first_row =
+      num_filtered > num_rows ? num_filtered - num_rows : 0;
+  if (follow_ || first_row_ > max_first_row) {
+    first_row_ = max_first_row;
   }
-  if (!new_message_arrived) {
+  scroll_bar_.setRangeLimits(0.0, static_cast<double>(num_filtered),
+                             juce::dontSendNotification);
+  scroll_bar_.setCurrentRange(static_cast<double>(first_row_),
+                              static_cast<double>(num_rows),
+                              juce::dontSendNotification);
+}
+
+int LogComponent::GetNumVisibleRows() const {
+  return std::max(GetRowsArea().getHeight() / kRowHeight, 1);
+}
+
+juce::Rectangle<int> LogComponent::GetRowsArea() const {
+  auto area = getLocalBounds().reduced(4);
+  area.removeFromTop(kFilterHeight + 4);
+  area.removeFromRight(scroll_bar_.getWidth());
+  return area.reduced(4, 0);
+}
+
+void LogComponent::scrollBarMoved(juce::ScrollBar*, double new_range_start) {
+  first_row_ = static_cast<size_t>(std::max(new_range_start, 0.0));
+  follow_ = first_row_ + GetNumVisibleRows() >= history_.GetNumRows();
+  repaint();
+}
+
+void LogComponent::paint(juce::Graphics& g) {
+  if (!show_messages_) {
     return;
   }
 
-  const auto excess_messages = log_messages_.size() - 50;
-  if (excess_messages > 0) {
-    log_messages_.removeRange(0, excess_messages);
+  g.setColour(findColour(juce::TextEditor::backgroundColourId).withAlpha(0.7f));
+  g.fillRect(getLocalBounds().reduced(4));
+
+  const auto area = GetRowsArea();
+  const auto text_colour = findColour(juce::TextEditor::textColourId);
+  g.setFont(static_cast<float>(kRowHeight - 2));
+
+  const auto num_rows = static_cast<size_t>(GetNumVisibleRows());
+  const auto end_row = std::min(first_row_ + num_rows, history_.GetNumRows());
+  auto y = area.getY();
+  for (auto row = first_row_; row < end_row; ++row, y += kRowHeight) {
+    const auto& entry = history_.GetRow(row);
+    switch (entry.level) {
+      case bbmp::LogLevel::kDebug:
+        g.setColour(text_colour.withAlpha(0.6f));
+        break;
+      case bbmp::LogLevel::kInfo:
+        g.setColour(text_colour);
+        break;
+      case bbmp::LogLevel::kWarning:
+        g.setColour(juce::Colours::orange);
+        break;
+      case bbmp::LogLevel::kError:
+        g.setColour(juce::Colours::red);
+        break;
+    }
+    g.drawText(entry.text, area.getX(), y, area.getWidth(), kRowHeight,
+               juce::Justification::centredLeft, true);
   }
+}
 
-  const auto last_messages_string = log_messages_.joinIntoString("\n");
-  editor_.clear();
-  editor_.setText(last_messages_string);
-  editor_.moveCaretToEnd();
-  editor_.scrollEditorToPositionCaret(0, 0);
+void LogComponent::mouseWheelMove(const juce::MouseEvent&,
+                                  const juce::MouseWheelDetails& wheel) {
+  const auto num_rows = static_cast<double>(GetNumVisibleRows());
+  scroll_bar_.setCurrentRangeStart(
+      scroll_bar_.getCurrentRangeStart() - wheel.deltaY * num_rows,
+      juce::sendNotificationSync);
+}
+
+void LogComponent::mouseDown(const juce::MouseEvent& e) {
+  if (!e.mods.isPopupMenu()) {
+    return;
+  }
+
+  juce::PopupMenu menu;
+  menu.addItem(1, "Copy");
+  menu.showMenuAsync(juce::PopupMenu::Options(), [this](int result) {
+    if (result != 1) {
+      return;
+    }
+    juce::String text;
+    for (size_t row = 0; row < history_.GetNumRows(); ++row) {
+      text << history_.GetRow(row).text << "\n";
+    }
+    juce::SystemClipboard::copyTextToClipboard(text);
+  });
 }
 
 void LogComponent::resized() {
-  auto editorBounds = getLocalBounds().reduced(4);
-  editor_.setBounds(editorBounds);
+  auto area = getLocalBounds().reduced(4);
+  auto filter_area = area.removeFromTop(kFilterHeight);
+  area.removeFromTop(4);
 
-  if (button_show_hide_)
+  if (button_show_hide_) {
     button_show_hide_->setBounds(
-        editorBounds.removeFromRight(30).removeFromTop(30).reduced(4));
+        filter_area.removeFromRight(30).removeFromTop(30).reduced(4));
+  }
+  level_filter_.setBounds(filter_area.removeFromLeft(110));
+  filter_area.removeFromLeft(4);
+  source_filter_.setBounds(filter_area.removeFromLeft(130));
+
+  scroll_bar_.setBounds(area.removeFromRight(12));
+  UpdateScrollBar();
 }
 
 void LogComponent::timerCallback() { Update(); }
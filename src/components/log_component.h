@@ -8,13 +8,25 @@ License that can be found in the LICENSE file.
 #pragma once
 
 #include "bbmp/logging.h"
+#include "log_history.h"
 
 #include <juce_gui_basics/juce_gui_basics.h>
 
+#include <cstdint>
 #include <functional>
 #include <optional>
+#include <vector>
+
+/*
+ * Keeps the last kCapacity messages in a LogHistory and paints only the rows
+ * that are on screen, so the cost of an update depends on the number of new
+ * messages and the height of the component, not on the length of the history.
+ */
+struct LogComponent : public juce::Component,
+                      private juce::Timer,
+                      private juce::ScrollBar::Listener {
+  static constexpr uint64_t kCapacity = LogHistory<juce::String>::kCapacity;
 
-struct LogComponent : public juce::Component, private juce::Timer {
   LogComponent(
       std::function<std::optional<bbmp::LogMessage>()> log_message_getter,
       bool has_hide_button);
@@ -25,9 +37,41 @@ struct LogComponent : public juce::Component, private juce::Timer {
 
   void resized() override;
 
+  void paint(juce::Graphics& g) override;
+
+  void mouseWheelMove(const juce::MouseEvent& e,
+                      const juce::MouseWheelDetails& wheel) override;
+
+  // Right click copies the filtered messages
+  void mouseDown(const juce::MouseEvent& e) override;
+
+ private:
+  void RebuildFilter();
+  void UpdateScrollBar();
+  int GetNumVisibleRows() const;
+  juce::Rectangle<int> GetRowsArea() const;
+  void scrollBarMoved(juce::ScrollBar* scroll_bar,
+                      double new_range_start) override;
+
   std::function<std::optional<bbmp::LogMessage>()> log_message_getter_;
-  juce::StringArray log_messages_;
-  juce::TextEditor editor_;
+
+  LogHistory<juce::String> history_;
+  // Index of the top row on screen
+  size_t first_row_ = 0;
+  // Keeps the newest message in view
+  bool follow_ = true;
+
+  // For converting the steady clock timestamps of the messages
+  int64_t wall_clock_offset_ms_;
+
+  bbmp::LogLevel min_level_ = bbmp::LogLevel::kDebug;
+  // 0 for all threads
+  uint32_t source_ = 0;
+  std::vector<uint32_t> known_sources_;
+
+  juce::ComboBox level_filter_;
+  juce::ComboBox source_filter_;
+  juce::ScrollBar scroll_bar_{true};
   std::unique_ptr<juce::TextButton> button_show_hide_ = nullptr;
-  unsigned int message_counter_;
+  bool show_messages_ = true;
 };
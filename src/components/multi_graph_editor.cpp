@@ -10,58 +10,87 @@ License that can be found in the LICENSE file.
 MultiGraphComponent::MultiGraphComponent(float xmin, float xmax, float ymin,
                                          float ymax,
                                          std::vector<juce::String> legend)
-    : xmin_(xmin),
-      xmax_(xmax),
-      ymin_(ymin),
-      ymax_(ymax),
-      legend_(std::move(legend)) {
-  colours_.push_back(findColour(juce::Slider::thumbColourId));
-  float color_shift = 0.25f;
-
-  const auto num_graphs = legend_.size() == 0 ? 1 : legend_.size();
-  for (int i = 0; i < num_graphs; ++i) {
-    graphs_.push_back(std::make_unique<GraphComponent>());
-    graphs_.back()->SetOnChange(
-        [this, i_graph = i](GraphComponent::Model& model) {
-          OnChangeCallback(i_graph, model);
-        });
-    addAndMakeVisible(*graphs_.back());
-
-    if (i > 0) {
-      if (i % 2 == 0) {
-        colours_.push_back(colours_.back().withRotatedHue(color_shift));
-        color_shift /= 2.0f;
-      } else {
-        colours_.push_back(colours_.back().withRotatedHue(0.5f));
-      }
-    }
-    graphs_.back()->SetColor(colours_.back());
-  }
-  if (graphs_.size() > 1) {
-    for (size_t i = 0; i < graphs_.size(); ++i) {
-      graph_selector_buttons_.push_back(
-          std::make_unique<juce::TextButton>(legend_[i]));
-      addAndMakeVisible(*graph_selector_buttons_.back());
-      graph_selector_buttons_.back()->setColour(
-          juce::TextButton::ColourIds::textColourOffId, colours_[i]);
-      graph_selector_buttons_.back()->onClick = [this, i]() { EnableGraph(i); };
+    : xmin_(xmin), xmax_(xmax), ymin_(ymin), ymax_(ymax) {
+  addChildComponent(graph_selector_);
+  graph_selector_.onChange = [this]() {
+    if (const auto id = graph_selector_.getSelectedId(); id > 0) {
+      EnableGraph(static_cast<size_t>(id - 1));
     }
+  };
+  if (legend.empty()) {
+    AddGraph();
   }
+  SetLegend(std::move(legend));
   EnableGraph(0);
 }
 
+void MultiGraphComponent::SetLegend(std::vector<juce::String> legend) {
+  legend_ = std::move(legend);
+  while (graphs_.size() < legend_.size()) {
+    AddGraph();
+  }
+  UpdateSelector();
+  EnableGraph(i_enabled_graph_);
+  resized();
+}
+
+void MultiGraphComponent::AddGraph() {
+  const auto i = graphs_.size();
+  graphs_.push_back(std::make_unique<GraphComponent>());
+  graphs_.back()->SetOnChange(
+      [this, i_graph = i](GraphComponent::Model& model) {
+        OnChangeCallback(i_graph, model);
+      });
+  addAndMakeVisible(*graphs_.back());
+
+  if (i == 0) {
+    colours_.push_back(findColour(juce::Slider::thumbColourId));
+  } else if (i % 2 == 0) {
+    colours_.push_back(colours_.back().withRotatedHue(colour_shift_));
+    colour_shift_ /= 2.0f;
+  } else {
+    colours_.push_back(colours_.back().withRotatedHue(0.5f));
+  }
+  graphs_.back()->SetColor(colours_.back());
+
+  graph_selector_buttons_.push_back(std::make_unique<juce::TextButton>());
+  addChildComponent(*graph_selector_buttons_.back());
+  graph_selector_buttons_.back()->setColour(
+      juce::TextButton::ColourIds::textColourOffId, colours_.back());
+  graph_selector_buttons_.back()->onClick = [this, i]() { EnableGraph(i); };
+}
+
+void MultiGraphComponent::UpdateSelector() {
+  const auto use_buttons = graphs_.size() > 1 &&
+                           graphs_.size() <= kMaxSelectorButtons;
+  for (auto& button : graph_selector_buttons_) {
+    button->setVisible(use_buttons);
+  }
+
+  graph_selector_.clear(juce::NotificationType::dontSendNotification);
+  for (size_t i = 0; i < graphs_.size(); ++i) {
+    graph_selector_.addItem(
+        "Editing: " + (i < legend_.size() ? legend_[i] : juce::String()),
+        static_cast<int>(i + 1));
+  }
+  graph_selector_.setVisible(graphs_.size() > kMaxSelectorButtons);
+}
+
 void MultiGraphComponent::EnableGraph(size_t i_graph) {
+  i_enabled_graph_ = i_graph;
   for (size_t i = 0; i < graphs_.size(); ++i) {
     graphs_[i]->SetEnabled(i == i_graph);
     if (i == i_graph) {
       graphs_[i]->toFront(true);
     }
     graph_selector_buttons_[i]->setEnabled(i != i_graph);
-    if (legend_.size() > 0) {
+    if (i < legend_.size()) {
       graph_selector_buttons_[i]->setButtonText(
           i == i_graph ? "Editing: " + legend_[i] : "Edit: " + legend_[i]);
     }
   }
+  graph_selector_.setSelectedId(static_cast<int>(i_graph + 1),
+                                juce::NotificationType::dontSendNotification);
 }
 
 void MultiGraphComponent::OnChangeCallback(size_t i_graph,
@@ -88,11 +117,15 @@ void MultiGraphComponent::resized() {
     auto edit_graph_buttons_area = area.removeFromTop(40);
     edit_graph_buttons_area.removeFromTop(10);
     edit_graph_buttons_area.removeFromRight(10);
-    for (int i = static_cast<int>(graph_selector_buttons_.size()) - 1; i >= 0;
-         --i) {
-      graph_selector_buttons_[i]->setBounds(
-          edit_graph_buttons_area.removeFromRight(100));
-      edit_graph_buttons_area.removeFromRight(10);
+    if (graph_selector_.isVisible()) {
+      graph_selector_.setBounds(edit_graph_buttons_area.removeFromRight(220));
+    } else {
+      for (int i = static_cast<int>(graph_selector_buttons_.size()) - 1;
+           i >= 0; --i) {
+        graph_selector_buttons_[i]->setBounds(
+            edit_graph_buttons_area.removeFromRight(100));
+        edit_graph_buttons_area.removeFromRight(10);
+      }
     }
   }
 
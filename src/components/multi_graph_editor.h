@@ -12,26 +12,36 @@ License that can be found in the LICENSE file.
 #include <juce_gui_basics/juce_gui_basics.h>
 
 #include <memory>
+#include <vector>
 
 class MultiGraphComponent : public juce::Component, public juce::AsyncUpdater {
  public:
+  // With more graphs than this, a combo box selects the graph to edit
+  static constexpr size_t kMaxSelectorButtons = 4;
+
   MultiGraphComponent(float xmin, float xmax, float ymin, float ymax,
                       std::vector<juce::String> legend = {});
 
+  // Adds a graph for every entry beyond the current ones, and renames the
+  // existing ones. Graphs are never removed, so their indices stay valid.
+  void SetLegend(std::vector<juce::String> legend);
+
+  size_t GetNumGraphs() const { return graphs_.size(); }
+
   void EnableGraph(size_t i_graph);
 
   void OnChangeCallback(size_t i_graph, GraphComponent::Model& model);
 
-  template <size_t N>
-  void SetState(std::array<std::vector<juce::Point<float>>, N>& points) {
+  // points[i_graph], graphs without points are cleared
+  void SetState(std::vector<std::vector<juce::Point<float>>> points) {
     for (auto& a : points) {
       for (auto& b : a) {
         b = Normalize(b);
       }
     }
 
-    const auto num_graphs = std::min(points.size(), graphs_.size());
-    for (auto i = 0u; i < num_graphs; ++i) {
+    points.resize(graphs_.size());
+    for (auto i = 0u; i < graphs_.size(); ++i) {
       graphs_[i]->AccessModel(
           [&graph_points = points[i]](GraphComponent::Model& model) {
             model.Clear();
@@ -72,6 +82,9 @@ class MultiGraphComponent : public juce::Component, public juce::AsyncUpdater {
  private:
   std::vector<std::unique_ptr<GraphComponent>> graphs_;
   std::vector<std::unique_ptr<juce::TextButton>> graph_selector_buttons_;
+  juce::ComboBox graph_selector_;
+  size_t i_enabled_graph_ = 0;
+  float colour_shift_ = 0.25f;
   float xmin_, xmax_, ymin_, ymax_;
   std::vector<float> xticks_, yticks_;
   juce::String xlabel_, ylabel_;
@@ -83,4 +96,8 @@ class MultiGraphComponent : public juce::Component, public juce::AsyncUpdater {
   std::mutex on_change_mutex_;
 
   std::atomic<std::optional<juce::Point<float>>> point_;
+
+  void AddGraph();
+
+  void UpdateSelector();
 };
@@ -0,0 +1,345 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// coolthctl talks to a running coolthd over its socket, see coolth_ipc.h
+
+#include "coolth_ipc.h"
+#include "ipc_client.h"
+#include "settings.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+const char* const kUsage =
+    "Usage: coolthctl [--socket PATH] COMMAND\n"
+    "\n"
+    "Commands:\n"
+    "  watch [PERIOD_MS]     Print the telemetry, by default after every\n"
+    "                        control step\n"
+    "  set-duty FAN PERCENT  Set the duty cycle the fan runs at while its\n"
+    "                        curves don't apply\n"
+    "  override FAN PERCENT  Run the fan at PERCENT until interrupted\n"
+    "  smooth on|off         Smooth the temperatures the curves get\n"
+    "  predictive on|off     Run the fans at what the curves ask for at the\n"
+    "                        predicted temperatures\n"
+    "  filter SENSOR [STAGE...]\n"
+    "                        Filter the sensor with the stages in order while\n"
+    "                        smoothing is on: ema:SECONDS, median:SAMPLES,\n"
+    "                        slew:DEGREES_PER_SECOND, kalman:Q:R\n"
+    "  curve FAN SENSOR [TEMP:DUTY...]\n"
+    "                        Make the fan follow the sensor along the points,\n"
+    "                        or stop following it without points\n"
+    "  curves FAN            Print the curves of the fan\n"
+    "  sensors               Print the ids and the labels of the sensors\n"
+    "  ping [COUNT]          Measure the round trip time of requests\n";
+
+const char* GetStatusName(coolth_ipc::Status status) {
+  switch (status) {
+    case coolth_ipc::kOk:
+      return "ok";
+    case coolth_ipc::kBadRequest:
+      return "bad request";
+    case coolth_ipc::kOutOfRange:
+      return "out of range";
+  }
+  return "unknown status";
+}
+
+void Check(const IpcClient::Reply& reply) {
+  if (reply.status != coolth_ipc::kOk) {
+    throw std::runtime_error(std::string("Request failed: ") +
+                             GetStatusName(reply.status));
+  }
+}
+
+std::vector<uint8_t> FanArguments(const std::string& i_fan,
+                                  const std::string* duty_cycle = nullptr) {
+  std::vector<uint8_t> arguments;
+  coolth_ipc::Writer writer(arguments);
+  writer.U16(static_cast<uint16_t>(std::stoul(i_fan)));
+  if (duty_cycle != nullptr) {
+    writer.F32(std::stof(*duty_cycle));
+  }
+  return arguments;
+}
+
+std::vector<std::string> SplitFields(const std::string& arg) {
+  std::vector<std::string> fields;
+  for (size_t begin = 0;;) {
+    const auto end = arg.find(':', begin);
+    fields.push_back(arg.substr(begin, end - begin));
+    if (end == std::string::npos) {
+      return fields;
+    }
+    begin = end + 1;
+  }
+}
+
+std::string SensorArgument(const std::string& arg) {
+  if (!CoolthSettings::IsValidSensorId(arg)) {
+    throw std::invalid_argument(arg);
+  }
+  return arg;
+}
+
+// args[0] is the sensor, the rest are stages. Throws std::invalid_argument
+// for anything else.
+std::vector<uint8_t> FilterArguments(const std::vector<std::string>& args) {
+  std::vector<uint8_t> arguments;
+  coolth_ipc::Writer writer(arguments);
+  writer.String(SensorArgument(args[0]));
+
+  for (size_t i = 1; i < args.size(); ++i) {
+    const auto fields = SplitFields(args[i]);
+    const auto& name = fields[0];
+    const auto num_values = name == "kalman" ? 2u : 1u;
+    if (fields.size() != num_values + 1) {
+      throw std::invalid_argument(args[i]);
+    }
+    if (name == "ema") {
+      writer.U8(FilterStage::kEma);
+    } else if (name == "median") {
+      writer.U8(FilterStage::kMedian);
+    } else if (name == "slew") {
+      writer.U8(FilterStage::kSlewLimit);
+    } else if (name == "kalman") {
+      writer.U8(FilterStage::kKalman);
+    } else {
+      throw std::invalid_argument(args[i]);
+    }
+    writer.F32(std::stof(fields[1]));
+    writer.F32(num_values == 2 ? std::stof(fields[2]) : 0.0f);
+  }
+  return arguments;
+}
+
+// args[0] is the fan, args[1] the sensor, the rest are points
+std::vector<uint8_t> CurveArguments(const std::vector<std::string>& args) {
+  auto arguments = FanArguments(args[0]);
+  coolth_ipc::Writer writer(arguments);
+  writer.String(SensorArgument(args[1]));
+  for (size_t i = 2; i < args.size(); ++i) {
+    const auto fields = SplitFields(args[i]);
+    if (fields.size() != 2) {
+      throw std::invalid_argument(args[i]);
+    }
+    writer.F32(std::stof(fields[0])).F32(std::stof(fields[1]));
+  }
+  return arguments;
+}
+
+struct Sensor {
+  std::string id;
+  std::string label;
+};
+
+std::vector<Sensor> GetSensors(IpcClient& client) {
+  const auto reply = client.Call(coolth_ipc::kGetSensors);
+  Check(reply);
+  coolth_ipc::Reader reader(reply.data.data(), reply.data.size());
+  std::vector<Sensor> sensors(reader.U16());
+  for (auto& sensor : sensors) {
+    sensor.id = reader.String();
+    sensor.label = reader.String();
+  }
+  if (!reader.IsValid()) {
+    throw std::runtime_error("Request failed: bad reply");
+  }
+  return sensors;
+}
+
+void PrintTelemetry(const coolth_ipc::Frame& frame,
+                    const std::vector<Sensor>& sensors) {
+  coolth_ipc::Reader reader(frame.payload.data(), frame.payload.size());
+  const auto timestamp_ms = reader.I64();
+  const size_t num_sensors = reader.U16();
+  std::vector<float> values(reader.U16());
+  for (auto& value : values) {
+    value = reader.F32();
+  }
+  if (!reader.IsValid() || values.size() < 2 * num_sensors) {
+    return;
+  }
+
+  std::printf("%lld", static_cast<long long>(timestamp_ms));
+  for (size_t i = 0; i < num_sensors; ++i) {
+    // A sensor that can't be read now and then would make the columns jump
+    if (std::isnan(values[i])) {
+      continue;
+    }
+    std::printf(" %s %.1f (%.1f)",
+                i < sensors.size() ? sensors[i].id.c_str() : "?",
+                values[num_sensors + i], values[i]);
+  }
+  const auto* fans = values.data() + 2 * num_sensors;
+  const auto num_fans = (values.size() - 2 * num_sensors) / 2;
+  for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+    std::printf(" | %zu: %.1f%% %.0f RPM", i_fan, fans[i_fan],
+                fans[num_fans + i_fan]);
+  }
+  std::printf("\n");
+  std::fflush(stdout);
+}
+
+int Watch(IpcClient& client, uint32_t period_ms) {
+  auto sensors = GetSensors(client);
+  std::vector<uint8_t> arguments;
+  coolth_ipc::Writer(arguments).U32(period_ms);
+  Check(client.Call(coolth_ipc::kSubscribe, arguments));
+  for (;;) {
+    const auto frame = client.Receive();
+    if (frame.type != coolth_ipc::kTelemetry) {
+      continue;
+    }
+    // Sensors are only ever added, at the end of the registry
+    coolth_ipc::Reader reader(frame.payload.data(), frame.payload.size());
+    reader.I64();
+    if (reader.U16() > sensors.size()) {
+      sensors = GetSensors(client);
+    }
+    PrintTelemetry(frame, sensors);
+  }
+}
+
+int PrintSensors(IpcClient& client) {
+  for (const auto& sensor : GetSensors(client)) {
+    std::printf("%-16s %s\n", sensor.id.c_str(), sensor.label.c_str());
+  }
+  return 0;
+}
+
+int PrintCurves(IpcClient& client, const std::string& i_fan) {
+  const auto reply = client.Call(coolth_ipc::kGetCurves, FanArguments(i_fan));
+  Check(reply);
+  coolth_ipc::Reader reader(reply.data.data(), reply.data.size());
+  while (reader.IsValid() && reader.GetRemaining() > 0) {
+    const auto sensor = reader.String();
+    std::printf("%s:", sensor.c_str());
+    const auto num_points = reader.U16();
+    for (uint16_t i = 0; i < num_points && reader.IsValid(); ++i) {
+      const auto temperature = reader.F32();
+      const auto duty_cycle = reader.F32();
+      std::printf(" (%.1f C, %.1f%%)", temperature, duty_cycle);
+    }
+    std::printf("\n");
+  }
+  return 0;
+}
+
+int Ping(IpcClient& client, int count) {
+  std::vector<double> round_trips_us;
+  for (int i = 0; i < count; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    Check(client.Call(coolth_ipc::kPing));
+    round_trips_us.push_back(
+        std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+  std::sort(round_trips_us.begin(), round_trips_us.end());
+  const auto percentile = [&round_trips_us](double p) {
+    return round_trips_us[static_cast<size_t>(
+        p * static_cast<double>(round_trips_us.size() - 1))];
+  };
+  std::printf("%d requests, round trip min %.1f us, median %.1f us, p99 %.1f "
+              "us, max %.1f us\n",
+              count, round_trips_us.front(), percentile(0.5),
+              percentile(0.99), round_trips_us.back());
+  return 0;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  auto socket_path = coolth_ipc::GetDefaultSocketPath();
+  if (args.size() >= 2 && args[0] == "--socket") {
+    socket_path = args[1];
+    args.erase(args.begin(), args.begin() + 2);
+  }
+  if (args.empty()) {
+    std::cerr << kUsage;
+    return 2;
+  }
+
+  try {
+    IpcClient client(socket_path);
+    const auto& command = args[0];
+    if (command == "watch" && args.size() <= 2) {
+      return Watch(client, args.size() == 2
+                               ? static_cast<uint32_t>(std::stoul(args[1]))
+                               : 0);
+    }
+    if (command == "set-duty" && args.size() == 3) {
+      Check(client.Call(coolth_ipc::kSetManualDutyCycle,
+                        FanArguments(args[1], &args[2])));
+      return 0;
+    }
+    if (command == "override" && args.size() == 3) {
+      Check(client.Call(coolth_ipc::kSetDutyCycleOverride,
+                        FanArguments(args[1], &args[2])));
+      // The override ends with the connection, i.e. when we're killed
+      std::cout << "Fan " << args[1] << " held at " << args[2]
+                << " %, press Ctrl+C to release" << std::endl;
+      for (;;) {
+        pause();
+      }
+    }
+    if (command == "smooth" && args.size() == 2 &&
+        (args[1] == "on" || args[1] == "off")) {
+      Check(client.Call(coolth_ipc::kSetSmoothTemps,
+                        {static_cast<uint8_t>(args[1] == "on")}));
+      return 0;
+    }
+    if (command == "predictive" && args.size() == 2 &&
+        (args[1] == "on" || args[1] == "off")) {
+      Check(client.Call(coolth_ipc::kSetPredictiveControl,
+                        {static_cast<uint8_t>(args[1] == "on")}));
+      return 0;
+    }
+    if (command == "filter" && args.size() >= 2) {
+      Check(client.Call(
+          coolth_ipc::kSetSensorFilter,
+          FilterArguments(std::vector<std::string>(args.begin() + 1,
+                                                   args.end()))));
+      return 0;
+    }
+    if (command == "curve" && args.size() >= 3) {
+      Check(client.Call(coolth_ipc::kSetCurve,
+                        CurveArguments(std::vector<std::string>(
+                            args.begin() + 1, args.end()))));
+      return 0;
+    }
+    if (command == "curves" && args.size() == 2) {
+      return PrintCurves(client, args[1]);
+    }
+    if (command == "sensors" && args.size() == 1) {
+      return PrintSensors(client);
+    }
+    if (command == "ping" && args.size() <= 2) {
+      return Ping(client, args.size() == 2 ? std::max(1, std::stoi(args[1]))
+                                           : 1000);
+    }
+  } catch (std::logic_error&) {
+    // Thrown by std::stoul and friends
+  } catch (std::exception& error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+
+  std::cerr << kUsage;
+  return 2;
+}
@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// coolthd drives the fans without the GUI. It uses the same settings and
+// telemetry files, so only one of them may run at a time, which the lock file
+// in the data directory makes sure of. On POSIX systems
+// clients like coolthctl connect to it through a Unix domain socket, and the
+// latest control step is published in shared memory, see telemetry_shm.h.
+// SIGUSR1 writes the latency histograms of the control pipeline in the log.
+//
+//   coolthd [--data-dir PATH] [--socket PATH] [--shm NAME]
+
+#include "bbmp/instance_lock.h"
+#include "bbmp/logging.h"
+#include "control_engine.h"
+#include "pipeline_latency.h"
+#include "settings.h"
+#include "settings_persister.h"
+
+#ifndef _WIN32
+#include "coolth_ipc.h"
+#include "ipc_server.h"
+#include "telemetry_shm_writer.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+// How often should_exit is checked while the engine waits
+constexpr int kExitPollMs = 100;
+constexpr std::chrono::milliseconds kLogPollPeriod{50};
+
+std::atomic<bool> g_should_exit{false};
+std::atomic<bool> g_log_latency{false};
+
+extern "C" void OnSignal(int) { g_should_exit = true; }
+
+extern "C" void OnLogLatencySignal(int) { g_log_latency = true; }
+
+const char* GetLevelName(bbmp::LogLevel level) {
+  switch (level) {
+    case bbmp::LogLevel::kDebug:
+      return "debug";
+    case bbmp::LogLevel::kInfo:
+      return "info";
+    case bbmp::LogLevel::kWarning:
+      return "warning";
+    case bbmp::LogLevel::kError:
+      return "error";
+  }
+  return "";
+}
+
+// Writes the log to stderr, where a service manager picks it up
+class LogDrain {
+ public:
+  LogDrain() : thread_([this] { Run(); }) {}
+
+  // Writes what was logged until now before returning
+  ~LogDrain() {
+    should_exit_ = true;
+    thread_.join();
+  }
+
+ private:
+  void Run() {
+    for (;;) {
+      const bool is_last = should_exit_.load();
+      // Logging isn't safe in a signal handler, so the handler only asks
+      if (g_log_latency.exchange(false)) {
+        for (const auto& line : PipelineLatency::GetInstance().GetReport()) {
+          bbmp::Log("Latency: {}", line);
+        }
+      }
+      bbmp::LogMessage message;
+      while (bbmp::NonBlockingLogger::GetInstance().TryDequeue(message)) {
+        std::cerr << "[" << GetLevelName(message.level) << "] ";
+        if (message.thread_name != nullptr) {
+          std::cerr << "[" << message.thread_name << "] ";
+        } else if (message.thread_id != 0) {
+          std::cerr << "[" << message.thread_id << "] ";
+        }
+        if (message.message != nullptr) {
+          std::cerr << *message.message;
+        }
+        if (message.heap_message != nullptr) {
+          std::cerr << *message.heap_message;
+        }
+        std::cerr << '\n';
+      }
+      std::cerr.flush();
+      if (is_last) {
+        return;
+      }
+      std::this_thread::sleep_for(kLogPollPeriod);
+    }
+  }
+
+  std::atomic<bool> should_exit_{false};
+  std::thread thread_;
+};
+}  // namespace
+
+int main(int argc, char** argv) {
+  auto data_dir = CoolthSettings::GetDefaultDirectory();
+  std::string socket_path;
+  std::string shm_name;
+#ifndef _WIN32
+  socket_path = coolth_ipc::GetDefaultSocketPath();
+  shm_name = telemetry_shm::kDefaultName;
+#endif
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--data-dir") == 0 && i + 1 < argc) {
+      data_dir = argv[++i];
+    } else if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (std::strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+      shm_name = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--data-dir PATH] [--socket PATH] [--shm NAME]\n";
+      return 2;
+    }
+  }
+
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+#ifdef SIGUSR1
+  std::signal(SIGUSR1, OnLogLatencySignal);
+#endif
+
+  LogDrain log_drain;
+  bbmp::NonBlockingLogger::GetInstance().SetThreadName("control");
+
+  std::error_code error;
+  std::filesystem::create_directories(data_dir, error);
+
+  // Before anything in the data directory is touched
+  std::unique_ptr<bbmp::InstanceLock> instance_lock;
+  try {
+    instance_lock = std::make_unique<bbmp::InstanceLock>(
+        (data_dir / CoolthSettings::kLockFileName).string());
+  } catch (std::runtime_error& error) {
+    bbmp::Log(bbmp::LogLevel::kError,
+              "{}. Is the Coolth GUI or another coolthd running?",
+              error.what());
+    return 1;
+  }
+
+  const auto settings_file = data_dir / "settings.bin";
+
+  CoolthSettings settings;
+  try {
+    settings.Load(settings_file);
+    bbmp::Log("Loaded settings from: {}", settings_file.string());
+  } catch (...) {
+    bbmp::Log(bbmp::LogLevel::kWarning, "Failed to load settings from: {}",
+              settings_file.string());
+  }
+
+  {
+    // Declared after the settings, so outstanding changes are saved before
+    // they are destroyed
+    SettingsPersister settings_persister(settings);
+
+    // Without the socket or the shared memory the fans are still driven
+    std::vector<ControlEngine::Listener*> listeners;
+#ifndef _WIN32
+    std::unique_ptr<IpcServer> ipc_server;
+    try {
+      ipc_server = std::make_unique<IpcServer>(settings, socket_path);
+      listeners.push_back(ipc_server.get());
+    } catch (std::runtime_error& error) {
+      bbmp::Log(bbmp::LogLevel::kError, "{}", error.what());
+    }
+    std::unique_ptr<TelemetryShmWriter> shm_writer;
+    try {
+      shm_writer = std::make_unique<TelemetryShmWriter>(settings, shm_name);
+      listeners.push_back(shm_writer.get());
+      bbmp::Log("Publishing telemetry in shared memory: {}", shm_name);
+    } catch (std::runtime_error& error) {
+      bbmp::Log(bbmp::LogLevel::kError, "{}", error.what());
+    }
+#endif
+
+    // The temperature reader is installed next to coolthd
+    ControlEngine engine(
+        settings,
+        {data_dir / "telemetry.bin",
+         std::filesystem::path(argv[0]).parent_path() /
+             "temperature_reader.exe"},
+        listeners);
+    engine.Run([] { return g_should_exit.load(); },
+               [](int ms) {
+                 for (; ms > 0 && !g_should_exit; ms -= kExitPollMs) {
+                   std::this_thread::sleep_for(
+                       std::chrono::milliseconds(std::min(ms, kExitPollMs)));
+                 }
+               });
+  }
+
+  bbmp::Log("Exiting");
+  return 0;
+}
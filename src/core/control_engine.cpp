@@ -0,0 +1,700 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "control_engine.h"
+
+#include "pipeline_latency.h"
+#include "sample_line.h"
+#include "sensor_filter.h"
+
+#include "bbmp/fan_controller_registry.h"
+#include "bbmp/logging.h"
+#include "bbmp/loop_metrics.h"
+#include "bbmp/periodic_timer.h"
+#include "bbmp/serial.h"
+
+#ifdef _WIN32
+#include "bbmp/child_process.h"
+#include "bbmp/line_reader.h"
+#include "bbmp/recreate_on_failure.h"
+#else
+#include "bbmp/hwmon_sensors.h"
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+// Boards saved before their fan counts were had four fans
+constexpr size_t kDefaultNumBoardFans = 4;
+
+// "<board id>/<number of fans>" for every slot, separated by ':'
+std::vector<bbmp::FanControllerRegistry::Slot> ParseSlots(
+    const std::string& slots) {
+  std::vector<bbmp::FanControllerRegistry::Slot> result;
+  size_t begin = 0;
+  while (begin < slots.size()) {
+    auto end = slots.find(':', begin);
+    if (end == std::string::npos) {
+      end = slots.size();
+    }
+    const auto slot = slots.substr(begin, end - begin);
+    const auto separator = slot.rfind('/');
+    size_t num_fans = kDefaultNumBoardFans;
+    if (separator != std::string::npos) {
+      num_fans = static_cast<size_t>(
+          std::strtoul(slot.c_str() + separator + 1, nullptr, 10));
+    }
+    if (!slot.empty() && separator != 0) {
+      result.push_back({slot.substr(0, separator), num_fans});
+    }
+    begin = end + 1;
+  }
+  return result;
+}
+
+std::string FormatSlots(
+    const std::vector<bbmp::FanControllerRegistry::Slot>& slots) {
+  std::string result;
+  for (const auto& slot : slots) {
+    if (!result.empty()) {
+      result += ':';
+    }
+    result += slot.board_id + '/' + std::to_string(slot.num_fans);
+  }
+  return result;
+}
+}  // namespace
+
+ControlEngine::ControlEngine(CoolthSettings& settings, Options options,
+                             std::vector<Listener*> listeners)
+    : settings_(settings),
+      options_(std::move(options)),
+      listeners_(std::move(listeners)) {
+  const auto state = settings_.Read();
+  OpenTelemetryStore(state->sensors, state->GetNumFans());
+}
+
+ControlEngine::~ControlEngine() = default;
+
+std::vector<TelemetryStore::Channel> ControlEngine::GetTelemetryChannels(
+    const CoolthSettings::TSensors& sensors, size_t num_fans) {
+  std::vector<TelemetryStore::Channel> channels;
+  for (const auto& sensor : sensors) {
+    channels.push_back({sensor.id + "_temp", 0.01f});
+  }
+  for (const auto& sensor : sensors) {
+    channels.push_back({sensor.id + "_temp_filtered", 0.01f});
+  }
+  for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+    channels.push_back({"fan" + std::to_string(i_fan) + "_duty", 0.01f});
+  }
+  for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+    channels.push_back({"fan" + std::to_string(i_fan) + "_rpm", 1.0f});
+  }
+  return channels;
+}
+
+void ControlEngine::AccessTelemetryStore(
+    const std::function<void(TelemetryStore* store)>& accessor) {
+  auto lock = std::lock_guard(telemetry_mutex_);
+  accessor(telemetry_store_.get());
+}
+
+void ControlEngine::OpenTelemetryStore(const CoolthSettings::TSensors& sensors,
+                                       size_t num_fans) {
+  auto lock = std::lock_guard(telemetry_mutex_);
+  auto channels = GetTelemetryChannels(sensors, num_fans);
+  try {
+    if (telemetry_store_) {
+      telemetry_store_->SetChannels(std::move(channels));
+    } else {
+      telemetry_store_ = std::make_unique<TelemetryStore>(
+          options_.telemetry_file.string(), std::move(channels));
+    }
+  } catch (std::exception& e) {
+    bbmp::Log(bbmp::LogLevel::kError, "Failed to open telemetry file: {}",
+              e.what());
+    // Its channels no longer match the samples
+    telemetry_store_.reset();
+  }
+  num_logged_sensors_ = sensors.size();
+  num_logged_fans_ = num_fans;
+}
+
+void ControlEngine::TrainOnTelemetry(PredictiveController& predictive) {
+  auto lock = std::lock_guard(telemetry_mutex_);
+  if (!telemetry_store_) {
+    return;
+  }
+
+  int64_t first_ms = 0;
+  int64_t last_ms = 0;
+  if (!telemetry_store_->GetTimeRange(first_ms, last_ms)) {
+    return;
+  }
+
+  const auto settings = settings_.Read();
+  const auto& store_channels = telemetry_store_->GetChannels();
+  const auto find_channel = [&store_channels](const std::string& name) {
+    for (size_t i = 0; i < store_channels.size(); ++i) {
+      if (store_channels[i].name == name) {
+        return static_cast<int>(i);
+      }
+    }
+    return -1;
+  };
+
+  // The raw temperatures of the sensors the store has, then the duty cycles
+  std::vector<size_t> channels;
+  std::vector<size_t> channel_sensors;
+  for (size_t i_sensor = 0; i_sensor < predictive.GetNumSensors() &&
+                            i_sensor < settings->GetNumSensors();
+       ++i_sensor) {
+    const auto i_channel =
+        find_channel(settings->sensors[i_sensor].id + "_temp");
+    if (i_channel >= 0) {
+      channels.push_back(static_cast<size_t>(i_channel));
+      channel_sensors.push_back(i_sensor);
+    }
+  }
+  size_t num_fans = 0;
+  for (;; ++num_fans) {
+    const auto i_channel =
+        find_channel("fan" + std::to_string(num_fans) + "_duty");
+    if (i_channel < 0) {
+      break;
+    }
+    channels.push_back(static_cast<size_t>(i_channel));
+  }
+
+  const auto max_gap_ms = 3 * kControlPeriod.count() / 2;
+  // The first sample restarts the models too, which is harmless
+  int64_t previous_ms = 0;
+  std::vector<float> temps(predictive.GetNumSensors(), std::nanf(""));
+  std::vector<float> duty_cycles(num_fans);
+  telemetry_store_->Scan(
+      last_ms - 3600 * 1000, last_ms + 1, channels,
+      [&](const TelemetryStore::ScanBlock& block) {
+        for (size_t i = 0; i < block.num_samples; ++i) {
+          if (block.timestamps[i] - previous_ms > max_gap_ms) {
+            predictive.Restart();
+          }
+          previous_ms = block.timestamps[i];
+
+          for (size_t j = 0; j < channel_sensors.size(); ++j) {
+            temps[channel_sensors[j]] = block.values[j][i];
+          }
+          for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+            duty_cycles[i_fan] =
+                block.values[channel_sensors.size() + i_fan][i];
+          }
+          predictive.Observe(temps.data());
+          predictive.SetInput(duty_cycles.data(), num_fans);
+        }
+      });
+  // The gap until the first control step
+  predictive.Restart();
+
+  size_t num_identified = 0;
+  for (const auto i_sensor : channel_sensors) {
+    const auto& model = predictive.GetModel(i_sensor);
+    const auto& [a, b, c] = model.GetParameters();
+    num_identified += model.IsIdentified();
+    bbmp::Log(bbmp::LogLevel::kDebug,
+              "Thermal model {} trained on {} samples: a={:.4f} b={:.5f} "
+              "c={:.3f}{}",
+              settings->sensors[i_sensor].id, model.GetNumUpdates(), a, b, c,
+              model.IsIdentified() ? "" : ", not identified");
+  }
+  bbmp::Log("Thermal models trained on the telemetry, {} of {} identified",
+            num_identified, channel_sensors.size());
+}
+
+void ControlEngine::Run(const std::function<bool()>& should_exit,
+                        const std::function<void(int)>& wait_ms) {
+  using Stage = PipelineLatency::Stage;
+  auto& latency = PipelineLatency::GetInstance();
+
+  // In between control steps the thread sleeps until serial IO, a new sample
+  // or the next deadline
+  bbmp::LoopMetrics loop_metrics(std::chrono::minutes(1));
+
+  // Outlives reconnects, the thermal behaviour doesn't change with them
+  PredictiveController predictive(settings_.Read()->GetNumSensors());
+  TrainOnTelemetry(predictive);
+
+  while (!should_exit()) {
+    try {
+      bbmp::FanControllerRegistry fan_controllers(
+          ParseSlots(settings_.Read()->last_com_port), should_exit, wait_ms);
+
+      // [i_sensor] over the registry, NaN while a sensor can't be read: the
+      // latest sample, and the temperatures the curves get, filtered as the
+      // samples arrive
+      std::vector<float> raw_temps;
+      std::vector<float> temps;
+      SensorFilterBank sensor_filters(0);
+      uint64_t filter_settings_version = 0;
+
+      // The registry only grows, and the state of the sensors it had is kept
+      const auto sync_sensors = [this, &raw_temps, &temps, &sensor_filters,
+                                 &filter_settings_version, &predictive]() {
+        const auto num_sensors = settings_.Read()->GetNumSensors();
+        if (num_sensors == raw_temps.size()) {
+          return;
+        }
+        raw_temps.resize(num_sensors, std::nanf(""));
+        temps.resize(num_sensors, std::nanf(""));
+        sensor_filters.Resize(num_sensors);
+        predictive.Resize(num_sensors);
+        // Configures the new channels
+        filter_settings_version = 0;
+      };
+
+      const auto register_sensors =
+          [this, &sync_sensors](const CoolthSettings::TSensors& sensors) {
+            if (settings_.EnsureSensors(sensors)) {
+              for (auto* listener : listeners_) {
+                listener->OnSensorsAdded();
+              }
+            }
+            sync_sensors();
+          };
+
+      const auto filter_temps = [this, &raw_temps, &temps, &sensor_filters,
+                                 &filter_settings_version](
+                                    SensorFilterBank::Clock::time_point time) {
+        // Only stages that changed restart
+        if (const auto settings = settings_.Read();
+            settings.GetVersion() != filter_settings_version) {
+          filter_settings_version = settings.GetVersion();
+          static const std::vector<FilterStage> kNoStages;
+          for (size_t i_sensor = 0; i_sensor < temps.size() &&
+                                    i_sensor < settings->GetNumSensors();
+               ++i_sensor) {
+            sensor_filters.Configure(i_sensor,
+                                     settings->smooth_temps
+                                         ? settings->sensors[i_sensor].filter
+                                         : kNoStages);
+          }
+        }
+        sensor_filters.Process(raw_temps.data(), time, temps.data());
+      };
+
+      sync_sensors();
+
+#ifdef _WIN32
+      bool new_sample = false;
+      // When the last chunk arrived from the pipe
+      PipelineLatency::Clock::time_point ingress_time;
+      // [i_field] the sensor of each field of the last line. The reader lists
+      // the same sensors in the same order every time, so ids are only
+      // searched when that changes.
+      std::vector<int> field_sensors;
+      CoolthSettings::TSensors new_sensors;
+      LineReader temp_stream_reader(
+          kMaxSampleLineLength,
+          [this, &new_sample, &ingress_time, &latency, &raw_temps,
+           &field_sensors, &new_sensors, &sync_sensors, &register_sensors,
+           &filter_temps](const char* data, size_t length) {
+            sync_sensors();
+            const auto settings = settings_.Read();
+            std::fill(raw_temps.begin(), raw_temps.end(), std::nanf(""));
+            sample_line::Parse(
+                data, length,
+                [&settings, &raw_temps, &field_sensors, &new_sensors](
+                    std::string_view key, float value, size_t i_field) {
+                  // Fields without a key are the CPU and the GPU of the old
+                  // format, the first two sensors of every registry
+                  int i_sensor = -1;
+                  if (key.empty()) {
+                    i_sensor = i_field < 2 ? static_cast<int>(i_field) : -1;
+                  } else {
+                    if (i_field >= field_sensors.size()) {
+                      field_sensors.resize(i_field + 1, -1);
+                    }
+                    auto& cached = field_sensors[i_field];
+                    if (cached < 0 || settings->sensors[cached].id != key) {
+                      cached = settings->FindSensor(key);
+                    }
+                    i_sensor = cached;
+                    // Registered after the line, their values count from the
+                    // next one
+                    if (i_sensor < 0 &&
+                        settings->GetNumSensors() <
+                            CoolthSettings::kMaxSensors &&
+                        CoolthSettings::IsValidSensorId(key)) {
+                      new_sensors.push_back(
+                          {std::string(key), std::string(key),
+                           CoolthSettings::GetDefaultFilter()});
+                    }
+                  }
+                  if (i_sensor >= 0 &&
+                      static_cast<size_t>(i_sensor) < raw_temps.size()) {
+                    raw_temps[i_sensor] = value;
+                  }
+                });
+            if (!new_sensors.empty()) {
+              register_sensors(new_sensors);
+              new_sensors.clear();
+            }
+
+            new_sample = true;
+            const auto filter_start =
+                latency.RecordSince(Stage::kSensorRead, ingress_time);
+            filter_temps(ingress_time);
+            latency.RecordSince(Stage::kSmoothing, filter_start);
+          });
+
+      RecreateOnFailure<ChildProcess> temp_reader_process{
+          [this, &temp_stream_reader, &ingress_time]() {
+            return std::make_unique<ChildProcess>(
+                options_.temperature_reader.string(),
+                [&temp_stream_reader, &ingress_time](const char* data,
+                                                     size_t length) {
+                  ingress_time = PipelineLatency::Clock::now();
+                  temp_stream_reader.Read(data, length);
+                });
+          }};
+#else
+      // Sensors are discovered once and then sampled in-process on every
+      // control tick
+      bbmp::HwmonSensors hwmon_sensors;
+      const auto cpu_sensor = hwmon_sensors.Find(
+          {"coretemp", "k10temp", "zenpower", "x86_pkg_temp", "cpu_thermal"},
+          {"Package id 0", "Tctl", "Tdie"});
+      const auto gpu_sensor =
+          hwmon_sensors.Find({"amdgpu", "radeon", "nouveau"}, {"edge"});
+
+      const auto log_sensor = [&hwmon_sensors](
+                                  const std::string& name,
+                                  const std::optional<size_t>& i_sensor) {
+        if (i_sensor) {
+          const auto& sensor = hwmon_sensors.GetSensors()[*i_sensor];
+          bbmp::Log("{} temperature sensor: {} {}", name, sensor.chip,
+                    sensor.label);
+        } else {
+          bbmp::Log(bbmp::LogLevel::kWarning, "No {} temperature sensor found",
+                    name);
+        }
+      };
+      log_sensor("CPU", cpu_sensor);
+      log_sensor("GPU", gpu_sensor);
+
+      // The id of every hwmon sensor and the one it reads. cpu and gpu are
+      // aliases of the sensors picked above. Sensors of identical chips get
+      // numbered in the order they are found.
+      std::vector<std::pair<std::string, size_t>> hwmon_ids;
+      if (cpu_sensor) {
+        hwmon_ids.emplace_back("cpu", *cpu_sensor);
+      }
+      if (gpu_sensor) {
+        hwmon_ids.emplace_back("gpu", *gpu_sensor);
+      }
+      const auto is_taken = [&hwmon_ids](const std::string& id) {
+        return id == "cpu" || id == "gpu" ||
+               std::any_of(hwmon_ids.begin(), hwmon_ids.end(),
+                           [&id](const auto& entry) {
+                             return entry.first == id;
+                           });
+      };
+      CoolthSettings::TSensors found_sensors;
+      for (size_t i_hwmon = 0; i_hwmon < hwmon_sensors.GetSensors().size();
+           ++i_hwmon) {
+        const auto& sensor = hwmon_sensors.GetSensors()[i_hwmon];
+        const auto label = sensor.chip + " " + sensor.label;
+        const auto base_id = CoolthSettings::MakeSensorId(label);
+        auto id = base_id;
+        for (int i = 2; is_taken(id); ++i) {
+          const auto suffix = "_" + std::to_string(i);
+          id = base_id.substr(0, CoolthSettings::kMaxSensorIdLength -
+                                     suffix.size()) +
+               suffix;
+        }
+        hwmon_ids.emplace_back(id, i_hwmon);
+        found_sensors.push_back(
+            {id, label, CoolthSettings::GetDefaultFilter()});
+      }
+      register_sensors(found_sensors);
+      bbmp::Log("{} hwmon temperature sensors, {} sensors registered",
+                hwmon_sensors.GetSensors().size(),
+                settings_.Read()->GetNumSensors());
+
+      // [i_sensor] the hwmon sensor of each sensor of the registry, -1 for
+      // the ones that aren't there
+      std::vector<int> sensor_hwmon;
+      const auto map_sensors = [this, &hwmon_ids, &sensor_hwmon]() {
+        const auto settings = settings_.Read();
+        sensor_hwmon.assign(settings->GetNumSensors(), -1);
+        for (const auto& [id, i_hwmon] : hwmon_ids) {
+          if (const auto i_sensor = settings->FindSensor(id); i_sensor >= 0) {
+            sensor_hwmon[i_sensor] = static_cast<int>(i_hwmon);
+          }
+        }
+      };
+#endif
+
+      // [i_fan] over the fans of all slots. Sized on the first control step
+      // and whenever the layout changes.
+      uint64_t layout_version = 0;
+      std::vector<float> duty_cycles;
+      std::vector<int> i_sensors;
+      // The temperature each duty cycle was read from the curves at
+      std::vector<float> plan_temps;
+      std::vector<std::optional<CurvePoint>> duty_points;
+      std::vector<int> rpms;
+      // One entry per telemetry channel
+      std::vector<float> sample;
+
+      // Recompiled whenever the layout, the registry or the settings change
+      FanCurveTable curve_table(0, 0);
+      uint64_t compiled_settings_version = 0;
+
+      bool control_step_due = true;
+      bbmp::PeriodicTimer control_timer(
+          kControlPeriod,
+          [&control_step_due,
+           &loop_metrics](bbmp::PeriodicTimer::Clock::time_point deadline) {
+            loop_metrics.OnTick(deadline);
+            control_step_due = true;
+          });
+
+      while (!should_exit()) {
+#ifdef _WIN32
+        temp_reader_process.Execute([](auto& p) { p.IssueRead(); });
+        // Only a step that picks up a new sample has a meaningful latency
+        bool fresh_sample = false;
+        if (new_sample) {
+          new_sample = false;
+          fresh_sample = true;
+          control_step_due = true;
+          control_timer.Restart();
+        }
+#endif
+        fan_controllers.IssueReads();
+        if (control_step_due) {
+          control_step_due = false;
+          // >>> AUTO DUTY CYCLE LOGIC ======================================
+          sync_sensors();
+#ifdef _WIN32
+          auto stage_start = PipelineLatency::Clock::now();
+          if (fresh_sample) {
+            latency.Record(Stage::kQueue, stage_start - ingress_time);
+          }
+#else
+          if (sensor_hwmon.size() != raw_temps.size()) {
+            map_sensors();
+          }
+          const bool fresh_sample = true;
+          const auto ingress_time = PipelineLatency::Clock::now();
+          for (size_t i_sensor = 0; i_sensor < raw_temps.size(); ++i_sensor) {
+            const auto i_hwmon = sensor_hwmon[i_sensor];
+            raw_temps[i_sensor] =
+                i_hwmon >= 0
+                    ? hwmon_sensors.Read(i_hwmon).value_or(std::nanf(""))
+                    : std::nanf("");
+          }
+          auto stage_start =
+              latency.RecordSince(Stage::kSensorRead, ingress_time);
+          filter_temps(ingress_time);
+          stage_start = latency.RecordSince(Stage::kSmoothing, stage_start);
+#endif
+          const auto smooth_temps = settings_.GetSmoothTemps();
+
+          if (fan_controllers.GetLayoutVersion() != layout_version) {
+            layout_version = fan_controllers.GetLayoutVersion();
+            const auto num_fans = fan_controllers.GetNumFans();
+
+            // Keeps the numbering of the fans the next time. Slots are never
+            // removed, so losing a board doesn't change this.
+            if (auto slots = FormatSlots(fan_controllers.GetSlots());
+                slots != settings_.Read()->last_com_port) {
+              settings_.AccessLastComPort(
+                  [&slots](auto& value) { value = std::move(slots); });
+              settings_.MarkChanged();
+            }
+
+            // One telemetry frame per control step is all we use, also for
+            // boards found while running
+            fan_controllers.SetTelemetryPeriod(
+                static_cast<uint16_t>(kControlPeriod.count()));
+
+            if (settings_.EnsureNumFans(num_fans)) {
+              for (auto* listener : listeners_) {
+                listener->OnFansAdded();
+              }
+            }
+            duty_cycles.resize(num_fans);
+            i_sensors.resize(num_fans);
+            plan_temps.resize(num_fans);
+            duty_points.resize(num_fans);
+            rpms.resize(num_fans);
+            curve_table = FanCurveTable(num_fans, temps.size());
+            compiled_settings_version = 0;
+          }
+          if (curve_table.GetNumSensors() != temps.size()) {
+            curve_table = FanCurveTable(curve_table.GetNumFans(), temps.size());
+            compiled_settings_version = 0;
+          }
+
+          const auto settings = settings_.Read();
+          if (settings.GetVersion() != compiled_settings_version) {
+            curve_table.Compile(settings->temp_curves,
+                                [&settings](const std::string& id) {
+                                  return settings->FindSensor(id);
+                                });
+            compiled_settings_version = settings.GetVersion();
+          }
+
+          // The models follow the raw temperatures, smoothing would only add
+          // lag to what they have to identify
+          predictive.Observe(raw_temps.data());
+
+          if (settings->predictive_control) {
+            predictive.Plan(curve_table, duty_cycles.data(), i_sensors.data(),
+                            plan_temps.data());
+          } else {
+            curve_table.Evaluate(temps.data(), duty_cycles.data(),
+                                 i_sensors.data());
+            for (auto i_fan = 0u; i_fan < duty_cycles.size(); ++i_fan) {
+              plan_temps[i_fan] = i_sensors[i_fan] >= 0
+                                      ? temps[i_sensors[i_fan]]
+                                      : std::nanf("");
+            }
+          }
+
+          for (auto i_fan = 0u; i_fan < duty_cycles.size(); ++i_fan) {
+            auto& duty_cycle = duty_cycles[i_fan];
+            std::optional<float> duty_cycle_override;
+            for (auto* listener : listeners_) {
+              if ((duty_cycle_override =
+                       listener->GetDutyCycleOverride(i_fan))) {
+                break;
+              }
+            }
+
+            if (duty_cycle_override) {
+              duty_cycle = *duty_cycle_override;
+              duty_points[i_fan] = {};
+            } else if (i_sensors[i_fan] >= 0) {
+              duty_points[i_fan] = CurvePoint{plan_temps[i_fan], duty_cycle};
+            } else {
+              // Fans beyond kMaxFans have no settings, they run at full speed
+              duty_cycle = i_fan < settings->manual_duty_cycles.size()
+                               ? settings->manual_duty_cycles[i_fan]
+                               : 100.0f;
+              duty_points[i_fan] = {};
+            }
+          }
+          // <<< AUTO DUTY CYCLE LOGIC
+          // --------------------------------------
+          stage_start = latency.RecordSince(Stage::kCurves, stage_start);
+
+          fan_controllers.GetRpms(rpms.data());
+
+          // The commands of all boards go out together
+          fan_controllers.SetDutyCycles(duty_cycles.data());
+          predictive.SetInput(duty_cycles.data(), duty_cycles.size());
+          stage_start = latency.RecordSince(Stage::kCommand, stage_start);
+          if (fresh_sample) {
+            latency.Record(Stage::kEndToEnd, stage_start - ingress_time);
+          }
+
+          // Every sensor and every fan the settings know about is logged, the
+          // fans on missing boards as NaN
+          const auto num_logged_sensors = temps.size();
+          const auto num_logged_fans = settings->GetNumFans();
+          if (num_logged_sensors != num_logged_sensors_ ||
+              num_logged_fans != num_logged_fans_) {
+            OpenTelemetryStore(
+                {settings->sensors.begin(),
+                 settings->sensors.begin() + num_logged_sensors},
+                num_logged_fans);
+            for (auto* listener : listeners_) {
+              listener->OnTelemetryChannelsChanged(num_logged_sensors,
+                                                   num_logged_fans);
+            }
+          }
+
+          const auto missing = std::nanf("");
+          sample.assign(2 * num_logged_sensors + 2 * num_logged_fans, missing);
+          std::copy(raw_temps.begin(), raw_temps.end(), sample.begin());
+          std::copy(temps.begin(), temps.end(),
+                    sample.begin() + num_logged_sensors);
+          auto* fan_channels = sample.data() + 2 * num_logged_sensors;
+          const auto num_fans = std::min(duty_cycles.size(), num_logged_fans);
+          for (auto i_fan = 0u; i_fan < num_fans; ++i_fan) {
+            if (fan_controllers.IsFanConnected(i_fan)) {
+              fan_channels[i_fan] = duty_cycles[i_fan];
+              fan_channels[num_logged_fans + i_fan] =
+                  static_cast<float>(rpms[i_fan]);
+            }
+          }
+          const auto timestamp_ms =
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::system_clock::now().time_since_epoch())
+                  .count();
+          {
+            auto lock = std::lock_guard(telemetry_mutex_);
+            if (telemetry_store_) {
+              telemetry_store_->Append(timestamp_ms, sample.data());
+            }
+          }
+
+          const Step step{timestamp_ms,       ingress_time,
+                          raw_temps.size(),   raw_temps.data(),
+                          temps.data(),       smooth_temps,
+                          duty_cycles.size(), duty_cycles.data(),
+                          rpms.data(),        duty_points.data(),
+                          sample.data(),      sample.size()};
+          stage_start = PipelineLatency::Clock::now();
+          for (auto* listener : listeners_) {
+            listener->OnStep(step);
+          }
+          latency.RecordSince(Stage::kListeners, stage_start);
+        }
+
+        // A command that couldn't be issued because the previous write was
+        // still in progress is retried after the wakeup of its completion
+        fan_controllers.FlushDutyCycles();
+
+        if (auto report = loop_metrics.TakeReport()) {
+          bbmp::Log(bbmp::LogLevel::kDebug, "Control loop: {}", *report);
+          for (const auto& line : latency.GetReport()) {
+            bbmp::Log(bbmp::LogLevel::kDebug, "Latency: {}", line);
+          }
+          // Only the models that plan duty cycles
+          const auto settings = settings_.Read();
+          for (size_t i_sensor = 0; i_sensor < curve_table.GetNumSensors();
+               ++i_sensor) {
+            if (!curve_table.HasCurves(i_sensor)) {
+              continue;
+            }
+            const auto& model = predictive.GetModel(i_sensor);
+            const auto& [a, b, c] = model.GetParameters();
+            bbmp::Log(bbmp::LogLevel::kDebug,
+                      "Thermal model {}: a={:.4f} b={:.5f} c={:.3f}{}",
+                      settings->sensors[i_sensor].id, a, b, c,
+                      model.IsIdentified() ? "" : ", not identified");
+          }
+        }
+
+        // The timer wakes us up every period, the timeout is only a safety net
+        bbmp::Serial::WindowsSleepEx(
+            static_cast<uint32_t>(2 * kControlPeriod.count()), true);
+        loop_metrics.OnWakeup();
+      }
+    } catch (std::runtime_error& error) {
+      bbmp::Log(bbmp::LogLevel::kError, "{}", error.what());
+    }
+    wait_ms(1000);
+  }
+}
@@ -0,0 +1,145 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "fan_curve_table.h"
+#include "predictive_controller.h"
+#include "settings.h"
+#include "telemetry_store.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*
+ * The control loop of Coolth: reads the temperatures, evaluates the fan curves,
+ * drives the fan controllers and records the telemetry.
+ *
+ * It depends on nothing but the standard library, bbmp and cereal. coolthd
+ * runs it on its own, the GUI runs it with a Listener that mirrors every
+ * control step on screen.
+ */
+class ControlEngine {
+ public:
+  // The control step runs once per period, or right away when a new sample
+  // arrives
+  static constexpr std::chrono::milliseconds kControlPeriod{1000};
+
+  // The longest sample line of the temperature reader, see sample_line.h
+  static constexpr size_t kMaxSampleLineLength = 4096;
+
+  // What a control step did. The temperatures have num_sensors entries, one
+  // per sensor of the registry, NaN where a sensor couldn't be read. The other
+  // arrays have num_fans entries, over the fans of all boards.
+  struct Step {
+    int64_t timestamp_ms;
+    // When the temperatures were read, for measuring how long they take to
+    // reach the fans and the screen
+    std::chrono::steady_clock::time_point ingress_time;
+    size_t num_sensors;
+    // Straight from the sensors
+    const float* raw_temps;
+    // Smoothed if the settings ask for it, these are what the curves get
+    const float* temps;
+    bool smooth_temps;
+    size_t num_fans;
+    const float* duty_cycles;
+    const int* rpms;
+    // Where the duty cycle is on the curve that set it, if a curve did
+    const std::optional<CurvePoint>* duty_points;
+    // The sample recorded in the telemetry, see GetTelemetryChannels
+    const float* telemetry;
+    size_t num_telemetry_channels;
+  };
+
+  // Everything is called on the control thread, and must not block it
+  class Listener {
+   public:
+    virtual ~Listener() = default;
+
+    // The settings have more fans than before, see
+    // CoolthSettings::EnsureNumFans
+    virtual void OnFansAdded() {}
+
+    // Sensors were registered, see CoolthSettings::EnsureSensors
+    virtual void OnSensorsAdded() {}
+
+    // The telemetry now has channels for the first num_logged_sensors sensors
+    // of the registry and num_logged_fans
+    virtual void OnTelemetryChannelsChanged(size_t /*num_logged_sensors*/,
+                                            size_t /*num_logged_fans*/) {}
+
+    // A duty cycle that takes precedence over the curves and the settings,
+    // e.g. while the user drags the slider of the fan
+    virtual std::optional<float> GetDutyCycleOverride(size_t /*i_fan*/) {
+      return std::nullopt;
+    }
+
+    virtual void OnStep(const Step& /*step*/) {}
+  };
+
+  struct Options {
+    std::filesystem::path telemetry_file;
+    // The Open Hardware Monitor based reader the temperatures come from on
+    // Windows. Linux reads hwmon directly.
+    std::filesystem::path temperature_reader;
+  };
+
+  // Opens the telemetry with channels for the sensors and the fans of
+  // settings. Listeners are called in order, and the first duty cycle override
+  // wins.
+  ControlEngine(CoolthSettings& settings, Options options,
+                std::vector<Listener*> listeners = {});
+  ~ControlEngine();
+
+  ControlEngine(const ControlEngine&) = delete;
+  ControlEngine& operator=(const ControlEngine&) = delete;
+
+  // The raw temperatures of the sensors, <id>_temp, the smoothed ones,
+  // <id>_temp_filtered, then the duty cycles and the RPMs of num_fans
+  static std::vector<TelemetryStore::Channel> GetTelemetryChannels(
+      const CoolthSettings::TSensors& sensors, size_t num_fans);
+
+  // Thread safe. store is null if the telemetry file couldn't be opened.
+  void AccessTelemetryStore(
+      const std::function<void(TelemetryStore* store)>& accessor);
+
+  // Drives the fans until should_exit returns true. Connection failures are
+  // retried. wait_ms(ms) sleeps for at most ms, it may return early when
+  // should_exit changes.
+  void Run(const std::function<bool()>& should_exit,
+           const std::function<void(int)>& wait_ms);
+
+ private:
+  // Opens the store with channels for the sensors and num_fans, or switches
+  // the open one to them. The history of the channels is kept.
+  void OpenTelemetryStore(const CoolthSettings::TSensors& sensors,
+                          size_t num_fans);
+
+  // Fits the models of predictive to the telemetry of the last hour, so the
+  // predictive mode is usable right after a restart. Sensors are matched to
+  // channels by id.
+  void TrainOnTelemetry(PredictiveController& predictive);
+
+  CoolthSettings& settings_;
+  const Options options_;
+  const std::vector<Listener*> listeners_;
+
+  std::mutex telemetry_mutex_;
+  // Null if the telemetry file couldn't be opened
+  std::unique_ptr<TelemetryStore> telemetry_store_;
+  // The number of sensors and fans the telemetry store has channels for
+  size_t num_logged_sensors_ = 0;
+  size_t num_logged_fans_ = 0;
+};
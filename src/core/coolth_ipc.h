@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * Binary protocol between coolthd and its clients, e.g. coolthctl, over a
+ * Unix domain stream socket.
+ *
+ * Frame layout:
+ *
+ *   | type | length | payload[length] |
+ *
+ * type is one byte, length is a uint16. Multi-byte fields are little endian,
+ * floats are IEEE 754 binary32, strings are | length: uint8 | bytes |. The
+ * socket is reliable, so there is no sync byte or checksum.
+ *
+ * Requests start with a uint32 request ID chosen by the client. Every request
+ * is answered with a kReply carrying the same ID, in the order the requests
+ * were sent. Telemetry frames can arrive in between replies once the client
+ * subscribed.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace coolth_ipc {
+const uint8_t kHeaderLength = 3;
+const uint16_t kMaxPayloadLength = UINT16_MAX;
+
+enum MessageType : uint8_t {
+  // Payload: | request_id | period_ms: uint32 |. Telemetry is sent at most
+  // once per period, 0 means after every control step. Subscribing again
+  // changes the period.
+  kSubscribe = 0x01,
+  // Payload: | request_id |
+  kUnsubscribe = 0x02,
+  // Payload: | request_id | i_fan: uint16 | duty_cycle: float |. The duty
+  // cycle the fan runs at while its curves don't apply, saved in the settings.
+  kSetManualDutyCycle = 0x10,
+  // Payload: | request_id | i_fan: uint16 | duty_cycle: float |. Takes
+  // precedence over the curves until it's cleared with NaN or the client
+  // disconnects. The last client to set it owns it.
+  kSetDutyCycleOverride = 0x11,
+  // Payload: | request_id | enabled: uint8 |
+  kSetSmoothTemps = 0x12,
+  // Payload: | request_id | enabled: uint8 |. Plans the duty cycles with the
+  // thermal models instead of reading the curves at the current temperatures.
+  kSetPredictiveControl = 0x13,
+  // Payload: | request_id | sensor: string | stages |, where stages is
+  // (type: uint8, value: float, noise: float) * n, see FilterStage. The filter
+  // of the sensor while smoothing is on, no stages leave it unfiltered.
+  kSetSensorFilter = 0x14,
+  // Payload: | request_id | i_fan: uint16 | sensor: string | points |, where
+  // points is (temperature: float, duty: float) * n. Replaces the curves of
+  // the fan that follow the sensor, no points remove them. The sensor doesn't
+  // need to be registered yet, the curve applies once it is. At most
+  // CoolthSettings::kMaxCurvePoints points, and kMaxCurvesPerFan sensors per
+  // fan.
+  kSetCurve = 0x15,
+  // Payload: | request_id | i_fan: uint16 |. Reply data: for every curve of
+  // the fan | sensor: string | num_points: uint16 |
+  // (temperature: float, duty: float) * n |
+  kGetCurves = 0x20,
+  // Payload: | request_id |. Reply data: | num_sensors: uint16 |
+  // (id: string, label: string) * n |, the sensor registry in index order
+  kGetSensors = 0x21,
+  // Payload: | request_id |. Replied right away, for measuring latency.
+  kPing = 0x30,
+
+  // Payload: | request_id | status: uint8 | data |. Data that doesn't fit
+  // into a frame is replied with kOutOfRange and no data.
+  kReply = 0x80,
+  // Payload: | timestamp_ms: int64 | num_sensors: uint16 | num_values: uint16 |
+  // values: float * n |. The values are the channels of the telemetry store:
+  // the raw temperatures of the first num_sensors sensors of the registry,
+  // their smoothed temperatures, then the duty cycles and the RPMs of the
+  // (num_values - 2 * num_sensors) / 2 fans.
+  kTelemetry = 0x81
+};
+
+enum Status : uint8_t { kOk = 0, kBadRequest = 1, kOutOfRange = 2 };
+
+const char* const kSocketName = "coolth.sock";
+
+// $XDG_RUNTIME_DIR/coolth.sock, or /tmp/coolth.sock without it
+inline std::string GetDefaultSocketPath() {
+  const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+  return std::string(runtime_dir != nullptr ? runtime_dir : "/tmp") + "/" +
+         kSocketName;
+}
+
+struct Frame {
+  uint8_t type = 0;
+  std::vector<uint8_t> payload;
+};
+
+// Appends to a payload
+class Writer {
+ public:
+  explicit Writer(std::vector<uint8_t>& out) : out_(out) {}
+
+  Writer& U8(uint8_t value) {
+    out_.push_back(value);
+    return *this;
+  }
+
+  Writer& U16(uint16_t value) { return Bytes(value, 2); }
+  Writer& U32(uint32_t value) { return Bytes(value, 4); }
+  Writer& I64(int64_t value) { return Bytes(static_cast<uint64_t>(value), 8); }
+
+  Writer& F32(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return U32(bits);
+  }
+
+  // Longer strings are cut at 255 bytes
+  Writer& String(const std::string& value) {
+    const auto length = std::min<size_t>(value.size(), UINT8_MAX);
+    U8(static_cast<uint8_t>(length));
+    out_.insert(out_.end(), value.begin(), value.begin() + length);
+    return *this;
+  }
+
+ private:
+  Writer& Bytes(uint64_t value, int size) {
+    for (int i = 0; i < size; ++i) {
+      out_.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+    return *this;
+  }
+
+  std::vector<uint8_t>& out_;
+};
+
+// Reads a payload. Reading past the end sets a flag instead of throwing, so a
+// message can be decoded in one go and checked with IsValid at the end.
+class Reader {
+ public:
+  Reader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  uint8_t U8() { return static_cast<uint8_t>(Bytes(1)); }
+  uint16_t U16() { return static_cast<uint16_t>(Bytes(2)); }
+  uint32_t U32() { return static_cast<uint32_t>(Bytes(4)); }
+  int64_t I64() { return static_cast<int64_t>(Bytes(8)); }
+
+  float F32() {
+    const auto bits = U32();
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::string String() {
+    const size_t length = U8();
+    if (size_ - position_ < length) {
+      is_valid_ = false;
+      position_ = size_;
+      return {};
+    }
+    std::string value(reinterpret_cast<const char*>(data_ + position_),
+                      length);
+    position_ += length;
+    return value;
+  }
+
+  bool IsValid() const { return is_valid_; }
+  size_t GetRemaining() const { return size_ - position_; }
+
+ private:
+  uint64_t Bytes(int size) {
+    if (size_ - position_ < static_cast<size_t>(size)) {
+      is_valid_ = false;
+      position_ = size_;
+      return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < size; ++i) {
+      value |= static_cast<uint64_t>(data_[position_++]) << (8 * i);
+    }
+    return value;
+  }
+
+  const uint8_t* data_;
+  size_t size_;
+  size_t position_ = 0;
+  bool is_valid_ = true;
+};
+
+// Appends a complete frame to out. Returns false if the payload is too long.
+inline bool EncodeFrame(uint8_t type, const std::vector<uint8_t>& payload,
+                        std::vector<uint8_t>& out) {
+  if (payload.size() > kMaxPayloadLength) {
+    return false;
+  }
+  Writer(out).U8(type).U16(static_cast<uint16_t>(payload.size()));
+  out.insert(out.end(), payload.begin(), payload.end());
+  return true;
+}
+
+// Decodes the frame at the front of data. Returns its length, or 0 if data
+// doesn't hold a complete frame yet.
+inline size_t DecodeFrame(const uint8_t* data, size_t size, Frame& frame) {
+  if (size < kHeaderLength) {
+    return 0;
+  }
+  Reader header(data, kHeaderLength);
+  frame.type = header.U8();
+  const size_t length = kHeaderLength + header.U16();
+  if (size < length) {
+    return 0;
+  }
+  frame.payload.assign(data + kHeaderLength, data + length);
+  return length;
+}
+}  // namespace coolth_ipc
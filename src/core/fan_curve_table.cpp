@@ -0,0 +1,198 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "fan_curve_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FAN_CURVE_TABLE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+struct Lookup {
+  size_t i_step;
+  float fraction;
+};
+
+bool GetLookup(float temp, Lookup& lookup) {
+  if (std::isnan(temp)) {
+    return false;
+  }
+  const auto position =
+      (std::clamp(temp, FanCurveTable::kMinTemp, FanCurveTable::kMaxTemp) -
+       FanCurveTable::kMinTemp) *
+      FanCurveTable::kStepsPerDegree;
+  lookup.i_step = std::min(static_cast<size_t>(position),
+                           static_cast<size_t>(FanCurveTable::kNumSteps - 2));
+  lookup.fraction = position - lookup.i_step;
+  return true;
+}
+}  // namespace
+
+FanCurveTable::FanCurveTable(size_t num_fans, size_t num_sensors)
+    : num_fans_(num_fans),
+      num_sensors_(num_sensors),
+      fan_stride_((num_fans + 3) / 4 * 4),
+      columns_(num_sensors, -1),
+      best_values_(fan_stride_),
+      best_sensors_(fan_stride_) {}
+
+void FanCurveTable::AllocateColumns() {
+  column_sensors_.clear();
+  for (size_t i_sensor = 0; i_sensor < num_sensors_; ++i_sensor) {
+    if (columns_[i_sensor] >= 0) {
+      columns_[i_sensor] = static_cast<int>(column_sensors_.size());
+      column_sensors_.push_back(i_sensor);
+    }
+  }
+  table_.assign(column_sensors_.size() * kNumSteps * fan_stride_, kNoCurve);
+}
+
+void FanCurveTable::SetCurve(size_t i_fan, size_t i_sensor, const float* xs,
+                             const float* ys, size_t num_points) {
+  if (!HasCurves(i_sensor)) {
+    if (num_points == 0) {
+      return;
+    }
+    // Keeps the other columns
+    const auto old_columns = columns_;
+    const auto old_table = std::move(table_);
+    columns_[i_sensor] = 0;
+    AllocateColumns();
+    for (size_t i_other = 0; i_other < num_sensors_; ++i_other) {
+      if (i_other != i_sensor && old_columns[i_other] >= 0) {
+        const auto column_size = kNumSteps * fan_stride_;
+        std::copy_n(old_table.data() + old_columns[i_other] * column_size,
+                    column_size, GetColumn(i_other));
+      }
+    }
+  }
+
+  float* column = GetColumn(i_sensor) + i_fan;
+  for (int i_step = 0; i_step < kNumSteps; ++i_step) {
+    column[i_step * fan_stride_] = kNoCurve;
+  }
+  SampleCurve(i_fan, i_sensor, xs, ys, num_points);
+}
+
+void FanCurveTable::SampleCurve(size_t i_fan, size_t i_sensor,
+                                const float* xs, const float* ys,
+                                size_t num_points) {
+  if (num_points == 0) {
+    return;
+  }
+  float* column = GetColumn(i_sensor) + i_fan;
+
+  std::vector<size_t> order(num_points);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [xs](size_t a, size_t b) { return xs[a] < xs[b]; });
+
+  // Index of the first point to the right of x
+  size_t i_larger = 0;
+  for (int i_step = 0; i_step < kNumSteps; ++i_step) {
+    const float x = kMinTemp + static_cast<float>(i_step) / kStepsPerDegree;
+    while (i_larger < num_points && xs[order[i_larger]] <= x) {
+      ++i_larger;
+    }
+
+    float y;
+    if (i_larger == 0) {
+      y = ys[order.front()];
+    } else if (i_larger == num_points) {
+      y = ys[order.back()];
+    } else {
+      const auto s = order[i_larger - 1];
+      const auto l = order[i_larger];
+      y = ys[s] + (ys[l] - ys[s]) * (x - xs[s]) / (xs[l] - xs[s]);
+    }
+    auto& value = column[i_step * fan_stride_];
+    value = std::max(value, y);
+  }
+}
+
+// Interpolates between the two neighbouring steps of the table of every sensor
+// in use, and keeps the highest value per fan. Sensor by sensor, so the rows
+// are read in order and only the best values of the fans stay in the cache.
+// Empty curves read kNoCurve, which never wins. On equal duty cycles the later
+// sensor wins.
+void FanCurveTable::Evaluate(const float* temps, float* duty_cycles,
+                             int* i_sensors) const {
+  float* best_values = best_values_.data();
+  int* best_sensors = best_sensors_.data();
+  std::fill(best_values, best_values + fan_stride_, kNoCurve);
+  std::fill(best_sensors, best_sensors + fan_stride_, -1);
+
+  for (size_t i_column = 0; i_column < column_sensors_.size(); ++i_column) {
+    const auto i_sensor = column_sensors_[i_column];
+    Lookup lookup;
+    if (!GetLookup(temps[i_sensor], lookup)) {
+      continue;
+    }
+    const float* row =
+        table_.data() + (i_column * kNumSteps + lookup.i_step) * fan_stride_;
+
+#if FAN_CURVE_TABLE_SSE2
+    const __m128 fraction = _mm_set1_ps(lookup.fraction);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i sensor = _mm_set1_epi32(static_cast<int>(i_sensor));
+    for (size_t i_fan = 0; i_fan < fan_stride_; i_fan += 4) {
+      const __m128 a = _mm_loadu_ps(row + i_fan);
+      const __m128 b = _mm_loadu_ps(row + fan_stride_ + i_fan);
+      const __m128 value =
+          _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), fraction));
+
+      const __m128 best = _mm_loadu_ps(best_values + i_fan);
+      auto* best_sensor = reinterpret_cast<__m128i*>(best_sensors + i_fan);
+      const __m128i wins = _mm_castps_si128(
+          _mm_and_ps(_mm_cmpge_ps(value, best), _mm_cmpge_ps(value, zero)));
+      _mm_storeu_ps(best_values + i_fan, _mm_max_ps(best, value));
+      _mm_storeu_si128(
+          best_sensor,
+          _mm_or_si128(_mm_and_si128(wins, sensor),
+                       _mm_andnot_si128(wins, _mm_loadu_si128(best_sensor))));
+    }
+#else
+    for (size_t i_fan = 0; i_fan < fan_stride_; ++i_fan) {
+      const float a = row[i_fan];
+      const float b = row[i_fan + fan_stride_];
+      const float value = a + (b - a) * lookup.fraction;
+      if (value >= 0.0f && value >= best_values[i_fan]) {
+        best_values[i_fan] = value;
+        best_sensors[i_fan] = static_cast<int>(i_sensor);
+      }
+    }
+#endif
+  }
+
+  std::copy_n(best_values, num_fans_, duty_cycles);
+  std::copy_n(best_sensors, num_fans_, i_sensors);
+}
+
+void FanCurveTable::EvaluateSensor(size_t i_sensor, const float* temps,
+                                   float* duty_cycles) const {
+  if (!HasCurves(i_sensor)) {
+    std::fill(duty_cycles, duty_cycles + num_fans_, kNoCurve);
+    return;
+  }
+  const float* column =
+      table_.data() + columns_[i_sensor] * kNumSteps * fan_stride_;
+  for (size_t i_fan = 0; i_fan < num_fans_; ++i_fan) {
+    Lookup lookup;
+    if (!GetLookup(temps[i_fan], lookup)) {
+      duty_cycles[i_fan] = kNoCurve;
+      continue;
+    }
+    const float* row = column + lookup.i_step * fan_stride_ + i_fan;
+    duty_cycles[i_fan] = row[0] + (row[fan_stride_] - row[0]) * lookup.fraction;
+  }
+}
@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/*
+ * The temperature curves of all fans sampled at fixed temperature steps, so a
+ * control step is a couple of table lookups instead of a search in every
+ * curve.
+ *
+ * Only sensors that some curve follows have a table, so a large registry costs
+ * nothing but the sensors in use. Tables are stored [i_column][i_step][i_fan],
+ * with the fans padded to a multiple of four. That way all fans of one step
+ * are next to each other, a single vector load picks up four fans at once,
+ * and a control step reads two rows per sensor in use.
+ */
+class FanCurveTable {
+ public:
+  // The range of the curve editor
+  static constexpr float kMinTemp = 30.0f;
+  static constexpr float kMaxTemp = 90.0f;
+  static constexpr int kStepsPerDegree = 10;
+  static constexpr int kNumSteps =
+      static_cast<int>(kMaxTemp - kMinTemp) * kStepsPerDegree + 1;
+
+  // Table value for curves without points. Duty cycles are never negative.
+  static constexpr float kNoCurve = -1.0f;
+
+  FanCurveTable(size_t num_fans, size_t num_sensors);
+
+  size_t GetNumFans() const { return num_fans_; }
+  size_t GetNumSensors() const { return num_sensors_; }
+
+  // If any curve follows the sensor
+  bool HasCurves(size_t i_sensor) const { return columns_[i_sensor] >= 0; }
+
+  // Samples the curve going through points, which don't need to be sorted.
+  // Outside the range of the points the curve is flat. Replaces the curves of
+  // the fan that follow the sensor.
+  void SetCurve(size_t i_fan, size_t i_sensor, const float* xs,
+                const float* ys, size_t num_points);
+
+  // Replaces all curves. TCurves is indexed [i_fan][i_curve], with curves
+  // that have a sensor and points with x and y, i.e.
+  // CoolthSettings::TTempCurves. find_sensor(curve.sensor) returns the index
+  // of the sensor, curves with a negative one are left out. Where a fan has
+  // several curves for a sensor the highest one counts.
+  template <typename TCurves, typename TFindSensor>
+  void Compile(const TCurves& curves, const TFindSensor& find_sensor) {
+    // find_sensor is called once per curve
+    std::vector<int> curve_sensors;
+    std::fill(columns_.begin(), columns_.end(), -1);
+    for (size_t i_fan = 0; i_fan < num_fans_ && i_fan < curves.size();
+         ++i_fan) {
+      for (const auto& curve : curves[i_fan]) {
+        const int i_sensor = find_sensor(curve.sensor);
+        curve_sensors.push_back(i_sensor);
+        if (i_sensor >= 0 && static_cast<size_t>(i_sensor) < num_sensors_ &&
+            !curve.points.empty()) {
+          columns_[i_sensor] = 0;
+        }
+      }
+    }
+    AllocateColumns();
+
+    std::vector<float> xs, ys;
+    size_t i_curve = 0;
+    for (size_t i_fan = 0; i_fan < num_fans_ && i_fan < curves.size();
+         ++i_fan) {
+      for (const auto& curve : curves[i_fan]) {
+        const int i_sensor = curve_sensors[i_curve++];
+        if (i_sensor < 0 || static_cast<size_t>(i_sensor) >= num_sensors_ ||
+            curve.points.empty()) {
+          continue;
+        }
+        xs.clear();
+        ys.clear();
+        for (const auto& p : curve.points) {
+          xs.push_back(p.x);
+          ys.push_back(p.y);
+        }
+        SampleCurve(i_fan, static_cast<size_t>(i_sensor), xs.data(), ys.data(),
+                    xs.size());
+      }
+    }
+  }
+
+  // temps has one entry per sensor, where unavailable readings are NaN.
+  //
+  // Writes the highest duty cycle over all sensors for each fan, and the index
+  // of the sensor it came from. Fans whose curves all are empty, or whose
+  // sensors are all unavailable get kNoCurve and -1. Not thread safe, it uses
+  // scratch space of the table.
+  void Evaluate(const float* temps, float* duty_cycles, int* i_sensors) const;
+
+  // What the curves of one sensor ask for, with a temperature per fan. Fans
+  // whose curve is empty or whose temperature is NaN get kNoCurve.
+  void EvaluateSensor(size_t i_sensor, const float* temps,
+                      float* duty_cycles) const;
+
+ private:
+  size_t num_fans_;
+  size_t num_sensors_;
+  size_t fan_stride_;
+  // [i_sensor], the column of the sensor's table, -1 if it has none
+  std::vector<int> columns_;
+  // [i_column], in increasing order
+  std::vector<size_t> column_sensors_;
+  std::vector<float> table_;
+  // [i_fan] with the padding, the best duty cycles and their sensors so far
+  mutable std::vector<float> best_values_;
+  mutable std::vector<int> best_sensors_;
+
+  float* GetColumn(size_t i_sensor) {
+    return table_.data() + columns_[i_sensor] * kNumSteps * fan_stride_;
+  }
+
+  // Gives every sensor with a non-negative entry in columns_ an empty column,
+  // and discards the others
+  void AllocateColumns();
+
+  // Raises the column of the fan to the curve
+  void SampleCurve(size_t i_fan, size_t i_sensor, const float* xs,
+                   const float* ys, size_t num_points);
+};
@@ -0,0 +1,60 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "coolth_ipc.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// A blocking client of IpcServer. Not thread safe.
+class IpcClient {
+ public:
+  struct Reply {
+    coolth_ipc::Status status;
+    std::vector<uint8_t> data;
+  };
+
+  // Throws if the server can't be reached
+  explicit IpcClient(const std::string& socket_path);
+  ~IpcClient();
+
+  IpcClient(const IpcClient&) = delete;
+  IpcClient& operator=(const IpcClient&) = delete;
+
+  int GetFd() const { return fd_; }
+
+  // Sends the request without waiting for the reply. arguments is the payload
+  // after the request ID. Returns the request ID.
+  uint32_t Send(coolth_ipc::MessageType type,
+                const std::vector<uint8_t>& arguments = {});
+
+  // Sends the request and waits for its reply. Telemetry arriving in the
+  // meantime is kept for Receive.
+  Reply Call(coolth_ipc::MessageType type,
+             const std::vector<uint8_t>& arguments = {});
+
+  // Blocks until a frame arrives. Throws if the server disconnected.
+  coolth_ipc::Frame Receive();
+
+  // Returns false if no complete frame has arrived yet
+  bool TryReceive(coolth_ipc::Frame& frame);
+
+ private:
+  // Returns false if nothing could be read without blocking
+  bool Fill(bool should_block);
+  bool TakeFrame(coolth_ipc::Frame& frame);
+
+  int fd_ = -1;
+  uint32_t next_request_id_ = 1;
+  std::vector<uint8_t> received_;
+  size_t received_begin_ = 0;
+  std::deque<coolth_ipc::Frame> queued_;
+};
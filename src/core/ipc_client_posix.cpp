@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "ipc_client.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+IpcClient::IpcClient(const std::string& socket_path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("IpcClient failed. Reason: socket path too long");
+  }
+  std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ == -1 || connect(fd_, reinterpret_cast<const sockaddr*>(&address),
+                           sizeof(address)) == -1) {
+    const std::string reason = strerror(errno);
+    if (fd_ != -1) {
+      close(fd_);
+    }
+    throw std::runtime_error("Connecting to " + socket_path +
+                             " failed. Reason: " + reason);
+  }
+}
+
+IpcClient::~IpcClient() { close(fd_); }
+
+uint32_t IpcClient::Send(coolth_ipc::MessageType type,
+                         const std::vector<uint8_t>& arguments) {
+  const auto request_id = next_request_id_++;
+  std::vector<uint8_t> payload;
+  coolth_ipc::Writer(payload).U32(request_id);
+  payload.insert(payload.end(), arguments.begin(), arguments.end());
+  std::vector<uint8_t> frame;
+  if (!coolth_ipc::EncodeFrame(type, payload, frame)) {
+    throw std::runtime_error("IpcClient failed. Reason: request too long");
+  }
+
+  for (size_t begin = 0; begin < frame.size();) {
+    const auto size = send(fd_, frame.data() + begin, frame.size() - begin,
+                           MSG_NOSIGNAL);
+    if (size == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(
+          std::string("IpcClient failed. Reason: send: ") + strerror(errno));
+    }
+    begin += static_cast<size_t>(size);
+  }
+  return request_id;
+}
+
+IpcClient::Reply IpcClient::Call(coolth_ipc::MessageType type,
+                                 const std::vector<uint8_t>& arguments) {
+  const auto request_id = Send(type, arguments);
+  for (;;) {
+    coolth_ipc::Frame frame;
+    while (!TakeFrame(frame)) {
+      Fill(true);
+    }
+    if (frame.type != coolth_ipc::kReply) {
+      queued_.push_back(std::move(frame));
+      continue;
+    }
+
+    coolth_ipc::Reader reader(frame.payload.data(), frame.payload.size());
+    const auto reply_id = reader.U32();
+    const auto status = static_cast<coolth_ipc::Status>(reader.U8());
+    if (!reader.IsValid()) {
+      throw std::runtime_error("IpcClient failed. Reason: invalid reply");
+    }
+    if (reply_id == request_id) {
+      return {status, {frame.payload.begin() + 5, frame.payload.end()}};
+    }
+  }
+}
+
+coolth_ipc::Frame IpcClient::Receive() {
+  coolth_ipc::Frame frame;
+  while (!TryReceive(frame)) {
+    Fill(true);
+  }
+  return frame;
+}
+
+bool IpcClient::TryReceive(coolth_ipc::Frame& frame) {
+  if (!queued_.empty()) {
+    frame = std::move(queued_.front());
+    queued_.pop_front();
+    return true;
+  }
+  return TakeFrame(frame) || (Fill(false) && TakeFrame(frame));
+}
+
+bool IpcClient::Fill(bool should_block) {
+  // Consumed bytes are dropped in one go, not after every frame
+  if (received_begin_ > 0) {
+    received_.erase(received_.begin(), received_.begin() + received_begin_);
+    received_begin_ = 0;
+  }
+
+  uint8_t buffer[16384];
+  ssize_t size;
+  do {
+    size = recv(fd_, buffer, sizeof(buffer), should_block ? 0 : MSG_DONTWAIT);
+  } while (size == -1 && errno == EINTR);
+
+  if (size > 0) {
+    received_.insert(received_.end(), buffer, buffer + size);
+    return true;
+  }
+  if (size == -1 && !should_block &&
+      (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return false;
+  }
+  throw std::runtime_error(
+      size == 0 ? std::string("The server closed the connection")
+                : std::string("IpcClient failed. Reason: recv: ") +
+                      strerror(errno));
+}
+
+bool IpcClient::TakeFrame(coolth_ipc::Frame& frame) {
+  const auto length =
+      coolth_ipc::DecodeFrame(received_.data() + received_begin_,
+                              received_.size() - received_begin_, frame);
+  received_begin_ += length;
+  return length > 0;
+}
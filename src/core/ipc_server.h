@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "control_engine.h"
+#include "settings.h"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+/*
+ * Serves the coolth_ipc protocol to any number of local clients.
+ *
+ * The server has its own thread. The control thread only hands each sample
+ * over, through an RcuCell and an eventfd, so a slow or stuck client can never
+ * delay a control step. The telemetry frame is encoded once per sample and
+ * queued for every subscriber that is due. Samples published faster than the
+ * server thread wakes up are coalesced, subscribers get the latest one. A
+ * subscriber that has more than kMaxPendingBytes waiting loses frames instead
+ * of buffering without limit.
+ *
+ * Commands run on the server thread. Settings go through CoolthSettings like
+ * the edits of the GUI, duty cycle overrides reach the control thread through
+ * GetDutyCycleOverride.
+ */
+class IpcServer : public ControlEngine::Listener {
+ public:
+  static constexpr size_t kMaxPendingBytes = 64 * 1024;
+
+  // Throws if socket_path can't be listened on, or another server already
+  // does. A socket file left behind by a crash is replaced.
+  IpcServer(CoolthSettings& settings, std::string socket_path);
+  ~IpcServer() override;
+
+  IpcServer(const IpcServer&) = delete;
+  IpcServer& operator=(const IpcServer&) = delete;
+
+  // Doesn't block, can be called from any one thread. values are the
+  // telemetry channels of num_sensors sensors and the fans.
+  void Publish(int64_t timestamp_ms, size_t num_sensors, const float* values,
+               size_t num_values);
+
+  // Telemetry frames not sent to slow subscribers
+  uint64_t GetNumDroppedFrames() const;
+
+  std::optional<float> GetDutyCycleOverride(size_t i_fan) override;
+
+  void OnStep(const ControlEngine::Step& step) override {
+    Publish(step.timestamp_ms, step.num_sensors, step.telemetry,
+            step.num_telemetry_channels);
+  }
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,591 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "ipc_server.h"
+
+#include "bbmp/alertable_wait.h"
+#include "bbmp/logging.h"
+#include "bbmp/rcu_cell.h"
+#include "coolth_ipc.h"
+#include "sensor_filter.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+// Only bounds how long a missed wakeup could go unnoticed
+constexpr uint32_t kIdleWaitMs = 1000;
+constexpr int kListenBacklog = 128;
+constexpr size_t kMaxPendingRequestBytes = 1024 * 1024;
+
+// The largest kGetCurves reply kSetCurve allows: the request ID and the
+// status, then every curve with the longest sensor string and the most points
+static_assert(5 + CoolthSettings::kMaxCurvesPerFan *
+                      (1 + UINT8_MAX + 2 + CoolthSettings::kMaxCurvePoints *
+                                               2 * sizeof(float)) <=
+                  coolth_ipc::kMaxPayloadLength,
+              "The curves of a fan don't fit into a reply");
+
+using Clock = std::chrono::steady_clock;
+
+std::string ErrnoString() { return strerror(errno); }
+
+sockaddr_un MakeAddress(const std::string& socket_path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("IpcServer failed. Reason: socket path too long");
+  }
+  std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  return address;
+}
+
+// True if a server accepts connections on the socket
+bool IsListening(const sockaddr_un& address) {
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return false;
+  }
+  const bool is_listening =
+      connect(fd, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) == 0;
+  close(fd);
+  return is_listening;
+}
+}  // namespace
+
+class IpcServer::Impl {
+ public:
+  Impl(CoolthSettings& settings, std::string socket_path)
+      : settings_(settings),
+        socket_path_(std::move(socket_path)),
+        listen_handler_(*this),
+        wake_handler_(*this) {
+    for (auto& duty_cycle : overrides_) {
+      duty_cycle.store(std::nanf(""), std::memory_order_relaxed);
+    }
+    override_owners_.fill(nullptr);
+
+    const auto address = MakeAddress(socket_path_);
+    if (IsListening(address)) {
+      throw std::runtime_error("IpcServer failed. Reason: another server is "
+                               "listening on " +
+                               socket_path_);
+    }
+    unlink(socket_path_.c_str());
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ == -1 ||
+        bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address),
+             sizeof(address)) == -1 ||
+        chmod(socket_path_.c_str(), S_IRUSR | S_IWUSR) == -1 ||
+        listen(listen_fd_, kListenBacklog) == -1) {
+      const auto reason = ErrnoString();
+      Close();
+      throw std::runtime_error("IpcServer failed. Reason: " + reason);
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ == -1) {
+      const auto reason = ErrnoString();
+      Close();
+      throw std::runtime_error("IpcServer failed. Reason: " + reason);
+    }
+
+    thread_ = std::thread([this] { Run(); });
+  }
+
+  ~Impl() {
+    should_exit_.store(true);
+    Wake();
+    thread_.join();
+    Close();
+  }
+
+  void Publish(int64_t timestamp_ms, size_t num_sensors, const float* values,
+               size_t num_values) {
+    latest_.Publish(
+        {timestamp_ms, num_sensors, {values, values + num_values}});
+    Wake();
+  }
+
+  uint64_t GetNumDroppedFrames() const {
+    return num_dropped_frames_.load(std::memory_order_relaxed);
+  }
+
+  std::optional<float> GetDutyCycleOverride(size_t i_fan) {
+    if (i_fan >= overrides_.size()) {
+      return std::nullopt;
+    }
+    const auto duty_cycle = overrides_[i_fan].load(std::memory_order_relaxed);
+    return std::isnan(duty_cycle) ? std::nullopt
+                                  : std::make_optional(duty_cycle);
+  }
+
+ private:
+  struct Sample {
+    int64_t timestamp_ms = 0;
+    size_t num_sensors = 0;
+    std::vector<float> values;
+  };
+
+  struct Client : bbmp::AlertableWait::Handler {
+    Client(Impl& server, int fd) : server(server), fd(fd) {}
+
+    void OnReady(uint32_t events) override {
+      server.OnClientReady(*this, events);
+    }
+
+    Impl& server;
+    const int fd;
+    std::vector<uint8_t> received;
+    std::vector<uint8_t> pending;
+    bool is_writable_armed = false;
+    bool is_closed = false;
+
+    bool is_subscribed = false;
+    Clock::duration period{};
+    Clock::time_point next_due;
+  };
+
+  struct ListenHandler : bbmp::AlertableWait::Handler {
+    explicit ListenHandler(Impl& server) : server(server) {}
+    void OnReady(uint32_t) override { server.Accept(); }
+    Impl& server;
+  };
+
+  struct WakeHandler : bbmp::AlertableWait::Handler {
+    explicit WakeHandler(Impl& server) : server(server) {}
+    void OnReady(uint32_t) override { server.OnWake(); }
+    Impl& server;
+  };
+
+  void Wake() {
+    const uint64_t one = 1;
+    // Fails only when the counter would overflow, and then it's set anyway
+    [[maybe_unused]] const auto result = write(wake_fd_, &one, sizeof(one));
+  }
+
+  void Run() {
+    bbmp::NonBlockingLogger::GetInstance().SetThreadName("ipc");
+    auto& wait = bbmp::AlertableWait::ForThisThread();
+    try {
+      wait.Arm(listen_fd_, EPOLLIN, &listen_handler_);
+      wait.Arm(wake_fd_, EPOLLIN, &wake_handler_);
+      bbmp::Log("Listening on {}", socket_path_);
+      while (!should_exit_.load()) {
+        wait.Wait(kIdleWaitMs);
+        RemoveClosedClients();
+      }
+    } catch (std::runtime_error& error) {
+      bbmp::Log(bbmp::LogLevel::kError, "{}", error.what());
+    }
+
+    for (auto& client : clients_) {
+      client->is_closed = true;
+    }
+    RemoveClosedClients();
+    wait.Disarm(listen_fd_);
+    wait.Disarm(wake_fd_);
+  }
+
+  void Accept() {
+    int fd;
+    while ((fd = accept4(listen_fd_, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+      clients_.push_back(std::make_unique<Client>(*this, fd));
+      bbmp::AlertableWait::ForThisThread().Arm(fd, EPOLLIN,
+                                               clients_.back().get());
+      bbmp::Log(bbmp::LogLevel::kDebug, "Client {} connected", fd);
+    }
+  }
+
+  // Clients are only destroyed here, after the handlers of a Wait() ran, so
+  // none is destroyed while its handler is running
+  void RemoveClosedClients() {
+    auto& wait = bbmp::AlertableWait::ForThisThread();
+    for (auto it = clients_.begin(); it != clients_.end();) {
+      auto& client = **it;
+      if (!client.is_closed) {
+        ++it;
+        continue;
+      }
+      for (size_t i_fan = 0; i_fan < override_owners_.size(); ++i_fan) {
+        if (override_owners_[i_fan] == &client) {
+          override_owners_[i_fan] = nullptr;
+          overrides_[i_fan].store(std::nanf(""), std::memory_order_relaxed);
+        }
+      }
+      wait.Disarm(client.fd);
+      close(client.fd);
+      bbmp::Log(bbmp::LogLevel::kDebug, "Client {} disconnected", client.fd);
+      it = clients_.erase(it);
+    }
+  }
+
+  void OnClientReady(Client& client, uint32_t events) {
+    if (client.is_closed) {
+      return;
+    }
+    if (events & EPOLLERR) {
+      client.is_closed = true;
+      return;
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP)) {
+      uint8_t buffer[4096];
+      ssize_t size;
+      while ((size = recv(client.fd, buffer, sizeof(buffer), 0)) > 0) {
+        client.received.insert(client.received.end(), buffer, buffer + size);
+      }
+      if (size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        client.is_closed = true;
+        return;
+      }
+
+      size_t begin = 0;
+      coolth_ipc::Frame frame;
+      while (const auto length =
+                 coolth_ipc::DecodeFrame(client.received.data() + begin,
+                                         client.received.size() - begin,
+                                         frame)) {
+        begin += length;
+        HandleRequest(client, frame);
+      }
+      client.received.erase(client.received.begin(),
+                            client.received.begin() + begin);
+    }
+
+    Flush(client);
+    // Replies are never dropped, so a client that keeps sending requests
+    // without reading them is cut off instead
+    if (client.pending.size() > kMaxPendingRequestBytes) {
+      bbmp::Log(bbmp::LogLevel::kWarning,
+                "Client {} doesn't read its replies, disconnecting", client.fd);
+      client.is_closed = true;
+    }
+  }
+
+  void HandleRequest(Client& client, const coolth_ipc::Frame& frame) {
+    coolth_ipc::Reader reader(frame.payload.data(), frame.payload.size());
+    const auto request_id = reader.U32();
+    auto status = coolth_ipc::kOk;
+    std::vector<uint8_t> data;
+
+    switch (frame.type) {
+      case coolth_ipc::kSubscribe: {
+        const auto period_ms = reader.U32();
+        if (reader.IsValid()) {
+          client.is_subscribed = true;
+          client.period = std::chrono::milliseconds(period_ms);
+          client.next_due = Clock::now();
+        }
+        break;
+      }
+      case coolth_ipc::kUnsubscribe:
+        client.is_subscribed = false;
+        break;
+      case coolth_ipc::kSetManualDutyCycle: {
+        const auto i_fan = reader.U16();
+        const auto duty_cycle = reader.F32();
+        if (!reader.IsValid()) {
+          break;
+        }
+        if (i_fan >= settings_.Read()->GetNumFans() ||
+            !(duty_cycle >= 0.0f && duty_cycle <= 100.0f)) {
+          status = coolth_ipc::kOutOfRange;
+          break;
+        }
+        settings_.SetManualDutyCycle(i_fan, duty_cycle);
+        break;
+      }
+      case coolth_ipc::kSetDutyCycleOverride: {
+        const auto i_fan = reader.U16();
+        const auto duty_cycle = reader.F32();
+        if (!reader.IsValid()) {
+          break;
+        }
+        if (i_fan >= overrides_.size() ||
+            !(std::isnan(duty_cycle) ||
+              (duty_cycle >= 0.0f && duty_cycle <= 100.0f))) {
+          status = coolth_ipc::kOutOfRange;
+          break;
+        }
+        override_owners_[i_fan] = std::isnan(duty_cycle) ? nullptr : &client;
+        overrides_[i_fan].store(duty_cycle, std::memory_order_relaxed);
+        break;
+      }
+      case coolth_ipc::kSetSmoothTemps: {
+        const auto enabled = reader.U8();
+        if (reader.IsValid()) {
+          settings_.SetSmoothTemps(enabled != 0);
+        }
+        break;
+      }
+      case coolth_ipc::kSetPredictiveControl: {
+        const auto enabled = reader.U8();
+        if (reader.IsValid()) {
+          settings_.SetPredictiveControl(enabled != 0);
+        }
+        break;
+      }
+      case coolth_ipc::kSetSensorFilter: {
+        const auto sensor = reader.String();
+        std::vector<FilterStage> stages;
+        while (reader.IsValid() && reader.GetRemaining() > 0) {
+          FilterStage stage;
+          stage.type = static_cast<FilterStage::Type>(reader.U8());
+          stage.value = reader.F32();
+          stage.noise = reader.F32();
+          stages.push_back(stage);
+        }
+        if (!reader.IsValid()) {
+          break;
+        }
+        const auto i_sensor = settings_.Read()->FindSensor(sensor);
+        if (i_sensor < 0 || stages.size() > SensorFilterBank::kMaxStages ||
+            !std::all_of(stages.begin(), stages.end(),
+                         CoolthSettings::IsValidFilterStage)) {
+          status = coolth_ipc::kOutOfRange;
+          break;
+        }
+        settings_.SetSensorFilter(i_sensor, std::move(stages));
+        break;
+      }
+      case coolth_ipc::kSetCurve: {
+        const auto i_fan = reader.U16();
+        const auto sensor = reader.String();
+        std::vector<CurvePoint> points;
+        while (reader.IsValid() && reader.GetRemaining() > 0) {
+          CurvePoint point;
+          point.x = reader.F32();
+          point.y = reader.F32();
+          points.push_back(point);
+        }
+        if (!reader.IsValid()) {
+          break;
+        }
+        const auto is_valid_point = [](const CurvePoint& point) {
+          return std::isfinite(point.x) && point.y >= 0.0f &&
+                 point.y <= 100.0f;
+        };
+        const auto settings = settings_.Read();
+        if (i_fan >= settings->GetNumFans() ||
+            !CoolthSettings::IsValidSensorId(sensor) ||
+            points.size() > CoolthSettings::kMaxCurvePoints ||
+            !std::all_of(points.begin(), points.end(), is_valid_point)) {
+          status = coolth_ipc::kOutOfRange;
+          break;
+        }
+        // Replacing or removing a curve is always fine, adding one only while
+        // there is room
+        const auto& curves = settings->temp_curves[i_fan];
+        if (!points.empty() &&
+            curves.size() >= CoolthSettings::kMaxCurvesPerFan &&
+            std::none_of(curves.begin(), curves.end(),
+                         [&sensor](const FanCurve& curve) {
+                           return curve.sensor == sensor;
+                         })) {
+          status = coolth_ipc::kOutOfRange;
+          break;
+        }
+        settings_.SetCurve(i_fan, sensor, std::move(points));
+        break;
+      }
+      case coolth_ipc::kGetCurves: {
+        const auto i_fan = reader.U16();
+        if (!reader.IsValid()) {
+          break;
+        }
+        const auto settings = settings_.Read();
+        if (i_fan >= settings->GetNumFans()) {
+          status = coolth_ipc::kOutOfRange;
+          break;
+        }
+        coolth_ipc::Writer writer(data);
+        for (const auto& curve : settings->temp_curves[i_fan]) {
+          writer.String(curve.sensor);
+          writer.U16(static_cast<uint16_t>(curve.points.size()));
+          for (const auto& point : curve.points) {
+            writer.F32(point.x).F32(point.y);
+          }
+        }
+        break;
+      }
+      case coolth_ipc::kGetSensors: {
+        const auto settings = settings_.Read();
+        coolth_ipc::Writer writer(data);
+        writer.U16(static_cast<uint16_t>(settings->GetNumSensors()));
+        for (const auto& sensor : settings->sensors) {
+          writer.String(sensor.id).String(sensor.label);
+        }
+        break;
+      }
+      case coolth_ipc::kPing:
+        break;
+      default:
+        status = coolth_ipc::kBadRequest;
+        break;
+    }
+
+    if (!reader.IsValid()) {
+      status = coolth_ipc::kBadRequest;
+      data.clear();
+    }
+
+    std::vector<uint8_t> payload;
+    coolth_ipc::Writer(payload).U32(request_id).U8(status);
+    payload.insert(payload.end(), data.begin(), data.end());
+    if (!coolth_ipc::EncodeFrame(coolth_ipc::kReply, payload,
+                                 client.pending)) {
+      // Curves from the GUI or an old settings file can exceed the limits of
+      // kSetCurve, the request is still answered
+      payload.clear();
+      coolth_ipc::Writer(payload).U32(request_id).U8(coolth_ipc::kOutOfRange);
+      coolth_ipc::EncodeFrame(coolth_ipc::kReply, payload, client.pending);
+    }
+  }
+
+  void OnWake() {
+    uint64_t count;
+    while (read(wake_fd_, &count, sizeof(count)) > 0) {
+    }
+
+    const auto sample = latest_.Read();
+    if (sample.GetVersion() == sent_version_) {
+      return;
+    }
+    sent_version_ = sample.GetVersion();
+
+    // Encoded once for every subscriber
+    payload_.clear();
+    coolth_ipc::Writer writer(payload_);
+    writer.I64(sample->timestamp_ms);
+    writer.U16(static_cast<uint16_t>(sample->num_sensors));
+    writer.U16(static_cast<uint16_t>(sample->values.size()));
+    for (const auto value : sample->values) {
+      writer.F32(value);
+    }
+    frame_.clear();
+    coolth_ipc::EncodeFrame(coolth_ipc::kTelemetry, payload_, frame_);
+
+    const auto now = Clock::now();
+    for (auto& client : clients_) {
+      // A period that matches the control period gets every sample despite
+      // jitter
+      if (!client->is_subscribed || client->is_closed ||
+          now + client->period / 10 < client->next_due) {
+        continue;
+      }
+      client->next_due = now + client->period;
+      if (client->pending.size() + frame_.size() > kMaxPendingBytes) {
+        num_dropped_frames_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      client->pending.insert(client->pending.end(), frame_.begin(),
+                             frame_.end());
+      Flush(*client);
+    }
+  }
+
+  void Flush(Client& client) {
+    size_t begin = 0;
+    while (begin < client.pending.size()) {
+      const auto size =
+          send(client.fd, client.pending.data() + begin,
+               client.pending.size() - begin, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (size > 0) {
+        begin += static_cast<size_t>(size);
+      } else if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      } else {
+        client.is_closed = true;
+        return;
+      }
+    }
+    client.pending.erase(client.pending.begin(),
+                         client.pending.begin() + begin);
+
+    // Woken up when the socket can take the rest
+    const bool wants_writable = !client.pending.empty();
+    if (wants_writable != client.is_writable_armed) {
+      bbmp::AlertableWait::ForThisThread().Arm(
+          client.fd, EPOLLIN | (wants_writable ? EPOLLOUT : 0u), &client);
+      client.is_writable_armed = wants_writable;
+    }
+  }
+
+  void Close() noexcept {
+    if (listen_fd_ != -1) {
+      close(listen_fd_);
+      unlink(socket_path_.c_str());
+      listen_fd_ = -1;
+    }
+    if (wake_fd_ != -1) {
+      close(wake_fd_);
+      wake_fd_ = -1;
+    }
+  }
+
+  CoolthSettings& settings_;
+  const std::string socket_path_;
+  int listen_fd_ = -1;
+  int wake_fd_ = -1;
+  std::atomic<bool> should_exit_{false};
+
+  bbmp::RcuCell<Sample> latest_;
+  std::atomic<uint64_t> num_dropped_frames_{0};
+  // NaN where there's no override
+  std::array<std::atomic<float>, CoolthSettings::kMaxFans> overrides_;
+
+  // >>> SERVER THREAD ONLY ===================================================
+  ListenHandler listen_handler_;
+  WakeHandler wake_handler_;
+  std::vector<std::unique_ptr<Client>> clients_;
+  // The client that set the override, which is cleared when it disconnects
+  std::array<Client*, CoolthSettings::kMaxFans> override_owners_;
+  uint64_t sent_version_ = 1;
+  std::vector<uint8_t> payload_;
+  std::vector<uint8_t> frame_;
+  // <<< SERVER THREAD ONLY ---------------------------------------------------
+
+  // Started last, so everything it uses is initialized
+  std::thread thread_;
+};
+
+IpcServer::IpcServer(CoolthSettings& settings, std::string socket_path)
+    : impl_(std::make_unique<Impl>(settings, std::move(socket_path))) {}
+
+IpcServer::~IpcServer() = default;
+
+void IpcServer::Publish(int64_t timestamp_ms, size_t num_sensors,
+                        const float* values, size_t num_values) {
+  impl_->Publish(timestamp_ms, num_sensors, values, num_values);
+}
+
+uint64_t IpcServer::GetNumDroppedFrames() const {
+  return impl_->GetNumDroppedFrames();
+}
+
+std::optional<float> IpcServer::GetDutyCycleOverride(size_t i_fan) {
+  return impl_->GetDutyCycleOverride(i_fan);
+}
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "pipeline_latency.h"
+
+#include <cstdio>
+
+PipelineLatency& PipelineLatency::GetInstance() {
+  static PipelineLatency instance;
+  return instance;
+}
+
+const char* PipelineLatency::GetStageName(Stage stage) {
+  switch (stage) {
+    case Stage::kSensorRead:
+      return "sensor read";
+    case Stage::kQueue:
+      return "queue";
+    case Stage::kSmoothing:
+      return "smoothing";
+    case Stage::kCurves:
+      return "curves";
+    case Stage::kCommand:
+      return "command";
+    case Stage::kEndToEnd:
+      return "sensor to command";
+    case Stage::kListeners:
+      return "listeners";
+    case Stage::kDisplay:
+      return "sensor to display";
+    case Stage::kNumStages:
+      break;
+  }
+  return "";
+}
+
+void PipelineLatency::Record(Stage stage, Clock::duration duration) {
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+                      .count();
+  GetThreadHistograms().stages[static_cast<size_t>(stage)].Record(
+      ns > 0 ? static_cast<uint64_t>(ns) : 0);
+}
+
+PipelineLatency::ThreadHistograms& PipelineLatency::GetThreadHistograms() {
+  thread_local ThreadHistograms* histograms = nullptr;
+  if (histograms == nullptr) {
+    auto lock = std::lock_guard(mutex_);
+    threads_.push_back(std::make_unique<ThreadHistograms>());
+    histograms = threads_.back().get();
+  }
+  return *histograms;
+}
+
+std::vector<std::string> PipelineLatency::GetReport() const {
+  constexpr auto kNumStages = static_cast<size_t>(Stage::kNumStages);
+  // Too large for the stack of the GUI thread
+  auto merged = std::make_unique<bbmp::LatencyHistogram::Counts[]>(kNumStages);
+  auto counts = std::make_unique<bbmp::LatencyHistogram::Counts>();
+  {
+    auto lock = std::lock_guard(mutex_);
+    for (const auto& thread : threads_) {
+      for (size_t i = 0; i < kNumStages; ++i) {
+        thread->stages[i].Load(*counts);
+        merged[i].Merge(*counts);
+      }
+    }
+  }
+
+  std::vector<std::string> report;
+  for (size_t i = 0; i < kNumStages; ++i) {
+    const auto& stage = merged[i];
+    if (stage.count == 0) {
+      continue;
+    }
+    const auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1e3; };
+    char line[160];
+    std::snprintf(
+        line, sizeof(line),
+        "%s: n %llu, mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us",
+        GetStageName(static_cast<Stage>(i)),
+        static_cast<unsigned long long>(stage.count),
+        us(stage.sum_ns) / static_cast<double>(stage.count),
+        us(stage.GetPercentile(0.5)), us(stage.GetPercentile(0.99)),
+        us(stage.max_ns));
+    report.emplace_back(line);
+  }
+  return report;
+}
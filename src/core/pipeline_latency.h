@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "bbmp/latency_histogram.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Where the time goes between a temperature being read and the fans getting
+ * their new duty cycles, as one latency histogram per stage.
+ *
+ * Every thread records into histograms of its own, so Record takes no lock and
+ * makes no system call. A thread's histograms are created on its first Record
+ * and kept for the lifetime of the process, so reports include the threads
+ * that are gone.
+ */
+class PipelineLatency {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Stage {
+    // Windows: parsing a line from the temperature reader's pipe. Linux:
+    // reading the hwmon sensors.
+    kSensorRead,
+    // From the sample arriving to the control step picking it up, Windows only
+    kQueue,
+    // The sensor filters, on Windows as the sample arrives
+    kSmoothing,
+    // The fan curves and the overrides
+    kCurves,
+    // Encoding the commands and issuing the serial writes
+    kCommand,
+    // From the sample arriving to the commands being issued
+    kEndToEnd,
+    // Everything the listeners do with a control step
+    kListeners,
+    // From the sample arriving to the GUI showing it
+    kDisplay,
+    kNumStages
+  };
+
+  static PipelineLatency& GetInstance();
+
+  static const char* GetStageName(Stage stage);
+
+  void Record(Stage stage, Clock::duration duration);
+
+  // Records the time since start and returns the current time, for timing
+  // consecutive stages with one clock read each
+  Clock::time_point RecordSince(Stage stage, Clock::time_point start) {
+    const auto now = Clock::now();
+    Record(stage, now - start);
+    return now;
+  }
+
+  // One line per stage that has samples, e.g.
+  // "curves: n 3600, mean 0.4 us, p50 0.4 us, p99 0.9 us, max 12.1 us"
+  std::vector<std::string> GetReport() const;
+
+ private:
+  struct ThreadHistograms {
+    bbmp::LatencyHistogram stages[static_cast<size_t>(Stage::kNumStages)];
+  };
+
+  PipelineLatency() = default;
+
+  ThreadHistograms& GetThreadHistograms();
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadHistograms>> threads_;
+};
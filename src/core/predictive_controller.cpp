@@ -0,0 +1,131 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "predictive_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Halves the range of duty cycles 8 times, down to 100 / 256, about one step
+// of the 8 bit duty cycles the boards get
+constexpr int kNumBisections = 8;
+}  // namespace
+
+double PredictiveController::Prediction::GetMax(double duty_cycle) const {
+  return std::max(offset_first + slope_first * duty_cycle,
+                  offset_last + slope_last * duty_cycle);
+}
+
+PredictiveController::PredictiveController(size_t num_sensors)
+    : models_(num_sensors) {}
+
+void PredictiveController::Observe(const float* temps) {
+  for (size_t i = 0; i < models_.size(); ++i) {
+    models_[i].Observe(temps[i]);
+  }
+}
+
+void PredictiveController::SetInput(const float* duty_cycles,
+                                    size_t num_fans) {
+  float sum = 0.0f;
+  size_t count = 0;
+  for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+    if (!std::isnan(duty_cycles[i_fan])) {
+      sum += duty_cycles[i_fan];
+      ++count;
+    }
+  }
+  const auto input = count > 0 ? sum / count : std::nanf("");
+  for (auto& model : models_) {
+    model.SetInput(input);
+  }
+}
+
+void PredictiveController::Restart() {
+  for (auto& model : models_) {
+    model.Restart();
+  }
+}
+
+void PredictiveController::Plan(const FanCurveTable& table, float* duty_cycles,
+                                int* i_sensors, float* plan_temps) const {
+  const auto num_fans = table.GetNumFans();
+  const auto num_sensors = std::min(models_.size(), table.GetNumSensors());
+  std::fill(duty_cycles, duty_cycles + num_fans, FanCurveTable::kNoCurve);
+  std::fill(i_sensors, i_sensors + num_fans, -1);
+  std::fill(plan_temps, plan_temps + num_fans, std::nanf(""));
+  lows_.resize(num_fans);
+  highs_.resize(num_fans);
+  temps_.resize(num_fans);
+  duty_cycles_at_.resize(num_fans);
+  sensor_duty_cycles_.resize(num_fans);
+
+  for (size_t i_sensor = 0; i_sensor < num_sensors; ++i_sensor) {
+    if (!table.HasCurves(i_sensor)) {
+      continue;
+    }
+    const auto& model = models_[i_sensor];
+    Prediction prediction;
+    const auto valid = model.IsIdentified() && !std::isnan(model.GetTemp());
+    if (valid) {
+      model.GetPrediction(1, prediction.offset_first, prediction.slope_first);
+      model.GetPrediction(kHorizonSteps, prediction.offset_last,
+                          prediction.slope_last);
+    } else {
+      // Evaluated at the current temperature, whatever the duty cycle
+      prediction.offset_first = prediction.offset_last = model.GetTemp();
+      prediction.slope_first = prediction.slope_last = 0.0;
+    }
+
+    // kNoCurve for empty curves, which never win
+    std::fill(temps_.begin(), temps_.end(),
+              static_cast<float>(prediction.GetMax(0.0)));
+    table.EvaluateSensor(i_sensor, temps_.data(), sensor_duty_cycles_.data());
+
+    if (valid) {
+      // The lowest duty cycle at least as high as the curve at the highest
+      // predicted temperature. Curves rise with the temperature and more
+      // cooling lowers it, so the difference only grows with the duty cycle,
+      // and at 100 % it is never negative. The fans are bisected together,
+      // so the lookups of different fans overlap.
+      for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+        lows_[i_fan] = 0.0f;
+        highs_[i_fan] = 100.0f;
+      }
+      for (int i = 0; i < kNumBisections; ++i) {
+        for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+          temps_[i_fan] = static_cast<float>(
+              prediction.GetMax(0.5f * (lows_[i_fan] + highs_[i_fan])));
+        }
+        table.EvaluateSensor(i_sensor, temps_.data(), duty_cycles_at_.data());
+        for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+          const auto middle = 0.5f * (lows_[i_fan] + highs_[i_fan]);
+          if (duty_cycles_at_[i_fan] <= middle) {
+            highs_[i_fan] = middle;
+          } else {
+            lows_[i_fan] = middle;
+          }
+        }
+      }
+      for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+        if (sensor_duty_cycles_[i_fan] > 0.0f) {
+          sensor_duty_cycles_[i_fan] = highs_[i_fan];
+        }
+      }
+    }
+
+    for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+      const auto duty_cycle = sensor_duty_cycles_[i_fan];
+      if (duty_cycle >= 0.0f && duty_cycle >= duty_cycles[i_fan]) {
+        duty_cycles[i_fan] = duty_cycle;
+        i_sensors[i_fan] = static_cast<int>(i_sensor);
+        plan_temps[i_fan] = static_cast<float>(prediction.GetMax(duty_cycle));
+      }
+    }
+  }
+}
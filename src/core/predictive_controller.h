@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "fan_curve_table.h"
+#include "thermal_model.h"
+
+#include <vector>
+
+/*
+ * The predictive control mode. Every sensor has a ThermalModel, and a fan gets
+ * the lowest duty cycle that keeps the temperatures predicted within the
+ * horizon under what its curves allow for that duty cycle. In other words the
+ * fan runs at what its curves ask for at the highest predicted temperature, so
+ * it speeds up before the temperature rises rather than after.
+ *
+ * The models see the average duty cycle of all fans, so the duty cycle of a fan
+ * is planned as if all fans ran at it.
+ *
+ * The predicted temperature is linear in the duty cycle, so its coefficients
+ * are computed once per sensor and step, and a fan costs a bisection over
+ * curve lookups. All fans are bisected together, one FanCurveTable pass per
+ * step of the bisection.
+ */
+class PredictiveController {
+ public:
+  // At the control period of one second
+  static constexpr int kHorizonSteps = 10;
+
+  explicit PredictiveController(size_t num_sensors);
+
+  size_t GetNumSensors() const { return models_.size(); }
+
+  // Models that are kept keep what they learned, new ones start from the
+  // prior
+  void Resize(size_t num_sensors) { models_.resize(num_sensors); }
+  const ThermalModel& GetModel(size_t i_sensor) const {
+    return models_[i_sensor];
+  }
+
+  // The temperatures of the current control step, NaN if unavailable
+  void Observe(const float* temps);
+
+  // The duty cycles applied after the last Observe
+  void SetInput(const float* duty_cycles, size_t num_fans);
+
+  // The next Observe doesn't form updates, e.g. after a gap in the samples
+  void Restart();
+
+  // Like FanCurveTable::Evaluate, but for the predicted temperatures. Sensors
+  // whose model isn't identified are evaluated at their last observed
+  // temperature, as in curve mode. Sensors without curves are skipped, so
+  // their models cost only the updates. Also writes the temperature each duty
+  // cycle was read at.
+  void Plan(const FanCurveTable& table, float* duty_cycles, int* i_sensors,
+            float* plan_temps) const;
+
+ private:
+  struct Prediction {
+    // The highest temperature within the horizon is the larger of the two
+    // lines, as a first order response is monotonic
+    double offset_first;
+    double slope_first;
+    double offset_last;
+    double slope_last;
+
+    double GetMax(double duty_cycle) const;
+  };
+
+  std::vector<ThermalModel> models_;
+  // Scratch space of Plan, one per fan
+  mutable std::vector<float> lows_;
+  mutable std::vector<float> highs_;
+  mutable std::vector<float> temps_;
+  mutable std::vector<float> duty_cycles_at_;
+  mutable std::vector<float> sensor_duty_cycles_;
+};
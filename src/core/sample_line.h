@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * The lines the temperature reader writes, one per sample. A line has a
+ * key=value field for every sensor, separated by whitespace:
+ *
+ *   cpu=54 gpu=41.5 nvme0=38 dimm_a1=44.25 inlet=null
+ *
+ * Keys are SensorInfo ids, values are degrees Celsius. A value that isn't a
+ * decimal number means the sensor couldn't be read.
+ *
+ * Readers written before sensors had ids write the CPU and the GPU temperature
+ * without keys, "54 41". Fields without '=' have an empty key, and the caller
+ * tells them apart by their position.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <string_view>
+
+namespace sample_line {
+inline bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// NaN unless text is an optionally signed decimal number, e.g. "-3", "41.25"
+inline float ParseValue(std::string_view text) {
+  size_t i = 0;
+  const bool negative = i < text.size() && text[i] == '-';
+  if (negative || (i < text.size() && text[i] == '+')) {
+    ++i;
+  }
+  float value = 0.0f;
+  float scale = 1.0f;
+  bool has_digits = false;
+  bool after_point = false;
+  for (; i < text.size(); ++i) {
+    const auto c = text[i];
+    if (c >= '0' && c <= '9') {
+      has_digits = true;
+      if (after_point) {
+        scale *= 0.1f;
+        value += scale * static_cast<float>(c - '0');
+      } else {
+        value = 10.0f * value + static_cast<float>(c - '0');
+      }
+    } else if (c == '.' && !after_point) {
+      after_point = true;
+    } else {
+      return std::nanf("");
+    }
+  }
+  if (!has_digits) {
+    return std::nanf("");
+  }
+  return negative ? -value : value;
+}
+
+// Calls on_field(key, value, i_field) for every field of the line, in order.
+// Doesn't allocate, the keys point into data.
+template <typename OnField>
+void Parse(const char* data, size_t length, OnField&& on_field) {
+  const std::string_view line(data, length);
+  size_t i_field = 0;
+  size_t position = 0;
+  for (;;) {
+    while (position < line.size() && IsSpace(line[position])) {
+      ++position;
+    }
+    if (position == line.size()) {
+      return;
+    }
+    auto end = position;
+    while (end < line.size() && !IsSpace(line[end])) {
+      ++end;
+    }
+
+    const auto field = line.substr(position, end - position);
+    const auto separator = field.find('=');
+    if (separator == std::string_view::npos) {
+      on_field(std::string_view(), ParseValue(field), i_field);
+    } else {
+      on_field(field.substr(0, separator),
+               ParseValue(field.substr(separator + 1)), i_field);
+    }
+    ++i_field;
+    position = end;
+  }
+}
+}  // namespace sample_line
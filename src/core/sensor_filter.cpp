@@ -0,0 +1,144 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "sensor_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+SensorFilterBank::SensorFilterBank(size_t num_channels)
+    : channels_(num_channels), stages_(num_channels * kMaxStages) {}
+
+void SensorFilterBank::Resize(size_t num_channels) {
+  channels_.resize(num_channels);
+  stages_.resize(num_channels * kMaxStages);
+}
+
+void SensorFilterBank::Configure(size_t i_channel,
+                                 const std::vector<FilterStage>& stages) {
+  auto& channel = channels_[i_channel];
+  auto* stage = &stages_[i_channel * kMaxStages];
+  const auto num_stages = std::min(stages.size(), kMaxStages);
+  bool changed = num_stages != channel.num_stages;
+  for (size_t i_stage = 0; i_stage < num_stages; ++i_stage) {
+    auto settings = stages[i_stage];
+    if (!CoolthSettings::IsValidFilterStage(settings)) {
+      // Zero makes the other stages pass samples through
+      settings.value = settings.type == FilterStage::kMedian ? 1.0f : 0.0f;
+      settings.noise = 0.0f;
+    } else if (settings.type == FilterStage::kMedian) {
+      settings.value = std::clamp(std::round(settings.value), 1.0f,
+                                  static_cast<float>(kMaxMedianLength));
+    }
+    auto& current = stage[i_stage].settings;
+    changed = changed || settings.type != current.type ||
+              settings.value != current.value ||
+              settings.noise != current.noise;
+    current = settings;
+  }
+  channel.num_stages = num_stages;
+  if (changed) {
+    Restart(i_channel);
+  }
+}
+
+void SensorFilterBank::Restart(size_t i_channel) {
+  channels_[i_channel].has_sample = false;
+}
+
+float SensorFilterBank::Process(size_t i_channel, float sample,
+                                Clock::time_point time) {
+  auto& channel = channels_[i_channel];
+  if (std::isnan(sample)) {
+    channel.has_sample = false;
+    return sample;
+  }
+
+  const auto first = !channel.has_sample;
+  const auto seconds =
+      first ? 0.0f
+            : std::chrono::duration<float>(time - channel.last_time).count();
+  channel.has_sample = true;
+  channel.last_time = time;
+
+  auto* stage = &stages_[i_channel * kMaxStages];
+  for (size_t i_stage = 0; i_stage < channel.num_stages; ++i_stage) {
+    sample = Run(stage[i_stage], sample, seconds, first);
+  }
+  return sample;
+}
+
+void SensorFilterBank::Process(const float* samples, Clock::time_point time,
+                               float* filtered) {
+  for (size_t i_channel = 0; i_channel < channels_.size(); ++i_channel) {
+    filtered[i_channel] = Process(i_channel, samples[i_channel], time);
+  }
+}
+
+float SensorFilterBank::Run(Stage& stage, float sample, float seconds,
+                            bool first) {
+  const auto& settings = stage.settings;
+  switch (settings.type) {
+    case FilterStage::kEma:
+      if (first || settings.value <= 0.0f) {
+        stage.output = sample;
+      } else {
+        const auto alpha = 1.0f - std::exp(-seconds / settings.value);
+        stage.output += alpha * (sample - stage.output);
+      }
+      return stage.output;
+
+    case FilterStage::kMedian: {
+      const auto length = static_cast<uint8_t>(settings.value);
+      if (first) {
+        stage.num_samples = 0;
+        stage.i_next = 0;
+      }
+      stage.samples[stage.i_next] = sample;
+      stage.i_next = static_cast<uint8_t>((stage.i_next + 1) % length);
+      stage.num_samples = std::min<uint8_t>(stage.num_samples + 1, length);
+
+      // Insertion sort, the windows are short
+      float sorted[kMaxMedianLength];
+      for (uint8_t i = 0; i < stage.num_samples; ++i) {
+        auto j = i;
+        for (; j > 0 && sorted[j - 1] > stage.samples[i]; --j) {
+          sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = stage.samples[i];
+      }
+      const auto middle = stage.num_samples / 2;
+      return stage.num_samples % 2 == 1
+                 ? sorted[middle]
+                 : 0.5f * (sorted[middle - 1] + sorted[middle]);
+    }
+
+    case FilterStage::kSlewLimit:
+      if (first || settings.value <= 0.0f) {
+        stage.output = sample;
+      } else {
+        const auto max_step = settings.value * seconds;
+        stage.output += std::clamp(sample - stage.output, -max_step, max_step);
+      }
+      return stage.output;
+
+    case FilterStage::kKalman:
+      if (first) {
+        stage.output = sample;
+        stage.variance = settings.noise;
+      } else {
+        stage.variance += settings.value * seconds;
+        const auto denominator = stage.variance + settings.noise;
+        const auto gain =
+            denominator > 0.0f ? stage.variance / denominator : 1.0f;
+        stage.output += gain * (sample - stage.output);
+        stage.variance *= 1.0f - gain;
+      }
+      return stage.output;
+  }
+  return sample;
+}
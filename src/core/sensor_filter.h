@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "settings.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Filters the samples of many sensors. Every channel runs a chain of
+ * FilterStage on each sample as it arrives, with the time since the previous
+ * sample of the channel, so time constants and slew rates mean the same at any
+ * sample rate.
+ *
+ * Every channel has room for kMaxStages stages, allocated by the constructor,
+ * so neither Configure nor Process allocates. The channels are the sensors of
+ * the registry, in the order of their indices. A NaN sample, a sensor that
+ * couldn't be read, passes through and restarts the chain of its channel.
+ */
+class SensorFilterBank {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t kMaxStages = 8;
+  static constexpr size_t kMaxMedianLength = 15;
+
+  explicit SensorFilterBank(size_t num_channels);
+
+  size_t GetNumChannels() const { return channels_.size(); }
+
+  // Channels that are kept keep their stages and their state, new ones start
+  // without stages. Allocates when the bank grows.
+  void Resize(size_t num_channels);
+
+  // Stages beyond kMaxStages are dropped, median lengths are clamped to
+  // [1, kMaxMedianLength], and unknown types and stages with negative or
+  // non-finite parameters pass samples through. Restarts the channel, unless
+  // the stages are the same as before.
+  void Configure(size_t i_channel, const std::vector<FilterStage>& stages);
+
+  // The next sample of the channel passes through unfiltered
+  void Restart(size_t i_channel);
+
+  // Returns the filtered sample
+  float Process(size_t i_channel, float sample, Clock::time_point time);
+
+  // One sample for every channel, all taken at time
+  void Process(const float* samples, Clock::time_point time, float* filtered);
+
+ private:
+  struct Stage {
+    FilterStage settings;
+    // The output of the EMA, the slew limiter and the Kalman filter
+    float output;
+    // Of the Kalman filter's estimate
+    float variance;
+    // A ring of the last samples of the median
+    uint8_t num_samples;
+    uint8_t i_next;
+    float samples[kMaxMedianLength];
+  };
+
+  struct Channel {
+    size_t num_stages = 0;
+    bool has_sample = false;
+    Clock::time_point last_time;
+  };
+
+  float Run(Stage& stage, float sample, float seconds, bool first);
+
+  std::vector<Channel> channels_;
+  // [i_channel * kMaxStages + i_stage]
+  std::vector<Stage> stages_;
+};
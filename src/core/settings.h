@@ -0,0 +1,583 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "bbmp/logging.h"
+#include "bbmp/rcu_cell.h"
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/array.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// >>> SETTINGS / MODEL =======================================================
+// A point of a temperature curve: temperature in degrees Celsius, duty cycle in
+// percent
+struct CurvePoint {
+  float x;
+  float y;
+};
+
+// A stage of the filter the samples of a sensor go through, see
+// SensorFilterBank
+struct FilterStage {
+  enum Type : uint8_t {
+    // Exponential moving average, value is the time constant in seconds
+    kEma = 0,
+    // Median of the last value samples
+    kMedian = 1,
+    // Follows the samples by at most value degrees per second
+    kSlewLimit = 2,
+    // Kalman filter of a random walk, value is the process noise in degrees^2
+    // per second and noise the variance of a sample in degrees^2
+    kKalman = 3
+  };
+
+  Type type;
+  float value;
+  float noise;
+};
+
+// A temperature the curves can follow, e.g. a CPU package, a DIMM or an inlet
+struct SensorInfo {
+  // What curves, sample lines and telemetry channels refer to the sensor by,
+  // see CoolthSettings::IsValidSensorId
+  std::string id;
+  // Shown on the UI
+  std::string label;
+  // [i_stage], applied while smooth_temps is on
+  std::vector<FilterStage> filter;
+};
+
+// The duty cycle a fan asks for at the temperature of a sensor. A fan can have
+// any number of curves, and runs at the highest duty cycle they ask for.
+struct FanCurve {
+  // SensorInfo::id. Curves of sensors that aren't registered are ignored.
+  std::string sensor;
+  std::vector<CurvePoint> points;
+};
+
+class CoolthSettings {
+ public:
+  // Settings start out with this many fans, and grow when more are found
+  static constexpr int kDefaultNumFans = 4;
+  static constexpr int kMaxFans = 128;
+  static constexpr int kMaxSensors = 128;
+  // Leaves room for the suffixes of the telemetry channel names
+  static constexpr size_t kMaxSensorIdLength = 15;
+  // Set over IPC, so the curves of a fan fit into one reply
+  static constexpr size_t kMaxCurvePoints = 256;
+  static constexpr size_t kMaxCurvesPerFan = 16;
+
+  using TFanCurves = std::vector<FanCurve>;
+  using TTempCurves = std::vector<TFanCurves>;
+  using TSensors = std::vector<SensorInfo>;
+
+  // What the single moving average applied once per control step used to do
+  static std::vector<FilterStage> GetDefaultFilter() {
+    return {{FilterStage::kEma, 9.5f, 0.0f}};
+  }
+
+  // The sensors every registry starts with, always at these indices, as the
+  // sample lines of the old format and the telemetry of earlier versions
+  // only had these two
+  static TSensors GetDefaultSensors() {
+    return {{"cpu", "CPU", GetDefaultFilter()},
+            {"gpu", "GPU", GetDefaultFilter()}};
+  }
+
+  // 1 to kMaxSensorIdLength lower case letters, digits and underscores
+  static bool IsValidSensorId(std::string_view id) {
+    return !id.empty() && id.size() <= kMaxSensorIdLength &&
+           std::all_of(id.begin(), id.end(), [](char c) {
+             return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                    c == '_';
+           });
+  }
+
+  // A known type with finite, non-negative parameters
+  static bool IsValidFilterStage(const FilterStage& stage) {
+    return stage.type <= FilterStage::kKalman && stage.value >= 0.0f &&
+           stage.noise >= 0.0f && std::isfinite(stage.value) &&
+           std::isfinite(stage.noise);
+  }
+
+  // A valid id that resembles name, e.g. "nvme_composite" for "nvme
+  // Composite". Different names can give the same id.
+  static std::string MakeSensorId(std::string_view name) {
+    std::string id;
+    for (const auto c : name) {
+      if (id.size() == kMaxSensorIdLength) {
+        break;
+      }
+      if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+        id += c;
+      } else if (c >= 'A' && c <= 'Z') {
+        id += static_cast<char>(c - 'A' + 'a');
+      } else if (!id.empty() && id.back() != '_') {
+        id += '_';
+      }
+    }
+    while (!id.empty() && id.back() == '_') {
+      id.pop_back();
+    }
+    return id.empty() ? "sensor" : id;
+  }
+
+  // Everything that is edited on the UI thread. Never modified in place, but
+  // replaced as a whole.
+  struct State {
+    State() : sensors(GetDefaultSensors()) { Resize(kDefaultNumFans); }
+
+    size_t GetNumFans() const { return temp_curves.size(); }
+    size_t GetNumSensors() const { return sensors.size(); }
+
+    // Index of the sensor in sensors, -1 if it isn't registered
+    int FindSensor(std::string_view id) const {
+      for (size_t i_sensor = 0; i_sensor < sensors.size(); ++i_sensor) {
+        if (sensors[i_sensor].id == id) {
+          return static_cast<int>(i_sensor);
+        }
+      }
+      return -1;
+    }
+
+    // New fans get the default curves
+    void Resize(size_t num_fans) {
+      TFanCurves default_curves;
+      for (const auto& sensor : GetDefaultSensors()) {
+        default_curves.push_back({sensor.id, {{60.0f, 40.0f}}});
+      }
+      temp_curves.resize(num_fans, default_curves);
+      manual_duty_cycles.resize(num_fans, 0.0f);
+    }
+
+    // The fan controller slots in the order their fans are numbered, as
+    // "<board id>/<number of fans>" separated by ':'. The board ID is the UUID
+    // of the board, or the port for old firmware. Boards that are gone keep
+    // their slots.
+    std::string last_com_port;
+
+    // The sensor registry, [i_sensor]. Sensors are added as they are found
+    // and never removed, so the indices stay valid and the curves of a sensor
+    // that is missing for a while are kept.
+    TSensors sensors;
+
+    // [i_fan][i_curve]
+    TTempCurves temp_curves;
+
+    bool smooth_temps = true;
+
+    // Plan the duty cycles for the predicted temperatures instead of the
+    // current ones, see PredictiveController
+    bool predictive_control = false;
+
+    // [i_fan], used while the curves of a fan don't apply
+    std::vector<float> manual_duty_cycles;
+  };
+
+  using Snapshot = bbmp::RcuCell<State>::Snapshot;
+
+  // Doesn't lock or allocate, so this is what the control thread uses. The
+  // version of the snapshot changes with every modification.
+  Snapshot Read() const { return state_.Read(); }
+
+  void AccessLastComPort(const std::function<void(std::string&)>& accessor) {
+    state_.Update([&accessor](State& state) { accessor(state.last_com_port); });
+  }
+
+  /* [i_fan][i_curve] */
+  void AccessTempCurves(const std::function<void(TTempCurves&)>& accessor) {
+    state_.Update([&accessor](State& state) { accessor(state.temp_curves); });
+  }
+
+  // Adds fans with default settings until there are at least num_fans, up to
+  // kMaxFans. Fans are never removed, so the settings of a board that is
+  // missing for a while are kept. Returns true if fans were added.
+  bool EnsureNumFans(size_t num_fans) {
+    num_fans = std::min(num_fans, static_cast<size_t>(kMaxFans));
+    if (Read()->GetNumFans() >= num_fans) {
+      return false;
+    }
+    state_.Update([num_fans](State& state) {
+      state.Resize(std::max(num_fans, state.GetNumFans()));
+    });
+    MarkChanged();
+    return true;
+  }
+
+  // Registers the sensors whose id isn't registered yet, up to kMaxSensors.
+  // Returns true if sensors were added.
+  bool EnsureSensors(const TSensors& sensors) {
+    {
+      const auto state = Read();
+      const auto is_new = [&state](const SensorInfo& sensor) {
+        return IsValidSensorId(sensor.id) && state->FindSensor(sensor.id) < 0;
+      };
+      if (state->sensors.size() >= kMaxSensors ||
+          std::none_of(sensors.begin(), sensors.end(), is_new)) {
+        return false;
+      }
+    }
+    bool added = false;
+    state_.Update([&sensors, &added](State& state) {
+      for (const auto& sensor : sensors) {
+        if (state.sensors.size() < kMaxSensors &&
+            IsValidSensorId(sensor.id) && state.FindSensor(sensor.id) < 0) {
+          state.sensors.push_back(sensor);
+          added = true;
+        }
+      }
+    });
+    if (added) {
+      MarkChanged();
+    }
+    return added;
+  }
+
+  // In the data directory, locked by whichever of the GUI and coolthd uses it,
+  // see bbmp::InstanceLock
+  static constexpr const char* kLockFileName = "coolth.lock";
+
+  // Where the settings and the telemetry are kept, shared by the GUI and
+  // coolthd: %APPDATA%\Bebump Coolth on Windows, $XDG_CONFIG_HOME/Bebump
+  // Coolth or ~/.config/Bebump Coolth elsewhere
+  static std::filesystem::path GetDefaultDirectory() {
+    std::filesystem::path base;
+#ifdef _WIN32
+    if (const char* app_data = std::getenv("APPDATA")) {
+      base = app_data;
+    }
+#else
+    if (const char* config_home = std::getenv("XDG_CONFIG_HOME")) {
+      base = config_home;
+    } else if (const char* home = std::getenv("HOME")) {
+      base = std::filesystem::path(home) / ".config";
+    }
+#endif
+    return base / "Bebump Coolth";
+  }
+
+  // If the file can't be read, the backup written by SettingsPersister is
+  // tried next. Throws if neither works.
+  void Load(std::filesystem::path file) {
+    {
+      auto lock = std::lock_guard(file_mutex_);
+      file_ = file;
+    }
+
+    std::error_code error;
+    const auto backup_file = GetBackupFile(file);
+    const auto backup_exists =
+        std::filesystem::is_regular_file(backup_file, error);
+    if (!std::filesystem::is_regular_file(file, error) && !backup_exists) {
+      MarkChanged();
+      return;
+    }
+
+    try {
+      LoadFrom(file);
+    } catch (...) {
+      if (!backup_exists) {
+        throw;
+      }
+      LoadFrom(backup_file);
+      bbmp::Log(bbmp::LogLevel::kWarning, "Settings recovered from {}",
+                backup_file.string());
+      MarkChanged();
+    }
+  }
+
+  std::filesystem::path GetFile() {
+    auto lock = std::lock_guard(file_mutex_);
+    return file_;
+  }
+
+  static std::filesystem::path GetBackupFile(
+      const std::filesystem::path& file) {
+    auto backup_file = file;
+    backup_file += ".bak";
+    return backup_file;
+  }
+
+  // Call after every change that should be saved
+  void MarkChanged() {
+    if (on_changed_) {
+      on_changed_();
+    }
+  }
+
+  // Only to be set before other threads start using the settings
+  void SetOnChanged(std::function<void()> callback) {
+    on_changed_ = std::move(callback);
+  }
+
+  // Can be called from any thread
+  std::string Serialize() const {
+    std::ostringstream os(std::ios::binary);
+    {
+      cereal::BinaryOutputArchive archive(os);
+      archive(*this);
+    }
+    return os.str();
+  }
+
+  bool GetSmoothTemps() const { return Read()->smooth_temps; }
+
+  void SetSmoothTemps(bool value) {
+    state_.Update([value](State& state) { state.smooth_temps = value; });
+    MarkChanged();
+  }
+
+  bool GetPredictiveControl() const { return Read()->predictive_control; }
+
+  void SetPredictiveControl(bool value) {
+    state_.Update([value](State& state) { state.predictive_control = value; });
+    MarkChanged();
+  }
+
+  void SetSensorFilter(size_t i_sensor, std::vector<FilterStage> stages) {
+    state_.Update([i_sensor, &stages](State& state) {
+      if (i_sensor < state.sensors.size()) {
+        state.sensors[i_sensor].filter = stages;
+      }
+    });
+    MarkChanged();
+  }
+
+  // Replaces the curves of the fan that follow the sensor. No points remove
+  // them.
+  void SetCurve(size_t i_fan, const std::string& sensor,
+                std::vector<CurvePoint> points) {
+    state_.Update([i_fan, &sensor, &points](State& state) {
+      if (i_fan >= state.temp_curves.size()) {
+        return;
+      }
+      auto& curves = state.temp_curves[i_fan];
+      const auto first = std::find_if(
+          curves.begin(), curves.end(),
+          [&sensor](const FanCurve& curve) { return curve.sensor == sensor; });
+      const auto position = first - curves.begin();
+      curves.erase(std::remove_if(curves.begin(), curves.end(),
+                                  [&sensor](const FanCurve& curve) {
+                                    return curve.sensor == sensor;
+                                  }),
+                   curves.end());
+      if (!points.empty()) {
+        curves.insert(curves.begin() + std::min<ptrdiff_t>(position,
+                                                           curves.size()),
+                      {sensor, points});
+      }
+    });
+    MarkChanged();
+  }
+
+  void SetManualDutyCycle(size_t i_fan, float value) {
+    state_.Update([i_fan, value](State& state) {
+      if (i_fan < state.manual_duty_cycles.size()) {
+        state.manual_duty_cycles[i_fan] = value;
+      }
+    });
+    MarkChanged();
+  }
+
+ private:
+  bbmp::RcuCell<State> state_;
+
+  std::filesystem::path file_;
+  std::mutex file_mutex_;
+  std::function<void()> on_changed_;
+
+  void LoadFrom(const std::filesystem::path& file) {
+    std::ifstream is(file, std::ios::binary);
+    if (!is) {
+      throw std::runtime_error("Failed to open " + file.string());
+    }
+    cereal::BinaryInputArchive archive(is);
+    archive(*this);
+  }
+
+  friend class cereal::access;
+
+  // Files written before the number of fans became dynamic start with the
+  // length of last_com_port, which is never this large
+  static constexpr uint64_t kFormatTag = UINT64_MAX;
+  static constexpr uint32_t kFormatVersion = 5;
+
+  // Before version 5 every fan had a curve for the CPU and one for the GPU,
+  // and every sensor a filter
+  using TLegacyFanCurves = std::array<std::vector<CurvePoint>, 2>;
+  using TLegacySensorFilters = std::array<std::vector<FilterStage>, 2>;
+
+  // Empty curves didn't apply, so they are left out
+  static TFanCurves FromLegacy(const TLegacyFanCurves& legacy_curves) {
+    const auto sensors = GetDefaultSensors();
+    TFanCurves curves;
+    for (size_t i_sensor = 0; i_sensor < legacy_curves.size(); ++i_sensor) {
+      if (!legacy_curves[i_sensor].empty()) {
+        curves.push_back({sensors[i_sensor].id, legacy_curves[i_sensor]});
+      }
+    }
+    return curves;
+  }
+
+  template <class Archive>
+  void save(Archive& archive) const {
+    const auto state = Read();
+    archive(kFormatTag, kFormatVersion, state->last_com_port,
+            state->temp_curves, state->smooth_temps,
+            state->manual_duty_cycles, state->predictive_control,
+            state->sensors);
+  }
+
+  template <class Archive>
+  void load(Archive& archive) {
+    State state;
+    uint64_t tag;
+    archive(tag);
+    if (tag == kFormatTag) {
+      uint32_t version;
+      archive(version);
+      // Version 2 had no control mode, versions before 4 no filters and
+      // versions before 5 no sensor registry
+      if (version < 2 || version > kFormatVersion) {
+        throw std::runtime_error(
+            "Loading settings failed. Reason: unknown version " +
+            std::to_string(version));
+      }
+      if (version >= 5) {
+        archive(state.last_com_port, state.temp_curves, state.smooth_temps,
+                state.manual_duty_cycles, state.predictive_control,
+                state.sensors);
+      } else {
+        std::vector<TLegacyFanCurves> temp_curves;
+        archive(state.last_com_port, temp_curves, state.smooth_temps,
+                state.manual_duty_cycles);
+        state.temp_curves.clear();
+        for (const auto& curves : temp_curves) {
+          state.temp_curves.push_back(FromLegacy(curves));
+        }
+        if (version >= 3) {
+          archive(state.predictive_control);
+        }
+        if (version >= 4) {
+          TLegacySensorFilters sensor_filters;
+          archive(sensor_filters);
+          for (size_t i_sensor = 0; i_sensor < sensor_filters.size();
+               ++i_sensor) {
+            state.sensors[i_sensor].filter = sensor_filters[i_sensor];
+          }
+        }
+      }
+    } else {
+      // Four fans, and tag was the length of last_com_port
+      if (tag > 4096) {
+        throw std::runtime_error(
+            "Loading settings failed. Reason: unknown format");
+      }
+      state.last_com_port.resize(tag);
+      archive(cereal::binary_data(state.last_com_port.data(), tag));
+      std::array<TLegacyFanCurves, kDefaultNumFans> temp_curves;
+      std::array<float, kDefaultNumFans> manual_duty_cycles;
+      archive(temp_curves, state.smooth_temps, manual_duty_cycles);
+      state.temp_curves.clear();
+      for (const auto& curves : temp_curves) {
+        state.temp_curves.push_back(FromLegacy(curves));
+      }
+      state.manual_duty_cycles.assign(manual_duty_cycles.begin(),
+                                      manual_duty_cycles.end());
+    }
+
+    // The default sensors keep their indices whatever the file says
+    const auto default_sensors = GetDefaultSensors();
+    for (size_t i_sensor = 0; i_sensor < default_sensors.size(); ++i_sensor) {
+      if (state.sensors.size() <= i_sensor ||
+          state.sensors[i_sensor].id != default_sensors[i_sensor].id) {
+        throw std::runtime_error(
+            "Loading settings failed. Reason: default sensors missing");
+      }
+    }
+    if (state.sensors.size() > kMaxSensors) {
+      state.sensors.resize(kMaxSensors);
+    }
+    // A damaged file must not crash the filters
+    for (auto& sensor : state.sensors) {
+      if (!std::all_of(sensor.filter.begin(), sensor.filter.end(),
+                       IsValidFilterStage)) {
+        bbmp::Log(bbmp::LogLevel::kWarning,
+                  "Invalid filter of sensor {} replaced with the default",
+                  sensor.id);
+        sensor.filter = GetDefaultFilter();
+      }
+    }
+    state.Resize(std::clamp(state.GetNumFans(),
+                            static_cast<size_t>(kDefaultNumFans),
+                            static_cast<size_t>(kMaxFans)));
+    state_.Publish(std::move(state));
+  }
+};
+
+namespace cereal {
+template <class Archive>
+void save(Archive& archive, CurvePoint const& m) {
+  archive(m.x, m.y);
+}
+
+template <class Archive>
+void load(Archive& archive, CurvePoint& m) {
+  archive(m.x, m.y);
+}
+
+template <class Archive>
+void save(Archive& archive, FilterStage const& m) {
+  archive(static_cast<uint8_t>(m.type), m.value, m.noise);
+}
+
+template <class Archive>
+void load(Archive& archive, FilterStage& m) {
+  uint8_t type;
+  archive(type, m.value, m.noise);
+  m.type = static_cast<FilterStage::Type>(type);
+}
+
+template <class Archive>
+void save(Archive& archive, SensorInfo const& m) {
+  archive(m.id, m.label, m.filter);
+}
+
+template <class Archive>
+void load(Archive& archive, SensorInfo& m) {
+  archive(m.id, m.label, m.filter);
+}
+
+template <class Archive>
+void save(Archive& archive, FanCurve const& m) {
+  archive(m.sensor, m.points);
+}
+
+template <class Archive>
+void load(Archive& archive, FanCurve& m) {
+  archive(m.sensor, m.points);
+}
+}  // namespace cereal
+// <<< SETTINGS / MODEL -------------------------------------------------------
@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "settings_persister.h"
+
+#include "bbmp/atomic_file.h"
+#include "bbmp/logging.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+SettingsPersister::SettingsPersister(CoolthSettings& settings,
+                                     std::chrono::milliseconds quiet_period,
+                                     std::chrono::milliseconds max_delay)
+    : settings_(settings), quiet_period_(quiet_period), max_delay_(max_delay) {
+  settings_.SetOnChanged([this] { RequestSave(); });
+  thread_ = std::thread([this] { Run(); });
+}
+
+SettingsPersister::~SettingsPersister() {
+  {
+    auto lock = std::lock_guard(mutex_);
+    should_exit_ = true;
+  }
+  condition_.notify_one();
+  thread_.join();
+  settings_.SetOnChanged(nullptr);
+}
+
+void SettingsPersister::RequestSave() {
+  {
+    auto lock = std::lock_guard(mutex_);
+    ++num_unsaved_changes_;
+  }
+  condition_.notify_one();
+}
+
+void SettingsPersister::Run() {
+  using Clock = std::chrono::steady_clock;
+  bbmp::NonBlockingLogger::GetInstance().SetThreadName("settings");
+
+  auto lock = std::unique_lock(mutex_);
+  for (;;) {
+    condition_.wait(lock,
+                    [this] { return should_exit_ || num_unsaved_changes_ > 0; });
+
+    // Wait for the burst of changes to end
+    const auto give_up_waiting_at = Clock::now() + max_delay_;
+    while (!should_exit_) {
+      const auto num_changes_seen = num_unsaved_changes_;
+      const auto deadline =
+          std::min(Clock::now() + quiet_period_, give_up_waiting_at);
+      const auto changed = condition_.wait_until(lock, deadline, [&] {
+        return should_exit_ || num_unsaved_changes_ != num_changes_seen;
+      });
+      if (!changed) {
+        break;
+      }
+    }
+
+    const auto num_changes = num_unsaved_changes_;
+    num_unsaved_changes_ = 0;
+    if (num_changes > 0) {
+      lock.unlock();
+      Save(num_changes);
+      lock.lock();
+    }
+
+    if (should_exit_ && num_unsaved_changes_ == 0) {
+      return;
+    }
+  }
+}
+
+void SettingsPersister::Save(uint64_t num_changes) {
+  const auto file = settings_.GetFile();
+  if (file.empty()) {
+    return;
+  }
+
+  try {
+    const auto start = std::chrono::steady_clock::now();
+    bbmp::ReplaceFileContents(file.string(), settings_.Serialize(),
+                              CoolthSettings::GetBackupFile(file).string());
+    const auto elapsed_ms = std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+
+    bbmp::Log("Settings saved in {:.1f} ms, {} changes coalesced", elapsed_ms,
+              num_changes - 1);
+  } catch (std::runtime_error& error) {
+    bbmp::Log(bbmp::LogLevel::kError, "Failed to save settings: {}",
+              error.what());
+  }
+}
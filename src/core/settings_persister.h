@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "settings.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+/*
+ * Saves CoolthSettings on its own thread whenever they change.
+ *
+ * Dragging a slider or a curve point changes the settings many times in a row,
+ * so a save only happens once the changes stopped for quiet_period, or
+ * max_delay after the first unsaved change, whichever comes first. Every save
+ * is logged with its duration and the number of changes it covered.
+ *
+ * The file is replaced atomically, and the previous version is kept as a
+ * backup that CoolthSettings::Load falls back to.
+ */
+class SettingsPersister {
+ public:
+  explicit SettingsPersister(
+      CoolthSettings& settings,
+      std::chrono::milliseconds quiet_period = std::chrono::milliseconds(500),
+      std::chrono::milliseconds max_delay = std::chrono::milliseconds(5000));
+
+  // Saves outstanding changes before returning
+  ~SettingsPersister();
+
+  SettingsPersister(const SettingsPersister&) = delete;
+  SettingsPersister& operator=(const SettingsPersister&) = delete;
+
+  // Thread safe. Called by CoolthSettings::MarkChanged.
+  void RequestSave();
+
+ private:
+  void Run();
+  void Save(uint64_t num_changes);
+
+  CoolthSettings& settings_;
+  const std::chrono::milliseconds quiet_period_;
+  const std::chrono::milliseconds max_delay_;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  uint64_t num_unsaved_changes_ = 0;
+  bool should_exit_ = false;
+
+  std::thread thread_;
+};
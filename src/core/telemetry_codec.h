@@ -0,0 +1,333 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+/*
+ * Column encodings of the telemetry store, after the Gorilla paper (Pelkonen
+ * et al., VLDB 2015). Every column of a block starts from a fresh state, so
+ * blocks can be decoded independently.
+ *
+ * Timestamps and quantized values are stored as the difference from the
+ * previous one (timestamps: difference of differences), with a prefix code
+ * that spends a single bit on a repeated difference:
+ *
+ *   0                 same
+ *   10    +  7 bits   [-64, 63]
+ *   110   + 12 bits   [-2048, 2047]
+ *   1110  + 20 bits   [-524288, 524287]
+ *   11110 + 64 bits   anything else
+ *   11111             missing value (values only)
+ *
+ * Unquantized values are float bit patterns XOR-ed with the previous one,
+ * stored as in Gorilla but with 5 bit fields sized for 32 bit floats.
+ */
+namespace telemetry_codec {
+class BitWriter {
+ public:
+  void Clear() {
+    bytes_.clear();
+    num_bits_ = 0;
+  }
+
+  // Most significant bit first. num_bits is at most 64.
+  void Write(uint64_t value, int num_bits) {
+    while (num_bits > 0) {
+      if (num_bits_ % 8 == 0) {
+        bytes_.push_back(0);
+      }
+      const int num_free_bits = 8 - static_cast<int>(num_bits_ % 8);
+      const int n = std::min(num_free_bits, num_bits);
+      const auto chunk =
+          static_cast<uint8_t>((value >> (num_bits - n)) & ((1u << n) - 1));
+      bytes_.back() |= static_cast<uint8_t>(chunk << (num_free_bits - n));
+      num_bits -= n;
+      num_bits_ += n;
+    }
+  }
+
+  const std::vector<uint8_t>& GetBytes() const { return bytes_; }
+  size_t GetNumBits() const { return num_bits_; }
+
+ private:
+  std::vector<uint8_t> bytes_;
+  size_t num_bits_ = 0;
+};
+
+class BitReader {
+ public:
+  BitReader(const uint8_t* data, size_t num_bytes)
+      : data_(data), num_bits_(num_bytes * 8) {}
+
+  // Reads zeros past the end
+  uint64_t Read(int num_bits) {
+    uint64_t value = 0;
+    while (num_bits > 0) {
+      if (position_ >= num_bits_) {
+        value <<= num_bits;
+        break;
+      }
+      const int num_available = 8 - static_cast<int>(position_ % 8);
+      const int n = std::min(num_available, num_bits);
+      const uint8_t byte = data_[position_ / 8];
+      value = (value << n) | ((byte >> (num_available - n)) & ((1u << n) - 1));
+      num_bits -= n;
+      position_ += n;
+    }
+    return value;
+  }
+
+  bool ReadBit() { return Read(1) != 0; }
+
+ private:
+  const uint8_t* data_;
+  size_t num_bits_;
+  size_t position_ = 0;
+};
+
+inline uint64_t Truncate(int64_t value, int num_bits) {
+  return static_cast<uint64_t>(value) & ((uint64_t{1} << num_bits) - 1);
+}
+
+inline int64_t SignExtend(uint64_t value, int num_bits) {
+  const auto shift = 64 - num_bits;
+  return static_cast<int64_t>(value << shift) >> shift;
+}
+
+inline void WriteDifference(BitWriter& writer, int64_t difference) {
+  if (difference == 0) {
+    writer.Write(0b0, 1);
+  } else if (difference >= -64 && difference <= 63) {
+    writer.Write(0b10, 2);
+    writer.Write(Truncate(difference, 7), 7);
+  } else if (difference >= -2048 && difference <= 2047) {
+    writer.Write(0b110, 3);
+    writer.Write(Truncate(difference, 12), 12);
+  } else if (difference >= -524288 && difference <= 524287) {
+    writer.Write(0b1110, 4);
+    writer.Write(Truncate(difference, 20), 20);
+  } else {
+    writer.Write(0b11110, 5);
+    writer.Write(static_cast<uint64_t>(difference), 64);
+  }
+}
+
+// Returns false for the missing value code
+inline bool ReadDifference(BitReader& reader, int64_t& difference) {
+  if (!reader.ReadBit()) {
+    difference = 0;
+  } else if (!reader.ReadBit()) {
+    difference = SignExtend(reader.Read(7), 7);
+  } else if (!reader.ReadBit()) {
+    difference = SignExtend(reader.Read(12), 12);
+  } else if (!reader.ReadBit()) {
+    difference = SignExtend(reader.Read(20), 20);
+  } else if (!reader.ReadBit()) {
+    difference = static_cast<int64_t>(reader.Read(64));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// >>> Timestamps =============================================================
+class TimestampEncoder {
+ public:
+  void Append(BitWriter& writer, int64_t timestamp) {
+    if (num_values_++ == 0) {
+      writer.Write(static_cast<uint64_t>(timestamp), 64);
+    } else {
+      const auto delta = timestamp - previous_;
+      WriteDifference(writer, delta - previous_delta_);
+      previous_delta_ = delta;
+    }
+    previous_ = timestamp;
+  }
+
+ private:
+  size_t num_values_ = 0;
+  int64_t previous_ = 0;
+  int64_t previous_delta_ = 0;
+};
+
+// Sums wrap around instead of overflowing, whatever a corrupt column holds
+inline int64_t WrappingAdd(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) +
+                              static_cast<uint64_t>(b));
+}
+
+// Returns false if the column is corrupt, out is incomplete then
+inline bool DecodeTimestamps(BitReader& reader, size_t num_values,
+                             int64_t* out) {
+  int64_t previous = 0;
+  int64_t previous_delta = 0;
+  for (size_t i = 0; i < num_values; ++i) {
+    if (i == 0) {
+      previous = static_cast<int64_t>(reader.Read(64));
+    } else {
+      int64_t delta_of_delta;
+      if (!ReadDifference(reader, delta_of_delta)) {
+        return false;
+      }
+      previous_delta = WrappingAdd(previous_delta, delta_of_delta);
+      previous = WrappingAdd(previous, previous_delta);
+    }
+    out[i] = previous;
+  }
+  return true;
+}
+// <<< Timestamps -------------------------------------------------------------
+
+// >>> Values =================================================================
+// With a quantum of 0 values are stored losslessly, otherwise rounded to the
+// nearest multiple of quantum. NaN marks a missing value. When quantized,
+// infinities are missing values too, and finite values are limited to
+// kMaxQuanta multiples of quantum.
+class ValueEncoder {
+ public:
+  // 2^53, exactly representable as a double, and differences of two can't
+  // overflow
+  static constexpr double kMaxQuanta = 9007199254740992.0;
+
+  explicit ValueEncoder(float quantum) : quantum_(quantum) {}
+
+  void Append(BitWriter& writer, float value) {
+    if (quantum_ > 0.0f) {
+      AppendQuantized(writer, value);
+    } else {
+      AppendXor(writer, value);
+    }
+  }
+
+ private:
+  void AppendQuantized(BitWriter& writer, float value) {
+    if (!std::isfinite(value)) {
+      writer.Write(0b11111, 5);
+      return;
+    }
+    const auto quanta = std::clamp(static_cast<double>(value) / quantum_,
+                                   -kMaxQuanta, kMaxQuanta);
+    const auto quantized = static_cast<int64_t>(std::llround(quanta));
+    WriteDifference(writer, quantized - previous_quantized_);
+    previous_quantized_ = quantized;
+  }
+
+  void AppendXor(BitWriter& writer, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    if (num_values_++ == 0) {
+      writer.Write(bits, 32);
+      previous_bits_ = bits;
+      return;
+    }
+
+    const uint32_t xored = bits ^ previous_bits_;
+    previous_bits_ = bits;
+    if (xored == 0) {
+      writer.Write(0b0, 1);
+      return;
+    }
+
+    const int leading = std::min(CountLeadingZeros(xored), 31);
+    const int trailing = CountTrailingZeros(xored);
+    if (previous_length_ > 0 && leading >= previous_leading_ &&
+        trailing >= 32 - previous_leading_ - previous_length_) {
+      // Fits into the window of the previous value
+      writer.Write(0b10, 2);
+      writer.Write(xored >> (32 - previous_leading_ - previous_length_),
+                   previous_length_);
+      return;
+    }
+
+    const int length = 32 - leading - trailing;
+    writer.Write(0b11, 2);
+    writer.Write(static_cast<uint64_t>(leading), 5);
+    writer.Write(static_cast<uint64_t>(length - 1), 5);
+    writer.Write(xored >> trailing, length);
+    previous_leading_ = leading;
+    previous_length_ = length;
+  }
+
+  static int CountLeadingZeros(uint32_t value) {
+    int count = 0;
+    for (uint32_t mask = 0x80000000u; (value & mask) == 0; mask >>= 1) {
+      ++count;
+    }
+    return count;
+  }
+
+  static int CountTrailingZeros(uint32_t value) {
+    int count = 0;
+    for (uint32_t mask = 1; (value & mask) == 0; mask <<= 1) {
+      ++count;
+    }
+    return count;
+  }
+
+  float quantum_;
+  size_t num_values_ = 0;
+  int64_t previous_quantized_ = 0;
+  uint32_t previous_bits_ = 0;
+  int previous_leading_ = 0;
+  int previous_length_ = 0;
+};
+
+// Returns false if the column is corrupt, out is incomplete then
+inline bool DecodeValues(BitReader& reader, float quantum, size_t num_values,
+                         float* out) {
+  if (quantum > 0.0f) {
+    int64_t previous = 0;
+    for (size_t i = 0; i < num_values; ++i) {
+      int64_t difference;
+      if (ReadDifference(reader, difference)) {
+        previous = WrappingAdd(previous, difference);
+        out[i] = static_cast<float>(previous * static_cast<double>(quantum));
+      } else {
+        out[i] = std::numeric_limits<float>::quiet_NaN();
+      }
+    }
+    return true;
+  }
+
+  uint32_t previous = 0;
+  int leading = 0;
+  int length = 0;
+  for (size_t i = 0; i < num_values; ++i) {
+    if (i == 0) {
+      previous = static_cast<uint32_t>(reader.Read(32));
+    } else if (reader.ReadBit()) {
+      if (reader.ReadBit()) {
+        leading = static_cast<int>(reader.Read(5));
+        length = static_cast<int>(reader.Read(5)) + 1;
+        if (leading + length > 32) {
+          return false;
+        }
+      } else if (length == 0) {
+        // Reuses a window that was never set
+        return false;
+      }
+      const auto meaningful = static_cast<uint32_t>(reader.Read(length));
+      previous ^= meaningful << (32 - leading - length);
+    }
+    std::memcpy(&out[i], &previous, sizeof(float));
+  }
+  return true;
+}
+// <<< Values -----------------------------------------------------------------
+
+// Upper bounds of the encoded size of one sample
+constexpr size_t kMaxTimestampBits = 69;
+constexpr size_t kMaxValueBits = 69;
+}  // namespace telemetry_codec
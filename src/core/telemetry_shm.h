@@ -0,0 +1,257 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * The latest control step of coolthd in POSIX shared memory, for monitoring
+ * agents that read more often than a socket round trip allows.
+ *
+ * The segment is a seqlock. The writer makes the sequence odd, writes the
+ * snapshot and makes it even again. A reader copies the snapshot between two
+ * reads of the sequence and retries if they differ or are odd. Reading takes
+ * no lock and no system call, and it never delays the writer.
+ *
+ * Every field is accessed through relaxed 64-bit atomics, so concurrent reads
+ * and writes are well defined. Only the fans and the sensors that are in use
+ * are copied.
+ *
+ * This header only depends on the standard library and POSIX, so agents can
+ * copy it. Link with -lrt on old glibc.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace telemetry_shm {
+const char* const kDefaultName = "/coolth_telemetry";
+
+const uint32_t kMagic = 0x48544c43;  // "CLTH"
+const uint32_t kLayoutVersion = 2;
+const uint32_t kMaxFans = 128;
+const uint32_t kMaxSensors = 128;
+
+struct Fan {
+  // Percent
+  float duty_cycle;
+  float rpm;
+};
+
+struct Sensor {
+  // The id of the sensor in coolthd's registry, NUL terminated
+  char id[16];
+  float temp;
+  float temp_filtered;
+};
+
+// What a reader gets. Temperatures are in degrees Celsius, NaN if the sensor is
+// missing.
+struct Snapshot {
+  // Control steps published since the writer started
+  uint64_t tick;
+  // Wall clock time of the control step
+  int64_t timestamp_ms;
+  // CLOCK_MONOTONIC when the step was published, to tell how fresh it is
+  int64_t monotonic_ns;
+  uint32_t num_fans;
+  uint32_t smooth_temps;
+  uint32_t num_sensors;
+  uint32_t reserved;
+  Fan fans[kMaxFans];
+  Sensor sensors[kMaxSensors];
+};
+
+const size_t kHeaderBytes = offsetof(Snapshot, fans);
+const size_t kSensorsOffset = offsetof(Snapshot, sensors);
+static_assert(kHeaderBytes % 8 == 0 && kSensorsOffset % 8 == 0 &&
+                  sizeof(Sensor) % 8 == 0 && sizeof(Snapshot) % 8 == 0,
+              "Snapshot is copied in 64-bit words");
+
+// The words of the snapshot in use: the header, then a range each for the
+// fans and the sensors
+struct WordRanges {
+  size_t fans_end;
+  size_t sensors_begin;
+  size_t sensors_end;
+
+  WordRanges(uint32_t num_fans, uint32_t num_sensors)
+      : fans_end((kHeaderBytes + std::min(num_fans, kMaxFans) * sizeof(Fan) +
+                  7) /
+                 8),
+        sensors_begin(kSensorsOffset / 8),
+        sensors_end((kSensorsOffset +
+                     std::min(num_sensors, kMaxSensors) * sizeof(Sensor)) /
+                    8) {}
+};
+
+struct Segment {
+  static constexpr size_t kNumWords = sizeof(Snapshot) / 8;
+
+  // Written once, before the writer starts publishing
+  std::atomic<uint32_t> magic;
+  uint32_t layout_version;
+  uint32_t size;
+  uint32_t max_fans;
+  uint32_t max_sensors;
+
+  // Odd while the writer is in the middle of an update
+  alignas(64) std::atomic<uint64_t> sequence;
+  alignas(64) std::atomic<uint64_t> words[kNumWords];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "Atomics in shared memory must be lock free");
+
+inline void Store(Segment& segment, const Snapshot& snapshot) {
+  const WordRanges ranges(snapshot.num_fans, snapshot.num_sensors);
+  uint64_t words[Segment::kNumWords];
+  std::memcpy(words, &snapshot, ranges.fans_end * 8);
+  std::memcpy(words + ranges.sensors_begin,
+              reinterpret_cast<const char*>(&snapshot) + kSensorsOffset,
+              (ranges.sensors_end - ranges.sensors_begin) * 8);
+
+  const auto sequence = segment.sequence.load(std::memory_order_relaxed);
+  segment.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < ranges.fans_end; ++i) {
+    segment.words[i].store(words[i], std::memory_order_relaxed);
+  }
+  for (size_t i = ranges.sensors_begin; i < ranges.sensors_end; ++i) {
+    segment.words[i].store(words[i], std::memory_order_relaxed);
+  }
+  segment.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Returns false if the writer was in the middle of an update, try again
+inline bool TryLoad(const Segment& segment, Snapshot& snapshot) {
+  const auto sequence = segment.sequence.load(std::memory_order_acquire);
+  if (sequence & 1) {
+    return false;
+  }
+
+  uint64_t words[Segment::kNumWords];
+  const size_t num_header_words = kHeaderBytes / 8;
+  for (size_t i = 0; i < num_header_words; ++i) {
+    words[i] = segment.words[i].load(std::memory_order_relaxed);
+  }
+  uint32_t num_fans;
+  uint32_t num_sensors;
+  std::memcpy(&num_fans,
+              reinterpret_cast<const char*>(words) +
+                  offsetof(Snapshot, num_fans),
+              sizeof(num_fans));
+  std::memcpy(&num_sensors,
+              reinterpret_cast<const char*>(words) +
+                  offsetof(Snapshot, num_sensors),
+              sizeof(num_sensors));
+  // Torn if the sequence changed, and then it's not used anyway
+  const WordRanges ranges(num_fans, num_sensors);
+  for (size_t i = num_header_words; i < ranges.fans_end; ++i) {
+    words[i] = segment.words[i].load(std::memory_order_relaxed);
+  }
+  for (size_t i = ranges.sensors_begin; i < ranges.sensors_end; ++i) {
+    words[i] = segment.words[i].load(std::memory_order_relaxed);
+  }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (segment.sequence.load(std::memory_order_relaxed) != sequence) {
+    return false;
+  }
+  std::memcpy(&snapshot, words, ranges.fans_end * 8);
+  std::memcpy(reinterpret_cast<char*>(&snapshot) + kSensorsOffset,
+              words + ranges.sensors_begin,
+              (ranges.sensors_end - ranges.sensors_begin) * 8);
+  return true;
+}
+
+// Maps the segment read-only
+class Reader {
+ public:
+  // Throws if coolthd doesn't publish the segment, or its layout is different
+  explicit Reader(const char* name = kDefaultName) {
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+      throw std::runtime_error(std::string("shm_open failed. Reason: ") +
+                               strerror(errno));
+    }
+    struct stat status;
+    if (fstat(fd, &status) == -1 ||
+        static_cast<size_t>(status.st_size) < sizeof(Segment)) {
+      close(fd);
+      throw std::runtime_error(
+          "Opening telemetry segment failed. Reason: too small");
+    }
+    void* address =
+        mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+      throw std::runtime_error(std::string("mmap failed. Reason: ") +
+                               strerror(errno));
+    }
+    segment_ = static_cast<const Segment*>(address);
+
+    if (segment_->magic.load(std::memory_order_acquire) != kMagic ||
+        segment_->layout_version != kLayoutVersion ||
+        segment_->size != sizeof(Segment) || segment_->max_fans != kMaxFans ||
+        segment_->max_sensors != kMaxSensors) {
+      munmap(const_cast<Segment*>(segment_), sizeof(Segment));
+      throw std::runtime_error(
+          "Opening telemetry segment failed. Reason: incompatible layout");
+    }
+  }
+
+  ~Reader() { munmap(const_cast<Segment*>(segment_), sizeof(Segment)); }
+
+  Reader(const Reader&) = delete;
+  Reader& operator=(const Reader&) = delete;
+
+  // Retries while the writer is updating, and yields now and then in case the
+  // writer was preempted on the same CPU. Returns false if it was updating on
+  // every attempt.
+  bool Read(Snapshot& snapshot, int max_attempts = 1000,
+            int* num_attempts = nullptr) const {
+    for (int i = 1; i <= max_attempts; ++i) {
+      if (TryLoad(*segment_, snapshot)) {
+        if (num_attempts != nullptr) {
+          *num_attempts = i;
+        }
+        return true;
+      }
+      if (i % kSpinsPerYield == 0) {
+        sched_yield();
+      }
+    }
+    if (num_attempts != nullptr) {
+      *num_attempts = max_attempts;
+    }
+    return false;
+  }
+
+  // Changes whenever a snapshot is published, cheaper than Read for polling
+  uint64_t GetSequence() const {
+    return segment_->sequence.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr int kSpinsPerYield = 16;
+
+  const Segment* segment_;
+};
+}  // namespace telemetry_shm
@@ -0,0 +1,50 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "control_engine.h"
+#include "settings.h"
+#include "telemetry_shm.h"
+
+#include <string>
+
+/*
+ * Publishes every control step into the shared memory segment of
+ * telemetry_shm.h. Publishing is a copy into the mapping, it takes no lock and
+ * makes no system call.
+ *
+ * The segment is removed when the writer is destroyed. Readers that still have
+ * it mapped keep seeing the last snapshot, its monotonic_ns tells them it's
+ * stale.
+ */
+class TelemetryShmWriter : public ControlEngine::Listener {
+ public:
+  // Throws if the segment can't be created. The ids of the sensors come from
+  // the registry of settings.
+  explicit TelemetryShmWriter(const CoolthSettings& settings,
+                              std::string name = telemetry_shm::kDefaultName);
+  ~TelemetryShmWriter() override;
+
+  TelemetryShmWriter(const TelemetryShmWriter&) = delete;
+  TelemetryShmWriter& operator=(const TelemetryShmWriter&) = delete;
+
+  // Fans beyond telemetry_shm::kMaxFans and sensors beyond
+  // telemetry_shm::kMaxSensors are left out
+  void Publish(const ControlEngine::Step& step);
+
+  void OnStep(const ControlEngine::Step& step) override { Publish(step); }
+
+ private:
+  const CoolthSettings& settings_;
+  const std::string name_;
+  telemetry_shm::Segment* segment_ = nullptr;
+  telemetry_shm::Snapshot snapshot_{};
+  // The sensors of snapshot_ that have their ids. The registry only grows, so
+  // the ids are copied once.
+  uint32_t num_named_sensors_ = 0;
+};
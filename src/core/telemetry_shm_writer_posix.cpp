@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "telemetry_shm_writer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+// Readable by monitoring agents of other users, only coolthd writes it
+constexpr mode_t kMode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+}  // namespace
+
+TelemetryShmWriter::TelemetryShmWriter(const CoolthSettings& settings,
+                                       std::string name)
+    : settings_(settings), name_(std::move(name)) {
+  // A segment left behind by a crash is replaced. Readers that still have it
+  // mapped see its monotonic_ns go stale and have to reopen.
+  shm_unlink(name_.c_str());
+  const int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, kMode);
+  if (fd == -1) {
+    throw std::runtime_error("TelemetryShmWriter failed. Reason: shm_open: " +
+                             std::string(strerror(errno)));
+  }
+  // The mode passed to shm_open is subject to the umask
+  fchmod(fd, kMode);
+  void* address = MAP_FAILED;
+  if (ftruncate(fd, sizeof(telemetry_shm::Segment)) == 0) {
+    address = mmap(nullptr, sizeof(telemetry_shm::Segment),
+                   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  const std::string reason = strerror(errno);
+  close(fd);
+  if (address == MAP_FAILED) {
+    shm_unlink(name_.c_str());
+    throw std::runtime_error("TelemetryShmWriter failed. Reason: " + reason);
+  }
+
+  // The mapping is zeroed, which is a valid value for every field
+  segment_ = new (address) telemetry_shm::Segment;
+  segment_->layout_version = telemetry_shm::kLayoutVersion;
+  segment_->size = sizeof(telemetry_shm::Segment);
+  segment_->max_fans = telemetry_shm::kMaxFans;
+  segment_->max_sensors = telemetry_shm::kMaxSensors;
+  segment_->magic.store(telemetry_shm::kMagic, std::memory_order_release);
+}
+
+TelemetryShmWriter::~TelemetryShmWriter() {
+  munmap(segment_, sizeof(telemetry_shm::Segment));
+  shm_unlink(name_.c_str());
+}
+
+void TelemetryShmWriter::Publish(const ControlEngine::Step& step) {
+  ++snapshot_.tick;
+  snapshot_.timestamp_ms = step.timestamp_ms;
+  snapshot_.monotonic_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+  snapshot_.num_fans = static_cast<uint32_t>(
+      std::min<size_t>(step.num_fans, telemetry_shm::kMaxFans));
+  snapshot_.smooth_temps = step.smooth_temps;
+  for (uint32_t i_fan = 0; i_fan < snapshot_.num_fans; ++i_fan) {
+    snapshot_.fans[i_fan] = {step.duty_cycles[i_fan],
+                             static_cast<float>(step.rpms[i_fan])};
+  }
+  const auto num_sensors = static_cast<uint32_t>(
+      std::min<size_t>(step.num_sensors, telemetry_shm::kMaxSensors));
+  for (uint32_t i_sensor = 0; i_sensor < num_sensors; ++i_sensor) {
+    auto& sensor = snapshot_.sensors[i_sensor];
+    sensor.temp = step.raw_temps[i_sensor];
+    sensor.temp_filtered = step.temps[i_sensor];
+  }
+  if (num_sensors > num_named_sensors_) {
+    const auto settings = settings_.Read();
+    for (; num_named_sensors_ < num_sensors &&
+           num_named_sensors_ < settings->GetNumSensors();
+         ++num_named_sensors_) {
+      auto& id = snapshot_.sensors[num_named_sensors_].id;
+      std::strncpy(id, settings->sensors[num_named_sensors_].id.c_str(),
+                   sizeof(id) - 1);
+    }
+  }
+  snapshot_.num_sensors = num_sensors;
+  telemetry_shm::Store(*segment_, snapshot_);
+}
@@ -0,0 +1,466 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "telemetry_store.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+constexpr char kMagic[8] = {'C', 'O', 'O', 'L', 'T', 'L', 'M', '\0'};
+constexpr uint32_t kVersion = 3;
+// The file header is padded to a multiple of this
+constexpr size_t kPageSize = 4096;
+}  // namespace
+
+// Followed by the channel table, a ChannelHeader for every channel. Channels
+// are only ever added to the end of it.
+struct TelemetryStore::FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;
+  uint32_t num_blocks;
+  uint32_t num_channels;
+};
+
+struct TelemetryStore::ChannelHeader {
+  char name[kMaxChannelNameLength + 1];
+  float quantum;
+};
+
+// Followed by the uint32 size of every column, [0] for the timestamp column
+// and [1 + i_channel] for the first num_channels channels of the table.
+//
+// A sequence of 0 marks an unused slot. It is cleared first and set last when
+// a slot is written, so a slot that was being written during a crash is
+// skipped.
+struct TelemetryStore::BlockHeader {
+  uint64_t sequence;
+  int64_t first_timestamp;
+  int64_t last_timestamp;
+  uint32_t num_samples;
+  uint32_t num_channels;
+};
+
+TelemetryStore::TelemetryStore(const std::string& path,
+                               std::vector<Channel> channels,
+                               size_t block_size, size_t num_blocks)
+    : channels_(std::move(channels)),
+      block_size_(block_size),
+      num_blocks_(num_blocks),
+      file_header_size_(
+          (sizeof(FileHeader) + kMaxChannels * sizeof(ChannelHeader) +
+           kPageSize - 1) /
+          kPageSize * kPageSize),
+      file_(path, file_header_size_ + block_size * num_blocks) {
+  CheckChannels(channels_);
+
+  const auto& header = *reinterpret_cast<const FileHeader*>(file_.GetData());
+  const bool matches = Matches(header);
+  if (matches) {
+    const auto* channels = reinterpret_cast<const ChannelHeader*>(&header + 1);
+    for (size_t i = 0; i < header.num_channels; ++i) {
+      file_channels_.push_back(
+          {std::string(channels[i].name,
+                       strnlen(channels[i].name, kMaxChannelNameLength)),
+           channels[i].quantum});
+    }
+  }
+  if (matches && AddChannels()) {
+    WriteChannels();
+    Recover();
+  } else {
+    Initialize();
+  }
+  ClearOpenBlock();
+}
+
+TelemetryStore::~TelemetryStore() {
+  if (!open_block_written_) {
+    auto lock = std::lock_guard(mutex_);
+    WriteOpenBlock();
+  }
+  file_.Flush();
+}
+
+void TelemetryStore::SetChannels(std::vector<Channel> channels) {
+  CheckChannels(channels);
+  if (num_open_samples_ > 0) {
+    StartNewBlock();
+  }
+  {
+    auto lock = std::lock_guard(mutex_);
+    channels_ = std::move(channels);
+    if (AddChannels()) {
+      WriteChannels();
+    } else {
+      Initialize();
+    }
+  }
+  file_.Flush();
+  ClearOpenBlock();
+}
+
+void TelemetryStore::Append(int64_t timestamp_ms, const float* values) {
+  const size_t num_channels = file_channels_.size();
+  const size_t capacity = block_size_ - GetBlockHeaderSize(num_channels);
+  const size_t max_sample_size =
+      (telemetry_codec::kMaxTimestampBits +
+       num_channels * telemetry_codec::kMaxValueBits) /
+          8 +
+      columns_.size();
+  if (num_open_samples_ > 0 &&
+      GetOpenBlockSize() + max_sample_size > capacity) {
+    StartNewBlock();
+  }
+
+  timestamp_encoder_.Append(columns_[0], timestamp_ms);
+  constexpr auto kMissing = std::numeric_limits<float>::quiet_NaN();
+  for (size_t i = 0; i < num_channels; ++i) {
+    const auto i_channel = channel_indices_[i];
+    value_encoders_[i].Append(
+        columns_[i + 1], i_channel == SIZE_MAX ? kMissing : values[i_channel]);
+  }
+  if (num_open_samples_++ == 0) {
+    open_first_timestamp_ = timestamp_ms;
+  }
+  open_last_timestamp_ = timestamp_ms;
+  open_block_written_ = false;
+
+  // A scan in progress only delays persisting the sample until the next
+  // append, it never blocks the caller
+  auto lock = std::unique_lock(mutex_, std::try_to_lock);
+  if (lock.owns_lock()) {
+    WriteOpenBlock();
+  }
+}
+
+void TelemetryStore::Scan(
+    int64_t from_ms, int64_t to_ms, const std::vector<size_t>& channels,
+    const std::function<void(const ScanBlock&)>& callback) const {
+  struct Candidate {
+    uint64_t sequence;
+    size_t i_slot;
+  };
+  std::vector<Candidate> candidates;
+  // The channel table as of the start of the scan. Blocks written after a
+  // change to it have higher sequences, so they aren't scanned.
+  size_t num_file_channels = 0;
+  std::vector<size_t> file_indices(channels.size());
+  std::vector<float> quanta(channels.size());
+  {
+    auto lock = std::lock_guard(mutex_);
+    num_file_channels = file_channels_.size();
+    for (size_t i = 0; i < channels.size(); ++i) {
+      file_indices[i] = file_indices_[channels[i]];
+      quanta[i] = file_channels_[file_indices[i]].quantum;
+    }
+    for (size_t i_slot = 0; i_slot < num_blocks_; ++i_slot) {
+      const auto& header =
+          *reinterpret_cast<const BlockHeader*>(GetSlot(i_slot));
+      if (header.sequence != 0 && header.last_timestamp >= from_ms &&
+          header.first_timestamp <= to_ms) {
+        candidates.push_back({header.sequence, i_slot});
+      }
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+              return a.sequence < b.sequence;
+            });
+
+  std::vector<uint8_t> block(block_size_);
+  std::vector<int64_t> timestamps;
+  std::vector<std::vector<float>> values(channels.size());
+  ScanBlock scan_block;
+  scan_block.values.resize(channels.size());
+
+  for (const auto& candidate : candidates) {
+    {
+      // The slot may have been reused since we looked at it
+      auto lock = std::lock_guard(mutex_);
+      const auto* slot = GetSlot(candidate.i_slot);
+      if (reinterpret_cast<const BlockHeader*>(slot)->sequence !=
+          candidate.sequence) {
+        continue;
+      }
+      std::memcpy(block.data(), slot, block_size_);
+    }
+
+    // The file may have been damaged or written by something else, so a
+    // block whose columns don't fit into it, or that can't hold as many
+    // samples as it claims, is skipped
+    const auto& header = *reinterpret_cast<const BlockHeader*>(block.data());
+    const size_t block_header_size = GetBlockHeaderSize(header.num_channels);
+    if (header.num_channels > num_file_channels ||
+        block_header_size >= block_size_) {
+      continue;
+    }
+    const auto* column_sizes = reinterpret_cast<const uint32_t*>(
+        block.data() + sizeof(BlockHeader));
+    const size_t capacity = block_size_ - block_header_size;
+    std::vector<const uint8_t*> column_starts(header.num_channels + 1);
+    size_t offset = 0;
+    bool is_valid = true;
+    for (size_t i_column = 0; i_column <= header.num_channels; ++i_column) {
+      if (column_sizes[i_column] > capacity - offset) {
+        is_valid = false;
+        break;
+      }
+      column_starts[i_column] = block.data() + block_header_size + offset;
+      offset += column_sizes[i_column];
+    }
+    // Every sample takes at least a bit of the timestamp column
+    if (!is_valid || header.num_samples > size_t{column_sizes[0]} * 8) {
+      continue;
+    }
+
+    timestamps.resize(header.num_samples);
+    telemetry_codec::BitReader timestamp_reader(column_starts[0],
+                                                column_sizes[0]);
+    if (!telemetry_codec::DecodeTimestamps(timestamp_reader,
+                                           header.num_samples,
+                                           timestamps.data())) {
+      continue;
+    }
+
+    const auto begin = static_cast<size_t>(
+        std::lower_bound(timestamps.begin(), timestamps.end(), from_ms) -
+        timestamps.begin());
+    const auto end = static_cast<size_t>(
+        std::upper_bound(timestamps.begin(), timestamps.end(), to_ms) -
+        timestamps.begin());
+    if (begin >= end) {
+      continue;
+    }
+
+    for (size_t i = 0; i < channels.size() && is_valid; ++i) {
+      const auto i_column = file_indices[i] + 1;
+      values[i].resize(header.num_samples);
+      if (i_column < column_starts.size()) {
+        telemetry_codec::BitReader reader(column_starts[i_column],
+                                          column_sizes[i_column]);
+        is_valid = telemetry_codec::DecodeValues(
+            reader, quanta[i], header.num_samples, values[i].data());
+      } else {
+        // Added after the block was written
+        std::fill(values[i].begin(), values[i].end(),
+                  std::numeric_limits<float>::quiet_NaN());
+      }
+      scan_block.values[i] = values[i].data() + begin;
+    }
+    if (!is_valid) {
+      continue;
+    }
+
+    scan_block.num_samples = end - begin;
+    scan_block.timestamps = timestamps.data() + begin;
+    callback(scan_block);
+  }
+}
+
+bool TelemetryStore::GetTimeRange(int64_t& first_ms, int64_t& last_ms) const {
+  auto lock = std::lock_guard(mutex_);
+  uint64_t min_sequence = UINT64_MAX;
+  uint64_t max_sequence = 0;
+  for (size_t i_slot = 0; i_slot < num_blocks_; ++i_slot) {
+    const auto& header =
+        *reinterpret_cast<const BlockHeader*>(GetSlot(i_slot));
+    if (header.sequence == 0) {
+      continue;
+    }
+    if (header.sequence < min_sequence) {
+      min_sequence = header.sequence;
+      first_ms = header.first_timestamp;
+    }
+    if (header.sequence > max_sequence) {
+      max_sequence = header.sequence;
+      last_ms = header.last_timestamp;
+    }
+  }
+  return max_sequence != 0;
+}
+
+size_t TelemetryStore::GetBlockHeaderSize(size_t num_channels) {
+  return sizeof(BlockHeader) + (num_channels + 1) * sizeof(uint32_t);
+}
+
+uint8_t* TelemetryStore::GetSlot(size_t i_slot) {
+  return file_.GetData() + file_header_size_ + i_slot * block_size_;
+}
+
+const uint8_t* TelemetryStore::GetSlot(size_t i_slot) const {
+  return file_.GetData() + file_header_size_ + i_slot * block_size_;
+}
+
+void TelemetryStore::CheckChannels(
+    const std::vector<Channel>& channels) const {
+  if (channels.size() > kMaxChannels) {
+    throw std::runtime_error("TelemetryStore: too many channels");
+  }
+  if (!CanHoldSample(channels.size())) {
+    throw std::runtime_error("TelemetryStore: blocks can't hold a sample");
+  }
+  std::unordered_set<std::string> names;
+  for (const auto& channel : channels) {
+    if (!names.insert(channel.name.substr(0, kMaxChannelNameLength)).second) {
+      throw std::runtime_error("TelemetryStore: duplicate channel " +
+                               channel.name);
+    }
+  }
+}
+
+bool TelemetryStore::CanHoldSample(size_t num_channels) const {
+  return block_size_ > GetBlockHeaderSize(num_channels) +
+                           (telemetry_codec::kMaxTimestampBits +
+                            num_channels * telemetry_codec::kMaxValueBits) /
+                               8 +
+                           num_channels + 1;
+}
+
+bool TelemetryStore::Matches(const FileHeader& header) const {
+  return std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+         header.version == kVersion && header.block_size == block_size_ &&
+         header.num_blocks == num_blocks_ &&
+         header.num_channels <= kMaxChannels;
+}
+
+// Adds the channels the table doesn't have yet and maps between the two. False
+// if a channel has a different quantum in the table, or the table outgrew the
+// blocks.
+bool TelemetryStore::AddChannels() {
+  file_indices_.clear();
+  for (const auto& channel : channels_) {
+    const auto name = channel.name.substr(0, kMaxChannelNameLength);
+    const auto it =
+        std::find_if(file_channels_.begin(), file_channels_.end(),
+                     [&name](const Channel& file_channel) {
+                       return file_channel.name == name;
+                     });
+    if (it == file_channels_.end()) {
+      file_indices_.push_back(file_channels_.size());
+      file_channels_.push_back({name, channel.quantum});
+    } else if (it->quantum == channel.quantum) {
+      file_indices_.push_back(static_cast<size_t>(it - file_channels_.begin()));
+    } else {
+      return false;
+    }
+  }
+  if (file_channels_.size() > kMaxChannels ||
+      !CanHoldSample(file_channels_.size())) {
+    return false;
+  }
+
+  channel_indices_.assign(file_channels_.size(), SIZE_MAX);
+  for (size_t i = 0; i < file_indices_.size(); ++i) {
+    channel_indices_[file_indices_[i]] = i;
+  }
+  return true;
+}
+
+// The new entries are written before the count that covers them
+void TelemetryStore::WriteChannels() {
+  auto& header = *reinterpret_cast<FileHeader*>(file_.GetData());
+  auto* channels = reinterpret_cast<ChannelHeader*>(&header + 1);
+  for (size_t i = header.num_channels; i < file_channels_.size(); ++i) {
+    std::strncpy(channels[i].name, file_channels_[i].name.c_str(),
+                 sizeof(channels[i].name));
+    channels[i].quantum = file_channels_[i].quantum;
+  }
+  header.num_channels = static_cast<uint32_t>(file_channels_.size());
+}
+
+void TelemetryStore::Initialize() {
+  std::memset(file_.GetData(), 0, file_.GetSize());
+
+  auto& header = *reinterpret_cast<FileHeader*>(file_.GetData());
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.block_size = static_cast<uint32_t>(block_size_);
+  header.num_blocks = static_cast<uint32_t>(num_blocks_);
+  // Always fits, CheckChannels saw to it
+  file_channels_.clear();
+  AddChannels();
+  WriteChannels();
+  file_.Flush();
+}
+
+// Appending continues in a new block after the newest one, the encoder state
+// of a partially filled block is not restored
+void TelemetryStore::Recover() {
+  uint64_t max_sequence = 0;
+  for (size_t i_slot = 0; i_slot < num_blocks_; ++i_slot) {
+    const auto& header =
+        *reinterpret_cast<const BlockHeader*>(GetSlot(i_slot));
+    if (header.sequence > max_sequence) {
+      max_sequence = header.sequence;
+      open_slot_ = (i_slot + 1) % num_blocks_;
+    }
+  }
+  open_sequence_ = max_sequence + 1;
+}
+
+void TelemetryStore::StartNewBlock() {
+  {
+    auto lock = std::lock_guard(mutex_);
+    WriteOpenBlock();
+  }
+  file_.Flush();
+
+  open_slot_ = (open_slot_ + 1) % num_blocks_;
+  ++open_sequence_;
+  ClearOpenBlock();
+}
+
+// The open block gets a column for every channel of the table
+void TelemetryStore::ClearOpenBlock() {
+  num_open_samples_ = 0;
+  timestamp_encoder_ = {};
+  value_encoders_.clear();
+  for (const auto& channel : file_channels_) {
+    value_encoders_.emplace_back(channel.quantum);
+  }
+  columns_.resize(file_channels_.size() + 1);
+  for (auto& column : columns_) {
+    column.Clear();
+  }
+}
+
+// Must be called with mutex_ held
+void TelemetryStore::WriteOpenBlock() {
+  auto* slot = GetSlot(open_slot_);
+  auto& header = *reinterpret_cast<BlockHeader*>(slot);
+  header.sequence = 0;
+
+  const size_t num_channels = columns_.size() - 1;
+  auto* column_sizes = reinterpret_cast<uint32_t*>(slot + sizeof(BlockHeader));
+  uint8_t* data = slot + GetBlockHeaderSize(num_channels);
+  for (size_t i_column = 0; i_column < columns_.size(); ++i_column) {
+    const auto& bytes = columns_[i_column].GetBytes();
+    std::memcpy(data, bytes.data(), bytes.size());
+    data += bytes.size();
+    column_sizes[i_column] = static_cast<uint32_t>(bytes.size());
+  }
+  header.first_timestamp = open_first_timestamp_;
+  header.last_timestamp = open_last_timestamp_;
+  header.num_samples = static_cast<uint32_t>(num_open_samples_);
+  header.num_channels = static_cast<uint32_t>(num_channels);
+  header.sequence = open_sequence_;
+
+  open_block_written_ = true;
+}
+
+size_t TelemetryStore::GetOpenBlockSize() const {
+  size_t size = 0;
+  for (const auto& column : columns_) {
+    size += column.GetBytes().size();
+  }
+  return size;
+}
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "bbmp/mapped_file.h"
+#include "telemetry_codec.h"
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Keeps the most recent samples of the control loop in a fixed size file, that
+ * is memory mapped and used as a ring of blocks.
+ *
+ * A block holds consecutive samples stored column by column: first the
+ * timestamps, then one column per channel, each compressed with
+ * telemetry_codec. Blocks hold as many samples as fit, about a thousand at
+ * 1 Hz with the channels of four fans. When the ring is full the oldest block
+ * is overwritten.
+ *
+ * The file has its own table of channels, which only grows. The channels of a
+ * store are matched to it by name, so a store opened or updated with new
+ * channels keeps the history of the old ones. A block covers the channels the
+ * table had when it was started, channels added later read as NaN in it.
+ *
+ * The block being filled is kept in memory and copied into its slot of the file
+ * after each append, so a crash loses at most the last sample.
+ *
+ * One thread appends, any number of threads can scan at the same time.
+ */
+class TelemetryStore {
+ public:
+  static constexpr size_t kMaxChannels = 1024;
+  static constexpr size_t kMaxChannelNameLength = 31;
+
+  struct Channel {
+    std::string name;
+    // See telemetry_codec::ValueEncoder
+    float quantum;
+  };
+
+  // The samples of one block that fell inside the scanned range. values has
+  // one column per requested channel.
+  struct ScanBlock {
+    size_t num_samples;
+    const int64_t* timestamps;
+    std::vector<const float*> values;
+  };
+
+  // If the file exists but was created with a different block size, block
+  // count or version, or has a channel by the same name with a different
+  // quantum, it is cleared
+  TelemetryStore(const std::string& path, std::vector<Channel> channels,
+                 size_t block_size = 8192, size_t num_blocks = 1024);
+  ~TelemetryStore();
+
+  TelemetryStore(const TelemetryStore&) = delete;
+  TelemetryStore& operator=(const TelemetryStore&) = delete;
+
+  const std::vector<Channel>& GetChannels() const { return channels_; }
+
+  // Following appends have values for channels. The open block is closed and
+  // the new channels are added to the file, the history is kept. Only called
+  // by the appending thread.
+  void SetChannels(std::vector<Channel> channels);
+
+  // values has one entry for every channel, NaN for missing values. Timestamps
+  // are expected to increase.
+  void Append(int64_t timestamp_ms, const float* values);
+
+  // Calls callback in time order for every block that has samples with
+  // from_ms <= timestamp <= to_ms. Only the requested channels are decoded,
+  // they are NaN in blocks written before they were added.
+  void Scan(int64_t from_ms, int64_t to_ms, const std::vector<size_t>& channels,
+            const std::function<void(const ScanBlock&)>& callback) const;
+
+  // Timestamp of the oldest and the newest sample, or false if empty
+  bool GetTimeRange(int64_t& first_ms, int64_t& last_ms) const;
+
+ private:
+  struct FileHeader;
+  struct ChannelHeader;
+  struct BlockHeader;
+
+  static size_t GetBlockHeaderSize(size_t num_channels);
+
+  uint8_t* GetSlot(size_t i_slot);
+  const uint8_t* GetSlot(size_t i_slot) const;
+  void CheckChannels(const std::vector<Channel>& channels) const;
+  bool CanHoldSample(size_t num_channels) const;
+  bool Matches(const FileHeader& header) const;
+  bool AddChannels();
+  void WriteChannels();
+  void Initialize();
+  void Recover();
+  void StartNewBlock();
+  void ClearOpenBlock();
+  void WriteOpenBlock();
+  size_t GetOpenBlockSize() const;
+
+  std::vector<Channel> channels_;
+  size_t block_size_;
+  size_t num_blocks_;
+  // Room for kMaxChannels, so adding channels doesn't move the blocks
+  size_t file_header_size_;
+  bbmp::MappedFile file_;
+
+  // >>> The channel table of the file, changed with mutex_ held =============
+  std::vector<Channel> file_channels_;
+  // [i_channel] -> index into file_channels_
+  std::vector<size_t> file_indices_;
+  // [i_file_channel] -> index into channels_, SIZE_MAX if it has none
+  std::vector<size_t> channel_indices_;
+  // <<< ----------------------------------------------------------------------
+
+  // Guards the contents of the slots
+  mutable std::mutex mutex_;
+
+  // >>> The block being filled, only touched by the appending thread ========
+  size_t open_slot_ = 0;
+  uint64_t open_sequence_ = 1;
+  size_t num_open_samples_ = 0;
+  int64_t open_first_timestamp_ = 0;
+  int64_t open_last_timestamp_ = 0;
+  bool open_block_written_ = true;
+  telemetry_codec::TimestampEncoder timestamp_encoder_;
+  std::vector<telemetry_codec::ValueEncoder> value_encoders_;
+  // [0] holds the timestamps, [1 + i_file_channel] the values
+  std::vector<telemetry_codec::BitWriter> columns_;
+  // <<< ----------------------------------------------------------------------
+};
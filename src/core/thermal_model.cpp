@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "thermal_model.h"
+
+#include <cmath>
+
+namespace {
+// About a 30 s time constant and 0.3 degrees less in the steady state per
+// percent of duty cycle
+constexpr ThermalModel::Parameters kInitialParameters{0.97, -0.009, 0.0};
+// The variance of the initial parameters. c is set by the first update.
+constexpr double kInitialVariance[3] = {1e-4, 1e-6, 1.0};
+// How much the variance of the parameters grows per step, i.e. how fast they
+// may change
+constexpr double kDrift[3] = {1e-8, 1e-10, 3e-4};
+// The variance of a reading, mostly the rounding to whole degrees
+constexpr double kNoise = 0.1;
+}  // namespace
+
+ThermalModel::ThermalModel()
+    : parameters_(kInitialParameters),
+      temp_(std::nanf("")),
+      input_(std::nanf("")) {
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      p_[i][j] = i == j ? kInitialVariance[i] : 0.0;
+    }
+  }
+}
+
+void ThermalModel::Observe(float temp) {
+  if (!std::isnan(temp) && !std::isnan(temp_) && !std::isnan(input_)) {
+    Update(temp_, input_, temp);
+  }
+  temp_ = temp;
+  input_ = std::nanf("");
+}
+
+void ThermalModel::SetInput(float input) { input_ = input; }
+
+void ThermalModel::Restart() {
+  temp_ = std::nanf("");
+  input_ = std::nanf("");
+}
+
+bool ThermalModel::IsIdentified() const {
+  return num_updates_ >= kMinUpdates && parameters_.a > 0.0 &&
+         parameters_.a < 1.0 && parameters_.b < 0.0;
+}
+
+void ThermalModel::GetPrediction(int steps, double& offset,
+                                 double& slope) const {
+  const auto& [a, b, c] = parameters_;
+  const auto a_n = std::pow(a, steps);
+  // 1 + a + ... + a^(steps - 1)
+  const auto sum = (1.0 - a_n) / (1.0 - a);
+  offset = a_n * temp_ + sum * c;
+  slope = sum * b;
+}
+
+void ThermalModel::Update(double temp, double input, double next_temp) {
+  auto& theta = parameters_;
+  if (num_updates_ == 0) {
+    theta.c = next_temp - theta.a * temp - theta.b * input;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    p_[i][i] += kDrift[i];
+  }
+
+  const double phi[3] = {temp, input, 1.0};
+  double p_phi[3];
+  for (int i = 0; i < 3; ++i) {
+    p_phi[i] = p_[i][0] * phi[0] + p_[i][1] * phi[1] + p_[i][2] * phi[2];
+  }
+  const auto denominator =
+      kNoise + phi[0] * p_phi[0] + phi[1] * p_phi[1] + phi[2] * p_phi[2];
+
+  const auto error =
+      next_temp - (theta.a * phi[0] + theta.b * phi[1] + theta.c * phi[2]);
+  theta.a += p_phi[0] / denominator * error;
+  theta.b += p_phi[1] / denominator * error;
+  theta.c += p_phi[2] / denominator * error;
+
+  // P = P - P * phi * phi^T * P / denominator, where phi^T * P = p_phi^T as P
+  // is symmetric
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      p_[i][j] -= p_phi[i] * p_phi[j] / denominator;
+    }
+  }
+  ++num_updates_;
+}
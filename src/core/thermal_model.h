@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * First order thermal model of one sensor, identified online:
+ *
+ *   T[k + 1] = a * T[k] + b * u[k] + c
+ *
+ * where T is the temperature at control step k and u the average duty cycle of
+ * the fans in percent. a is how much of the temperature above the steady state
+ * remains after a step, b how much the fans take off, and c absorbs the heat
+ * load and the ambient temperature.
+ *
+ * The temperatures change by a fraction of a degree per step, less than the
+ * resolution of most sensors, and mostly with the load rather than with the
+ * fans. Fitting all three parameters freely doesn't converge on such data, so
+ * they are tracked with recursive least squares in its Kalman filter form: a
+ * and b start from a typical CPU cooler and only drift slowly, where the data
+ * supports it, while c follows the load within some twenty steps.
+ */
+class ThermalModel {
+ public:
+  // Updates needed before the model is trusted
+  static constexpr uint64_t kMinUpdates = 30;
+
+  struct Parameters {
+    double a;
+    double b;
+    double c;
+  };
+
+  ThermalModel();
+
+  // The temperature of the current control step, NaN if it couldn't be read.
+  // Forms an update with the previous temperature and the input since then.
+  void Observe(float temp);
+
+  // The duty cycle applied after the last Observe, NaN if unknown
+  void SetInput(float input);
+
+  // The next Observe doesn't form an update, e.g. after a gap in the samples
+  void Restart();
+
+  // Enough updates for c to follow the load, and the parameters describe a
+  // stable system that fans cool
+  bool IsIdentified() const;
+
+  const Parameters& GetParameters() const { return parameters_; }
+  uint64_t GetNumUpdates() const { return num_updates_; }
+
+  // The last observed temperature, NaN if there is none
+  float GetTemp() const { return temp_; }
+
+  // The temperature steps ahead of the last observation, if input is held
+  // from now on, is offset + slope * input. Only meaningful if identified.
+  void GetPrediction(int steps, double& offset, double& slope) const;
+
+ private:
+  void Update(double temp, double input, double next_temp);
+
+  Parameters parameters_;
+  // Covariance of the parameters
+  double p_[3][3];
+  uint64_t num_updates_ = 0;
+
+  float temp_;
+  float input_;
+};
@@ -43,9 +43,7 @@ MainComponent::MainComponent()
                      std::ios::binary);
     cereal::BinaryInputArchive archive(is);
     archive(settings_);
-    CoolthSettings::TTempCurves curves;
-    settings_.AccessTempCurves(
-        [&curves](auto& settings_curves) { curves = settings_curves; });
+    auto curves = settings_.Read()->temp_curves;
     graph_.SetState(std::move(curves[0]));
   }
 
@@ -52,8 +52,7 @@ class MainComponent : public juce::Component, public juce::Timer {
   }
 
   void read(const char* data, size_t length) {
-    bbmp::NonBlockingLogger::GetInstance().TryLog(
-        {nullptr, std::make_unique<std::string>(data, length)});
+    bbmp::Log("{}", std::string_view(data, length));
   }
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MainComponent)
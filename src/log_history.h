@@ -0,0 +1,95 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include "bbmp/logging.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+/*
+ * The last kCapacity log messages in a ring, and the rows of the log view: the
+ * numbers of the messages that pass the filters, in order. Filtering doesn't
+ * copy the messages. Appending costs the same however long the history is.
+ *
+ * TText is the type of the message text, juce::String in LogComponent.
+ */
+template <typename TText>
+class LogHistory {
+ public:
+  static constexpr uint64_t kCapacity = 100000;
+
+  struct Entry {
+    TText text;
+    bbmp::LogLevel level;
+    uint32_t thread_id;
+  };
+
+  // Returns the number of rows removed from the top, 1 if the ring overwrote
+  // a message that passed the filters, 0 otherwise
+  size_t Append(Entry entry) {
+    size_t num_rows_dropped = 0;
+    if (num_messages_ >= kCapacity && !filtered_.empty() &&
+        filtered_.front() == num_messages_ - kCapacity) {
+      filtered_.pop_front();
+      num_rows_dropped = 1;
+    }
+
+    if (entries_.size() < kCapacity) {
+      entries_.push_back(std::move(entry));
+    } else {
+      entries_[num_messages_ % kCapacity] = std::move(entry);
+    }
+    if (Matches(entries_[num_messages_ % kCapacity])) {
+      filtered_.push_back(num_messages_);
+    }
+    ++num_messages_;
+    return num_rows_dropped;
+  }
+
+  // source is a thread ID, 0 for all threads. Rebuilds the rows.
+  void SetFilter(bbmp::LogLevel min_level, uint32_t source) {
+    min_level_ = min_level;
+    source_ = source;
+    filtered_.clear();
+    for (auto i = num_messages_ - std::min(num_messages_, kCapacity);
+         i < num_messages_; ++i) {
+      if (Matches(entries_[i % kCapacity])) {
+        filtered_.push_back(i);
+      }
+    }
+  }
+
+  // Messages appended since the start, including the overwritten ones
+  uint64_t GetNumMessages() const { return num_messages_; }
+
+  size_t GetNumRows() const { return filtered_.size(); }
+
+  const Entry& GetRow(size_t row) const {
+    return entries_[filtered_[row] % kCapacity];
+  }
+
+ private:
+  bool Matches(const Entry& entry) const {
+    return entry.level >= min_level_ &&
+           (source_ == 0 || entry.thread_id == source_);
+  }
+
+  // Message number i is at entries_[i % kCapacity]
+  std::vector<Entry> entries_;
+  uint64_t num_messages_ = 0;
+  // Numbers of the messages passing the filters, in order
+  std::deque<uint64_t> filtered_;
+
+  bbmp::LogLevel min_level_ = bbmp::LogLevel::kDebug;
+  uint32_t source_ = 0;
+};
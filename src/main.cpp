@@ -8,6 +8,12 @@ License that can be found in the LICENSE file.
 #include "main_component.h"
 
 #include "BinaryData.h"
+#include "bbmp/instance_lock.h"
+#include "settings.h"
+
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
 
 class GuiAppApplication : public juce::JUCEApplication {
  public:
@@ -25,11 +31,33 @@ class GuiAppApplication : public juce::JUCEApplication {
 
   void initialise(const juce::String& command_line) override {
     juce::ignoreUnused(command_line);
+
+    // coolthd uses the same files, and moreThanOneInstanceAllowed doesn't know
+    // about it. Taken before MainComponent loads the settings.
+    const auto data_dir = CoolthSettings::GetDefaultDirectory();
+    std::error_code error;
+    std::filesystem::create_directories(data_dir, error);
+    try {
+      instance_lock_ = std::make_unique<bbmp::InstanceLock>(
+          (data_dir / CoolthSettings::kLockFileName).string());
+    } catch (std::runtime_error& lock_error) {
+      juce::AlertWindow::showMessageBoxAsync(
+          juce::AlertWindow::WarningIcon, getApplicationName(),
+          juce::String(lock_error.what()) +
+              ".\n\nIs coolthd running? Stop it before starting Coolth.",
+          "Quit", nullptr,
+          juce::ModalCallbackFunction::create([](int) { quit(); }));
+      return;
+    }
+
     main_window = std::make_unique<MainWindow>(getApplicationName() + " " +
                                                getApplicationVersion());
   }
 
-  void shutdown() override { main_window = nullptr; }
+  void shutdown() override {
+    main_window = nullptr;
+    instance_lock_ = nullptr;
+  }
 
   void systemRequestedQuit() override {
     // This is called when the app is being asked to quit: you can ignore this
@@ -122,6 +150,8 @@ class GuiAppApplication : public juce::JUCEApplication {
   };
 
  private:
+  // Held while the window, and the engine in it, exist
+  std::unique_ptr<bbmp::InstanceLock> instance_lock_;
   std::unique_ptr<MainWindow> main_window;
 };
 
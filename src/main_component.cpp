@@ -8,6 +8,70 @@ License that can be found in the LICENSE file.
 #include "main_component.h"
 #include <BinaryData.h>
 
+#include <cmath>
+
+namespace {
+constexpr int kMinSliderWidth = 80;
+
+// The labels of the first num_sensors sensors of the registry
+std::vector<juce::String> GetSensorLegend(const CoolthSettings::State& settings,
+                                          size_t num_sensors) {
+  std::vector<juce::String> legend;
+  for (size_t i = 0; i < num_sensors && i < settings.GetNumSensors(); ++i) {
+    legend.push_back(juce::String::fromUTF8(settings.sensors[i].label.c_str()));
+  }
+  return legend;
+}
+
+// The filtered temperatures of num_sensors, then the duty cycles and the RPMs
+// of every fan
+std::vector<HistoryComponent::Plot> MakeHistoryPlots(
+    const CoolthSettings::State& settings, size_t num_sensors,
+    size_t num_fans) {
+  std::vector<juce::String> fan_legend;
+  for (size_t i_fan = 0; i_fan < num_fans; ++i_fan) {
+    fan_legend.push_back("Fan " + juce::String(static_cast<int>(i_fan)));
+  }
+  return {{juce::CharPointer_UTF8("T [\xc2\xb0"
+                                  "C]"),
+           20.0f, 100.0f, 20.0f, false,
+           GetSensorLegend(settings, num_sensors)},
+          {"Duty cycle [%]", 0.0f, 100.0f, 25.0f, false, fan_legend},
+          {"RPM", 0.0f, 1000.0f, 500.0f, true, fan_legend}};
+}
+
+// Curves are kept in the settings as plain points, the graphs edit juce points.
+// There is a graph for every sensor of the registry, and curves of sensors
+// that aren't registered yet aren't shown.
+std::vector<std::vector<juce::Point<float>>> ToGraph(
+    const CoolthSettings::State& settings, size_t i_fan) {
+  std::vector<std::vector<juce::Point<float>>> points(
+      settings.GetNumSensors());
+  for (const auto& curve : settings.temp_curves[i_fan]) {
+    const auto i_sensor = settings.FindSensor(curve.sensor);
+    if (i_sensor < 0 || !points[i_sensor].empty()) {
+      continue;
+    }
+    for (const auto& p : curve.points) {
+      points[i_sensor].emplace_back(p.x, p.y);
+    }
+  }
+  return points;
+}
+
+std::optional<float> ToOptional(float temp) {
+  return std::isnan(temp) ? std::nullopt : std::make_optional(temp);
+}
+
+juce::String FormatTemp(const std::optional<float>& temp, bool smooth_temps) {
+  if (!temp) {
+    return "N/A";
+  }
+  return smooth_temps ? juce::String(temp.value(), 1, false)
+                      : juce::String(temp.value());
+}
+}  // namespace
+
 MainComponent::MainComponent()
     : log_component_(
           [] {
@@ -19,16 +83,24 @@ MainComponent::MainComponent()
           },
           false),
       button_log_("Show log >"),
+      button_latency_("Latency"),
+      history_component_(MakeHistoryPlots(*settings_.Read(),
+                                          settings_.Read()->GetNumSensors(),
+                                          CoolthSettings::kDefaultNumFans)),
       temperature_thread_(
           [this](const std::function<bool()>& thread_should_exit,
                  const std::function<void(int)>& wait_ms) {
-            program_loop(thread_should_exit, wait_ms);
+            bbmp::NonBlockingLogger::GetInstance().SetThreadName("control");
+            engine_->Run(thread_should_exit, wait_ms);
           }),
       tabs_(juce::TabbedButtonBar::Orientation::TabsAtBottom),
       button_info_("info") {
   addAndMakeVisible(temperature_component_);
   addAndMakeVisible(button_log_);
-  addAndMakeVisible(slider_component_);
+  addAndMakeVisible(button_latency_);
+  slider_viewport_.setViewedComponent(&slider_component_, false);
+  slider_viewport_.setScrollBarsShown(false, true);
+  addAndMakeVisible(slider_viewport_);
   addAndMakeVisible(log_component_);
   addAndMakeVisible(tabs_);
   addAndMakeVisible(button_info_);
@@ -54,9 +126,9 @@ MainComponent::MainComponent()
 
   auto set_size = [this]() {
     if (show_log_) {
-      setSize(450 + log_width, 580);
+      setSize(560 + log_width, 580);
     } else {
-      setSize(450, 580);
+      setSize(560, 580);
     }
   };
 
@@ -66,84 +138,90 @@ MainComponent::MainComponent()
     set_size();
   };
 
-  for (auto i_fan = 0u; i_fan < fan_graphs_.size(); ++i_fan) {
-    fan_graphs_[i_fan] = std::make_unique<MultiGraphComponent>(
-        30.0f, 90.0f, 0.0f, 100.0f, std::vector<juce::String>{"CPU", "GPU"});
-    auto& graph = fan_graphs_[i_fan];
-    graph->SetXTicks({30, 40, 50, 60, 70, 80, 90});
-    graph->SetYTicks({0, 20, 40, 60, 80, 100});
-    graph->SetXLabel(
-        juce::CharPointer_UTF8("T [\xc2\xb0"
-                               "C]"));
-    graph->SetYLabel("Duty cycle [%]");
-    graph->SetOnChange(
-        [this, i_fan](size_t i_cpu_or_gpu,
-                      std::vector<juce::Point<float>> new_values) {
-          settings_.AccessTempCurves([i_fan, i_cpu_or_gpu, &new_values](
-                                         CoolthSettings::TTempCurves& curves) {
-            if (curves.size() > i_fan && curves[i_fan].size() > i_cpu_or_gpu) {
-              curves[i_fan][i_cpu_or_gpu] = std::move(new_values);
-            }
-          });
-          settings_.should_save_.store(true, std::memory_order_release);
-        });
-    tabs_.addTab(
-        "Fan " + juce::String(i_fan),
-        getLookAndFeel().findColour(juce::ResizableWindow::backgroundColourId),
-        fan_graphs_[i_fan].get(), false);
-  }
+  button_latency_.onClick = [this]() {
+    for (const auto& line : PipelineLatency::GetInstance().GetReport()) {
+      bbmp::Log("Latency: {}", line);
+    }
+    if (!show_log_) {
+      button_log_.onClick();
+    }
+  };
 
-  auto settings_file_dir =
-      juce::File::getSpecialLocation(
-          juce::File::SpecialLocationType::userApplicationDataDirectory)
-          .getChildFile(
-              juce::JUCEApplication::getInstance()->getApplicationName());
-  if (!settings_file_dir.exists()) {
-    settings_file_dir.createDirectory();
-  }
-  auto settings_file = settings_file_dir.getChildFile("settings.bin");
+  tabs_.addTab(
+      "History",
+      getLookAndFeel().findColour(juce::ResizableWindow::backgroundColourId),
+      &history_component_, false);
+
+  // Shared with coolthd, so only one of them should be running
+  const auto settings_file_dir = CoolthSettings::GetDefaultDirectory();
+  std::error_code error;
+  std::filesystem::create_directories(settings_file_dir, error);
+  const auto settings_file = settings_file_dir / "settings.bin";
 
   try {
     settings_.Load(settings_file);
-    bbmp::Log({"Loaded settings from: " +
-               settings_file.getFullPathName().toStdString()});
+    bbmp::Log("Loaded settings from: {}", settings_file.string());
   } catch (...) {
-    bbmp::Log({"Failed to load settings from: " +
-               settings_file.getFullPathName().toStdString()});
+    bbmp::Log(bbmp::LogLevel::kWarning, "Failed to load settings from: {}",
+              settings_file.string());
   }
 
-  {
-    CoolthSettings::TTempCurves curves;
-    settings_.AccessTempCurves([&curves](auto& c) { curves = c; });
-    const auto i_fan_end = std::min(curves.size(), fan_graphs_.size());
-    for (auto i_fan = 0u; i_fan < i_fan_end; ++i_fan) {
-      fan_graphs_[i_fan]->SetState(curves[i_fan]);
+  const auto num_fans = settings_.Read()->GetNumFans();
+  // The telemetry store starts with every sensor the settings have
+  const auto num_sensors = settings_.Read()->GetNumSensors();
+
+  engine_ = std::make_unique<ControlEngine>(
+      settings_,
+      ControlEngine::Options{
+          settings_file_dir / "telemetry.bin",
+          juce::File::getSpecialLocation(juce::File::currentExecutableFile)
+              .getParentDirectory()
+              .getChildFile("temperature_reader.exe")
+              .getFullPathName()
+              .toStdString()},
+      std::vector<ControlEngine::Listener*>{this});
+  history_component_.SetPlots(
+      MakeHistoryPlots(*settings_.Read(), num_sensors, num_fans));
+
+  // The history shows the filtered temperatures, the duty cycles and the RPMs,
+  // which are the channels after the raw temperatures
+  engine_->AccessTelemetryStore([this, num_sensors](TelemetryStore* store) {
+    int64_t first_ms, last_ms;
+    if (store == nullptr || !store->GetTimeRange(first_ms, last_ms)) {
+      return;
     }
-  }
+    std::vector<size_t> history_channels;
+    for (size_t i = 0; i < history_component_.GetNumSeries(); ++i) {
+      history_channels.push_back(num_sensors + i);
+    }
+    std::vector<float> values(history_channels.size());
+    store->Scan(last_ms - 24 * 3600 * 1000, last_ms, history_channels,
+                [this, &values](const TelemetryStore::ScanBlock& block) {
+                  for (size_t i = 0; i < block.num_samples; ++i) {
+                    for (size_t i_value = 0; i_value < values.size();
+                         ++i_value) {
+                      values[i_value] = block.values[i_value][i];
+                    }
+                    history_component_.Append(block.timestamps[i],
+                                              values.data());
+                  }
+                });
+  });
+
+  ShowFans(num_fans);
 
   temperature_component_.SetAverage(settings_.GetSmoothTemps());
   temperature_component_.button_average_.onClick =
       [&button = temperature_component_.button_average_, this]() {
         settings_.SetSmoothTemps(button.getToggleState());
       };
-
-  {
-    static_assert(
-        std::tuple_size<decltype(settings_.manual_duty_cycles)>::value ==
-        std::tuple_size<decltype(slider_component_.sliders_)>::value);
-
-    for (auto i_fan = 0u; i_fan < slider_component_.sliders_.size(); ++i_fan) {
-      slider_component_.sliders_[i_fan]->Get().setValue(
-          settings_.manual_duty_cycles[i_fan].load());
-
-      slider_component_.sliders_[i_fan]->on_drag_end_callback_ =
-          [&settings = settings_,
-           &slider = slider_component_.sliders_[i_fan]->Get(), i_fan] {
-            settings.manual_duty_cycles[i_fan].store(slider.getValue());
-            settings.should_save_.store(true, std::memory_order_release);
-          };
-    }
-  }
+  temperature_component_.button_predictive_.setToggleState(
+      settings_.GetPredictiveControl(),
+      juce::NotificationType::dontSendNotification);
+  temperature_component_.button_predictive_.onClick =
+      [&button = temperature_component_.button_predictive_, this]() {
+        settings_.SetPredictiveControl(button.getToggleState());
+      };
 
   set_size();
   temperature_thread_.startThread(0);
@@ -154,6 +232,99 @@ void MainComponent::paint(juce::Graphics& g) {
       getLookAndFeel().findColour(juce::ResizableWindow::backgroundColourId));
 }
 
+void MainComponent::handleAsyncUpdate() {
+  ShowFans(settings_.Read()->GetNumFans());
+  ShowSensors();
+}
+
+void MainComponent::ShowSensors() {
+  const auto settings = settings_.Read();
+  const auto legend = GetSensorLegend(*settings, settings->GetNumSensors());
+  const auto num_fan_views = num_fan_views_.load(std::memory_order_relaxed);
+  for (size_t i_fan = 0; i_fan < num_fan_views; ++i_fan) {
+    auto& graph = *fan_graphs_[i_fan];
+    if (graph.GetNumGraphs() >= legend.size()) {
+      continue;
+    }
+    graph.SetLegend(legend);
+    // Curves can follow sensors before they are registered
+    if (i_fan < settings->GetNumFans()) {
+      graph.SetState(ToGraph(*settings, i_fan));
+    }
+  }
+}
+
+void MainComponent::ShowFans(size_t num_fans) {
+  num_fans = std::min(num_fans, fan_graphs_.size());
+  const auto num_fans_before = num_fan_views_.load(std::memory_order_relaxed);
+  if (num_fans <= num_fans_before) {
+    return;
+  }
+
+  const auto settings = settings_.Read();
+  slider_component_.SetNumSliders(num_fans);
+
+  for (auto i_fan = num_fans_before; i_fan < num_fans; ++i_fan) {
+    fan_graphs_[i_fan] = std::make_unique<MultiGraphComponent>(
+        30.0f, 90.0f, 0.0f, 100.0f,
+        GetSensorLegend(*settings, settings->GetNumSensors()));
+    auto& graph = fan_graphs_[i_fan];
+    graph->SetXTicks({30, 40, 50, 60, 70, 80, 90});
+    graph->SetYTicks({0, 20, 40, 60, 80, 100});
+    graph->SetXLabel(
+        juce::CharPointer_UTF8("T [\xc2\xb0"
+                               "C]"));
+    graph->SetYLabel("Duty cycle [%]");
+    if (i_fan < settings->GetNumFans()) {
+      graph->SetState(ToGraph(*settings, i_fan));
+    }
+    graph->SetOnChange([this, i_fan](
+                           size_t i_sensor,
+                           std::vector<juce::Point<float>> new_values) {
+      std::string sensor;
+      {
+        const auto state = settings_.Read();
+        if (i_sensor >= state->GetNumSensors()) {
+          return;
+        }
+        sensor = state->sensors[i_sensor].id;
+      }
+      std::vector<CurvePoint> points;
+      for (const auto& p : new_values) {
+        points.push_back({p.x, p.y});
+      }
+      settings_.SetCurve(i_fan, sensor, std::move(points));
+    });
+    // The history stays the last tab
+    tabs_.addTab(
+        "Fan " + juce::String(static_cast<int>(i_fan)),
+        getLookAndFeel().findColour(juce::ResizableWindow::backgroundColourId),
+        fan_graphs_[i_fan].get(), false, static_cast<int>(i_fan));
+
+    auto& slider = slider_component_.sliders_[i_fan];
+    if (i_fan < settings->manual_duty_cycles.size()) {
+      slider->Get().setValue(settings->manual_duty_cycles[i_fan]);
+    }
+    slider->on_drag_end_callback_ = [this, &value = slider->Get(), i_fan] {
+      settings_.SetManualDutyCycle(i_fan, static_cast<float>(value.getValue()));
+    };
+  }
+
+  num_fan_views_.store(num_fans, std::memory_order_release);
+  LayoutSliders();
+}
+
+void MainComponent::LayoutSliders() {
+  const auto viewport_width = slider_viewport_.getWidth();
+  const auto width = std::max(
+      viewport_width,
+      static_cast<int>(slider_component_.GetNumSliders()) * kMinSliderWidth);
+  const auto height =
+      slider_viewport_.getHeight() -
+      (width > viewport_width ? slider_viewport_.getScrollBarThickness() : 0);
+  slider_component_.setSize(width, height);
+}
+
 void MainComponent::resized() {
   auto local_bounds = getLocalBounds();
   if (show_log_) {
@@ -163,8 +334,10 @@ void MainComponent::resized() {
     log_component_.setVisible(false);
     auto top_row = local_bounds.removeFromTop(46).reduced(8);
     button_log_.setBounds(top_row.removeFromRight(88));
+    button_latency_.setBounds(top_row.removeFromRight(70).withTrimmedRight(8));
     temperature_component_.setBounds(top_row);
-    slider_component_.setBounds(local_bounds.removeFromTop(110));
+    slider_viewport_.setBounds(local_bounds.removeFromTop(110));
+    LayoutSliders();
     local_bounds.removeFromTop(16);
     tabs_.setBounds(local_bounds);
   }
@@ -172,198 +345,88 @@ void MainComponent::resized() {
       getLocalBounds().removeFromRight(30).removeFromBottom(30).reduced(8));
 }
 
-void MainComponent::program_loop(
-    const std::function<bool()>& thread_should_exit,
-    const std::function<void(int)>& wait_ms) {
-  juce::int64 time = 0;
-
-  while (!thread_should_exit()) {
-    try {
-      FanControllerCommunicator fan_controller_communicator(
-          settings_, thread_should_exit, wait_ms);
-
-      LineReader temp_stream_reader(
-          32, [this](const char* data, size_t length) {
-            const auto AsFloat =
-                [](const std::optional<int>& opt) -> std::optional<float> {
-              return opt ? std::make_optional<float>(
-                               static_cast<float>(opt.value()))
-                         : std::nullopt;
-            };
-
-            StringStream stream(data, length);
-            std::optional<float> cpu = AsFloat(stream.GetInt());
-            if (!cpu) {
-              stream.ForwardToNextToken();
-            }
-            std::optional<float> gpu = AsFloat(stream.GetInt());
-            temperature_component_.SetTemps(cpu, gpu);
-          });
-
-      RecreateOnFailure<ChildProcess> temp_reader_process{
-          [this, &temp_stream_reader]() {
-            auto temp_reader_path = juce::File::getSpecialLocation(
-                                        juce::File::currentExecutableFile)
-                                        .getParentDirectory()
-                                        .getChildFile("temperature_reader.exe");
-
-            return std::make_unique<ChildProcess>(
-                temp_reader_path.getFullPathName().toStdString(),
-                [this, &temp_stream_reader](const char* data, size_t length) {
-                  temp_stream_reader.Read(data, length);
-                });
-          }};
-
-      std::array<std::optional<float>, CoolthSettings::kCurvesPerFan> temps;
-
-      while (!thread_should_exit()) {
-        temp_reader_process.Execute([](auto& p) { p.IssueRead(); });
-        fan_controller_communicator.IssueRead();
-        const auto current_time = juce::Time::currentTimeMillis();
-        if (current_time - time > 1000) {
-          // >>> AUTO DUTY CYCLE LOGIC ======================================
-          const auto smooth_temps = temperature_component_.GetAverage();
-          const auto cpu_temp =
-              temperature_component_.cpu_temp_.load(std::memory_order_relaxed);
-          const auto gpu_temp =
-              temperature_component_.gpu_temp_.load(std::memory_order_relaxed);
-
-          temps[0] = (temps[0] && cpu_temp && smooth_temps)
-                         ? 0.1f * cpu_temp.value() + 0.9f * temps[0].value()
-                         : cpu_temp;
-          temps[1] = (temps[1] && gpu_temp && smooth_temps)
-                         ? 0.1f * gpu_temp.value() + 0.9f * temps[1].value()
-                         : gpu_temp;
-
-          if (temps[0]) {
-            temperature_component_.SetCpuDisplay(
-                smooth_temps ? juce::String(temps[0].value(), 1, false)
-                             : juce::String(temps[0].value()));
-          } else {
-            temperature_component_.SetCpuDisplay("N/A");
-          }
-
-          if (temps[1]) {
-            temperature_component_.SetGpuDisplay(
-                smooth_temps ? juce::String(temps[1].value(), 1, false)
-                             : juce::String(temps[1].value()));
-          } else {
-            temperature_component_.SetGpuDisplay("N/A");
-          }
-
-          std::array<std::optional<juce::Point<float>>,
-                     CoolthSettings::kNumFans>
-              duty_point_on_graph;
-
-          std::array<float, CoolthSettings::kNumFans> duty_cycles{0.0f};
-
-          settings_.AccessTempCurves(
-              [this, &temps, &duty_point_on_graph,
-               &duty_cycles](CoolthSettings::TTempCurves& curves) {
-                for (auto i_fan = 0u; i_fan < curves.size(); ++i_fan) {
-                  auto& duty_cycle = duty_cycles[i_fan];
-                  for (auto i_cpu_or_gpu = 0u; i_cpu_or_gpu < temps.size();
-                       ++i_cpu_or_gpu) {
-                    if (auto temp = temps[i_cpu_or_gpu]) {
-                      if (auto dc = GraphComponent::GetYForX(
-                              curves[i_fan][i_cpu_or_gpu], *temp)) {
-                        if (*dc >= duty_cycle) {
-                          duty_cycle = *dc;
-                          duty_point_on_graph[i_fan] = {
-                              static_cast<float>(*temp), duty_cycle};
-                        }
-                      }
-                    }
-                  }
-                }
-              });
-
-          static_assert(
-              std::tuple_size<decltype(slider_component_.sliders_)>::value ==
-              std::tuple_size<decltype(duty_cycles)>::value);
-
-          for (auto i_fan = 0u; i_fan < duty_cycles.size(); ++i_fan) {
-            auto& duty_cycle = duty_cycles[i_fan];
-            if (!duty_point_on_graph[i_fan] ||
-                slider_component_.sliders_[i_fan]->IsUserHolding()) {
-              duty_cycle = slider_component_.sliders_[i_fan]->Get().getValue();
-              duty_point_on_graph[i_fan] = {};
-            } else {
-              slider_component_.sliders_[i_fan]->SetValue(duty_cycle);
-            }
-
-            if (!duty_point_on_graph[i_fan] &&
-                !slider_component_.sliders_[i_fan]->IsUserHolding()) {
-              slider_component_.sliders_[i_fan]->SetValue(
-                  settings_.manual_duty_cycles[i_fan]);
-            }
+void MainComponent::OnTelemetryChannelsChanged(size_t num_logged_sensors,
+                                               size_t num_logged_fans) {
+  history_component_.SetPlots(MakeHistoryPlots(
+      *settings_.Read(), num_logged_sensors, num_logged_fans));
+}
 
-            fan_graphs_[i_fan]->SetPoint(duty_point_on_graph[i_fan]);
-          }
-
-          // <<< AUTO DUTY CYCLE LOGIC
-          // --------------------------------------
-
-          const auto rpms = fan_controller_communicator.GetRpms();
-
-          static_assert(
-              std::tuple_size<decltype(rpms)>::value ==
-              std::tuple_size<decltype(slider_component_.sliders_)>::value);
-
-          for (int i_fan = 0; i_fan < rpms.size(); ++i_fan) {
-            slider_component_.sliders_[i_fan]->SetNumber(rpms[i_fan]);
-          }
-          char msg[100];
-          snprintf(
-              msg, 100, "c 1 %d %d %d %d\n",
-              static_cast<int>(std::round(duty_cycles[0] / 100.0f * 255.0f)),
-              static_cast<int>(std::round(duty_cycles[1] / 100.0f * 255.0f)),
-              static_cast<int>(std::round(duty_cycles[2] / 100.0f * 255.0f)),
-              static_cast<int>(std::round(duty_cycles[3] / 100.0f * 255.0f)));
-          fan_controller_communicator.serial_->TryIssueWrite(msg, strlen(msg));
-          time = current_time;
-        }
-        settings_.SaveChanges();
+std::optional<float> MainComponent::GetDutyCycleOverride(size_t i_fan) {
+  if (i_fan >= num_fan_views_.load(std::memory_order_acquire)) {
+    return std::nullopt;
+  }
+  auto& slider = *slider_component_.sliders_[i_fan];
+  if (!slider.IsUserHolding()) {
+    return std::nullopt;
+  }
+  return static_cast<float>(slider.Get().getValue());
+}
 
-        WindowsSleepEx(50, true);
-      }
-    } catch (std::runtime_error& error) {
-      bbmp::Log({error.what()});
+void MainComponent::OnStep(const ControlEngine::Step& step) {
+  // The default sensors, which are always the first two
+  temperature_component_.SetTemps(ToOptional(step.raw_temps[0]),
+                                  ToOptional(step.raw_temps[1]),
+                                  step.ingress_time);
+  temperature_component_.SetCpuDisplay(
+      FormatTemp(ToOptional(step.temps[0]), step.smooth_temps));
+  temperature_component_.SetGpuDisplay(
+      FormatTemp(ToOptional(step.temps[1]), step.smooth_temps));
+
+  const auto num_fan_views = std::min(
+      step.num_fans, num_fan_views_.load(std::memory_order_acquire));
+  for (size_t i_fan = 0; i_fan < num_fan_views; ++i_fan) {
+    auto& slider = *slider_component_.sliders_[i_fan];
+    if (!slider.IsUserHolding()) {
+      slider.SetValue(step.duty_cycles[i_fan]);
     }
-    wait_ms(1000);
-  }
-  try {
-    settings_.SaveChanges();
-  } catch (std::runtime_error& error) {
-    bbmp::Log({error.what()});
+    slider.SetNumber(step.rpms[i_fan]);
+
+    const auto& duty_point = step.duty_points[i_fan];
+    fan_graphs_[i_fan]->SetPoint(
+        duty_point ? std::make_optional<juce::Point<float>>(duty_point->x,
+                                                            duty_point->y)
+                   : std::nullopt);
   }
+
+  // The filtered temperatures follow the raw ones
+  history_component_.Append(step.timestamp_ms,
+                            step.telemetry + step.num_sensors);
 }
 
-SliderComponent::SliderComponent() {
-  for (auto& slider : sliders_) {
+void SliderComponent::SetNumSliders(size_t num_sliders) {
+  num_sliders = std::min(num_sliders, sliders_.size());
+  for (; num_sliders_ < num_sliders; ++num_sliders_) {
+    auto& slider = sliders_[num_sliders_];
     slider = std::make_unique<SliderWithNumberInTheMiddle>();
     slider->Get().setRange(0.0, 100.0, 1.0 / 255.0);
     slider->Get().setNumDecimalPlacesToDisplay(2);
     addAndMakeVisible(*slider);
   }
+  resized();
 }
 
 void SliderComponent::resized() {
+  if (num_sliders_ == 0) {
+    return;
+  }
   auto local_bounds = getLocalBounds();
-  const int slider_width = local_bounds.getWidth() / sliders_.size();
-  for (auto& slider : sliders_) {
-    slider->setBounds(local_bounds.removeFromLeft(slider_width));
+  const int slider_width =
+      local_bounds.getWidth() / static_cast<int>(num_sliders_);
+  for (size_t i = 0; i < num_sliders_; ++i) {
+    sliders_[i]->setBounds(local_bounds.removeFromLeft(slider_width));
   }
 }
 
 TemperatureComponent::TemperatureComponent()
     : button_average_("Average temps"),
+      button_predictive_("Predictive"),
       button_average_accessor_(button_average_),
       cpu_display_accesor_(cpu_display_),
       gpu_display_accesor_(gpu_display_) {
   addAndMakeVisible(cpu_);
   addAndMakeVisible(gpu_);
   addAndMakeVisible(button_average_);
+  addAndMakeVisible(button_predictive_);
 
   cpu_.setText("CPU: N/A", juce::NotificationType::dontSendNotification);
   gpu_.setText("GPU: N/A", juce::NotificationType::dontSendNotification);
@@ -371,13 +434,17 @@ TemperatureComponent::TemperatureComponent()
 
 void TemperatureComponent::resized() {
   auto local_bounds = getLocalBounds();
-  cpu_.setBounds(local_bounds.removeFromLeft(100));
-  gpu_.setBounds(local_bounds.removeFromLeft(100));
-  button_average_.setBounds(local_bounds.removeFromLeft(150));
+  cpu_.setBounds(local_bounds.removeFromLeft(90));
+  gpu_.setBounds(local_bounds.removeFromLeft(90));
+  button_average_.setBounds(local_bounds.removeFromLeft(110));
+  button_predictive_.setBounds(local_bounds.removeFromLeft(96));
 }
 
-void TemperatureComponent::SetTemps(const std::optional<float>& cpu,
-                                    const std::optional<float>& gpu) {
+void TemperatureComponent::SetTemps(
+    const std::optional<float>& cpu, const std::optional<float>& gpu,
+    PipelineLatency::Clock::time_point ingress_time) {
+  // Picked up by the update that SetCpuDisplay triggers on every step
+  ingress_time_.store(ingress_time, std::memory_order_relaxed);
   if (cpu_temp_.load(std::memory_order_relaxed) != cpu) {
     cpu_temp_.store(cpu);
     repaint_.store(true, std::memory_order_relaxed);
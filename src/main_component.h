@@ -7,17 +7,15 @@ License that can be found in the LICENSE file.
 
 #pragma once
 
-#include "bbmp/child_process.h"
-#include "bbmp/fan_controller_communicator.h"
-#include "bbmp/line_reader.h"
-#include "bbmp/recreate_on_failure.h"
-#include "bbmp/stringstream.h"
-
 #include "components/custom_slider.h"
+#include "components/history_component.h"
 #include "components/log_component.h"
 #include "components/multi_graph_editor.h"
+#include "control_engine.h"
 #include "juce_priorizable_thread.h"
+#include "pipeline_latency.h"
 #include "settings.h"
+#include "settings_persister.h"
 
 #include <juce_gui_extra/juce_gui_extra.h>
 
@@ -25,8 +23,11 @@ License that can be found in the LICENSE file.
 #include <array>
 #include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <string>
+#include <vector>
 
 template <typename T>
 class AsyncAccessor : private juce::AsyncUpdater {
@@ -63,8 +64,11 @@ struct TemperatureComponent : public juce::Component,
 
   void resized() override;
 
+  // ingress_time is when the temperatures were read, see
+  // PipelineLatency::Stage::kDisplay
   void SetTemps(const std::optional<float>& cpu,
-                const std::optional<float>& gpu);
+                const std::optional<float>& gpu,
+                PipelineLatency::Clock::time_point ingress_time);
 
   void handleAsyncUpdate() override {
     if (repaint_.load(std::memory_order_relaxed)) {
@@ -77,6 +81,12 @@ struct TemperatureComponent : public juce::Component,
                    juce::NotificationType::dontSendNotification);
       repaint();
     }
+    if (const auto ingress_time = ingress_time_.exchange(
+            PipelineLatency::Clock::time_point{}, std::memory_order_relaxed);
+        ingress_time != PipelineLatency::Clock::time_point{}) {
+      PipelineLatency::GetInstance().RecordSince(
+          PipelineLatency::Stage::kDisplay, ingress_time);
+    }
   }
 
   bool GetAverage() { return button_average_.getToggleState(); }
@@ -112,9 +122,13 @@ struct TemperatureComponent : public juce::Component,
   std::atomic<std::optional<float>> cpu_temp_;
   std::atomic<std::optional<float>> gpu_temp_;
   juce::ToggleButton button_average_;
+  // Plans the duty cycles with the thermal models, see PredictiveController
+  juce::ToggleButton button_predictive_;
 
  private:
   std::atomic<bool> repaint_{false};
+  // Of the temperatures not shown yet, the epoch if there are none
+  std::atomic<PipelineLatency::Clock::time_point> ingress_time_{};
   AsyncAccessor<juce::ToggleButton> button_average_accessor_;
 
   juce::String cpu_display_{"N/A"};
@@ -128,17 +142,26 @@ struct TemperatureComponent : public juce::Component,
 
 class SliderComponent : public juce::Component {
  public:
-  SliderComponent();
-
   void resized() override;
 
+  // Only adds sliders. Existing ones are never moved or destroyed, so another
+  // thread can keep using them.
+  void SetNumSliders(size_t num_sliders);
+
+  size_t GetNumSliders() const { return num_sliders_; }
+
   std::array<std::unique_ptr<SliderWithNumberInTheMiddle>,
-             CoolthSettings::kNumFans>
+             CoolthSettings::kMaxFans>
       sliders_;
   std::mutex mutex_values_to_set_;
+
+ private:
+  size_t num_sliders_ = 0;
 };
 
-class MainComponent : public juce::Component {
+class MainComponent : public juce::Component,
+                      private juce::AsyncUpdater,
+                      private ControlEngine::Listener {
  public:
   MainComponent();
 
@@ -147,25 +170,57 @@ class MainComponent : public juce::Component {
 
  private:
   SliderComponent slider_component_;
+  // Scrolls the sliders when there are too many fans to fit
+  juce::Viewport slider_viewport_;
   TemperatureComponent temperature_component_;
   LogComponent log_component_;
   bool show_log_ = false;
   juce::TextButton button_log_;
-  std::unique_ptr<ChildProcess> temperature_reader_;
-  JucePriorizableThread temperature_thread_;
+  // Writes the latency histograms in the log
+  juce::TextButton button_latency_;
+  // Declared before the thread using them, so they outlive it
   CoolthSettings settings_;
-  juce::TabbedComponent tabs_;
-  std::array<std::unique_ptr<MultiGraphComponent>, CoolthSettings::kNumFans>
+  SettingsPersister settings_persister_{settings_};
+  // Created once the settings are loaded
+  std::unique_ptr<ControlEngine> engine_;
+  HistoryComponent history_component_;
+  std::array<std::unique_ptr<MultiGraphComponent>, CoolthSettings::kMaxFans>
       fan_graphs_;
+  // Number of fans with a slider and a graph, the control thread only touches
+  // these
+  std::atomic<size_t> num_fan_views_{0};
+  JucePriorizableThread temperature_thread_;
+  juce::TabbedComponent tabs_;
   static constexpr int log_width = 400;
   juce::ImageButton button_info_;
 
-  void program_loop(const std::function<bool()>& thread_should_exit,
-                    const std::function<void(int)>& wait_ms);
+  // Adds sliders and graphs for the fans the settings have and the UI doesn't
+  // have yet
+  void handleAsyncUpdate() override;
+
+  void ShowFans(size_t num_fans);
+
+  // Gives the graphs of the fans a curve for the sensors registered since
+  void ShowSensors();
+
+  void LayoutSliders();
+
+  // >>> CONTROL THREAD ========================================================
+  void OnFansAdded() override { triggerAsyncUpdate(); }
+
+  void OnSensorsAdded() override { triggerAsyncUpdate(); }
+
+  void OnTelemetryChannelsChanged(size_t num_logged_sensors,
+                                  size_t num_logged_fans) override;
+
+  // The value of the slider the user is dragging
+  std::optional<float> GetDutyCycleOverride(size_t i_fan) override;
+
+  void OnStep(const ControlEngine::Step& step) override;
+  // <<< CONTROL THREAD --------------------------------------------------------
 
   void read(const char* data, size_t length) {
-    bbmp::NonBlockingLogger::GetInstance().TryLog(
-        {nullptr, std::make_unique<std::string>(data, length)});
+    bbmp::Log("{}", std::string_view(data, length));
   }
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MainComponent)
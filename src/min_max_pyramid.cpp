@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#include "min_max_pyramid.h"
+
+#include <cmath>
+
+namespace {
+MinMaxPyramid::Range ToRange(float value) {
+  if (std::isnan(value)) {
+    return {};
+  }
+  return {value, value};
+}
+}  // namespace
+
+void MinMaxPyramid::Append(float value) {
+  values_.push_back(value);
+
+  // Completes one run on every level for which the new sample is the last one
+  const size_t n = values_.size();
+  for (size_t level = 0; n % (size_t{2} << level) == 0; ++level) {
+    if (level == levels_.size()) {
+      levels_.emplace_back();
+    }
+
+    Range range;
+    if (level == 0) {
+      range = ToRange(values_[n - 2]);
+      range.Add(ToRange(values_[n - 1]));
+    } else {
+      const auto& children = levels_[level - 1];
+      range = children[children.size() - 2];
+      range.Add(children.back());
+    }
+    levels_[level].push_back(range);
+  }
+}
+
+void MinMaxPyramid::DropFront(size_t num_values) {
+  if (num_values >= values_.size()) {
+    Clear();
+    return;
+  }
+
+  // Runs are aligned to the first sample, so the levels have to be rebuilt
+  std::vector<float> values(values_.begin() + num_values, values_.end());
+  Clear();
+  values_.reserve(values.size());
+  for (const auto value : values) {
+    Append(value);
+  }
+}
+
+void MinMaxPyramid::Clear() {
+  values_.clear();
+  levels_.clear();
+}
+
+MinMaxPyramid::Range MinMaxPyramid::GetRange(size_t begin, size_t end) const {
+  Range range;
+
+  // Takes the largest aligned run starting at begin that fits into the span.
+  // Run sizes first grow, then shrink, so the level is tracked across steps
+  // instead of searched for every time.
+  size_t level = 0;
+  while (begin < end) {
+    while (level < levels_.size() && ((begin >> level) & 1) == 0 &&
+           begin + (size_t{2} << level) <= end) {
+      ++level;
+    }
+    while (begin + (size_t{1} << level) > end) {
+      --level;
+    }
+
+    if (level == 0) {
+      range.Add(ToRange(values_[begin]));
+    } else {
+      range.Add(levels_[level - 1][begin >> level]);
+    }
+    begin += size_t{1} << level;
+  }
+  return range;
+}
@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+/*
+ * The minimum and maximum of every aligned run of 2, 4, 8, ... samples of a
+ * series, so the range of any span of samples is the combination of at most
+ * 2 * log2(n) precomputed runs.
+ *
+ * Levels are extended as samples are appended, at an amortized cost of two
+ * comparisons per sample. Memory use is three floats per sample.
+ */
+class MinMaxPyramid {
+ public:
+  // Empty ranges have min > max
+  struct Range {
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+
+    bool IsEmpty() const { return min > max; }
+
+    void Add(const Range& other) {
+      min = other.min < min ? other.min : min;
+      max = other.max > max ? other.max : max;
+    }
+  };
+
+  // NaN values are missing, they are skipped by GetRange
+  void Append(float value);
+
+  // Discards the first num_values samples
+  void DropFront(size_t num_values);
+
+  void Clear();
+
+  size_t GetSize() const { return values_.size(); }
+
+  float GetValue(size_t i) const { return values_[i]; }
+
+  // Range of the samples [begin, end)
+  Range GetRange(size_t begin, size_t end) const;
+
+ private:
+  std::vector<float> values_;
+  // levels_[l][i] is the range of samples [i << (l + 1), (i + 1) << (l + 1))
+  std::vector<std::vector<Range>> levels_;
+};
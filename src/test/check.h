@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * The checks of the test programs in src/test. A failed CHECK prints the
+ * condition and where it is, and the test carries on. Every test is a function
+ * passed to check::Run, and main returns check::Finish(), which is non-zero if
+ * anything failed, so ctest picks it up.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <exception>
+
+namespace check {
+inline int& GetNumFailures() {
+  static int num_failures = 0;
+  return num_failures;
+}
+
+inline bool Check(bool passed, const char* condition, const char* file,
+                  int line) {
+  if (!passed) {
+    std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, condition);
+    ++GetNumFailures();
+  }
+  return passed;
+}
+
+// An exception escaping the test counts as a failure
+template <typename TTest>
+void Run(const char* name, TTest&& test) {
+  std::printf("%s\n", name);
+  std::fflush(stdout);
+  try {
+    test();
+  } catch (std::exception& e) {
+    std::fprintf(stderr, "%s threw: %s\n", name, e.what());
+    ++GetNumFailures();
+  }
+}
+
+inline int Finish() {
+  if (GetNumFailures() > 0) {
+    std::fprintf(stderr, "%d checks failed\n", GetNumFailures());
+    return 1;
+  }
+  std::printf("All checks passed\n");
+  return 0;
+}
+}  // namespace check
+
+#define CHECK(condition) \
+  ::check::Check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
@@ -0,0 +1,170 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// bbmp::DeviceWatcher and the registry waiting on it, with simulated boards
+// plugged in and out by creating and removing their ptys. The ports are links
+// in a temporary directory listed in BBMP_EXTRA_SERIAL_PORTS, which is
+// watched with inotify like /dev.
+//
+//   coolth_device_watcher_test SIMULATOR
+
+#include "check.h"
+#include "simulator.h"
+
+#include "bbmp/device_watcher.h"
+#include "bbmp/fan_controller_registry.h"
+#include "bbmp/serial.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+std::string g_simulator;
+
+double ToMilliseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+class PortDirectory {
+ public:
+  PortDirectory() {
+    std::string pattern =
+        (fs::temp_directory_path() / "coolth_ports_XXXXXX").string();
+    root_ = mkdtemp(pattern.data());
+    setenv("BBMP_EXTRA_SERIAL_PORTS", GetPort().c_str(), 1);
+  }
+
+  ~PortDirectory() {
+    unsetenv("BBMP_EXTRA_SERIAL_PORTS");
+    std::error_code error;
+    fs::remove_all(root_, error);
+  }
+
+  // Doesn't exist until a board is plugged in
+  std::string GetPort() const { return (root_ / "board").string(); }
+
+  std::unique_ptr<test::Simulator> PlugIn() const {
+    return std::make_unique<test::Simulator>(
+        g_simulator, std::vector<std::string>{"--link", GetPort()});
+  }
+
+  bool IsListed() const {
+    const auto ports = bbmp::GetComPortNames();
+    return std::find(ports.begin(), ports.end(), GetPort()) != ports.end();
+  }
+
+ private:
+  fs::path root_;
+};
+
+// Sleeps in Serial::WindowsSleepEx, the way the registry does, until the
+// watcher reports a change or timeout passes. Returns how long it took since
+// start.
+std::optional<double> WaitForChange(bbmp::DeviceWatcher& watcher,
+                                    Clock::time_point start,
+                                    std::chrono::milliseconds timeout) {
+  const auto deadline = Clock::now() + timeout;
+  while (!watcher.TakeChange()) {
+    const auto remaining =
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline -
+                                                              Clock::now());
+    if (remaining.count() <= 0) {
+      return std::nullopt;
+    }
+    bbmp::Serial::WindowsSleepEx(static_cast<uint32_t>(remaining.count()),
+                                 true);
+  }
+  return ToMilliseconds(Clock::now() - start);
+}
+
+// Both plugging and unplugging wake the sleeping thread right away. The times
+// include starting and stopping the simulator.
+void TestPlugAndUnplug() {
+  PortDirectory directory;
+  bbmp::DeviceWatcher watcher;
+  CHECK(!directory.IsListed());
+
+  const auto plug_start = Clock::now();
+  auto board = directory.PlugIn();
+  const auto plug_ms =
+      WaitForChange(watcher, plug_start, std::chrono::milliseconds(1000));
+  CHECK(plug_ms && *plug_ms < 100.0);
+  CHECK(directory.IsListed());
+
+  const auto unplug_start = Clock::now();
+  board->Stop();
+  const auto unplug_ms =
+      WaitForChange(watcher, unplug_start, std::chrono::milliseconds(1000));
+  CHECK(unplug_ms && *unplug_ms < 100.0);
+  CHECK(!directory.IsListed());
+
+  std::printf("Plug noticed in %.1f ms, unplug in %.1f ms\n",
+              plug_ms.value_or(-1.0), unplug_ms.value_or(-1.0));
+}
+
+// Without a device change the thread sleeps through the whole timeout
+void TestQuietWithoutChanges() {
+  PortDirectory directory;
+  bbmp::DeviceWatcher watcher;
+  const auto start = Clock::now();
+  CHECK(!WaitForChange(watcher, start, std::chrono::milliseconds(300)));
+  CHECK(ToMilliseconds(Clock::now() - start) >= 290.0);
+}
+
+// The registry waits for a board without polling, and connects to it as soon
+// as it's plugged in
+void TestRegistryConnectsOnPlug() {
+  PortDirectory directory;
+  std::unique_ptr<test::Simulator> board;
+  Clock::time_point plug_time;
+  std::thread plugger([&directory, &board, &plug_time] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    plug_time = Clock::now();
+    board = directory.PlugIn();
+  });
+
+  int num_waits = 0;
+  bbmp::FanControllerRegistry registry(
+      {}, [] { return false; }, [&num_waits](int) { ++num_waits; });
+  const auto connect_time = Clock::now();
+  plugger.join();
+  const auto connect_ms = ToMilliseconds(connect_time - plug_time);
+
+  std::printf("Connected %.1f ms after the board was plugged in\n",
+              connect_ms);
+  CHECK(registry.GetNumControllers() == 1);
+  CHECK(connect_ms < 100.0);
+  // wait_ms is only for rescanning where changes can't be watched
+  CHECK(num_waits == 0);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s SIMULATOR\n", argv[0]);
+    return 2;
+  }
+  g_simulator = argv[1];
+
+  check::Run("TestPlugAndUnplug", TestPlugAndUnplug);
+  check::Run("TestQuietWithoutChanges", TestQuietWithoutChanges);
+  check::Run("TestRegistryConnectsOnPlug", TestRegistryConnectsOnPlug);
+  return check::Finish();
+}
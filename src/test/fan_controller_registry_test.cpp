@@ -0,0 +1,328 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// bbmp::FanControllerRegistry against simulated boards and ptys that never
+// answer, all listed in BBMP_EXTRA_SERIAL_PORTS.
+//
+// The time to the first command is compared with probing the ports one by
+// one, waiting up to 4 seconds for each, like before the registry. Boards are
+// identified by the UUID in their EEPROM across restarts and port changes,
+// and keep the numbers of their fans while they are gone.
+//
+//   coolth_fan_controller_registry_test SIMULATOR
+
+#include "check.h"
+#include "pty.h"
+#include "simulator.h"
+
+#include "bbmp/fan_controller.h"
+#include "bbmp/fan_controller_registry.h"
+#include "bbmp/serial.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Where the firmware keeps the UUID
+constexpr size_t kUuidAddress = 16;
+
+std::string g_simulator;
+
+// Where the ports are linked under names that decide the order of probing
+class PortDirectory {
+ public:
+  PortDirectory() {
+    std::string pattern =
+        (fs::temp_directory_path() / "coolth_ports_XXXXXX").string();
+    root_ = mkdtemp(pattern.data());
+  }
+
+  ~PortDirectory() {
+    unsetenv("BBMP_EXTRA_SERIAL_PORTS");
+    std::error_code error;
+    fs::remove_all(root_, error);
+  }
+
+  std::string GetPath(const std::string& name) const {
+    return (root_ / name).string();
+  }
+
+  // A tty that is opened fine but never says anything, like a modem
+  std::string AddSilentPort(const std::string& name) {
+    silent_ptys_.push_back(std::make_unique<test::Pty>());
+    fs::create_symlink(silent_ptys_.back()->GetPortName(), GetPath(name));
+    return AddPath(name);
+  }
+
+  // The EEPROM of a board with the given UUID, the rest blank. Returns the
+  // board ID it's identified by.
+  std::string WriteEeprom(const std::string& name, uint8_t uuid_seed) {
+    std::string contents(kUuidAddress, '\xff');
+    std::string board_id;
+    char digits[3];
+    for (uint8_t i = 0; i < 16; ++i) {
+      const auto value = static_cast<uint8_t>(uuid_seed + i);
+      contents.push_back(static_cast<char>(value));
+      if (i == 4 || i == 6 || i == 8 || i == 10) {
+        board_id.push_back('-');
+      }
+      std::snprintf(digits, sizeof(digits), "%02x", value);
+      board_id.append(digits);
+    }
+    std::ofstream(GetPath(name), std::ios::binary) << contents;
+    return board_id;
+  }
+
+  std::unique_ptr<test::Simulator> AddBoard(
+      const std::string& name, std::vector<std::string> args = {}) {
+    args.insert(args.end(), {"--link", GetPath(name)});
+    auto simulator = std::make_unique<test::Simulator>(g_simulator, args);
+    AddPath(name);
+    return simulator;
+  }
+
+  const std::vector<std::string>& GetPorts() const { return ports_; }
+
+ private:
+  std::string AddPath(const std::string& name) {
+    ports_.push_back(GetPath(name));
+    std::string extra_ports;
+    for (const auto& port : ports_) {
+      extra_ports += (extra_ports.empty() ? "" : ":") + port;
+    }
+    setenv("BBMP_EXTRA_SERIAL_PORTS", extra_ports.c_str(), 1);
+    return ports_.back();
+  }
+
+  fs::path root_;
+  std::vector<std::unique_ptr<test::Pty>> silent_ptys_;
+  std::vector<std::string> ports_;
+};
+
+void WaitMs(int ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+double ToMilliseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Runs completions until predicate holds or timeout passes
+template <typename TPredicate>
+bool WaitUntil(bbmp::FanControllerRegistry& registry, TPredicate&& predicate,
+               std::chrono::milliseconds timeout) {
+  const auto deadline = Clock::now() + timeout;
+  while (!predicate()) {
+    if (Clock::now() >= deadline) {
+      return false;
+    }
+    registry.IssueReads();
+    bbmp::Serial::WindowsSleepEx(10, true);
+  }
+  return true;
+}
+
+// The port of the first board found by opening the ports one after the other
+std::string ProbeSequentially(const std::vector<std::string>& ports) {
+  for (const auto& port : ports) {
+    bbmp::FanController controller(port);
+    const auto deadline = Clock::now() + std::chrono::milliseconds(4000);
+    while (!controller.IsIdentified() && Clock::now() < deadline) {
+      controller.IssueRead();
+      bbmp::Serial::WindowsSleepEx(10, true);
+    }
+    if (controller.IsIdentified()) {
+      return port;
+    }
+  }
+  return {};
+}
+
+using Boards = std::vector<std::unique_ptr<test::Simulator>>;
+
+void AddModemsAndBoards(PortDirectory& directory, Boards& boards) {
+  directory.AddSilentPort("a_modem");
+  directory.AddSilentPort("b_modem");
+  for (const auto* name : {"c_board", "d_board", "e_board"}) {
+    boards.push_back(directory.AddBoard(name));
+  }
+}
+
+// Two ttys that never answer come before three boards. Probing them all at
+// once, the first command can go out as soon as the first board answered.
+//
+// Each way of probing gets boards of its own, since a board that switched to
+// the binary protocol stays there.
+void TestProbesInParallel() {
+  double sequential_ms = 0.0;
+  {
+    PortDirectory directory;
+    Boards boards;
+    AddModemsAndBoards(directory, boards);
+    const auto start = Clock::now();
+    const auto port = ProbeSequentially(directory.GetPorts());
+    sequential_ms = ToMilliseconds(Clock::now() - start);
+    CHECK(port == directory.GetPath("c_board"));
+  }
+
+  PortDirectory directory;
+  Boards boards;
+  AddModemsAndBoards(directory, boards);
+  const auto start = Clock::now();
+  bbmp::FanControllerRegistry registry(
+      {}, [] { return false; }, WaitMs);
+  const std::vector<float> duty_cycles(registry.GetNumFans(), 50.0f);
+  registry.SetDutyCycles(duty_cycles.data());
+  const auto parallel_ms = ToMilliseconds(Clock::now() - start);
+
+  CHECK(registry.GetNumControllers() >= 1);
+  CHECK(WaitUntil(
+      registry, [&registry] { return registry.GetNumControllers() == 3; },
+      std::chrono::milliseconds(1000)));
+  CHECK(registry.GetNumFans() == 12);
+
+  std::printf("Time to the first command: %.1f ms in parallel, %.1f ms one "
+              "port after the other\n",
+              parallel_ms, sequential_ms);
+  CHECK(parallel_ms < 500.0);
+  CHECK(parallel_ms * 10.0 < sequential_ms);
+}
+
+// Within a round trip, and by the same ID after a restart on another port
+void TestIdentifiesBoard() {
+  PortDirectory directory;
+  const auto board_id = directory.WriteEeprom("eeprom", 0x40);
+  auto board = directory.AddBoard("board", {"--eeprom",
+                                            directory.GetPath("eeprom")});
+
+  const auto start = Clock::now();
+  {
+    bbmp::FanController controller(directory.GetPath("board"));
+    while (!controller.IsIdentified() &&
+           Clock::now() - start < std::chrono::milliseconds(1000)) {
+      controller.IssueRead();
+      bbmp::Serial::WindowsSleepEx(10, true);
+    }
+    const auto identify_ms = ToMilliseconds(Clock::now() - start);
+    std::printf("Identified in %.1f ms\n", identify_ms);
+    CHECK(identify_ms < 50.0);
+    CHECK(controller.GetBoardId() == board_id);
+    CHECK(controller.GetNumFans() == 4);
+  }
+
+  board->Stop();
+  auto restarted_board = directory.AddBoard(
+      "other_port", {"--eeprom", directory.GetPath("eeprom")});
+  bbmp::FanController controller(directory.GetPath("other_port"));
+  const auto deadline = Clock::now() + std::chrono::milliseconds(1000);
+  while (!controller.IsIdentified() && Clock::now() < deadline) {
+    controller.IssueRead();
+    bbmp::Serial::WindowsSleepEx(10, true);
+  }
+  CHECK(controller.GetBoardId() == board_id);
+}
+
+// The fans of the boards after a lost one keep their numbers, and the lost
+// board gets its fans back when it returns on another port
+void TestLostBoardKeepsItsSlot() {
+  PortDirectory directory;
+  Boards boards;
+  std::vector<std::string> board_ids;
+  for (uint8_t i = 0; i < 3; ++i) {
+    const auto eeprom = "eeprom_" + std::to_string(i);
+    board_ids.push_back(directory.WriteEeprom(eeprom, 0x10 * (i + 1)));
+    boards.push_back(directory.AddBoard(
+        "board_" + std::to_string(i), {"--eeprom", directory.GetPath(eeprom)}));
+  }
+
+  std::vector<bbmp::FanControllerRegistry::Slot> saved_slots;
+  for (const auto& board_id : board_ids) {
+    saved_slots.push_back({board_id, 4});
+  }
+  bbmp::FanControllerRegistry registry(
+      saved_slots, [] { return false; }, WaitMs);
+  if (!CHECK(registry.GetNumControllers() == 3)) {
+    return;
+  }
+
+  const auto check_slots = [&registry, &board_ids] {
+    const auto slots = registry.GetSlots();
+    CHECK(slots.size() == 3);
+    for (size_t i = 0; i < slots.size() && i < board_ids.size(); ++i) {
+      CHECK(slots[i].board_id == board_ids[i]);
+      CHECK(slots[i].num_fans == 4);
+    }
+    CHECK(registry.GetNumFans() == 12);
+  };
+
+  boards[1]->Stop();
+  CHECK(WaitUntil(
+      registry, [&registry] { return registry.GetNumControllers() == 2; },
+      std::chrono::milliseconds(1000)));
+  check_slots();
+  for (size_t i_fan = 0; i_fan < registry.GetNumFans(); ++i_fan) {
+    CHECK(registry.IsFanConnected(i_fan) == (i_fan < 4 || i_fan >= 8));
+  }
+
+  boards[1] = directory.AddBoard(
+      "board_1_again", {"--eeprom", directory.GetPath("eeprom_1")});
+  CHECK(WaitUntil(
+      registry, [&registry] { return registry.GetNumControllers() == 3; },
+      std::chrono::milliseconds(3000)));
+  check_slots();
+  for (size_t i_fan = 0; i_fan < registry.GetNumFans(); ++i_fan) {
+    CHECK(registry.IsFanConnected(i_fan));
+  }
+}
+
+// A saved board that isn't there reserves its fans, the boards that are come
+// after them
+void TestAbsentSavedBoard() {
+  PortDirectory directory;
+  const auto board_id = directory.WriteEeprom("eeprom", 0x80);
+  auto board = directory.AddBoard("board", {"--eeprom",
+                                            directory.GetPath("eeprom")});
+
+  bbmp::FanControllerRegistry registry(
+      {{"absent", 6}, {board_id, 4}}, [] { return false; }, WaitMs);
+  const auto slots = registry.GetSlots();
+  CHECK(slots.size() == 2);
+  CHECK(slots.size() == 2 && slots[0].board_id == "absent");
+  CHECK(registry.GetNumFans() == 10);
+  for (size_t i_fan = 0; i_fan < registry.GetNumFans(); ++i_fan) {
+    CHECK(registry.IsFanConnected(i_fan) == (i_fan >= 6));
+  }
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s SIMULATOR\n", argv[0]);
+    return 2;
+  }
+  g_simulator = argv[1];
+
+  check::Run("TestProbesInParallel", TestProbesInParallel);
+  check::Run("TestIdentifiesBoard", TestIdentifiesBoard);
+  check::Run("TestLostBoardKeepsItsSlot", TestLostBoardKeepsItsSlot);
+  check::Run("TestAbsentSavedBoard", TestAbsentSavedBoard);
+  return check::Finish();
+}
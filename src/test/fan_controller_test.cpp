@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// bbmp::FanController against a pty playing the board: the hello going out,
+// and which lines of text telemetry count, with and without an identify reply.
+//
+//   coolth_fan_controller_test
+
+#include "check.h"
+#include "pty.h"
+
+#include "bbmp/fan_controller.h"
+#include "bbmp/serial.h"
+#include "fan_protocol.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Runs completions until predicate holds or timeout passes
+template <typename TPredicate>
+bool WaitUntil(bbmp::FanController& controller, TPredicate&& predicate,
+               std::chrono::milliseconds timeout) {
+  const auto deadline = Clock::now() + timeout;
+  while (!predicate()) {
+    if (Clock::now() >= deadline) {
+      return false;
+    }
+    controller.IssueRead();
+    bbmp::Serial::WindowsSleepEx(10, true);
+  }
+  return true;
+}
+
+// Runs completions for a while, for checking that nothing happens
+void Pump(bbmp::FanController& controller, std::chrono::milliseconds duration) {
+  WaitUntil(controller, [] { return false; }, duration);
+}
+
+std::string EncodeIdentity(uint8_t num_fans) {
+  fan_protocol::Identity identity{};
+  identity.firmware_version = 3;
+  for (uint8_t i = 0; i < fan_protocol::kUuidLength; ++i) {
+    identity.uuid[i] = static_cast<uint8_t>(0x10 + i);
+  }
+  identity.num_fans = num_fans;
+  uint8_t frame[fan_protocol::kMaxFrameLength];
+  const auto length = fan_protocol::EncodeIdentity(identity, frame,
+                                                   sizeof(frame));
+  return std::string(reinterpret_cast<const char*>(frame), length);
+}
+
+void TestSendsHello() {
+  test::Pty pty;
+  bbmp::FanController controller(pty.GetPortName());
+  const auto received = pty.Read(2, std::chrono::milliseconds(1000));
+  CHECK(received.size() >= 2 &&
+        static_cast<uint8_t>(received[1]) == fan_protocol::kHello);
+}
+
+// Firmware that doesn't identify itself has four fans. Lines cut short or
+// run together are dropped, even when they hold an even number of values.
+void TestLegacyLines() {
+  test::Pty pty;
+  bbmp::FanController controller(pty.GetPortName());
+
+  pty.Write("1200 1300 1400\n1200 1300 1400 1500 10 20\n"
+            "1200 1300 1400 1500 10 20 30 40 1200 1300\n");
+  Pump(controller, std::chrono::milliseconds(100));
+  CHECK(controller.GetNumFans() == 0);
+
+  pty.Write("1200 1300 1400 1500 10 20 30 40\n");
+  if (!CHECK(WaitUntil(
+          controller, [&controller] { return controller.IsIdentified(); },
+          std::chrono::milliseconds(1000)))) {
+    return;
+  }
+  CHECK(controller.GetNumFans() == 4);
+  CHECK(controller.GetRpms()[0] == 1200);
+  CHECK(controller.GetRpms()[3] == 1500);
+}
+
+// Once the board told its fan count, lines must describe that many fans
+void TestIdentifiedLines() {
+  test::Pty pty;
+  bbmp::FanController controller(pty.GetPortName());
+
+  pty.Write(EncodeIdentity(6));
+  if (!CHECK(WaitUntil(
+          controller, [&controller] { return controller.IsIdentified(); },
+          std::chrono::milliseconds(1000)))) {
+    return;
+  }
+  CHECK(controller.GetNumFans() == 6);
+
+  pty.Write("\n1200 1300 1400 1500 10 20 30 40\n");
+  Pump(controller, std::chrono::milliseconds(100));
+  CHECK(controller.GetRpms()[0] == 0);
+
+  pty.Write("1000 1100 1200 1300 1400 1500 10 20 30 40 50 60\n");
+  CHECK(WaitUntil(
+      controller, [&controller] { return controller.GetRpms()[5] == 1500; },
+      std::chrono::milliseconds(1000)));
+  CHECK(controller.GetRpms()[0] == 1000);
+}
+}  // namespace
+
+int main() {
+  check::Run("TestSendsHello", TestSendsHello);
+  check::Run("TestLegacyLines", TestLegacyLines);
+  check::Run("TestIdentifiedLines", TestIdentifiedLines);
+  return check::Finish();
+}
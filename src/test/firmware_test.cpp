@@ -0,0 +1,300 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// The fan controller firmware: the Tachometer on synthetic pulse trains, and
+// the command handling of the firmware running in the simulator.
+//
+//   coolth_firmware_test SIMULATOR
+
+#include "check.h"
+#include "simulator.h"
+
+#include "fan_protocol.h"
+#include "tachometer.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr uint8_t kNumFans = 4;
+using TestTachometer = Tachometer<kNumFans>;
+
+// Square waves on the tach pins, two pulses per revolution, fed to the
+// tachometer edge by edge like the pin change interrupts would
+class PulseTrain {
+ public:
+  explicit PulseTrain(uint32_t start_us) : now_us_(start_us) {}
+
+  // 0 stops the fan, the pin stays where it is
+  void SetRpm(uint8_t i_fan, uint32_t rpm) {
+    half_period_us_[i_fan] = rpm == 0 ? 0 : 15000000 / rpm;
+    next_edge_us_[i_fan] = now_us_ + half_period_us_[i_fan];
+  }
+
+  void AdvanceTo(uint32_t end_us, TestTachometer& tachometer) {
+    for (;;) {
+      int i_next = -1;
+      for (uint8_t i = 0; i < kNumFans; ++i) {
+        if (half_period_us_[i] != 0 &&
+            static_cast<int32_t>(end_us - next_edge_us_[i]) >= 0 &&
+            (i_next == -1 || static_cast<int32_t>(next_edge_us_[i_next] -
+                                                  next_edge_us_[i]) > 0)) {
+          i_next = i;
+        }
+      }
+      if (i_next == -1) {
+        break;
+      }
+
+      now_us_ = next_edge_us_[i_next];
+      levels_ ^= 1 << i_next;
+      tachometer.OnPinChange(levels_, now_us_);
+      if ((ringing_ & 1 << i_next) && !(levels_ & 1 << i_next)) {
+        for (uint32_t i = 1; i <= 4; ++i) {
+          levels_ ^= 1 << i_next;
+          tachometer.OnPinChange(levels_, now_us_ + 20 * i);
+        }
+      }
+      next_edge_us_[i_next] += half_period_us_[i_next];
+    }
+    now_us_ = end_us;
+  }
+
+  // Every falling edge of the fan is followed by a burst of edges far too
+  // close to be pulses, which ends at the low level
+  void SetRinging(uint8_t i_fan, bool ringing) {
+    ringing_ = static_cast<uint8_t>(ringing ? ringing_ | 1 << i_fan
+                                            : ringing_ & ~(1 << i_fan));
+  }
+
+  uint32_t GetNow() const { return now_us_; }
+
+ private:
+  uint32_t now_us_;
+  uint8_t levels_ = 0xff;
+  uint8_t ringing_ = 0;
+  uint32_t half_period_us_[kNumFans] = {};
+  uint32_t next_edge_us_[kNumFans] = {};
+};
+
+bool IsNear(uint16_t rpm, uint32_t expected) {
+  return std::abs(static_cast<int>(rpm) - static_cast<int>(expected)) <=
+         static_cast<int>(expected / 100 + 1);
+}
+
+// All four fans at once, each at its own speed, read at 10 Hz
+void TestSteadyRpm() {
+  TestTachometer tachometer;
+  PulseTrain pulses(0);
+  const uint32_t rpms[kNumFans] = {600, 1200, 1850, 3000};
+  for (uint8_t i = 0; i < kNumFans; ++i) {
+    pulses.SetRpm(i, rpms[i]);
+  }
+
+  for (int window = 0; window < 20; ++window) {
+    pulses.AdvanceTo(pulses.GetNow() + 100000, tachometer);
+    for (uint8_t i = 0; i < kNumFans; ++i) {
+      const auto rpm = tachometer.TakeRpm(i, pulses.GetNow());
+      // The first window may hold a single edge of the slow fans
+      if (window > 0) {
+        CHECK(IsNear(rpm, rpms[i]));
+      }
+    }
+  }
+}
+
+// At 150 RPM there is a falling edge every 200 ms, so most 100 ms windows have
+// at most one
+void TestSlowFan() {
+  TestTachometer tachometer;
+  PulseTrain pulses(0);
+  pulses.SetRpm(0, 150);
+  pulses.AdvanceTo(500000, tachometer);
+  tachometer.TakeRpm(0, pulses.GetNow());
+
+  for (int window = 0; window < 10; ++window) {
+    pulses.AdvanceTo(pulses.GetNow() + 100000, tachometer);
+    CHECK(IsNear(tachometer.TakeRpm(0, pulses.GetNow()), 150));
+  }
+}
+
+void TestStall() {
+  TestTachometer tachometer;
+  PulseTrain pulses(0);
+  pulses.SetRpm(1, 1200);
+  pulses.AdvanceTo(1000000, tachometer);
+  CHECK(IsNear(tachometer.TakeRpm(1, pulses.GetNow()), 1200));
+
+  pulses.SetRpm(1, 0);
+  pulses.AdvanceTo(pulses.GetNow() + 100000, tachometer);
+  CHECK(tachometer.TakeRpm(1, pulses.GetNow()) == 1200);
+  pulses.AdvanceTo(pulses.GetNow() + TestTachometer::kStallTimeoutUs,
+                   tachometer);
+  CHECK(tachometer.TakeRpm(1, pulses.GetNow()) == 0);
+
+  // Spinning up again is measured from scratch
+  pulses.SetRpm(1, 900);
+  pulses.AdvanceTo(pulses.GetNow() + 300000, tachometer);
+  CHECK(IsNear(tachometer.TakeRpm(1, pulses.GetNow()), 900));
+}
+
+void TestRingingIsIgnored() {
+  TestTachometer tachometer;
+  PulseTrain pulses(0);
+  pulses.SetRpm(2, 1500);
+  pulses.SetRinging(2, true);
+  pulses.AdvanceTo(200000, tachometer);
+  tachometer.TakeRpm(2, pulses.GetNow());
+
+  for (int window = 0; window < 5; ++window) {
+    pulses.AdvanceTo(pulses.GetNow() + 100000, tachometer);
+    CHECK(IsNear(tachometer.TakeRpm(2, pulses.GetNow()), 1500));
+  }
+}
+
+// micros() overflows every 71 minutes
+void TestMicrosWraparound() {
+  TestTachometer tachometer;
+  PulseTrain pulses(0xffffffffu - 150000);
+  pulses.SetRpm(3, 2400);
+  for (int window = 0; window < 4; ++window) {
+    pulses.AdvanceTo(pulses.GetNow() + 100000, tachometer);
+    const auto rpm = tachometer.TakeRpm(3, pulses.GetNow());
+    if (window > 0) {
+      CHECK(IsNear(rpm, 2400));
+    }
+  }
+}
+
+// The simulator's side of the pty, in raw mode already
+class Port {
+ public:
+  explicit Port(const std::string& name)
+      : fd_(open(name.c_str(), O_RDWR | O_NOCTTY)) {
+    if (fd_ == -1) {
+      throw std::runtime_error("Opening " + name + " failed");
+    }
+  }
+
+  ~Port() { close(fd_); }
+
+  void Write(const std::vector<uint8_t>& data) {
+    CHECK(write(fd_, data.data(), data.size()) ==
+          static_cast<ssize_t>(data.size()));
+  }
+
+  // The types of the frames received within timeout, in order
+  std::vector<uint8_t> ReadFrameTypes(std::chrono::milliseconds timeout) {
+    std::vector<uint8_t> types;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    for (;;) {
+      const auto remaining =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now());
+      pollfd poll_fd{fd_, POLLIN, 0};
+      if (remaining.count() <= 0 ||
+          poll(&poll_fd, 1, static_cast<int>(remaining.count())) <= 0) {
+        return types;
+      }
+      uint8_t buffer[256];
+      const auto length = read(fd_, buffer, sizeof(buffer));
+      for (ssize_t i = 0; i < length; ++i) {
+        if (decoder_.Push(buffer[i])) {
+          types.push_back(decoder_.GetType());
+        }
+      }
+    }
+  }
+
+ private:
+  int fd_;
+  fan_protocol::FrameDecoder decoder_;
+};
+
+void AppendFrame(std::vector<uint8_t>& data, uint8_t type,
+                 std::vector<uint8_t> payload) {
+  uint8_t frame[fan_protocol::kMaxFrameLength];
+  const auto length =
+      fan_protocol::EncodeFrame(type, payload.data(),
+                                static_cast<uint8_t>(payload.size()), frame,
+                                sizeof(frame));
+  data.insert(data.end(), frame, frame + length);
+}
+
+size_t Count(const std::vector<uint8_t>& types, uint8_t type) {
+  size_t count = 0;
+  for (const auto t : types) {
+    count += t == type ? 1 : 0;
+  }
+  return count;
+}
+
+// Frames that arrive together with a duty cycle command are all handled,
+// whatever their order
+void TestFramesAfterDutyCycles(const std::string& simulator_path) {
+  test::Simulator simulator(simulator_path);
+  Port port(simulator.GetPortName());
+
+  std::vector<uint8_t> data;
+  AppendFrame(data, fan_protocol::kHello, {fan_protocol::kVersion});
+  AppendFrame(data, fan_protocol::kSetDutyCycles, {128, 128, 128, 128});
+  // 20 ms
+  AppendFrame(data, fan_protocol::kSetTelemetryPeriod, {20, 0});
+  AppendFrame(data, fan_protocol::kSetDutyCycles, {255, 255, 255, 255});
+  AppendFrame(data, fan_protocol::kIdentify, {});
+  // Noise between frames is skipped
+  data.push_back('\n');
+  data.push_back(0);
+  port.Write(data);
+
+  const auto types = port.ReadFrameTypes(std::chrono::milliseconds(500));
+  CHECK(Count(types, fan_protocol::kHelloReply) == 1);
+  CHECK(Count(types, fan_protocol::kIdentifyReply) == 1);
+  // 25 at 20 ms, 5 at the default 100 ms
+  CHECK(Count(types, fan_protocol::kTelemetry) >= 15);
+}
+
+// A legacy host's text command doesn't swallow a frame right behind it
+void TestFrameAfterTextCommand(const std::string& simulator_path) {
+  test::Simulator simulator(simulator_path);
+  Port port(simulator.GetPortName());
+
+  const std::string command = "c 1 100 100 100 100\n";
+  std::vector<uint8_t> data(command.begin(), command.end());
+  AppendFrame(data, fan_protocol::kIdentify, {});
+  port.Write(data);
+
+  const auto types = port.ReadFrameTypes(std::chrono::milliseconds(300));
+  CHECK(Count(types, fan_protocol::kIdentifyReply) == 1);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  check::Run("TestSteadyRpm", TestSteadyRpm);
+  check::Run("TestSlowFan", TestSlowFan);
+  check::Run("TestStall", TestStall);
+  check::Run("TestRingingIsIgnored", TestRingingIsIgnored);
+  check::Run("TestMicrosWraparound", TestMicrosWraparound);
+
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s SIMULATOR\n", argv[0]);
+    return 2;
+  }
+  const std::string simulator_path = argv[1];
+  check::Run("TestFramesAfterDutyCycles",
+             [&] { TestFramesAfterDutyCycles(simulator_path); });
+  check::Run("TestFrameAfterTextCommand",
+             [&] { TestFrameAfterTextCommand(simulator_path); });
+  return check::Finish();
+}
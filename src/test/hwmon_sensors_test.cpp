@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// bbmp::HwmonSensors on a fake sysfs tree: discovery order, labels, re-reading
+// the open files, unreadable sensors and Find.
+//
+//   coolth_hwmon_sensors_test
+
+#include "check.h"
+
+#include "bbmp/hwmon_sensors.h"
+
+#include <stdlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace {
+namespace fs = std::filesystem;
+
+// A temporary directory laid out like /sys/class, removed on destruction
+class FakeSysfs {
+ public:
+  FakeSysfs() {
+    std::string pattern =
+        (fs::temp_directory_path() / "coolth_sysfs_XXXXXX").string();
+    root_ = mkdtemp(pattern.data());
+  }
+
+  ~FakeSysfs() {
+    std::error_code error;
+    fs::remove_all(root_, error);
+  }
+
+  const fs::path& GetRoot() const { return root_; }
+
+  void Write(const fs::path& relative_path, const std::string& contents) {
+    fs::create_directories((root_ / relative_path).parent_path());
+    std::ofstream(root_ / relative_path) << contents;
+  }
+
+ private:
+  fs::path root_;
+};
+
+// Two hwmon chips, with the directory entries made in an order that only a
+// natural sort gets right, and a thermal zone
+void MakeTree(FakeSysfs& sysfs) {
+  sysfs.Write("hwmon/hwmon10/name", "amdgpu\n");
+  sysfs.Write("hwmon/hwmon10/temp1_input", "61000\n");
+  sysfs.Write("hwmon/hwmon10/temp1_label", "edge\n");
+
+  sysfs.Write("hwmon/hwmon2/name", "k10temp\n");
+  sysfs.Write("hwmon/hwmon2/temp10_input", "38500\n");
+  sysfs.Write("hwmon/hwmon2/temp2_input", "40000\n");
+  sysfs.Write("hwmon/hwmon2/temp2_label", "Tccd1\n");
+  sysfs.Write("hwmon/hwmon2/temp1_input", "45250\n");
+  sysfs.Write("hwmon/hwmon2/temp1_label", "Tctl\n");
+  sysfs.Write("hwmon/hwmon2/temp1_crit", "100000\n");
+
+  sysfs.Write("thermal/thermal_zone0/type", "acpitz\n");
+  sysfs.Write("thermal/thermal_zone0/temp", "27800\n");
+}
+
+void TestDiscovery() {
+  FakeSysfs sysfs;
+  MakeTree(sysfs);
+  bbmp::HwmonSensors sensors(sysfs.GetRoot().string());
+
+  const auto& found = sensors.GetSensors();
+  if (!CHECK(found.size() == 5)) {
+    return;
+  }
+
+  CHECK(found[0].chip == "k10temp" && found[0].label == "Tctl");
+  CHECK(found[1].chip == "k10temp" && found[1].label == "Tccd1");
+  CHECK(found[2].chip == "k10temp" && found[2].label == "temp10");
+  CHECK(found[3].chip == "amdgpu" && found[3].label == "edge");
+  CHECK(found[4].chip == "acpitz" && found[4].label == "thermal_zone0");
+}
+
+void TestRead() {
+  FakeSysfs sysfs;
+  MakeTree(sysfs);
+  bbmp::HwmonSensors sensors(sysfs.GetRoot().string());
+
+  CHECK(sensors.Read(0) == 45.25f);
+  CHECK(sensors.Read(3) == 61.0f);
+  CHECK(sensors.Read(4) == 27.8f);
+
+  // The file stays open and is read again from the start
+  sysfs.Write("hwmon/hwmon2/temp1_input", "52125\n");
+  CHECK(sensors.Read(0) == 52.125f);
+  CHECK(sensors.Read(0) == 52.125f);
+}
+
+// Like a GPU driver with the device powered down
+void TestUnreadable() {
+  FakeSysfs sysfs;
+  sysfs.Write("hwmon/hwmon0/name", "nouveau\n");
+  sysfs.Write("hwmon/hwmon0/temp1_input", "");
+  sysfs.Write("hwmon/hwmon0/temp2_input", "N/A\n");
+  bbmp::HwmonSensors sensors(sysfs.GetRoot().string());
+
+  if (!CHECK(sensors.GetSensors().size() == 2)) {
+    return;
+  }
+  CHECK(!sensors.Read(0).has_value());
+  CHECK(!sensors.Read(1).has_value());
+}
+
+void TestMissingRoot() {
+  bbmp::HwmonSensors sensors("/nonexistent/coolth/sysfs");
+  CHECK(sensors.GetSensors().empty());
+}
+
+void TestFind() {
+  FakeSysfs sysfs;
+  MakeTree(sysfs);
+  bbmp::HwmonSensors sensors(sysfs.GetRoot().string());
+
+  CHECK(sensors.Find({"coretemp", "k10temp"}) == size_t{0});
+  CHECK(sensors.Find({"k10temp"}, {"Tccd1"}) == size_t{1});
+  CHECK(sensors.Find({"k10temp"}, {"Tdie"}) == size_t{0});
+  CHECK(sensors.Find({"amdgpu", "k10temp"}) == size_t{3});
+  CHECK(!sensors.Find({"coretemp"}).has_value());
+}
+}  // namespace
+
+int main() {
+  check::Run("TestDiscovery", TestDiscovery);
+  check::Run("TestRead", TestRead);
+  check::Run("TestUnreadable", TestUnreadable);
+  check::Run("TestMissingRoot", TestMissingRoot);
+  check::Run("TestFind", TestFind);
+  return check::Finish();
+}
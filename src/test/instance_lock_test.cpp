@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// bbmp::InstanceLock: a second lock on the same file fails while the first is
+// held, and succeeds once it's released. flock conflicts between separately
+// opened files in the same process too, so no second process is needed.
+//
+//   coolth_instance_lock_test
+
+#include "check.h"
+
+#include "bbmp/instance_lock.h"
+
+#include <stdlib.h>
+
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace fs = std::filesystem;
+
+namespace {
+class TempDirectory {
+ public:
+  TempDirectory() {
+    std::string pattern =
+        (fs::temp_directory_path() / "coolth_lock_XXXXXX").string();
+    root_ = mkdtemp(pattern.data());
+  }
+
+  ~TempDirectory() {
+    std::error_code error;
+    fs::remove_all(root_, error);
+  }
+
+  std::string GetPath(const std::string& name) const {
+    return (root_ / name).string();
+  }
+
+ private:
+  fs::path root_;
+};
+
+bool TryLock(const std::string& path) {
+  try {
+    bbmp::InstanceLock lock(path);
+    return true;
+  } catch (std::runtime_error&) {
+    return false;
+  }
+}
+
+void TestExclusive() {
+  TempDirectory directory;
+  const auto path = directory.GetPath("coolth.lock");
+  {
+    bbmp::InstanceLock lock(path);
+    CHECK(fs::exists(path));
+    CHECK(!TryLock(path));
+    CHECK(TryLock(directory.GetPath("other.lock")));
+  }
+  CHECK(TryLock(path));
+}
+
+void TestUnopenableFileThrows() {
+  TempDirectory directory;
+  CHECK(!TryLock(directory.GetPath("missing/coolth.lock")));
+}
+}  // namespace
+
+int main() {
+  check::Run("TestExclusive", TestExclusive);
+  check::Run("TestUnopenableFileThrows", TestUnopenableFileThrows);
+  return check::Finish();
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// bbmp::NonBlockingLogger: logging from the destructor of a thread_local
+// object that outlives the ring of its thread.
+//
+//   coolth_logging_test
+
+#include "check.h"
+
+#include "bbmp/logging.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+std::vector<std::string> DrainMessages() {
+  std::vector<std::string> messages;
+  bbmp::LogMessage message;
+  while (bbmp::NonBlockingLogger::GetInstance().TryDequeue(message)) {
+    messages.push_back(*message.heap_message);
+  }
+  return messages;
+}
+
+// Constructed before the thread first logs, so it's destroyed after the ring
+// of the thread was abandoned
+struct LateLogger {
+  static inline std::vector<std::string> drained;
+
+  bool is_used = false;
+
+  ~LateLogger() {
+    // Frees the abandoned ring
+    drained = DrainMessages();
+    bbmp::NonBlockingLogger::GetInstance().SetThreadName("gone");
+    bbmp::Log("After the ring was freed");
+  }
+};
+
+thread_local LateLogger late_logger;
+
+// Used to write into the freed ring
+void TestLogAfterThreadExit() {
+  auto& logger = bbmp::NonBlockingLogger::GetInstance();
+  DrainMessages();
+  const auto num_dropped = logger.GetNumDropped();
+
+  std::thread([] {
+    late_logger.is_used = true;
+    bbmp::NonBlockingLogger::GetInstance().SetThreadName("late");
+    bbmp::Log("Before the thread exits");
+  }).join();
+
+  CHECK(LateLogger::drained ==
+        std::vector<std::string>{"Before the thread exits"});
+  CHECK(logger.GetNumDropped() == num_dropped + 1);
+  const auto messages = DrainMessages();
+  CHECK(messages == std::vector<std::string>{"1 log messages were dropped"});
+}
+}  // namespace
+
+int main() {
+  check::Run("TestLogAfterThreadExit", TestLogAfterThreadExit);
+  return check::Finish();
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * A pseudo terminal pair standing in for a serial port. The code under test
+ * opens GetPortName() like a /dev/ttyUSB, and the test plays the device on the
+ * master side.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace test {
+class Pty {
+ public:
+  Pty() {
+    master_fd_ = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd_ == -1 || grantpt(master_fd_) != 0 ||
+        unlockpt(master_fd_) != 0) {
+      throw std::runtime_error(std::string("posix_openpt failed. Reason: ") +
+                               strerror(errno));
+    }
+
+    port_name_ = ptsname(master_fd_);
+
+    // No echo or line editing on the master's behalf, like a real device
+    termios attributes;
+    tcgetattr(master_fd_, &attributes);
+    cfmakeraw(&attributes);
+    tcsetattr(master_fd_, TCSANOW, &attributes);
+  }
+
+  Pty(const Pty&) = delete;
+  Pty& operator=(const Pty&) = delete;
+
+  ~Pty() { Close(); }
+
+  const std::string& GetPortName() const { return port_name_; }
+
+  int GetMasterFd() const { return master_fd_; }
+
+  void Write(const std::string& data) {
+    if (write(master_fd_, data.data(), data.size()) !=
+        static_cast<ssize_t>(data.size())) {
+      throw std::runtime_error(std::string("Pty write failed. Reason: ") +
+                               strerror(errno));
+    }
+  }
+
+  // Whatever arrives from the port within timeout. Returns as soon as at least
+  // min_size bytes are in.
+  std::string Read(size_t min_size, std::chrono::milliseconds timeout) {
+    std::string result;
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (result.size() < min_size) {
+      const auto remaining =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0) {
+        break;
+      }
+
+      pollfd poll_fd{master_fd_, POLLIN, 0};
+      if (poll(&poll_fd, 1, static_cast<int>(remaining.count())) <= 0) {
+        break;
+      }
+
+      char buffer[256];
+      const auto num_read = read(master_fd_, buffer, sizeof(buffer));
+      if (num_read <= 0) {
+        break;
+      }
+      result.append(buffer, static_cast<size_t>(num_read));
+    }
+    return result;
+  }
+
+  // Hangs up, the port side sees EPOLLHUP
+  void Close() {
+    if (master_fd_ != -1) {
+      close(master_fd_);
+      master_fd_ = -1;
+    }
+  }
+
+ private:
+  int master_fd_ = -1;
+  std::string port_name_;
+};
+}  // namespace test
@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// bbmp::RcuCell: snapshots and versions, running out of hazard slots, and
+// readers racing a writer.
+//
+//   coolth_rcu_cell_test
+
+#include "check.h"
+
+#include "bbmp/rcu_cell.h"
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+void TestSnapshotKeepsItsValue() {
+  bbmp::RcuCell<std::vector<int>> cell(3, 1);
+  const auto before = cell.Read();
+  cell.Update([](auto& value) { value.push_back(2); });
+  cell.Publish({7});
+
+  CHECK(before->size() == 3);
+  CHECK(before.GetVersion() == 1);
+  CHECK(cell.GetVersion() == 3);
+  const auto after = cell.Read();
+  CHECK(*after == std::vector<int>{7});
+  CHECK(after.GetVersion() == 3);
+}
+
+// Used to spin forever
+void TestAllSlotsHeldByThisThread() {
+  bbmp::RcuCell<int> cell(42);
+  std::vector<std::optional<bbmp::RcuCell<int>::Snapshot>> snapshots(
+      bbmp::RcuCell<int>::kNumHazardSlots);
+  for (auto& snapshot : snapshots) {
+    snapshot.emplace(cell.Read());
+  }
+
+  bool threw = false;
+  try {
+    cell.Read();
+  } catch (std::runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  snapshots.back().reset();
+  CHECK(*cell.Read() == 42);
+}
+
+// A reader that finds all slots taken by others waits for one
+void TestWaitsForOtherThreads() {
+  bbmp::RcuCell<int> cell(1);
+  std::vector<std::optional<bbmp::RcuCell<int>::Snapshot>> snapshots(
+      bbmp::RcuCell<int>::kNumHazardSlots);
+  std::atomic<bool> holding{false};
+  std::atomic<bool> release{false};
+  std::thread holder([&] {
+    for (auto& snapshot : snapshots) {
+      snapshot.emplace(cell.Read());
+    }
+    holding = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+    snapshots.front().reset();
+  });
+
+  while (!holding) {
+    std::this_thread::yield();
+  }
+  std::thread releaser([&release] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release = true;
+  });
+  CHECK(*cell.Read() == 1);
+
+  releaser.join();
+  holder.join();
+}
+
+// Every value has both halves equal, a torn or freed one wouldn't
+void TestReadersAndWriter() {
+  struct Pair {
+    std::vector<int> a;
+    std::vector<int> b;
+  };
+  bbmp::RcuCell<Pair> cell(Pair{{0}, {0}});
+  std::atomic<bool> done{false};
+  std::atomic<int> num_mismatches{0};
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&] {
+      while (!done) {
+        const auto snapshot = cell.Read();
+        if (snapshot->a != snapshot->b) {
+          ++num_mismatches;
+        }
+      }
+    });
+  }
+
+  for (int i = 1; i <= 20000; ++i) {
+    cell.Update([i](Pair& pair) {
+      pair.a.assign(8, i);
+      pair.b.assign(8, i);
+    });
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  CHECK(num_mismatches == 0);
+  CHECK(cell.GetVersion() == 20001);
+}
+}  // namespace
+
+int main() {
+  check::Run("TestSnapshotKeepsItsValue", TestSnapshotKeepsItsValue);
+  check::Run("TestAllSlotsHeldByThisThread", TestAllSlotsHeldByThisThread);
+  check::Run("TestWaitsForOtherThreads", TestWaitsForOtherThreads);
+  check::Run("TestReadersAndWriter", TestReadersAndWriter);
+  return check::Finish();
+}
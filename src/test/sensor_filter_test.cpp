@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// SensorFilterBank and the filters in the settings: stages with parameters
+// that are negative or not finite, configured directly or loaded from a file.
+//
+//   coolth_sensor_filter_test
+
+#include "check.h"
+
+#include "sensor_filter.h"
+#include "settings.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+namespace fs = std::filesystem;
+
+constexpr auto kNan = std::numeric_limits<float>::quiet_NaN();
+constexpr auto kInfinity = std::numeric_limits<float>::infinity();
+
+// A NaN median length used to divide by zero in Process
+void TestInvalidStagesPassThrough() {
+  const std::vector<std::vector<FilterStage>> chains = {
+      {{FilterStage::kMedian, kNan, 0.0f}},
+      {{FilterStage::kMedian, -3.0f, 0.0f}},
+      {{FilterStage::kMedian, 5.0f, kNan}},
+      {{FilterStage::kEma, kInfinity, 0.0f}},
+      {{FilterStage::kSlewLimit, -1.0f, 0.0f}},
+      {{FilterStage::kKalman, 0.1f, -kInfinity}}};
+
+  SensorFilterBank bank(chains.size());
+  for (size_t i_channel = 0; i_channel < chains.size(); ++i_channel) {
+    bank.Configure(i_channel, chains[i_channel]);
+  }
+
+  auto time = SensorFilterBank::Clock::now();
+  for (int i = 0; i < 20; ++i) {
+    time += std::chrono::seconds(1);
+    const auto sample = 40.0f + static_cast<float>(i % 5);
+    for (size_t i_channel = 0; i_channel < chains.size(); ++i_channel) {
+      CHECK(bank.Process(i_channel, sample, time) == sample);
+    }
+  }
+}
+
+void TestLoadReplacesInvalidFilters() {
+  const auto path = fs::temp_directory_path() / "coolth_sensor_filter_test";
+  fs::remove(path);
+  fs::remove(CoolthSettings::GetBackupFile(path));
+
+  const std::vector<FilterStage> median = {{FilterStage::kMedian, 5.0f, 0.0f}};
+  {
+    CoolthSettings settings;
+    settings.SetSensorFilter(0, {{FilterStage::kMedian, kNan, 0.0f}});
+    settings.SetSensorFilter(1, median);
+    std::ofstream(path, std::ios::binary) << settings.Serialize();
+  }
+
+  CoolthSettings settings;
+  settings.Load(path);
+  const auto state = settings.Read();
+  const auto& cpu_filter = state->sensors[0].filter;
+  const auto default_filter = CoolthSettings::GetDefaultFilter();
+  if (CHECK(cpu_filter.size() == default_filter.size())) {
+    CHECK(cpu_filter[0].type == default_filter[0].type);
+    CHECK(cpu_filter[0].value == default_filter[0].value);
+  }
+  const auto& gpu_filter = state->sensors[1].filter;
+  if (CHECK(gpu_filter.size() == 1)) {
+    CHECK(gpu_filter[0].type == FilterStage::kMedian);
+    CHECK(gpu_filter[0].value == 5.0f);
+  }
+  fs::remove(path);
+}
+}  // namespace
+
+int main() {
+  check::Run("TestInvalidStagesPassThrough", TestInvalidStagesPassThrough);
+  check::Run("TestLoadReplacesInvalidFilters",
+             TestLoadReplacesInvalidFilters);
+  return check::Finish();
+}
@@ -0,0 +1,146 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// bbmp::Serial against a pty: reads, writes, waking up as soon as the bytes
+// arrive, hangups, and a read callback that destroys its Serial.
+//
+//   coolth_serial_test
+
+#include "check.h"
+#include "pty.h"
+
+#include "bbmp/serial.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// Runs completions until predicate holds or timeout passes
+template <typename TPredicate>
+bool WaitUntil(TPredicate&& predicate, std::chrono::milliseconds timeout) {
+  const auto deadline = Clock::now() + timeout;
+  while (!predicate()) {
+    if (Clock::now() >= deadline) {
+      return false;
+    }
+    bbmp::Serial::WindowsSleepEx(10, true);
+  }
+  return true;
+}
+
+void TestRead() {
+  test::Pty pty;
+  std::string received;
+  bbmp::Serial serial(pty.GetPortName().c_str(),
+                      [&received](const char* data, size_t length) {
+                        received.append(data, length);
+                      });
+
+  pty.Write("hello\n");
+  while (received.size() < 6) {
+    serial.IssueRead();
+    if (!CHECK(WaitUntil([&] { return !received.empty(); },
+                         std::chrono::milliseconds(1000)))) {
+      return;
+    }
+  }
+  CHECK(received == "hello\n");
+}
+
+void TestWrite() {
+  test::Pty pty;
+  bbmp::Serial serial(pty.GetPortName().c_str(), [](const char*, size_t) {});
+
+  std::string message;
+  for (int i = 0; i < 100; ++i) {
+    message += "0123456789";
+  }
+
+  CHECK(serial.TryIssueWrite(message.data(), message.size()));
+  bbmp::Serial::WindowsSleepEx(10, true);
+  CHECK(pty.Read(message.size(), std::chrono::milliseconds(1000)) == message);
+}
+
+// The wait must end when the bytes arrive, not when the timeout passes
+void TestWakesUpOnData() {
+  test::Pty pty;
+  bool received = false;
+  bbmp::Serial serial(pty.GetPortName().c_str(),
+                      [&received](const char*, size_t) { received = true; });
+  serial.IssueRead();
+
+  std::thread writer([&pty] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    pty.Write("x");
+  });
+
+  const auto start = Clock::now();
+  while (!received && Clock::now() - start < std::chrono::seconds(5)) {
+    bbmp::Serial::WindowsSleepEx(5000, true);
+  }
+  const auto elapsed = Clock::now() - start;
+  writer.join();
+
+  CHECK(received);
+  CHECK(elapsed < std::chrono::milliseconds(1000));
+}
+
+void TestHangupThrows() {
+  test::Pty pty;
+  bbmp::Serial serial(pty.GetPortName().c_str(), [](const char*, size_t) {});
+  serial.IssueRead();
+  pty.Close();
+
+  bool threw = false;
+  try {
+    for (int i = 0; i < 10; ++i) {
+      bbmp::Serial::WindowsSleepEx(50, true);
+      serial.IssueRead();
+    }
+  } catch (std::exception&) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+// The registry drops a controller from its read callback when the frame says
+// it isn't a fan controller, see Serial::Impl::OnReady
+void TestCallbackDestroysSerial() {
+  test::Pty pty;
+  int num_callbacks = 0;
+  std::unique_ptr<bbmp::Serial> serial;
+  serial = std::make_unique<bbmp::Serial>(
+      pty.GetPortName().c_str(), [&](const char*, size_t) {
+        ++num_callbacks;
+        serial.reset();
+      });
+  serial->IssueRead();
+
+  pty.Write("x");
+  CHECK(WaitUntil([&] { return num_callbacks > 0; },
+                  std::chrono::milliseconds(1000)));
+  CHECK(serial == nullptr);
+
+  // Nothing of the destroyed Serial may be dispatched afterwards
+  pty.Write("y");
+  bbmp::Serial::WindowsSleepEx(50, true);
+  CHECK(num_callbacks == 1);
+}
+}  // namespace
+
+int main() {
+  check::Run("TestRead", TestRead);
+  check::Run("TestWrite", TestWrite);
+  check::Run("TestWakesUpOnData", TestWakesUpOnData);
+  check::Run("TestHangupThrows", TestHangupThrows);
+  check::Run("TestCallbackDestroysSerial", TestCallbackDestroysSerial);
+  return check::Finish();
+}
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+/*
+ * A fan_controller_simulator process, i.e. the firmware on a pty, for the
+ * duration of a test. The tests get the path of the simulator as their first
+ * argument from ctest.
+ */
+
+#pragma once
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace test {
+class Simulator {
+ public:
+  // args are passed on to the simulator, e.g. --eeprom
+  explicit Simulator(const std::string& executable,
+                     const std::vector<std::string>& args = {}) {
+    int stdout_pipe[2];
+    if (pipe(stdout_pipe) != 0) {
+      throw std::runtime_error(std::string("pipe failed. Reason: ") +
+                               strerror(errno));
+    }
+
+    pid_ = fork();
+    if (pid_ == 0) {
+      dup2(stdout_pipe[1], STDOUT_FILENO);
+      close(stdout_pipe[0]);
+      close(stdout_pipe[1]);
+
+      std::vector<char*> argv;
+      argv.push_back(const_cast<char*>(executable.c_str()));
+      for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+      }
+      argv.push_back(nullptr);
+      execv(executable.c_str(), argv.data());
+      _exit(127);
+    }
+    close(stdout_pipe[1]);
+
+    // The first line is the path of the port
+    char c;
+    while (read(stdout_pipe[0], &c, 1) == 1 && c != '\n') {
+      port_name_.push_back(c);
+    }
+    close(stdout_pipe[0]);
+
+    if (pid_ == -1 || port_name_.empty()) {
+      Stop();
+      throw std::runtime_error("Starting " + executable + " failed");
+    }
+  }
+
+  Simulator(const Simulator&) = delete;
+  Simulator& operator=(const Simulator&) = delete;
+
+  ~Simulator() { Stop(); }
+
+  const std::string& GetPortName() const { return port_name_; }
+
+  // Like unplugging the board. The simulator saves its EEPROM on the way out.
+  void Stop() {
+    if (pid_ > 0) {
+      kill(pid_, SIGTERM);
+      waitpid(pid_, nullptr, 0);
+      pid_ = -1;
+    }
+  }
+
+ private:
+  pid_t pid_ = -1;
+  std::string port_name_;
+};
+}  // namespace test
@@ -0,0 +1,266 @@
+/*
+Copyright (c) 2021 Attila Szarvas <attila.szarvas@gmail.com>
+
+All rights reserved. Use of this source code is governed by the 3-Clause BSD
+License that can be found in the LICENSE file.
+*/
+
+// TelemetryStore and telemetry_codec: samples across many blocks, values the
+// quantized columns can't hold, damaged blocks in the file, and the history
+// kept when channels are added.
+//
+//   coolth_telemetry_store_test
+
+#include "check.h"
+
+#include "bbmp/mapped_file.h"
+#include "telemetry_store.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace {
+namespace fs = std::filesystem;
+
+constexpr size_t kBlockSize = 1024;
+constexpr size_t kNumBlocks = 16;
+// The layout of telemetry_store.cpp for two channels: the file header has room
+// for kMaxChannels and is padded to pages, and a block header is followed by
+// the sizes of the three columns
+constexpr size_t kFileHeaderSize = 40960;
+constexpr size_t kColumnSizesOffset = 32;
+constexpr size_t kBlockHeaderSize = kColumnSizesOffset + 3 * sizeof(uint32_t);
+
+const std::vector<TelemetryStore::Channel> kChannels = {{"temp", 0.1f},
+                                                        {"raw", 0.0f}};
+
+fs::path GetPath(const std::string& name) {
+  return fs::temp_directory_path() / ("coolth_telemetry_test_" + name);
+}
+
+struct Samples {
+  std::vector<int64_t> timestamps;
+  std::vector<float> temps;
+  std::vector<float> raws;
+};
+
+Samples ScanAll(const TelemetryStore& store, size_t i_temp = 0,
+                size_t i_raw = 1) {
+  Samples samples;
+  store.Scan(INT64_MIN, INT64_MAX, {i_temp, i_raw},
+             [&samples](const TelemetryStore::ScanBlock& block) {
+               for (size_t i = 0; i < block.num_samples; ++i) {
+                 samples.timestamps.push_back(block.timestamps[i]);
+                 samples.temps.push_back(block.values[0][i]);
+                 samples.raws.push_back(block.values[1][i]);
+               }
+             });
+  return samples;
+}
+
+std::vector<float> ScanChannel(const TelemetryStore& store, size_t i_channel) {
+  std::vector<float> values;
+  store.Scan(INT64_MIN, INT64_MAX, {i_channel},
+             [&values](const TelemetryStore::ScanBlock& block) {
+               values.insert(values.end(), block.values[0],
+                             block.values[0] + block.num_samples);
+             });
+  return values;
+}
+
+// Irregular timestamps and values, so every prefix code is used
+void AppendSamples(TelemetryStore& store, int num_samples) {
+  int64_t timestamp = 1600000000000;
+  for (int i = 0; i < num_samples; ++i) {
+    timestamp += 1000 + (i % 7 == 0 ? 3 : 0) + (i % 101 == 0 ? 90000 : 0);
+    const float values[] = {40.0f + static_cast<float>(i % 300) * 0.1f,
+                            std::sin(static_cast<float>(i)) * 1000.0f};
+    store.Append(timestamp, values);
+  }
+}
+
+void TestRoundTrip() {
+  const auto path = GetPath("round_trip");
+  fs::remove(path);
+  TelemetryStore store(path.string(), kChannels, kBlockSize, kNumBlocks);
+  AppendSamples(store, 600);
+
+  const auto samples = ScanAll(store);
+  if (!CHECK(samples.timestamps.size() == 600)) {
+    return;
+  }
+
+  int64_t timestamp = 1600000000000;
+  for (int i = 0; i < 600; ++i) {
+    timestamp += 1000 + (i % 7 == 0 ? 3 : 0) + (i % 101 == 0 ? 90000 : 0);
+    CHECK(samples.timestamps[i] == timestamp);
+    CHECK(std::abs(samples.temps[i] -
+                   (40.0f + static_cast<float>(i % 300) * 0.1f)) < 0.051f);
+    CHECK(samples.raws[i] == std::sin(static_cast<float>(i)) * 1000.0f);
+  }
+  fs::remove(path);
+}
+
+// Quantizing infinity was undefined behavior. Quantized columns store it as
+// missing, lossless ones keep it.
+void TestNonFiniteValues() {
+  const auto path = GetPath("non_finite");
+  fs::remove(path);
+  TelemetryStore store(path.string(), kChannels, kBlockSize, kNumBlocks);
+
+  constexpr auto kInfinity = std::numeric_limits<float>::infinity();
+  constexpr auto kNan = std::numeric_limits<float>::quiet_NaN();
+  const float inputs[] = {kInfinity, -kInfinity, kNan, 3.0e38f, -3.0e38f,
+                          42.0f};
+  for (size_t i = 0; i < std::size(inputs); ++i) {
+    const float values[] = {inputs[i], inputs[i]};
+    store.Append(static_cast<int64_t>(i) * 1000, values);
+  }
+
+  const auto samples = ScanAll(store);
+  if (!CHECK(samples.temps.size() == std::size(inputs))) {
+    return;
+  }
+  CHECK(std::isnan(samples.temps[0]));
+  CHECK(std::isnan(samples.temps[1]));
+  CHECK(std::isnan(samples.temps[2]));
+  // Limited to kMaxQuanta steps of 0.1
+  CHECK(samples.temps[3] > 9.0e14f && samples.temps[3] < 1.0e15f);
+  CHECK(samples.temps[4] < -9.0e14f && samples.temps[4] > -1.0e15f);
+  CHECK(std::abs(samples.temps[5] - 42.0f) < 0.01f);
+
+  CHECK(samples.raws[0] == kInfinity);
+  CHECK(samples.raws[1] == -kInfinity);
+  CHECK(std::isnan(samples.raws[2]));
+  CHECK(samples.raws[3] == 3.0e38f);
+  fs::remove(path);
+}
+
+// A scan skips blocks that make no sense, and delivers the others
+void TestDamagedBlocks() {
+  const auto path = GetPath("damaged");
+  fs::remove(path);
+  size_t num_intact = 0;
+  {
+    TelemetryStore store(path.string(), kChannels, kBlockSize, kNumBlocks);
+    AppendSamples(store, 400);
+    num_intact = ScanAll(store).timestamps.size();
+  }
+
+  size_t num_damaged = 0;
+  {
+    bbmp::MappedFile file(path.string(),
+                          kFileHeaderSize + kBlockSize * kNumBlocks);
+    const auto get_block = [&file](size_t i_slot) {
+      return file.GetData() + kFileHeaderSize + i_slot * kBlockSize;
+    };
+    const auto get_num_samples = [](const uint8_t* block) {
+      uint32_t num_samples;
+      std::memcpy(&num_samples, block + 24, sizeof(num_samples));
+      return num_samples;
+    };
+
+    // A column far larger than the block
+    num_damaged += get_num_samples(get_block(0));
+    const uint32_t huge = 0xfffffff0u;
+    std::memcpy(get_block(0) + kColumnSizesOffset, &huge, sizeof(huge));
+
+    // The missing value code in the timestamp column, right after the first
+    // timestamp
+    num_damaged += get_num_samples(get_block(1));
+    std::memset(get_block(1) + kBlockHeaderSize + 8, 0xff, 4);
+
+    // Claims more samples than its timestamp column could hold
+    num_damaged += get_num_samples(get_block(2));
+    const uint32_t many = 1000000;
+    std::memcpy(get_block(2) + 24, &many, sizeof(many));
+
+    // An XOR window reaching past the value
+    num_damaged += get_num_samples(get_block(3));
+    uint32_t sizes[3];
+    std::memcpy(sizes, get_block(3) + kColumnSizesOffset, sizeof(sizes));
+    uint8_t* raw_column = get_block(3) + kBlockHeaderSize + sizes[0] + sizes[1];
+    // The first value, then a new window of 31 leading zeros and 32 bits
+    std::memset(raw_column + 4, 0xff, 2);
+  }
+
+  TelemetryStore store(path.string(), kChannels, kBlockSize, kNumBlocks);
+  CHECK(ScanAll(store).timestamps.size() == num_intact - num_damaged);
+  fs::remove(path);
+}
+
+// A new channel starts a new block, the old samples stay and read as NaN in
+// it. Reopening with more or fewer channels keeps them too.
+void TestAddChannels() {
+  const auto path = GetPath("add_channels");
+  fs::remove(path);
+  const std::vector<TelemetryStore::Channel> channels = {
+      {"rpm", 1.0f}, kChannels[0], kChannels[1]};
+  Samples before;
+  const auto check_history = [&before](const TelemetryStore& store,
+                                       size_t i_temp, size_t i_raw) {
+    const auto after = ScanAll(store, i_temp, i_raw);
+    if (!CHECK(after.timestamps.size() == before.timestamps.size() + 1)) {
+      return;
+    }
+    for (size_t i = 0; i < before.timestamps.size(); ++i) {
+      CHECK(after.timestamps[i] == before.timestamps[i]);
+      CHECK(after.temps[i] == before.temps[i]);
+      CHECK(after.raws[i] == before.raws[i]);
+    }
+    CHECK(std::abs(after.temps.back() - 45.0f) < 0.051f);
+    CHECK(after.raws.back() == 2.0f);
+  };
+
+  {
+    TelemetryStore store(path.string(), kChannels, kBlockSize, kNumBlocks);
+    AppendSamples(store, 200);
+    before = ScanAll(store);
+
+    store.SetChannels(channels);
+    int64_t first_ms, last_ms;
+    CHECK(store.GetTimeRange(first_ms, last_ms));
+    const float values[] = {1200.0f, 45.0f, 2.0f};
+    store.Append(last_ms + 1000, values);
+
+    check_history(store, 1, 2);
+    const auto rpms = ScanChannel(store, 0);
+    if (CHECK(rpms.size() == 201)) {
+      CHECK(std::all_of(rpms.begin(), rpms.end() - 1,
+                        [](float rpm) { return std::isnan(rpm); }));
+      CHECK(rpms.back() == 1200.0f);
+    }
+  }
+
+  {
+    TelemetryStore store(path.string(), channels, kBlockSize, kNumBlocks);
+    check_history(store, 1, 2);
+    CHECK(ScanChannel(store, 0).back() == 1200.0f);
+  }
+
+  {
+    TelemetryStore store(path.string(), kChannels, kBlockSize, kNumBlocks);
+    check_history(store, 0, 1);
+  }
+
+  // The same name with another quantum can't share the column
+  TelemetryStore store(path.string(), {{"temp", 0.5f}}, kBlockSize,
+                       kNumBlocks);
+  int64_t first_ms, last_ms;
+  CHECK(!store.GetTimeRange(first_ms, last_ms));
+  fs::remove(path);
+}
+}  // namespace
+
+int main() {
+  check::Run("TestRoundTrip", TestRoundTrip);
+  check::Run("TestNonFiniteValues", TestNonFiniteValues);
+  check::Run("TestDamagedBlocks", TestDamagedBlocks);
+  check::Run("TestAddChannels", TestAddChannels);
+  return check::Finish();
+}
@@ -1,4 +1,7 @@
 ﻿using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.Text;
 using System.Threading;
 using OpenHardwareMonitor.Hardware;
 
@@ -15,15 +18,100 @@ namespace temperature_reader
             }
         }
 
+        // Like CoolthSettings::MakeSensorId: lowercase letters, digits and
+        // underscores, at most 15 characters
+        static string makeSensorId(string name)
+        {
+            var id = new StringBuilder();
+            foreach (var c in name.ToLowerInvariant())
+            {
+                if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+                {
+                    id.Append(c);
+                }
+                else if (id.Length > 0 && id[id.Length - 1] != '_')
+                {
+                    id.Append('_');
+                }
+            }
+            var result = id.ToString();
+            if (result.Length > 15)
+            {
+                result = result.Substring(0, 15);
+            }
+            result = result.TrimEnd('_');
+            return result.Length > 0 ? result : "sensor";
+        }
+
+        static string getIdPrefix(IHardware hw)
+        {
+            switch (hw.HardwareType)
+            {
+                case HardwareType.CPU:
+                    return "cpu";
+                case HardwareType.GpuAti:
+                case HardwareType.GpuNvidia:
+                    return "gpu";
+                case HardwareType.HDD:
+                    return "hdd";
+                case HardwareType.RAM:
+                    return "ram";
+                default:
+                    return "mb";
+            }
+        }
+
+        static string formatTemp(float? temp)
+        {
+            return temp.HasValue ? temp.Value.ToString("0.###", CultureInfo.InvariantCulture) : "null";
+        }
+
+        // Every temperature sensor of the hardware and its subhardware as a
+        // key=value field. The order is the same on every line.
+        static void appendSensors(IHardware hw, StringBuilder line, HashSet<string> ids)
+        {
+            var sensors = new List<ISensor>(hw.Sensors);
+            foreach (var subHw in hw.SubHardware)
+            {
+                sensors.AddRange(subHw.Sensors);
+            }
+
+            foreach (var sensor in sensors)
+            {
+                if (sensor.SensorType != SensorType.Temperature)
+                {
+                    continue;
+                }
+                // Hardware names are long and would fill the id on their own
+                var baseId = makeSensorId(getIdPrefix(sensor.Hardware) + " " + sensor.Name);
+                var id = baseId;
+                for (var i = 2; ids.Contains(id); ++i)
+                {
+                    var suffix = "_" + i;
+                    id = baseId.Substring(0, Math.Min(baseId.Length, 15 - suffix.Length)) + suffix;
+                }
+                ids.Add(id);
+                line.Append($" {id}={formatTemp(sensor.Value)}");
+            }
+        }
+
         static void Main(string[] args)
         {
-            var computer = new Computer() { CPUEnabled = true, GPUEnabled = true };
+            var computer = new Computer()
+            {
+                CPUEnabled = true,
+                GPUEnabled = true,
+                MainboardEnabled = true,
+                HDDEnabled = true
+            };
             computer.Open();
 
             while (true)
             {
                 float? cpuTemp = null;
                 float? gpuTemp = null;
+                var sensorFields = new StringBuilder();
+                var ids = new HashSet<string> { "cpu", "gpu" };
 
                 foreach (var hardwareItem in computer.Hardware)
                 {
@@ -62,11 +150,16 @@ namespace temperature_reader
                             }
                         }
                     }
+
+                    if (hardwareItem.HardwareType == HardwareType.Mainboard || hardwareItem.HardwareType == HardwareType.HDD)
+                    {
+                        updateHardware(hardwareItem);
+                    }
+                    appendSensors(hardwareItem, sensorFields, ids);
                 }
 
-                var cpuTempString = cpuTemp.HasValue ? cpuTemp.Value.ToString() : "null";
-                var gpuTempString = gpuTemp.HasValue ? gpuTemp.Value.ToString() : "null";
-                Console.WriteLine($"{cpuTempString} {gpuTempString}");
+                // See src/core/sample_line.h
+                Console.WriteLine($"cpu={formatTemp(cpuTemp)} gpu={formatTemp(gpuTemp)}{sensorFields}");
                 Thread.Sleep(1000);
             }
         }